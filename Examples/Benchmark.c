@@ -0,0 +1,548 @@
+/** @file Benchmark.c
+ * Load generation and latency benchmark running without any external service.
+ * A minimal loopback server is started in the same process. It grants all connections and sends back each PUBLISH packet to the client that sent it, as if the client had subscribed to its own topics.
+ * Several clients then publish at a configurable rate, and the time each message takes to come back is measured.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** Latencies are recorded with a 1 microsecond resolution up to this value (in microseconds), bigger ones are stored in the last bucket. */
+#define BENCHMARK_LATENCY_BUCKETS_COUNT 100000
+
+/** Size of the buffers used to send and receive data. */
+#define BENCHMARK_BUFFER_SIZE 65536
+
+/** Biggest supported application message size. */
+#define BENCHMARK_MAXIMUM_PAYLOAD_SIZE 16384
+
+/** How many topics can be used at most. */
+#define BENCHMARK_MAXIMUM_TOPICS_COUNT 1024
+
+/** How long to wait for the last messages to come back after the publishing time elapsed, in milliseconds. */
+#define BENCHMARK_DRAIN_TIME 500
+
+//-------------------------------------------------------------------------------------------------
+// Private types
+//-------------------------------------------------------------------------------------------------
+/** All data owned by a client. */
+typedef struct
+{
+	int Socket; //!< Connection to the loopback server.
+	int Index; //!< Client number.
+	pthread_t Sending_Thread; //!< Publishes messages.
+	pthread_t Receiving_Thread; //!< Measures the latency of received messages.
+	unsigned long long Sent_Messages_Count; //!< How many PUBLISH packets have been sent.
+	unsigned long long Sent_Bytes_Count; //!< How many bytes of PUBLISH packets have been sent.
+	unsigned long long Received_Messages_Count; //!< How many PUBLISH packets came back.
+	unsigned long long *Pointer_Latency_Buckets; //!< Latency histogram.
+	TMQTTPreparedPublish Prepared_Publishes[BENCHMARK_MAXIMUM_TOPICS_COUNT]; //!< One PUBLISH packet per topic, the topic name is encoded only once.
+	unsigned char Payload[BENCHMARK_MAXIMUM_PAYLOAD_SIZE]; //!< The application message, beginning with the sending time.
+} TBenchmarkClient;
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** Command line parameters. */
+static int Benchmark_Clients_Count = 4, Benchmark_Rate = 10000, Benchmark_Topics_Count = 16, Benchmark_Payload_Size = 64, Benchmark_Duration = 5;
+
+/** Set to 1 by the main thread when clients must stop publishing. */
+static volatile int Benchmark_Is_Publishing_Stopped = 0;
+
+/** The loopback server listening socket. */
+static int Benchmark_Server_Socket;
+
+/** All topic names. */
+static char Benchmark_Strings_Topic_Names[BENCHMARK_MAXIMUM_TOPICS_COUNT][32];
+
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Each client owns two slots, the first one for its sending thread and the second one for its receiving thread. */
+	static TMQTTStatisticsSlot *Benchmark_Pointer_Statistics_Slots;
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time.
+ * @return The time in nanoseconds.
+ */
+static unsigned long long BenchmarkGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (unsigned long long) Time.tv_sec * 1000000000ULL + Time.tv_nsec;
+}
+
+/** Write all data to a socket.
+ * @param Socket The socket.
+ * @param Pointer_Data The data to send.
+ * @param Size The data size in bytes.
+ * @return -1 if the connection is broken,
+ * @return 0 on success.
+ */
+static int BenchmarkWriteAll(int Socket, unsigned char *Pointer_Data, int Size)
+{
+	ssize_t Written_Size;
+	
+	while (Size > 0)
+	{
+		Written_Size = send(Socket, Pointer_Data, Size, MSG_NOSIGNAL);
+		if (Written_Size < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		Pointer_Data += Written_Size;
+		Size -= (int) Written_Size;
+	}
+	return 0;
+}
+
+/** Serve a single client connection : grant the connection and send back all PUBLISH packets.
+ * @param Pointer_Parameter The connection socket.
+ * @return Always NULL.
+ */
+static void *BenchmarkServerConnectionThread(void *Pointer_Parameter)
+{
+	static const unsigned char Connection_Acknowledge_Packet[4] = { MQTT_PACKET_TYPE_CONNACK << 4, 2, 0, 0 };
+	int Socket = (int) (long) Pointer_Parameter, Result, Offset, Is_Connection_Broken = 0;
+	unsigned char *Pointer_Receive_Buffer, *Pointer_Decoder_Buffer, *Pointer_Context_Buffer, *Pointer_Batch_Buffer;
+	char String_Topic_Name[256];
+	ssize_t Read_Size;
+	TMQTTDecoder Decoder;
+	TMQTTPacket Packet;
+	TMQTTContext Context;
+	TMQTTBatch Batch;
+	
+	Pointer_Receive_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	Pointer_Decoder_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	Pointer_Context_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	Pointer_Batch_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	if ((Pointer_Receive_Buffer == NULL) || (Pointer_Decoder_Buffer == NULL) || (Pointer_Context_Buffer == NULL) || (Pointer_Batch_Buffer == NULL))
+	{
+		printf("Error : failed to allocate server connection memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	MQTTDecoderInitialize(&Decoder, Pointer_Decoder_Buffer, BENCHMARK_BUFFER_SIZE);
+	MQTTInitializeContext(&Context, Pointer_Context_Buffer, BENCHMARK_BUFFER_SIZE); // The server only needs the context to forge PUBLISH packets
+	
+	// The decoder does not handle packets sent by clients, so skip the CONNECT packet by hand. The client waits for the CONNACK before sending anything else, so the CONNECT packet is alone in the first read, and it is small enough to have a single byte remaining length
+	Read_Size = read(Socket, Pointer_Receive_Buffer, BENCHMARK_BUFFER_SIZE);
+	if ((Read_Size < 2) || ((Pointer_Receive_Buffer[0] >> 4) != MQTT_PACKET_TYPE_CONNECT) || (BenchmarkWriteAll(Socket, (unsigned char *) Connection_Acknowledge_Packet, sizeof(Connection_Acknowledge_Packet)) != 0)) Is_Connection_Broken = 1;
+	
+	while (!Is_Connection_Broken)
+	{
+		Read_Size = read(Socket, Pointer_Receive_Buffer, BENCHMARK_BUFFER_SIZE);
+		if (Read_Size <= 0) break;
+		
+		// Answer all packets contained in the received data with as few writes as possible
+		MQTTBatchInitialize(&Batch, Pointer_Batch_Buffer, BENCHMARK_BUFFER_SIZE);
+		for (Offset = 0; Offset < Read_Size; Offset += Result)
+		{
+			// PUBLISH packets have the same format in both directions, so they can be decoded like received ones
+			Result = MQTTDecode(&Decoder, Pointer_Receive_Buffer + Offset, (int) Read_Size - Offset, &Packet);
+			if (Result < 0)
+			{
+				printf("Error : loopback server received a malformed packet.\n");
+				exit(EXIT_FAILURE);
+			}
+			if ((Packet.Type != MQTT_PACKET_TYPE_PUBLISH) || (Packet.Topic_Name_Size >= (int) sizeof(String_Topic_Name))) continue;
+			
+			// Topic name must be terminated to be given to the encoder
+			memcpy(String_Topic_Name, Packet.Pointer_Topic_Name, Packet.Topic_Name_Size);
+			String_Topic_Name[Packet.Topic_Name_Size] = 0;
+			MQTTPublish(&Context, String_Topic_Name, Packet.Pointer_Payload, Packet.Payload_Size);
+			
+			if (MQTTBatchAppend(&Batch, &Context) != 0)
+			{
+				// Flush the batch when it is full
+				if (BenchmarkWriteAll(Socket, MQTT_GET_BATCH_BUFFER(&Batch), MQTT_GET_BATCH_SIZE(&Batch)) != 0)
+				{
+					Is_Connection_Broken = 1;
+					break;
+				}
+				MQTTBatchInitialize(&Batch, Pointer_Batch_Buffer, BENCHMARK_BUFFER_SIZE);
+				MQTTBatchAppend(&Batch, &Context);
+			}
+		}
+		if ((!Is_Connection_Broken) && (BenchmarkWriteAll(Socket, MQTT_GET_BATCH_BUFFER(&Batch), MQTT_GET_BATCH_SIZE(&Batch)) != 0)) break;
+	}
+	
+	close(Socket);
+	free(Pointer_Receive_Buffer);
+	free(Pointer_Decoder_Buffer);
+	free(Pointer_Context_Buffer);
+	free(Pointer_Batch_Buffer);
+	return NULL;
+}
+
+/** Accept all client connections and start a thread for each one.
+ * @param Pointer_Parameter Not used.
+ * @return Always NULL.
+ */
+static void *BenchmarkServerThread(void *Pointer_Parameter)
+{
+	int Socket;
+	pthread_t Thread;
+	
+	(void) Pointer_Parameter;
+	
+	while (1)
+	{
+		Socket = accept(Benchmark_Server_Socket, NULL, NULL);
+		if (Socket < 0) break;
+		
+		if (pthread_create(&Thread, NULL, BenchmarkServerConnectionThread, (void *) (long) Socket) != 0)
+		{
+			printf("Error : failed to create server connection thread.\n");
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(Thread);
+	}
+	return NULL;
+}
+
+/** Publish messages at the requested rate until the benchmark duration elapses.
+ * @param Pointer_Parameter The client.
+ * @return Always NULL.
+ */
+static void *BenchmarkClientSendingThread(void *Pointer_Parameter)
+{
+	TBenchmarkClient *Pointer_Client = Pointer_Parameter;
+	TMQTTPreparedPublish *Prepared_Publishes = Pointer_Client->Prepared_Publishes;
+	unsigned char *Payload = Pointer_Client->Payload;
+	unsigned char *Pointer_Prepared_Publishes_Buffer, *Pointer_Batch_Buffer;
+	unsigned long long Start_Time, Current_Time, Due_Messages_Count;
+	int Topic_Index = 0, i;
+	TMQTTBatch Batch;
+	struct timespec Sleeping_Time = { 0, 100000 };
+	
+	// Topic names are encoded only once
+	Pointer_Prepared_Publishes_Buffer = malloc((size_t) Benchmark_Topics_Count * (BENCHMARK_MAXIMUM_PAYLOAD_SIZE + 64));
+	Pointer_Batch_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	if ((Pointer_Prepared_Publishes_Buffer == NULL) || (Pointer_Batch_Buffer == NULL))
+	{
+		printf("Error : failed to allocate client memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < Benchmark_Topics_Count; i++)
+	{
+		MQTTPreparePublish(&Prepared_Publishes[i], Pointer_Prepared_Publishes_Buffer + i * (BENCHMARK_MAXIMUM_PAYLOAD_SIZE + 64), BENCHMARK_MAXIMUM_PAYLOAD_SIZE + 64, Benchmark_Strings_Topic_Names[i], 0, MQTT_PROTOCOL_VERSION_3_1_1);
+		#ifdef MQTT_ENABLE_STATISTICS
+			MQTTSetStatisticsSlot(&Prepared_Publishes[i].Context, &Benchmark_Pointer_Statistics_Slots[2 * Pointer_Client->Index]);
+		#endif
+	}
+	memset(Payload, 'A' + Pointer_Client->Index % 26, BENCHMARK_MAXIMUM_PAYLOAD_SIZE);
+	
+	Start_Time = BenchmarkGetTime();
+	while (!Benchmark_Is_Publishing_Stopped)
+	{
+		// Send all messages that should have been sent since the beginning, so the rate is kept even if the thread is not woken up on time
+		Current_Time = BenchmarkGetTime();
+		if (Benchmark_Rate > 0) Due_Messages_Count = (Current_Time - Start_Time) * Benchmark_Rate / 1000000000ULL - Pointer_Client->Sent_Messages_Count;
+		else Due_Messages_Count = ~0ULL;
+		
+		MQTTBatchInitialize(&Batch, Pointer_Batch_Buffer, BENCHMARK_BUFFER_SIZE);
+		while (Due_Messages_Count > 0)
+		{
+			// The sending time is stored in the payload beginning
+			memcpy(Payload, &Current_Time, sizeof(Current_Time));
+			MQTTPublishPrepared(&Prepared_Publishes[Topic_Index], 0, Payload, Benchmark_Payload_Size);
+			if (MQTTBatchAppend(&Batch, &Prepared_Publishes[Topic_Index].Context) != 0) break;
+			
+			Pointer_Client->Sent_Messages_Count++;
+			Pointer_Client->Sent_Bytes_Count += MQTT_GET_MESSAGE_SIZE(&Prepared_Publishes[Topic_Index].Context);
+			Topic_Index = (Topic_Index + 1) % Benchmark_Topics_Count;
+			Due_Messages_Count--;
+		}
+		
+		if (MQTT_GET_BATCH_SIZE(&Batch) > 0)
+		{
+			if (BenchmarkWriteAll(Pointer_Client->Socket, MQTT_GET_BATCH_BUFFER(&Batch), MQTT_GET_BATCH_SIZE(&Batch)) != 0)
+			{
+				printf("Error : client %d failed to send data (%s).\n", Pointer_Client->Index, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		else nanosleep(&Sleeping_Time, NULL);
+	}
+	
+	free(Pointer_Prepared_Publishes_Buffer);
+	free(Pointer_Batch_Buffer);
+	return NULL;
+}
+
+/** Decode the messages sent back by the server and record their latency.
+ * @param Pointer_Parameter The client.
+ * @return Always NULL.
+ */
+static void *BenchmarkClientReceivingThread(void *Pointer_Parameter)
+{
+	TBenchmarkClient *Pointer_Client = Pointer_Parameter;
+	unsigned char *Pointer_Receive_Buffer, *Pointer_Decoder_Buffer;
+	unsigned long long Sending_Time, Latency;
+	ssize_t Read_Size;
+	int Offset, Result;
+	TMQTTDecoder Decoder;
+	TMQTTPacket Packet;
+	
+	Pointer_Receive_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	Pointer_Decoder_Buffer = malloc(BENCHMARK_BUFFER_SIZE);
+	if ((Pointer_Receive_Buffer == NULL) || (Pointer_Decoder_Buffer == NULL))
+	{
+		printf("Error : failed to allocate client memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	MQTTDecoderInitialize(&Decoder, Pointer_Decoder_Buffer, BENCHMARK_BUFFER_SIZE);
+	#ifdef MQTT_ENABLE_STATISTICS
+		MQTTDecoderSetStatisticsSlot(&Decoder, &Benchmark_Pointer_Statistics_Slots[2 * Pointer_Client->Index + 1]);
+	#endif
+	
+	while (1)
+	{
+		Read_Size = read(Pointer_Client->Socket, Pointer_Receive_Buffer, BENCHMARK_BUFFER_SIZE);
+		if (Read_Size <= 0) break;
+		
+		for (Offset = 0; Offset < Read_Size; Offset += Result)
+		{
+			Result = MQTTDecode(&Decoder, Pointer_Receive_Buffer + Offset, (int) Read_Size - Offset, &Packet);
+			if (Result < 0)
+			{
+				printf("Error : client %d received a malformed packet.\n", Pointer_Client->Index);
+				exit(EXIT_FAILURE);
+			}
+			if (Packet.Type != MQTT_PACKET_TYPE_PUBLISH) continue;
+			
+			// Record latency with a microsecond resolution
+			memcpy(&Sending_Time, Packet.Pointer_Payload, sizeof(Sending_Time));
+			Latency = (BenchmarkGetTime() - Sending_Time) / 1000;
+			if (Latency >= BENCHMARK_LATENCY_BUCKETS_COUNT) Latency = BENCHMARK_LATENCY_BUCKETS_COUNT - 1;
+			Pointer_Client->Pointer_Latency_Buckets[Latency]++;
+			Pointer_Client->Received_Messages_Count++;
+		}
+	}
+	
+	free(Pointer_Receive_Buffer);
+	free(Pointer_Decoder_Buffer);
+	return NULL;
+}
+
+/** Find the latency below which a given proportion of messages are.
+ * @param Pointer_Buckets The latency histogram of all clients.
+ * @param Messages_Count How many messages are recorded in the histogram.
+ * @param Percentile The proportion of messages, from 0 to 100.
+ * @return The latency in microseconds.
+ */
+static int BenchmarkComputePercentile(unsigned long long *Pointer_Buckets, unsigned long long Messages_Count, double Percentile)
+{
+	unsigned long long Count = 0, Threshold;
+	int i;
+	
+	Threshold = (unsigned long long) (Messages_Count * Percentile / 100.0);
+	for (i = 0; i < BENCHMARK_LATENCY_BUCKETS_COUNT; i++)
+	{
+		Count += Pointer_Buckets[i];
+		if (Count > Threshold) return i;
+	}
+	return BENCHMARK_LATENCY_BUCKETS_COUNT - 1;
+}
+
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Display the library statistics of a traffic direction.
+	 * @param Pointer_String_Name The direction name.
+	 * @param Pointer_Direction The direction counters.
+	 */
+	static void BenchmarkDisplayStatisticsDirection(char *Pointer_String_Name, TMQTTStatisticsDirection *Pointer_Direction)
+	{
+		int i;
+		
+		printf("%s : %llu bytes, buffer high water mark = %d bytes.\n  Packets per type :", Pointer_String_Name, Pointer_Direction->Bytes_Count, Pointer_Direction->Buffer_High_Water_Mark);
+		for (i = 1; i < 15; i++) printf(" %u", Pointer_Direction->Packets_Counts[i]);
+		printf("\n  Remaining length sizes (1 to 4 bytes) :");
+		for (i = 0; i < 4; i++) printf(" %u", Pointer_Direction->Remaining_Length_Sizes_Counts[i]);
+		printf("\n  Topic name lengths (0, then up to 2^N - 1) :");
+		for (i = 0; i < MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT; i++) printf(" %u", Pointer_Direction->Topic_Name_Lengths_Counts[i]);
+		printf("\n");
+	}
+#endif
+
+/** Display the program usage.
+ * @param Pointer_String_Program_Name The program name.
+ */
+static void BenchmarkDisplayUsage(char *Pointer_String_Program_Name)
+{
+	printf("Usage : %s [-c Clients_Count] [-r Messages_Per_Second_Per_Client] [-t Topics_Count] [-s Payload_Size] [-d Duration_Seconds]\n"
+		"Use a rate of 0 to publish as fast as possible. Payload size must be at least 8 bytes to store the sending time.\n", Pointer_String_Program_Name);
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	TBenchmarkClient *Pointer_Clients;
+	TMQTTContext Context;
+	TMQTTConnectionParameters Connection_Parameters;
+	struct sockaddr_in Address;
+	socklen_t Address_Size = sizeof(Address);
+	pthread_t Server_Thread;
+	unsigned char Buffer[256];
+	unsigned long long *Pointer_Latency_Buckets, Start_Time, Elapsed_Time, Sent_Messages_Count = 0, Sent_Bytes_Count = 0, Received_Messages_Count = 0;
+	char String_Client_Identifier[32];
+	int i, j, Option, Value;
+	double Seconds;
+	#ifdef MQTT_ENABLE_STATISTICS
+		TMQTTStatisticsCounters Statistics_Counters;
+	#endif
+	
+	// Check parameters
+	while ((Option = getopt(argc, argv, "c:r:t:s:d:h")) != -1)
+	{
+		if (Option == 'h' || Option == '?')
+		{
+			BenchmarkDisplayUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+		Value = atoi(optarg);
+		if (Option == 'c') Benchmark_Clients_Count = Value;
+		else if (Option == 'r') Benchmark_Rate = Value;
+		else if (Option == 't') Benchmark_Topics_Count = Value;
+		else if (Option == 's') Benchmark_Payload_Size = Value;
+		else if (Option == 'd') Benchmark_Duration = Value;
+	}
+	if ((Benchmark_Clients_Count <= 0) || (Benchmark_Rate < 0) || (Benchmark_Topics_Count <= 0) || (Benchmark_Topics_Count > BENCHMARK_MAXIMUM_TOPICS_COUNT) || (Benchmark_Payload_Size < (int) sizeof(unsigned long long)) || (Benchmark_Payload_Size > BENCHMARK_MAXIMUM_PAYLOAD_SIZE) || (Benchmark_Duration <= 0))
+	{
+		BenchmarkDisplayUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < Benchmark_Topics_Count; i++) snprintf(Benchmark_Strings_Topic_Names[i], sizeof(Benchmark_Strings_Topic_Names[i]), "benchmark/topic/%d", i);
+	
+	// Start the loopback server on any free port
+	Benchmark_Server_Socket = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&Address, 0, sizeof(Address));
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((Benchmark_Server_Socket < 0) || (bind(Benchmark_Server_Socket, (struct sockaddr *) &Address, sizeof(Address)) != 0) || (listen(Benchmark_Server_Socket, SOMAXCONN) != 0) || (getsockname(Benchmark_Server_Socket, (struct sockaddr *) &Address, &Address_Size) != 0))
+	{
+		printf("Error : failed to create loopback server socket (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	if (pthread_create(&Server_Thread, NULL, BenchmarkServerThread, NULL) != 0)
+	{
+		printf("Error : failed to create loopback server thread.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Connect all clients
+	Pointer_Clients = calloc(Benchmark_Clients_Count, sizeof(TBenchmarkClient));
+	if (Pointer_Clients == NULL)
+	{
+		printf("Error : failed to allocate clients memory.\n");
+		return EXIT_FAILURE;
+	}
+	#ifdef MQTT_ENABLE_STATISTICS
+		Benchmark_Pointer_Statistics_Slots = aligned_alloc(MQTT_STATISTICS_CACHE_LINE_SIZE, 2 * Benchmark_Clients_Count * sizeof(TMQTTStatisticsSlot));
+		if (Benchmark_Pointer_Statistics_Slots == NULL)
+		{
+			printf("Error : failed to allocate statistics slots.\n");
+			return EXIT_FAILURE;
+		}
+		MQTTStatisticsInitialize(Benchmark_Pointer_Statistics_Slots, 2 * Benchmark_Clients_Count);
+	#endif
+	for (i = 0; i < Benchmark_Clients_Count; i++)
+	{
+		Pointer_Clients[i].Index = i;
+		Pointer_Clients[i].Pointer_Latency_Buckets = calloc(BENCHMARK_LATENCY_BUCKETS_COUNT, sizeof(unsigned long long));
+		Pointer_Clients[i].Socket = socket(AF_INET, SOCK_STREAM, 0);
+		if ((Pointer_Clients[i].Pointer_Latency_Buckets == NULL) || (Pointer_Clients[i].Socket < 0) || (connect(Pointer_Clients[i].Socket, (struct sockaddr *) &Address, sizeof(Address)) != 0))
+		{
+			printf("Error : failed to connect client %d (%s).\n", i, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		Value = 1;
+		setsockopt(Pointer_Clients[i].Socket, IPPROTO_TCP, TCP_NODELAY, &Value, sizeof(Value));
+		
+		// Establish MQTT connection
+		snprintf(String_Client_Identifier, sizeof(String_Client_Identifier), "benchmark-%d", i);
+		memset(&Connection_Parameters, 0, sizeof(Connection_Parameters));
+		Connection_Parameters.Pointer_String_Client_Identifier = String_Client_Identifier;
+		Connection_Parameters.Is_Clean_Session_Enabled = 1;
+		Connection_Parameters.Pointer_Buffer = Buffer;
+		Connection_Parameters.Buffer_Size = sizeof(Buffer);
+		MQTTConnect(&Context, &Connection_Parameters);
+		if ((BenchmarkWriteAll(Pointer_Clients[i].Socket, MQTT_GET_MESSAGE_BUFFER(&Context), MQTT_GET_MESSAGE_SIZE(&Context)) != 0) || (read(Pointer_Clients[i].Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+		{
+			printf("Error : client %d failed to establish MQTT connection.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// Start publishing
+	printf("Running benchmark with %d clients, %d messages/s per client%s, %d topics, %d bytes payloads during %d seconds...\n", Benchmark_Clients_Count, Benchmark_Rate, Benchmark_Rate == 0 ? " (unlimited)" : "", Benchmark_Topics_Count, Benchmark_Payload_Size, Benchmark_Duration);
+	Start_Time = BenchmarkGetTime();
+	for (i = 0; i < Benchmark_Clients_Count; i++)
+	{
+		if ((pthread_create(&Pointer_Clients[i].Receiving_Thread, NULL, BenchmarkClientReceivingThread, &Pointer_Clients[i]) != 0) || (pthread_create(&Pointer_Clients[i].Sending_Thread, NULL, BenchmarkClientSendingThread, &Pointer_Clients[i]) != 0))
+		{
+			printf("Error : failed to create client %d threads.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// Stop publishing when duration elapsed, then let the last messages come back
+	sleep(Benchmark_Duration);
+	Benchmark_Is_Publishing_Stopped = 1;
+	for (i = 0; i < Benchmark_Clients_Count; i++) pthread_join(Pointer_Clients[i].Sending_Thread, NULL);
+	Elapsed_Time = BenchmarkGetTime() - Start_Time;
+	usleep(BENCHMARK_DRAIN_TIME * 1000);
+	for (i = 0; i < Benchmark_Clients_Count; i++)
+	{
+		shutdown(Pointer_Clients[i].Socket, SHUT_RDWR);
+		pthread_join(Pointer_Clients[i].Receiving_Thread, NULL);
+		close(Pointer_Clients[i].Socket);
+	}
+	
+	// Merge all clients statistics
+	Pointer_Latency_Buckets = calloc(BENCHMARK_LATENCY_BUCKETS_COUNT, sizeof(unsigned long long));
+	if (Pointer_Latency_Buckets == NULL)
+	{
+		printf("Error : failed to allocate statistics memory.\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < Benchmark_Clients_Count; i++)
+	{
+		Sent_Messages_Count += Pointer_Clients[i].Sent_Messages_Count;
+		Sent_Bytes_Count += Pointer_Clients[i].Sent_Bytes_Count;
+		Received_Messages_Count += Pointer_Clients[i].Received_Messages_Count;
+		for (j = 0; j < BENCHMARK_LATENCY_BUCKETS_COUNT; j++) Pointer_Latency_Buckets[j] += Pointer_Clients[i].Pointer_Latency_Buckets[j];
+	}
+	
+	// Display results
+	Seconds = Elapsed_Time / 1000000000.0;
+	printf("Sent messages : %llu (%.0f messages/s, %.2f MB/s).\n", Sent_Messages_Count, Sent_Messages_Count / Seconds, Sent_Bytes_Count / Seconds / 1000000.0);
+	printf("Received messages : %llu (%.0f messages/s).\n", Received_Messages_Count, Received_Messages_Count / Seconds);
+	if (Received_Messages_Count > 0) printf("Latency : p50 = %d us, p99 = %d us, p99.9 = %d us (values above %d us are clamped).\n", BenchmarkComputePercentile(Pointer_Latency_Buckets, Received_Messages_Count, 50), BenchmarkComputePercentile(Pointer_Latency_Buckets, Received_Messages_Count, 99), BenchmarkComputePercentile(Pointer_Latency_Buckets, Received_Messages_Count, 99.9), BENCHMARK_LATENCY_BUCKETS_COUNT - 1);
+	#ifdef MQTT_ENABLE_STATISTICS
+		MQTTStatisticsSnapshot(Benchmark_Pointer_Statistics_Slots, 2 * Benchmark_Clients_Count, &Statistics_Counters);
+		BenchmarkDisplayStatisticsDirection("Encoded", &Statistics_Counters.Encoded);
+		BenchmarkDisplayStatisticsDirection("Decoded", &Statistics_Counters.Decoded);
+		printf("Decoding errors : %u.\n", Statistics_Counters.Decoding_Errors_Count);
+	#endif
+	
+	close(Benchmark_Server_Socket);
+	return 0;
+}
@@ -0,0 +1,162 @@
+/** @file Coalescer.c
+ * Simulate sensors updating their topics at a very high rate, only the latest value of each topic is sent every few milliseconds.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Coalescer.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many sensors are simulated. */
+#define COALESCER_SENSORS_COUNT 8
+/** How many entries the coalescer table has (twice the topics count keeps probing short). */
+#define COALESCER_ENTRIES_COUNT 16
+/** The longest topic name. */
+#define COALESCER_MAXIMUM_TOPIC_NAME_LENGTH 32
+/** The biggest sensor value. */
+#define COALESCER_MAXIMUM_MESSAGE_SIZE 32
+/** The latest values are sent at this interval in milliseconds. */
+#define COALESCER_FLUSH_INTERVAL 10
+/** The batch size in bytes, it is also the coalescer byte budget. */
+#define COALESCER_BATCH_SIZE 1024
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time in milliseconds.
+ * @return The time in milliseconds.
+ */
+static unsigned int CoalescerGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (unsigned int) (Time.tv_sec * 1000 + Time.tv_nsec / 1000000);
+}
+
+/** Send the batch content to the server.
+ * @param Socket The connected socket.
+ * @param Pointer_Batch The batch to send.
+ * @return -1 if an error occurred,
+ * @return 0 on success.
+ */
+static int CoalescerSendBatch(int Socket, TMQTTBatch *Pointer_Batch)
+{
+	unsigned char *Pointer_Buffer = MQTT_GET_BATCH_BUFFER(Pointer_Batch);
+	int Size = MQTT_GET_BATCH_SIZE(Pointer_Batch);
+	ssize_t Sent_Size;
+	
+	while (Size > 0)
+	{
+		Sent_Size = write(Socket, Pointer_Buffer, Size);
+		if (Sent_Size < 0) return -1;
+		Pointer_Buffer += Sent_Size;
+		Size -= (int) Sent_Size;
+	}
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Buffer[256], Batch_Buffer[COALESCER_BATCH_SIZE], Coalescer_Buffer[COALESCER_ENTRIES_COUNT * (COALESCER_MAXIMUM_TOPIC_NAME_LENGTH + 1 + COALESCER_MAXIMUM_MESSAGE_SIZE)];
+	static TMQTTCoalescerEntry Coalescer_Entries[COALESCER_ENTRIES_COUNT];
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTCoalescer MQTT_Coalescer;
+	TMQTTBatch MQTT_Batch;
+	struct sockaddr_in Address;
+	char String_Topic_Name[COALESCER_MAXIMUM_TOPIC_NAME_LENGTH + 1], String_Message[COALESCER_MAXIMUM_MESSAGE_SIZE];
+	int Socket, Duration, Result, Sent_Messages_Count = 0, i;
+	unsigned int Start_Time, Current_Time, Updates_Count = 0;
+	
+	// Check parameters
+	if (argc != 4)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Duration_Seconds\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Duration = atoi(argv[3]);
+	if (Duration <= 0)
+	{
+		printf("Error : duration must be a positive value.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Connect to the server
+	Socket = socket(AF_INET, SOCK_STREAM, 0);
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	if ((Socket == -1) || (connect(Socket, (const struct sockaddr *) &Address, sizeof(Address)) == -1))
+	{
+		printf("Error : failed to connect to MQTT server (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "MQTT library coalescer";
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
+	if ((write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) || (read(Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+	{
+		printf("Error : failed to establish MQTT connection.\n");
+		return EXIT_FAILURE;
+	}
+	
+	MQTTCoalescerInitialize(&MQTT_Coalescer, Coalescer_Entries, COALESCER_ENTRIES_COUNT, Coalescer_Buffer, COALESCER_MAXIMUM_TOPIC_NAME_LENGTH, COALESCER_MAXIMUM_MESSAGE_SIZE, COALESCER_BATCH_SIZE, COALESCER_FLUSH_INTERVAL);
+	
+	// Update all sensors as fast as possible
+	Start_Time = CoalescerGetTime();
+	do
+	{
+		Current_Time = CoalescerGetTime();
+		for (i = 0; i < COALESCER_SENSORS_COUNT; i++)
+		{
+			snprintf(String_Topic_Name, sizeof(String_Topic_Name), "coalescer/sensor/%d", i);
+			snprintf(String_Message, sizeof(String_Message), "%u", Updates_Count);
+			Result = MQTTCoalescerPublish(&MQTT_Coalescer, String_Topic_Name, 0, String_Message, strlen(String_Message));
+			if (Result < 0)
+			{
+				printf("Error : failed to store the value of sensor %d.\n", i);
+				return EXIT_FAILURE;
+			}
+			Updates_Count++;
+		}
+		
+		// Send the latest values
+		if (MQTTCoalescerIsFlushNeeded(&MQTT_Coalescer, Current_Time))
+		{
+			MQTTBatchInitialize(&MQTT_Batch, Batch_Buffer, sizeof(Batch_Buffer));
+			Result = MQTTCoalescerFlush(&MQTT_Coalescer, &MQTT_Context, &MQTT_Batch, Current_Time);
+			if ((Result < 0) || (CoalescerSendBatch(Socket, &MQTT_Batch) != 0))
+			{
+				printf("Error : failed to send the latest values.\n");
+				return EXIT_FAILURE;
+			}
+			Sent_Messages_Count += Result;
+		}
+	} while (Current_Time - Start_Time < (unsigned int) Duration * 1000);
+	printf("%u values were updated, %d PUBLISH packets have been sent (%u values replaced before being sent).\n", Updates_Count, Sent_Messages_Count, MQTT_COALESCER_GET_REPLACED_MESSAGES_COUNT(&MQTT_Coalescer));
+	
+	// Close the connection
+	MQTTDisconnect(&MQTT_Context);
+	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) printf("Error : failed to send DISCONNECT packet (%s).\n", strerror(errno));
+	close(Socket);
+	return 0;
+}
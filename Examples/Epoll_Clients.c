@@ -0,0 +1,180 @@
+/** @file Epoll_Clients.c
+ * Drive many MQTT sessions from a single thread using the epoll transport.
+ * Each session publishes a message when it is connected, then stays idle so keep alive PINGREQ packets can be observed.
+ * Sessions do not own a buffer to forge packets, they borrow one from a shared pool only while a packet is forged and queued.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Epoll.h>
+#include <MQTT_Pool.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** Size of the small blocks shared by all sessions to forge packets. */
+#define EPOLL_CLIENTS_POOL_SMALL_BLOCK_SIZE 64
+/** Size of the big blocks shared by all sessions to forge packets. */
+#define EPOLL_CLIENTS_POOL_BIG_BLOCK_SIZE 256
+/** How many blocks of each size are available. Only one is used at a time, because sessions give the block back as soon as their packet is queued. */
+#define EPOLL_CLIENTS_POOL_BLOCKS_COUNT 4
+/** Each session send queue size. */
+#define EPOLL_CLIENTS_SEND_QUEUE_SIZE 1024
+/** Each session decoder buffer size. */
+#define EPOLL_CLIENTS_DECODER_BUFFER_SIZE 256
+/** Keep alive value in seconds, it is short to quickly see PINGREQ packets. */
+#define EPOLL_CLIENTS_KEEP_ALIVE 5
+
+//-------------------------------------------------------------------------------------------------
+// Private types
+//-------------------------------------------------------------------------------------------------
+/** All memory needed by a session. */
+typedef struct
+{
+	TMQTTEpollSession Session;
+	unsigned char Send_Queue_Buffer[EPOLL_CLIENTS_SEND_QUEUE_SIZE];
+	unsigned char Decoder_Buffer[EPOLL_CLIENTS_DECODER_BUFFER_SIZE];
+	char String_Client_Identifier[32];
+} TEpollClient;
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** The loop driving all sessions. */
+static TMQTTEpollLoop Epoll_Clients_Loop;
+
+/** Packets buffers shared by all sessions. */
+static TMQTTPool Epoll_Clients_Pool;
+/** The pool memory. */
+static unsigned char Epoll_Clients_Pool_Buffer[EPOLL_CLIENTS_POOL_BLOCKS_COUNT * (EPOLL_CLIENTS_POOL_SMALL_BLOCK_SIZE + EPOLL_CLIENTS_POOL_BIG_BLOCK_SIZE)];
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Publish a message as soon as a session is connected.
+ * @param Pointer_Session The connected session.
+ */
+static void EpollClientsHandleConnection(TMQTTEpollSession *Pointer_Session)
+{
+	TEpollClient *Pointer_Client = Pointer_Session->Pointer_User_Data;
+	
+	int Message_Size = (int) strlen(Pointer_Client->String_Client_Identifier);
+	
+	printf("Session '%s' is connected, publishing data...\n", Pointer_Client->String_Client_Identifier);
+	
+	// Borrow a buffer just big enough to forge the packet, it can be given back as soon as the packet is queued
+	if (MQTTPoolBorrowBuffer(&Epoll_Clients_Pool, &Pointer_Session->Context, MQTTComputePublishBufferSize("epoll/clients", 0, Message_Size)) != 0)
+	{
+		printf("Error : no buffer is available to publish data for session '%s'.\n", Pointer_Client->String_Client_Identifier);
+		return;
+	}
+	MQTTPublish(&Pointer_Session->Context, "epoll/clients", Pointer_Client->String_Client_Identifier, Message_Size);
+	if (MQTTEpollSend(&Epoll_Clients_Loop, Pointer_Session) != 0) printf("Error : failed to send PUBLISH packet for session '%s'.\n", Pointer_Client->String_Client_Identifier);
+	MQTTPoolReleaseBuffer(&Epoll_Clients_Pool, &Pointer_Session->Context);
+}
+
+/** Display why a session has been closed.
+ * @param Pointer_Session The closed session.
+ */
+static void EpollClientsHandleClose(TMQTTEpollSession *Pointer_Session)
+{
+	TEpollClient *Pointer_Client = Pointer_Session->Pointer_User_Data;
+	
+	printf("Session '%s' has been closed (connection error or keep alive timeout).\n", Pointer_Client->String_Client_Identifier);
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static const int Pool_Blocks_Sizes[2] = { EPOLL_CLIENTS_POOL_SMALL_BLOCK_SIZE, EPOLL_CLIENTS_POOL_BIG_BLOCK_SIZE }, Pool_Blocks_Counts[2] = { EPOLL_CLIENTS_POOL_BLOCKS_COUNT, EPOLL_CLIENTS_POOL_BLOCKS_COUNT };
+	TEpollClient *Pointer_Clients;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	struct sockaddr_in Address;
+	int Clients_Count, i, Result;
+	
+	// Check parameters
+	if (argc != 4)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Sessions_Count\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	Clients_Count = atoi(argv[3]);
+	if (Clients_Count <= 0)
+	{
+		printf("Error : sessions count must be a positive value.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Allocate all sessions at once
+	Pointer_Clients = calloc(Clients_Count, sizeof(TEpollClient));
+	if (Pointer_Clients == NULL)
+	{
+		printf("Error : failed to allocate sessions memory.\n");
+		return EXIT_FAILURE;
+	}
+	
+	if (MQTTEpollInitialize(&Epoll_Clients_Loop) != 0)
+	{
+		printf("Error : failed to create the event loop (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	Epoll_Clients_Loop.Connection_Handler = EpollClientsHandleConnection;
+	Epoll_Clients_Loop.Close_Handler = EpollClientsHandleClose;
+	
+	if (MQTTPoolInitialize(&Epoll_Clients_Pool, Epoll_Clients_Pool_Buffer, sizeof(Epoll_Clients_Pool_Buffer), Pool_Blocks_Sizes, Pool_Blocks_Counts, 2) != 0)
+	{
+		printf("Error : failed to create the buffers pool.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Start all connections without waiting for them to complete
+	printf("Connecting %d sessions to '%s:%s'...\n", Clients_Count, argv[1], argv[2]);
+	for (i = 0; i < Clients_Count; i++)
+	{
+		snprintf(Pointer_Clients[i].String_Client_Identifier, sizeof(Pointer_Clients[i].String_Client_Identifier), "epoll-client-%d", i);
+		MQTTEpollInitializeSession(&Pointer_Clients[i].Session, Pointer_Clients[i].Send_Queue_Buffer, sizeof(Pointer_Clients[i].Send_Queue_Buffer), Pointer_Clients[i].Decoder_Buffer, sizeof(Pointer_Clients[i].Decoder_Buffer));
+		Pointer_Clients[i].Session.Pointer_User_Data = &Pointer_Clients[i];
+		
+		memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+		MQTT_Connection_Parameters.Pointer_String_Client_Identifier = Pointer_Clients[i].String_Client_Identifier;
+		MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+		MQTT_Connection_Parameters.Keep_Alive = EPOLL_CLIENTS_KEEP_ALIVE;
+		
+		// The CONNECT packet is queued by the session, so the buffer can be given back right after the connection started
+		MQTT_Connection_Parameters.Buffer_Size = MQTTComputeConnectBufferSize(&MQTT_Connection_Parameters);
+		MQTT_Connection_Parameters.Pointer_Buffer = MQTTPoolAllocate(&Epoll_Clients_Pool, MQTT_Connection_Parameters.Buffer_Size, NULL);
+		if (MQTT_Connection_Parameters.Pointer_Buffer == NULL)
+		{
+			printf("Error : no buffer is available to connect session %d.\n", i);
+			return EXIT_FAILURE;
+		}
+		Result = MQTTEpollConnect(&Epoll_Clients_Loop, &Pointer_Clients[i].Session, (struct sockaddr *) &Address, sizeof(Address), &MQTT_Connection_Parameters);
+		MQTTPoolFree(&Epoll_Clients_Pool, MQTT_Connection_Parameters.Pointer_Buffer);
+		if (Result != 0)
+		{
+			printf("Error : failed to start session %d connection (%s).\n", i, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// Process network events until the program is stopped
+	printf("Press Ctrl+C to exit.\n");
+	while (1)
+	{
+		if (MQTTEpollProcessEvents(&Epoll_Clients_Loop, -1) != 0)
+		{
+			printf("Error : failed to process events (%s).\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+}
@@ -0,0 +1,210 @@
+/** @file IO_Uring.c
+ * Publish QoS 1 messages from several sessions driven by a single io_uring loop, then display how many system calls were needed per message.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_IO_Uring.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many sessions can be started at most. */
+#define IO_URING_MAXIMUM_SESSIONS_COUNT 64
+/** A send slot size, it must be able to hold the biggest message. */
+#define IO_URING_SEND_SLOT_SIZE 128
+/** The decoder buffer size, the server sends only small acknowledges. */
+#define IO_URING_DECODER_BUFFER_SIZE 256
+
+//-------------------------------------------------------------------------------------------------
+// Private types
+//-------------------------------------------------------------------------------------------------
+/** The progress of a session. */
+typedef struct
+{
+	int Published_Messages_Count; //!< How many PUBLISH packets have been queued.
+	int Acknowledged_Messages_Count; //!< How many PUBACK packets have been received.
+} TIOUringSessionCounters;
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** How many sessions have been closed because of an error. */
+static int IO_Uring_Closed_Sessions_Count = 0;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Count the acknowledged messages.
+ * @param Pointer_Session The session the packet has been received on.
+ * @param Pointer_Packet The received packet.
+ */
+static void IOUringPacketHandler(TMQTTIOUringSession *Pointer_Session, TMQTTPacket *Pointer_Packet)
+{
+	TIOUringSessionCounters *Pointer_Counters = Pointer_Session->Pointer_User_Data;
+	
+	if (Pointer_Packet->Type == MQTT_PACKET_TYPE_PUBACK) Pointer_Counters->Acknowledged_Messages_Count++;
+}
+
+/** Tell that a session has been lost.
+ * @param Pointer_Session The closed session.
+ */
+static void IOUringCloseHandler(TMQTTIOUringSession *Pointer_Session)
+{
+	(void) Pointer_Session;
+	
+	printf("Error : a session has been closed by the server or because of a network error.\n");
+	IO_Uring_Closed_Sessions_Count++;
+}
+
+/** Connect to the MQTT server with a blocking socket.
+ * @param Pointer_Address The server address.
+ * @param Session_Index The session number, used to build an unique client identifier.
+ * @return -1 if the connection failed,
+ * @return The connected socket on success.
+ */
+static int IOUringConnect(struct sockaddr_in *Pointer_Address, int Session_Index)
+{
+	unsigned char Buffer[256];
+	char String_Client_Identifier[64];
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	int Socket;
+	
+	Socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (Socket == -1) return -1;
+	if (connect(Socket, (const struct sockaddr *) Pointer_Address, sizeof(struct sockaddr_in)) == -1)
+	{
+		close(Socket);
+		return -1;
+	}
+	
+	snprintf(String_Client_Identifier, sizeof(String_Client_Identifier), "MQTT library io_uring %d", Session_Index);
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = String_Client_Identifier;
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
+	if ((write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) || (read(Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+	{
+		close(Socket);
+		return -1;
+	}
+	
+	return Socket;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Send_Buffers[IO_URING_MAXIMUM_SESSIONS_COUNT][MQTT_IO_URING_SEND_SLOTS_COUNT * IO_URING_SEND_SLOT_SIZE], Decoder_Buffers[IO_URING_MAXIMUM_SESSIONS_COUNT][IO_URING_DECODER_BUFFER_SIZE];
+	static TMQTTIOUringSession Sessions[IO_URING_MAXIMUM_SESSIONS_COUNT];
+	static TIOUringSessionCounters Sessions_Counters[IO_URING_MAXIMUM_SESSIONS_COUNT];
+	static TMQTTIOUringLoop Loop;
+	TMQTTIOUringSession *Pointer_Session;
+	struct sockaddr_in Address;
+	char String_Message[32];
+	int Sessions_Count, Messages_Count, Acknowledged_Messages_Count = 0, Socket, Is_Sending_Pending, i;
+	
+	// Check parameters
+	if (argc != 5)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Sessions_Count Messages_Per_Session\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Sessions_Count = atoi(argv[3]);
+	Messages_Count = atoi(argv[4]);
+	if ((Sessions_Count <= 0) || (Sessions_Count > IO_URING_MAXIMUM_SESSIONS_COUNT) || (Messages_Count <= 0))
+	{
+		printf("Error : sessions count must be in range [1; %d] and messages count must be a positive value.\n", IO_URING_MAXIMUM_SESSIONS_COUNT);
+		return EXIT_FAILURE;
+	}
+	
+	// All sessions must be initialized before the loop registers their send buffers
+	for (i = 0; i < Sessions_Count; i++)
+	{
+		MQTTIOUringInitializeSession(&Sessions[i], Send_Buffers[i], IO_URING_SEND_SLOT_SIZE, Decoder_Buffers[i], IO_URING_DECODER_BUFFER_SIZE);
+		Sessions[i].Pointer_User_Data = &Sessions_Counters[i];
+	}
+	if (MQTTIOUringInitialize(&Loop, Sessions, Sessions_Count) != 0)
+	{
+		printf("Error : failed to initialize the loop (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	Loop.Packet_Handler = IOUringPacketHandler;
+	Loop.Close_Handler = IOUringCloseHandler;
+	printf("Using %s.\n", MQTT_IO_URING_IS_FALLBACK_USED(&Loop) ? "poll(), writev() and read() because io_uring is not available" : "io_uring");
+	
+	// Establish all connections
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	for (i = 0; i < Sessions_Count; i++)
+	{
+		Socket = IOUringConnect(&Address, i);
+		if ((Socket == -1) || (MQTTIOUringAttach(&Loop, &Sessions[i], Socket, MQTT_PROTOCOL_VERSION_3_1_1) != 0))
+		{
+			printf("Error : failed to connect session %d to MQTT server (%s).\n", i, strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+	
+	// Publish as fast as the send slots are released, until all messages are acknowledged
+	while (Acknowledged_Messages_Count < Sessions_Count * Messages_Count)
+	{
+		for (i = 0; i < Sessions_Count; i++)
+		{
+			Pointer_Session = &Sessions[i];
+			while ((Sessions_Counters[i].Published_Messages_Count < Messages_Count) && (MQTT_IO_URING_GET_FREE_SEND_SLOTS_COUNT(Pointer_Session) > 0))
+			{
+				snprintf(String_Message, sizeof(String_Message), "message %d", Sessions_Counters[i].Published_Messages_Count);
+				MQTTPublishExtended(&Pointer_Session->Context, "io_uring", MQTT_PUBLISH_FLAG_QOS_1, MQTTAllocatePacketIdentifier(&Pointer_Session->Context), String_Message, strlen(String_Message));
+				MQTTIOUringSend(&Loop, Pointer_Session);
+				Sessions_Counters[i].Published_Messages_Count++;
+			}
+		}
+		
+		if (MQTTIOUringProcessEvents(&Loop, 1000) != 0)
+		{
+			printf("Error : failed to process events (%s).\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if (IO_Uring_Closed_Sessions_Count > 0) return EXIT_FAILURE;
+		
+		Acknowledged_Messages_Count = 0;
+		for (i = 0; i < Sessions_Count; i++) Acknowledged_Messages_Count += Sessions_Counters[i].Acknowledged_Messages_Count;
+	}
+	printf("%d messages have been acknowledged with %llu system calls (%.3f system calls per message).\n", Acknowledged_Messages_Count, MQTT_IO_URING_GET_SYSTEM_CALLS_COUNT(&Loop), (double) MQTT_IO_URING_GET_SYSTEM_CALLS_COUNT(&Loop) / Acknowledged_Messages_Count);
+	
+	// Send the DISCONNECT packets, then wait for them to be sent before closing the connections (the server is allowed to close the connections first)
+	Loop.Close_Handler = NULL;
+	for (i = 0; i < Sessions_Count; i++)
+	{
+		MQTTDisconnect(&Sessions[i].Context);
+		MQTTIOUringSend(&Loop, &Sessions[i]);
+	}
+	do
+	{
+		if (MQTTIOUringProcessEvents(&Loop, 100) != 0) break;
+		
+		Is_Sending_Pending = 0;
+		for (i = 0; i < Sessions_Count; i++)
+		{
+			if (MQTT_IO_URING_IS_SESSION_ATTACHED(&Sessions[i]) && (MQTT_IO_URING_GET_FREE_SEND_SLOTS_COUNT(&Sessions[i]) < MQTT_IO_URING_SEND_SLOTS_COUNT - 1)) Is_Sending_Pending = 1;
+		}
+	} while (Is_Sending_Pending);
+	for (i = 0; i < Sessions_Count; i++) MQTTIOUringClose(&Loop, &Sessions[i]);
+	MQTTIOUringUninitialize(&Loop);
+	return 0;
+}
@@ -0,0 +1,408 @@
+/** @file Microbenchmark.c
+ * Measure how much time and how many CPU cycles the encoders need to forge a single packet.
+ * The library source is included directly so the private functions MQTTAppendString() and MQTTAddFixedHeader() can be measured too.
+ * Results are displayed and written to a CSV file, so runs made before and after an encoder change can be compared.
+ * @author Adrien RICCIARDI
+ */
+#include "../MQTT.c"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** The biggest remaining length that is measured, it is the first value needing a 4-byte remaining length field. */
+#define MICROBENCHMARK_MAXIMUM_REMAINING_LENGTH 2097152
+
+/** The buffer must be able to hold the biggest measured packet. */
+#define MICROBENCHMARK_BUFFER_SIZE (MICROBENCHMARK_MAXIMUM_REMAINING_LENGTH + 1024)
+
+/** A measure is repeated this amount of times and the fastest one is kept, to filter out interrupts and scheduling noise. */
+#define MICROBENCHMARK_RUNS_COUNT 7
+
+/** A single run must last at least this amount of nanoseconds, iterations count is doubled until it is reached. */
+#define MICROBENCHMARK_MINIMUM_RUN_DURATION 2000000ULL
+
+/** How many topic filters can be given to MQTTSubscribe() at most. */
+#define MICROBENCHMARK_MAXIMUM_SUBSCRIPTIONS_COUNT 16
+
+/** Tell the compiler that memory has been used, so it can't remove a call whose results are never read. */
+#define MICROBENCHMARK_BARRIER() __asm__ __volatile__("" : : : "memory")
+
+//-------------------------------------------------------------------------------------------------
+// Private types
+//-------------------------------------------------------------------------------------------------
+/** All cycles counters that can be used. */
+typedef enum
+{
+	MICROBENCHMARK_CYCLES_SOURCE_NONE, //!< No counter is available, cycles are reported as 0.
+	MICROBENCHMARK_CYCLES_SOURCE_PERF, //!< Linux perf CPU cycles hardware counter.
+	MICROBENCHMARK_CYCLES_SOURCE_TSC //!< x86 time stamp counter, it counts at a constant reference frequency on recent CPUs.
+} TMicrobenchmarkCyclesSource;
+
+struct TMicrobenchmarkCase;
+
+/** Call the measured function several times.
+ * @param Pointer_Case The case parameters.
+ * @param Iterations_Count How many times the function must be called.
+ */
+typedef void (*TMicrobenchmarkFunction)(struct TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count);
+
+/** A measured function and its parameters. */
+typedef struct TMicrobenchmarkCase
+{
+	char *Pointer_String_Name; //!< The measured function name.
+	TMicrobenchmarkFunction Function; //!< The function doing the calls.
+	int String_Length; //!< Topic name, topic filter, client identifier or string length.
+	int Strings_Count; //!< How many strings are encoded in the packet.
+	int Payload_Size; //!< PUBLISH application message size.
+	int Remaining_Length; //!< Only used by the MQTTAddFixedHeader() case, other cases find the value in the forged packet.
+} TMicrobenchmarkCase;
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** All packets are forged in this context. */
+static TMQTTContext Microbenchmark_Context;
+
+/** All strings are made of this buffer characters. */
+static char Microbenchmark_String[MICROBENCHMARK_BUFFER_SIZE];
+
+/** Application messages come from there. */
+static unsigned char Microbenchmark_Payload[MICROBENCHMARK_BUFFER_SIZE];
+
+/** The counter used to get cycles. */
+static TMicrobenchmarkCyclesSource Microbenchmark_Cycles_Source = MICROBENCHMARK_CYCLES_SOURCE_NONE;
+
+/** The perf counter file descriptor. */
+static int Microbenchmark_Perf_Descriptor = -1;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time.
+ * @return The time in nanoseconds.
+ */
+static unsigned long long MicrobenchmarkGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (unsigned long long) Time.tv_sec * 1000000000ULL + Time.tv_nsec;
+}
+
+/** Select the most accurate available cycles counter. */
+static void MicrobenchmarkInitializeCyclesCounter(void)
+{
+	#ifdef __linux__
+		struct perf_event_attr Attributes;
+		
+		// Prefer the real CPU cycles count when the kernel allows to access it
+		memset(&Attributes, 0, sizeof(Attributes));
+		Attributes.type = PERF_TYPE_HARDWARE;
+		Attributes.size = sizeof(Attributes);
+		Attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+		Attributes.exclude_kernel = 1;
+		Attributes.exclude_hv = 1;
+		Microbenchmark_Perf_Descriptor = (int) syscall(SYS_perf_event_open, &Attributes, 0, -1, -1, 0);
+		if (Microbenchmark_Perf_Descriptor >= 0)
+		{
+			ioctl(Microbenchmark_Perf_Descriptor, PERF_EVENT_IOC_ENABLE, 0);
+			Microbenchmark_Cycles_Source = MICROBENCHMARK_CYCLES_SOURCE_PERF;
+			return;
+		}
+	#endif
+	
+	#if defined(__x86_64__) || defined(__i386__)
+		Microbenchmark_Cycles_Source = MICROBENCHMARK_CYCLES_SOURCE_TSC;
+	#endif
+}
+
+/** Read the selected cycles counter.
+ * @return The counter value, or 0 if no counter is available.
+ */
+static unsigned long long MicrobenchmarkGetCycles(void)
+{
+	#ifdef __linux__
+		unsigned long long Cycles;
+		
+		if (Microbenchmark_Cycles_Source == MICROBENCHMARK_CYCLES_SOURCE_PERF)
+		{
+			if (read(Microbenchmark_Perf_Descriptor, &Cycles, sizeof(Cycles)) != sizeof(Cycles)) return 0;
+			return Cycles;
+		}
+	#endif
+	
+	#if defined(__x86_64__) || defined(__i386__)
+		if (Microbenchmark_Cycles_Source == MICROBENCHMARK_CYCLES_SOURCE_TSC) return __rdtsc();
+	#endif
+	
+	return 0;
+}
+
+/** Get the remaining length of the packet forged in the context.
+ * @return The remaining length field value.
+ */
+static int MicrobenchmarkGetRemainingLength(void)
+{
+	unsigned char *Pointer_Byte = Microbenchmark_Context.Pointer_Message_Buffer + 1;
+	int Remaining_Length = 0, Shift = 0;
+	
+	do
+	{
+		Remaining_Length |= (*Pointer_Byte & 0x7F) << Shift;
+		Shift += 7;
+	} while (*Pointer_Byte++ & 0x80);
+	
+	return Remaining_Length;
+}
+
+/** Forge CONNECT packets with a client identifier and optional credentials. */
+static void MicrobenchmarkConnect(TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count)
+{
+	TMQTTConnectionParameters Connection_Parameters;
+	unsigned long long i;
+	
+	memset(&Connection_Parameters, 0, sizeof(Connection_Parameters));
+	Connection_Parameters.Pointer_String_Client_Identifier = Microbenchmark_String + MICROBENCHMARK_BUFFER_SIZE - 1 - Pointer_Case->String_Length; // Take the end of the string, so it has the requested length
+	if (Pointer_Case->Strings_Count == 3)
+	{
+		Connection_Parameters.Pointer_String_User_Name = Connection_Parameters.Pointer_String_Client_Identifier;
+		Connection_Parameters.Pointer_String_Password = Connection_Parameters.Pointer_String_Client_Identifier;
+	}
+	Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	Connection_Parameters.Keep_Alive = 60;
+	Connection_Parameters.Pointer_Buffer = Microbenchmark_Context.Pointer_Buffer;
+	Connection_Parameters.Buffer_Size = Microbenchmark_Context.Buffer_Size;
+	
+	for (i = 0; i < Iterations_Count; i++)
+	{
+		MQTTConnect(&Microbenchmark_Context, &Connection_Parameters);
+		MICROBENCHMARK_BARRIER();
+	}
+}
+
+/** Forge QoS 0 PUBLISH packets. */
+static void MicrobenchmarkPublish(TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count)
+{
+	char *Pointer_String_Topic_Name = Microbenchmark_String + MICROBENCHMARK_BUFFER_SIZE - 1 - Pointer_Case->String_Length;
+	unsigned long long i;
+	
+	for (i = 0; i < Iterations_Count; i++)
+	{
+		MQTTPublish(&Microbenchmark_Context, Pointer_String_Topic_Name, Microbenchmark_Payload, Pointer_Case->Payload_Size);
+		MICROBENCHMARK_BARRIER();
+	}
+}
+
+/** Forge SUBSCRIBE packets with several topic filters. */
+static void MicrobenchmarkSubscribe(TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count)
+{
+	TMQTTSubscription Subscriptions[MICROBENCHMARK_MAXIMUM_SUBSCRIPTIONS_COUNT];
+	unsigned long long i;
+	int j;
+	
+	for (j = 0; j < Pointer_Case->Strings_Count; j++)
+	{
+		Subscriptions[j].Pointer_String_Topic_Filter = Microbenchmark_String + MICROBENCHMARK_BUFFER_SIZE - 1 - Pointer_Case->String_Length;
+		Subscriptions[j].QoS = 1;
+	}
+	
+	for (i = 0; i < Iterations_Count; i++)
+	{
+		MQTTSubscribe(&Microbenchmark_Context, 1, Subscriptions, Pointer_Case->Strings_Count);
+		MICROBENCHMARK_BARRIER();
+	}
+}
+
+/** Append strings to a buffer. */
+static void MicrobenchmarkAppendString(TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count)
+{
+	char *Pointer_String = Microbenchmark_String + MICROBENCHMARK_BUFFER_SIZE - 1 - Pointer_Case->String_Length;
+	unsigned char *Pointer_Buffer;
+	unsigned long long i;
+	
+	for (i = 0; i < Iterations_Count; i++)
+	{
+		Pointer_Buffer = Microbenchmark_Context.Pointer_Buffer;
+		MQTTAppendString(&Pointer_Buffer, Pointer_String);
+		MICROBENCHMARK_BARRIER();
+	}
+}
+
+/** Add fixed headers to an already forged payload. */
+static void MicrobenchmarkAddFixedHeader(TMicrobenchmarkCase *Pointer_Case, unsigned long long Iterations_Count)
+{
+	unsigned long long i;
+	
+	for (i = 0; i < Iterations_Count; i++)
+	{
+		MQTTAddFixedHeader(&Microbenchmark_Context, MQTT_CONTROL_PACKET_TYPE_PUBLISH, Pointer_Case->Remaining_Length);
+		MICROBENCHMARK_BARRIER();
+	}
+}
+
+/** Measure a case and output the results.
+ * @param Pointer_Case The case to measure.
+ * @param Pointer_Output_File Where to write the CSV line.
+ */
+static void MicrobenchmarkRunCase(TMicrobenchmarkCase *Pointer_Case, FILE *Pointer_Output_File)
+{
+	static char *Pointer_Strings_Cycles_Sources[] = { "none", "perf", "tsc" };
+	unsigned long long Iterations_Count = 16, Start_Time, Elapsed_Time, Start_Cycles, Elapsed_Cycles;
+	double Nanoseconds_Per_Packet = 1e300, Cycles_Per_Packet = 1e300;
+	int i, Remaining_Length;
+	
+	// Find how many iterations are needed for a run to last long enough to be measured accurately (this also warms caches up)
+	while (1)
+	{
+		Start_Time = MicrobenchmarkGetTime();
+		Pointer_Case->Function(Pointer_Case, Iterations_Count);
+		if (MicrobenchmarkGetTime() - Start_Time >= MICROBENCHMARK_MINIMUM_RUN_DURATION) break;
+		Iterations_Count *= 2;
+	}
+	
+	// Keep the fastest run
+	for (i = 0; i < MICROBENCHMARK_RUNS_COUNT; i++)
+	{
+		Start_Cycles = MicrobenchmarkGetCycles();
+		Start_Time = MicrobenchmarkGetTime();
+		Pointer_Case->Function(Pointer_Case, Iterations_Count);
+		Elapsed_Time = MicrobenchmarkGetTime() - Start_Time;
+		Elapsed_Cycles = MicrobenchmarkGetCycles() - Start_Cycles;
+		
+		if ((double) Elapsed_Time / Iterations_Count < Nanoseconds_Per_Packet) Nanoseconds_Per_Packet = (double) Elapsed_Time / Iterations_Count;
+		if ((double) Elapsed_Cycles / Iterations_Count < Cycles_Per_Packet) Cycles_Per_Packet = (double) Elapsed_Cycles / Iterations_Count;
+	}
+	
+	// MQTTAppendString() does not forge a packet
+	if (Pointer_Case->Function == MicrobenchmarkAppendString) Remaining_Length = 0;
+	else Remaining_Length = MicrobenchmarkGetRemainingLength();
+	
+	printf("%-20s %8d %8d %8d %10d %12llu %12.2f %12.2f\n", Pointer_Case->Pointer_String_Name, Pointer_Case->String_Length, Pointer_Case->Strings_Count, Pointer_Case->Payload_Size, Remaining_Length, Iterations_Count, Nanoseconds_Per_Packet, Cycles_Per_Packet);
+	fprintf(Pointer_Output_File, "%s,%d,%d,%d,%d,%llu,%.3f,%.3f,%s\n", Pointer_Case->Pointer_String_Name, Pointer_Case->String_Length, Pointer_Case->Strings_Count, Pointer_Case->Payload_Size, Remaining_Length, Iterations_Count, Nanoseconds_Per_Packet, Cycles_Per_Packet, Pointer_Strings_Cycles_Sources[Microbenchmark_Cycles_Source]);
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static int String_Lengths[] = { 8, 32, 128, 512 }, Payload_Sizes[] = { 0, 16, 128, 1024, 8192 }, Remaining_Lengths[] = { 127, 128, 16383, 16384, 2097151, MICROBENCHMARK_MAXIMUM_REMAINING_LENGTH }, Subscriptions_Counts[] = { 1, 4, MICROBENCHMARK_MAXIMUM_SUBSCRIPTIONS_COUNT };
+	char *Pointer_String_Output_File_Name = "Microbenchmark.csv";
+	TMicrobenchmarkCase Case;
+	FILE *Pointer_Output_File;
+	unsigned int i, j;
+	
+	// Check parameters
+	if (argc > 2)
+	{
+		printf("Usage : %s [Output_CSV_File]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc == 2) Pointer_String_Output_File_Name = argv[1];
+	
+	Pointer_Output_File = fopen(Pointer_String_Output_File_Name, "w");
+	if (Pointer_Output_File == NULL)
+	{
+		printf("Error : failed to open output file '%s' (%s).\n", Pointer_String_Output_File_Name, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	fprintf(Pointer_Output_File, "function,string_length,strings_count,payload_size,remaining_length,iterations,ns_per_packet,cycles_per_packet,cycles_source\n");
+	
+	// Prepare data
+	Microbenchmark_Context.Pointer_Buffer = malloc(MICROBENCHMARK_BUFFER_SIZE);
+	if (Microbenchmark_Context.Pointer_Buffer == NULL)
+	{
+		printf("Error : failed to allocate packets buffer.\n");
+		return EXIT_FAILURE;
+	}
+	Microbenchmark_Context.Buffer_Size = MICROBENCHMARK_BUFFER_SIZE;
+	memset(Microbenchmark_String, 'a', sizeof(Microbenchmark_String) - 1);
+	memset(Microbenchmark_Payload, 0x55, sizeof(Microbenchmark_Payload));
+	MicrobenchmarkInitializeCyclesCounter();
+	
+	printf("%-20s %8s %8s %8s %10s %12s %12s %12s\n", "Function", "Str_Len", "Str_Cnt", "Payload", "Rem_Len", "Iterations", "ns/packet", "cycles/pkt");
+	
+	// MQTTAppendString()
+	memset(&Case, 0, sizeof(Case));
+	Case.Pointer_String_Name = "MQTTAppendString";
+	Case.Function = MicrobenchmarkAppendString;
+	Case.Strings_Count = 1;
+	for (i = 0; i < sizeof(String_Lengths) / sizeof(String_Lengths[0]); i++)
+	{
+		Case.String_Length = String_Lengths[i];
+		MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+	}
+	
+	// MQTTAddFixedHeader() at all remaining length field size boundaries
+	memset(&Case, 0, sizeof(Case));
+	Case.Pointer_String_Name = "MQTTAddFixedHeader";
+	Case.Function = MicrobenchmarkAddFixedHeader;
+	for (i = 0; i < sizeof(Remaining_Lengths) / sizeof(Remaining_Lengths[0]); i++)
+	{
+		Case.Remaining_Length = Remaining_Lengths[i];
+		MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+	}
+	
+	// MQTTConnect() without and with credentials
+	memset(&Case, 0, sizeof(Case));
+	Case.Pointer_String_Name = "MQTTConnect";
+	Case.Function = MicrobenchmarkConnect;
+	Case.String_Length = 23; // Biggest client identifier length all servers must accept
+	for (i = 1; i <= 3; i += 2)
+	{
+		Case.Strings_Count = i;
+		MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+	}
+	
+	// MQTTPublish() with all topic length and payload size combinations
+	memset(&Case, 0, sizeof(Case));
+	Case.Pointer_String_Name = "MQTTPublish";
+	Case.Function = MicrobenchmarkPublish;
+	Case.Strings_Count = 1;
+	for (i = 0; i < sizeof(String_Lengths) / sizeof(String_Lengths[0]); i++)
+	{
+		for (j = 0; j < sizeof(Payload_Sizes) / sizeof(Payload_Sizes[0]); j++)
+		{
+			Case.String_Length = String_Lengths[i];
+			Case.Payload_Size = Payload_Sizes[j];
+			MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+		}
+	}
+	
+	// MQTTPublish() at all remaining length field size boundaries
+	Case.String_Length = 16;
+	for (i = 0; i < sizeof(Remaining_Lengths) / sizeof(Remaining_Lengths[0]); i++)
+	{
+		Case.Payload_Size = Remaining_Lengths[i] - 2 - Case.String_Length; // Remove the topic name and its length field
+		MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+	}
+	
+	// MQTTSubscribe() with several topic filters
+	memset(&Case, 0, sizeof(Case));
+	Case.Pointer_String_Name = "MQTTSubscribe";
+	Case.Function = MicrobenchmarkSubscribe;
+	Case.String_Length = 32;
+	for (i = 0; i < sizeof(Subscriptions_Counts) / sizeof(Subscriptions_Counts[0]); i++)
+	{
+		Case.Strings_Count = Subscriptions_Counts[i];
+		MicrobenchmarkRunCase(&Case, Pointer_Output_File);
+	}
+	
+	fclose(Pointer_Output_File);
+	printf("Results have been written to '%s' (cycles source : %s).\n", Pointer_String_Output_File_Name, Microbenchmark_Cycles_Source == MICROBENCHMARK_CYCLES_SOURCE_PERF ? "perf" : Microbenchmark_Cycles_Source == MICROBENCHMARK_CYCLES_SOURCE_TSC ? "tsc" : "none");
+	return 0;
+}
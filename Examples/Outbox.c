@@ -0,0 +1,155 @@
+/** @file Outbox.c
+ * Store telemetry messages in a persistent outbox, then try to send all pending messages to the server. Messages that could not be sent are kept in the outbox file for the next run.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Outbox.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** The outbox ring size in bytes. */
+#define OUTBOX_DATA_SIZE (4 * 1024 * 1024)
+/** How many bytes are sent with a single system call at most. */
+#define OUTBOX_MAXIMUM_CHUNK_SIZE (256 * 1024)
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Connect to the MQTT server.
+ * @param Pointer_String_Server_IP_Address The server IP address.
+ * @param Server_Port The server port.
+ * @return -1 if the connection failed,
+ * @return The connected socket on success.
+ */
+static int OutboxConnect(char *Pointer_String_Server_IP_Address, unsigned short Server_Port)
+{
+	static unsigned char Buffer[256];
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	struct sockaddr_in Address;
+	int Socket;
+	
+	// Connect to the server
+	Socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (Socket == -1) return -1;
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(Pointer_String_Server_IP_Address);
+	Address.sin_port = htons(Server_Port);
+	if (connect(Socket, (const struct sockaddr *) &Address, sizeof(Address)) == -1)
+	{
+		printf("Failed to connect to MQTT server (%s).\n", strerror(errno));
+		close(Socket);
+		return -1;
+	}
+	
+	// Establish the MQTT connection
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "MQTT library outbox";
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
+	if ((write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) || (read(Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+	{
+		printf("Failed to establish MQTT connection.\n");
+		close(Socket);
+		return -1;
+	}
+	
+	return Socket;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Buffer[256];
+	TMQTTOutbox MQTT_Outbox;
+	TMQTTContext MQTT_Context;
+	TMQTTBufferSegment Segments[2];
+	struct iovec IO_Vectors[2];
+	char String_Message[64];
+	int Socket, Messages_Count, Segments_Count, i;
+	ssize_t Sent_Size;
+	
+	// Check parameters
+	if (argc != 5)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Outbox_File Messages_Count\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Messages_Count = atoi(argv[4]);
+	
+	if (MQTTOutboxOpen(&MQTT_Outbox, argv[3], OUTBOX_DATA_SIZE) != 0)
+	{
+		printf("Error : failed to open outbox file '%s' (%s).\n", argv[3], strerror(errno));
+		return EXIT_FAILURE;
+	}
+	printf("%llu bytes were pending in the outbox.\n", MQTT_OUTBOX_GET_PENDING_SIZE(&MQTT_Outbox));
+	
+	// Store the messages, the context is only used to forge them
+	MQTTInitializeContext(&MQTT_Context, Buffer, sizeof(Buffer));
+	for (i = 0; i < Messages_Count; i++)
+	{
+		snprintf(String_Message, sizeof(String_Message), "time %ld, message %d", (long) time(NULL), i);
+		MQTTPublish(&MQTT_Context, "outbox", String_Message, strlen(String_Message));
+		if (MQTTOutboxAppend(&MQTT_Outbox, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != 0)
+		{
+			printf("The outbox is full, only %d messages have been stored.\n", i);
+			break;
+		}
+	}
+	MQTTOutboxSynchronize(&MQTT_Outbox, 0);
+	
+	// Keep the messages for the next run if the server can't be reached
+	Socket = OutboxConnect(argv[1], atoi(argv[2]));
+	if (Socket == -1)
+	{
+		printf("%llu bytes are kept in the outbox.\n", MQTT_OUTBOX_GET_PENDING_SIZE(&MQTT_Outbox));
+		MQTTOutboxClose(&MQTT_Outbox);
+		return EXIT_FAILURE;
+	}
+	
+	// Send all pending messages with big writes
+	MQTTOutboxRewind(&MQTT_Outbox);
+	while ((Segments_Count = MQTTOutboxPeek(&MQTT_Outbox, Segments, OUTBOX_MAXIMUM_CHUNK_SIZE)) > 0)
+	{
+		for (i = 0; i < Segments_Count; i++)
+		{
+			IO_Vectors[i].iov_base = Segments[i].Pointer_Buffer;
+			IO_Vectors[i].iov_len = Segments[i].Size;
+		}
+		Sent_Size = writev(Socket, IO_Vectors, Segments_Count);
+		if (Sent_Size < 0)
+		{
+			printf("Error : failed to send pending messages (%s), %llu bytes are kept in the outbox.\n", strerror(errno), MQTT_OUTBOX_GET_PENDING_SIZE(&MQTT_Outbox));
+			MQTTOutboxClose(&MQTT_Outbox);
+			return EXIT_FAILURE;
+		}
+		
+		// QoS 0 messages are released as soon as they are sent
+		MQTTOutboxConsume(&MQTT_Outbox, (int) Sent_Size);
+		MQTTOutboxAcknowledge(&MQTT_Outbox, MQTT_OUTBOX_GET_SEND_OFFSET(&MQTT_Outbox));
+	}
+	printf("All pending messages have been sent.\n");
+	
+	// Close the connection
+	MQTTDisconnect(&MQTT_Context);
+	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) printf("Error : failed to send DISCONNECT packet (%s).\n", strerror(errno));
+	close(Socket);
+	MQTTOutboxClose(&MQTT_Outbox);
+	return 0;
+}
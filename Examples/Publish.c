@@ -12,8 +12,16 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** Size of the application message sent in chunks. It is big enough to need a 3-byte "remaining length" field and must be a multiple of the chunk size. */
+#define PUBLISH_STREAMED_MESSAGE_SIZE (100 * 512)
+
 //-------------------------------------------------------------------------------------------------
 // Private variables
 //-------------------------------------------------------------------------------------------------
@@ -27,12 +35,20 @@ static unsigned short Publish_Server_Port;
 //-------------------------------------------------------------------------------------------------
 void PublishConnectAndPublishData(char *Pointer_String_Client_ID, char *Pointer_String_User_Name, char *Pointer_String_Password, char *Pointer_String_Topic_Name, void *Pointer_Application_Data, int Application_Data_Size)
 {
-	static unsigned char Buffer[1024]; // Avoid storing a big buffer on the stack
+	static unsigned char Buffer[1024], Batch_Buffer[2048], Chunk_Buffer[512], Decoder_Buffer[256], Prepared_Publish_Buffer[1024]; // Avoid storing big buffers on the stack
 	TMQTTContext MQTT_Context;
 	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTBatch MQTT_Batch;
+	TMQTTPreparedPublish MQTT_Prepared_Publish;
+	TMQTTInFlightWindow MQTT_In_Flight_Window;
+	TMQTTDecoder MQTT_Decoder;
+	TMQTTPacket MQTT_Packet;
 	int Socket, Result;
 	struct sockaddr_in Address;
 	ssize_t Read_Bytes_Count;
+	TMQTTBufferSegment Segments[MQTT_PUBLISH_SEGMENTS_MAXIMUM_COUNT];
+	struct iovec IO_Vectors[MQTT_PUBLISH_SEGMENTS_MAXIMUM_COUNT];
+	int i, Segments_Count, Message_Size, Packet_Identifier;
 	
 	// Create a TCP socket
 	Socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -60,7 +76,11 @@ void PublishConnectAndPublishData(char *Pointer_String_Client_ID, char *Pointer_
 	MQTT_Connection_Parameters.Pointer_String_Password = Pointer_String_Password;
 	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
 	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_String_Will_Topic = NULL;
+	MQTT_Connection_Parameters.Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+	MQTT_Connection_Parameters.Session_Expiry_Interval = 0;
 	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
 	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
 	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
 	{
@@ -87,12 +107,90 @@ void PublishConnectAndPublishData(char *Pointer_String_Client_ID, char *Pointer_
 		exit(EXIT_FAILURE);
 	}
 	
+	// Publish the same data again without copying it to the MQTT buffer
+	printf("Sending scatter-gather PUBLISH packet...\n");
+	Segments_Count = MQTTPublishSegmented(&MQTT_Context, Pointer_String_Topic_Name, Pointer_Application_Data, Application_Data_Size, Segments);
+	Message_Size = 0;
+	for (i = 0; i < Segments_Count; i++)
+	{
+		IO_Vectors[i].iov_base = Segments[i].Pointer_Buffer;
+		IO_Vectors[i].iov_len = Segments[i].Size;
+		Message_Size += Segments[i].Size;
+	}
+	if (writev(Socket, IO_Vectors, Segments_Count) != Message_Size)
+	{
+		printf("Error : failed to send MQTT scatter-gather PUBLISH packet (%s).\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	
+	// Publish the data with QoS 1 and wait for the server acknowledge
+	printf("Sending QoS 1 PUBLISH packet...\n");
+	MQTTInFlightWindowInitialize(&MQTT_In_Flight_Window);
+	Packet_Identifier = MQTTInFlightWindowPublish(&MQTT_Context, &MQTT_In_Flight_Window, Pointer_String_Topic_Name, MQTT_PUBLISH_FLAG_QOS_1, Pointer_Application_Data, Application_Data_Size, time(NULL));
+	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	{
+		printf("Error : failed to send MQTT QoS 1 PUBLISH packet (%s).\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	printf("Waiting for PUBACK packet with identifier %d...\n", Packet_Identifier);
+	MQTTDecoderInitialize(&MQTT_Decoder, Decoder_Buffer, sizeof(Decoder_Buffer));
+	while (MQTT_GET_IN_FLIGHT_MESSAGES_COUNT(&MQTT_In_Flight_Window) > 0)
+	{
+		Read_Bytes_Count = read(Socket, Chunk_Buffer, sizeof(Chunk_Buffer)); // Do not use the context buffer, the decoded packet could be overwritten by a response packet
+		if (Read_Bytes_Count <= 0)
+		{
+			printf("Error : failed to receive MQTT PUBACK packet.\n");
+			exit(EXIT_FAILURE);
+		}
+		for (i = 0; i < Read_Bytes_Count; i += Result)
+		{
+			Result = MQTTDecode(&MQTT_Decoder, Chunk_Buffer + i, Read_Bytes_Count - i, &MQTT_Packet);
+			if (Result < 0)
+			{
+				printf("Error : received a malformed packet.\n");
+				exit(EXIT_FAILURE);
+			}
+			if (MQTT_Packet.Type != 0) MQTTInFlightWindowProcessPacket(&MQTT_Context, &MQTT_In_Flight_Window, &MQTT_Packet, time(NULL));
+		}
+	}
+	
+	// Stream a big application message in small chunks, as if it was read from a file
+	printf("Sending streamed PUBLISH packet...\n");
+	MQTTPublishStreamBegin(&MQTT_Context, Pointer_String_Topic_Name, PUBLISH_STREAMED_MESSAGE_SIZE);
+	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	{
+		printf("Error : failed to send MQTT streamed PUBLISH packet headers (%s).\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	for (Message_Size = 0; Message_Size < PUBLISH_STREAMED_MESSAGE_SIZE; Message_Size += sizeof(Chunk_Buffer))
+	{
+		memset(Chunk_Buffer, 'A' + (Message_Size / (int) sizeof(Chunk_Buffer)) % 26, sizeof(Chunk_Buffer)); // Fill each chunk with a different letter
+		if (write(Socket, Chunk_Buffer, sizeof(Chunk_Buffer)) != sizeof(Chunk_Buffer))
+		{
+			printf("Error : failed to send MQTT streamed PUBLISH packet application message (%s).\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	// Publish the data several times followed by the disconnection request, all with a single system call
+	printf("Sending batched PUBLISH and DISCONNECT packets...\n");
+	MQTTBatchInitialize(&MQTT_Batch, Batch_Buffer, sizeof(Batch_Buffer));
+	MQTTPreparePublish(&MQTT_Prepared_Publish, Prepared_Publish_Buffer, sizeof(Prepared_Publish_Buffer), Pointer_String_Topic_Name, 0, MQTT_GET_PROTOCOL_VERSION(&MQTT_Context)); // The topic name is encoded only once
+	for (i = 0; i < 4; i++)
+	{
+		MQTTPublishPrepared(&MQTT_Prepared_Publish, 0, Pointer_Application_Data, Application_Data_Size);
+		if (MQTTBatchAppend(&MQTT_Batch, &MQTT_Prepared_Publish.Context) != 0) break; // Stop when the batch is full
+	}
 	// Disconnect from MQTT server
 	MQTTDisconnect(&MQTT_Context);
-	printf("Sending DISCONNECT packet...\n");
-	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	if (MQTTBatchAppend(&MQTT_Batch, &MQTT_Context) != 0)
+	{
+		printf("Error : batch buffer is too small to store the MQTT DISCONNECT packet.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (write(Socket, MQTT_GET_BATCH_BUFFER(&MQTT_Batch), MQTT_GET_BATCH_SIZE(&MQTT_Batch)) != MQTT_GET_BATCH_SIZE(&MQTT_Batch))
 	{
-		printf("Error : failed to send MQTT DISCONNECT packet (%s).\n", strerror(errno));
+		printf("Error : failed to send MQTT batched packets (%s).\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
 	
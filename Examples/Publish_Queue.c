@@ -0,0 +1,188 @@
+/** @file Publish_Queue.c
+ * Several threads publish on the same connection through a lock-free publish queue, while the main thread sends the queued packets with writev().
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Publish_Queue.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many packets the queue can hold. */
+#define PUBLISH_QUEUE_SLOTS_COUNT 256
+/** The biggest packet size. */
+#define PUBLISH_QUEUE_SLOT_BUFFER_SIZE 128
+/** How many packets are sent with a single system call at most. */
+#define PUBLISH_QUEUE_MAXIMUM_BATCH_SIZE 64
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** The queue shared by all producers. */
+static TMQTTPublishQueue Publish_Queue;
+/** The queue slots. */
+static TMQTTPublishQueueSlot Publish_Queue_Slots[PUBLISH_QUEUE_SLOTS_COUNT];
+/** The queued packets memory. */
+static unsigned char Publish_Queue_Buffer[PUBLISH_QUEUE_SLOTS_COUNT * PUBLISH_QUEUE_SLOT_BUFFER_SIZE];
+/** How many messages each producer publishes. */
+static int Publish_Queue_Messages_Count;
+/** How many producers are still publishing. */
+static atomic_int Publish_Queue_Running_Producers_Count;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Publish messages to a topic specific to the thread.
+ * @param Pointer_Parameter The producer number.
+ * @return Always NULL.
+ */
+static void *PublishQueueProducerThread(void *Pointer_Parameter)
+{
+	char String_Topic_Name[32], String_Message[32];
+	int Producer_Index = (int) (long) Pointer_Parameter, i;
+	
+	snprintf(String_Topic_Name, sizeof(String_Topic_Name), "publish_queue/%d", Producer_Index);
+	for (i = 0; i < Publish_Queue_Messages_Count; i++)
+	{
+		snprintf(String_Message, sizeof(String_Message), "message %d", i);
+		
+		// Let the sending thread run when the queue is full
+		while (MQTTPublishQueuePublish(&Publish_Queue, String_Topic_Name, 0, 0, String_Message, strlen(String_Message)) != 0) sched_yield();
+	}
+	
+	atomic_fetch_sub(&Publish_Queue_Running_Producers_Count, 1);
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Buffer[256];
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTBufferSegment Segments[PUBLISH_QUEUE_MAXIMUM_BATCH_SIZE];
+	struct iovec IO_Vectors[PUBLISH_QUEUE_MAXIMUM_BATCH_SIZE];
+	struct sockaddr_in Address;
+	pthread_t Thread;
+	ssize_t Sent_Size;
+	int Socket, Producers_Count, Segments_Count, First_Segment_Index, Sent_Packets_Count = 0, i;
+	
+	// Check parameters
+	if (argc != 5)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Producers_Count Messages_Per_Producer\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Producers_Count = atoi(argv[3]);
+	Publish_Queue_Messages_Count = atoi(argv[4]);
+	if ((Producers_Count <= 0) || (Publish_Queue_Messages_Count <= 0))
+	{
+		printf("Error : producers and messages count must be positive values.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Connect to the server
+	Socket = socket(AF_INET, SOCK_STREAM, 0);
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	if ((Socket == -1) || (connect(Socket, (const struct sockaddr *) &Address, sizeof(Address)) == -1))
+	{
+		printf("Error : failed to connect to MQTT server (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "MQTT library publish queue";
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
+	if ((write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) || (read(Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+	{
+		printf("Error : failed to establish MQTT connection.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Start all producers
+	MQTTPublishQueueInitialize(&Publish_Queue, Publish_Queue_Slots, PUBLISH_QUEUE_SLOTS_COUNT, Publish_Queue_Buffer, PUBLISH_QUEUE_SLOT_BUFFER_SIZE, MQTT_GET_PROTOCOL_VERSION(&MQTT_Context));
+	atomic_init(&Publish_Queue_Running_Producers_Count, Producers_Count);
+	for (i = 0; i < Producers_Count; i++)
+	{
+		if (pthread_create(&Thread, NULL, PublishQueueProducerThread, (void *) (long) i) != 0)
+		{
+			printf("Error : failed to create producer thread %d.\n", i);
+			return EXIT_FAILURE;
+		}
+		pthread_detach(Thread);
+	}
+	
+	// Send packets until all producers are done and the queue is empty
+	while (1)
+	{
+		Segments_Count = MQTTPublishQueuePeek(&Publish_Queue, Segments, PUBLISH_QUEUE_MAXIMUM_BATCH_SIZE);
+		if (Segments_Count == 0)
+		{
+			// Producers count must be read before checking the queue again, so the last packets are not missed
+			if (atomic_load(&Publish_Queue_Running_Producers_Count) == 0)
+			{
+				if (MQTTPublishQueuePeek(&Publish_Queue, Segments, PUBLISH_QUEUE_MAXIMUM_BATCH_SIZE) == 0) break;
+				continue;
+			}
+			sched_yield();
+			continue;
+		}
+		
+		// Send all packets with as few system calls as possible
+		for (i = 0; i < Segments_Count; i++)
+		{
+			IO_Vectors[i].iov_base = Segments[i].Pointer_Buffer;
+			IO_Vectors[i].iov_len = Segments[i].Size;
+		}
+		First_Segment_Index = 0;
+		while (First_Segment_Index < Segments_Count)
+		{
+			Sent_Size = writev(Socket, &IO_Vectors[First_Segment_Index], Segments_Count - First_Segment_Index);
+			if (Sent_Size < 0)
+			{
+				printf("Error : failed to send PUBLISH packets (%s).\n", strerror(errno));
+				return EXIT_FAILURE;
+			}
+			
+			// Skip the fully sent packets and resume the partially sent one
+			while ((First_Segment_Index < Segments_Count) && (Sent_Size >= (ssize_t) IO_Vectors[First_Segment_Index].iov_len))
+			{
+				Sent_Size -= IO_Vectors[First_Segment_Index].iov_len;
+				First_Segment_Index++;
+			}
+			if (First_Segment_Index < Segments_Count)
+			{
+				IO_Vectors[First_Segment_Index].iov_base = (unsigned char *) IO_Vectors[First_Segment_Index].iov_base + Sent_Size;
+				IO_Vectors[First_Segment_Index].iov_len -= Sent_Size;
+			}
+		}
+		MQTTPublishQueueRelease(&Publish_Queue, Segments_Count);
+		Sent_Packets_Count += Segments_Count;
+	}
+	printf("%d PUBLISH packets have been sent by %d producers.\n", Sent_Packets_Count, Producers_Count);
+	
+	// Close the connection
+	MQTTDisconnect(&MQTT_Context);
+	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) printf("Error : failed to send DISCONNECT packet (%s).\n", strerror(errno));
+	close(Socket);
+	return 0;
+}
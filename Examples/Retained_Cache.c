@@ -0,0 +1,182 @@
+/** @file Retained_Cache.c
+ * A receiving thread stores all messages matching a topic filter in a cache, while the main thread acts as a dashboard displaying the latest value of each topic every second.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Retained_Cache.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many topics can be cached, it must be a power of two. */
+#define RETAINED_CACHE_ENTRIES_COUNT 256
+/** The longest topic name that can be cached. */
+#define RETAINED_CACHE_MAXIMUM_TOPIC_NAME_LENGTH 128
+/** The biggest application message that can be cached. */
+#define RETAINED_CACHE_MAXIMUM_APPLICATION_MESSAGE_SIZE 256
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** The cache shared by the receiving thread and the dashboard. */
+static TMQTTRetainedCache Retained_Cache;
+/** The connected socket. */
+static int Retained_Cache_Socket;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Store all received messages in the cache until the connection is closed.
+ * @param Pointer_Parameter Not used.
+ * @return Always NULL.
+ */
+static void *RetainedCacheReceivingThread(void *Pointer_Parameter)
+{
+	static unsigned char Received_Data_Buffer[4096], Decoder_Buffer[4096];
+	TMQTTDecoder MQTT_Decoder;
+	TMQTTPacket MQTT_Packet;
+	ssize_t Read_Bytes_Count;
+	unsigned char *Pointer_Received_Data;
+	int Result;
+	
+	(void) Pointer_Parameter;
+	
+	MQTTDecoderInitialize(&MQTT_Decoder, Decoder_Buffer, sizeof(Decoder_Buffer));
+	while (1)
+	{
+		// Received data can contain any number of packets, even incomplete ones
+		Read_Bytes_Count = read(Retained_Cache_Socket, Received_Data_Buffer, sizeof(Received_Data_Buffer));
+		if (Read_Bytes_Count < 0) printf("Error : failed to receive data (%s).\n", strerror(errno));
+		if (Read_Bytes_Count <= 0) return NULL; // The server closes the connection after the DISCONNECT packet
+		Pointer_Received_Data = Received_Data_Buffer;
+		while (Read_Bytes_Count > 0)
+		{
+			Result = MQTTDecode(&MQTT_Decoder, Pointer_Received_Data, Read_Bytes_Count, &MQTT_Packet);
+			if (Result < 0)
+			{
+				printf("Error : received a malformed packet.\n");
+				return NULL;
+			}
+			Pointer_Received_Data += Result;
+			Read_Bytes_Count -= Result;
+			
+			if ((MQTT_Packet.Type == MQTT_PACKET_TYPE_PUBLISH) && (MQTTRetainedCacheStore(&Retained_Cache, &MQTT_Packet, time(NULL)) != 0)) printf("Error : could not cache a message of topic '%.*s'.\n", MQTT_Packet.Topic_Name_Size, MQTT_Packet.Pointer_Topic_Name);
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Arena[MQTT_RETAINED_CACHE_COMPUTE_ARENA_SIZE(RETAINED_CACHE_ENTRIES_COUNT, RETAINED_CACHE_MAXIMUM_TOPIC_NAME_LENGTH, RETAINED_CACHE_MAXIMUM_APPLICATION_MESSAGE_SIZE)] __attribute__((aligned(sizeof(int)))), Buffer[1024], Application_Message[RETAINED_CACHE_MAXIMUM_APPLICATION_MESSAGE_SIZE];
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTSubscription Subscription;
+	TMQTTRetainedCacheMessageInformation Information;
+	struct sockaddr_in Address;
+	struct pollfd Poll_Descriptor;
+	pthread_t Receiving_Thread;
+	char *Pointer_String_Topic_Name;
+	int Result, Topics_Count, i;
+	
+	// Check parameters
+	if (argc != 4)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Topic_Filter\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	// Connect to the server
+	Retained_Cache_Socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (Retained_Cache_Socket == -1)
+	{
+		printf("Error : failed to create socket (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	if (connect(Retained_Cache_Socket, (const struct sockaddr *) &Address, sizeof(Address)) == -1)
+	{
+		printf("Error : failed to connect to MQTT server (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "MQTT library retained cache";
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
+	if ((write(Retained_Cache_Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) || (read(Retained_Cache_Socket, Buffer, MQTT_CONNACK_MESSAGE_SIZE) != MQTT_CONNACK_MESSAGE_SIZE) || (MQTTIsConnectionEstablished(Buffer, MQTT_CONNACK_MESSAGE_SIZE) != 0))
+	{
+		printf("Error : the server did not accept the connection.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// The server sends the retained messages of all matching topics right after the subscription
+	Subscription.Pointer_String_Topic_Filter = argv[3];
+	Subscription.QoS = 0;
+	if (MQTTSubscribe(&MQTT_Context, MQTTAllocatePacketIdentifier(&MQTT_Context), &Subscription, 1) != 1)
+	{
+		printf("Error : the topic filter is not valid or is too long.\n");
+		return EXIT_FAILURE;
+	}
+	if (write(Retained_Cache_Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	{
+		printf("Error : failed to send MQTT SUBSCRIBE packet (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	// Fill the cache from another thread
+	MQTTRetainedCacheInitialize(&Retained_Cache, Arena, RETAINED_CACHE_ENTRIES_COUNT, RETAINED_CACHE_MAXIMUM_TOPIC_NAME_LENGTH, RETAINED_CACHE_MAXIMUM_APPLICATION_MESSAGE_SIZE);
+	if (pthread_create(&Receiving_Thread, NULL, RetainedCacheReceivingThread, NULL) != 0)
+	{
+		printf("Error : failed to create the receiving thread.\n");
+		return EXIT_FAILURE;
+	}
+	
+	// Display the latest value of each topic every second, until the user presses enter
+	printf("Press enter to exit.\n");
+	Poll_Descriptor.fd = STDIN_FILENO;
+	Poll_Descriptor.events = POLLIN;
+	do
+	{
+		Topics_Count = 0;
+		for (i = 0; i < MQTT_RETAINED_CACHE_GET_ENTRIES_COUNT(&Retained_Cache); i++)
+		{
+			Pointer_String_Topic_Name = MQTTRetainedCacheGetTopicName(&Retained_Cache, i);
+			if (Pointer_String_Topic_Name == NULL) continue;
+			
+			Result = MQTTRetainedCacheRead(&Retained_Cache, Pointer_String_Topic_Name, Application_Message, sizeof(Application_Message), &Information);
+			printf("%s%s : '%.*s' (QoS %d, received %us ago, %u updates)\n", Pointer_String_Topic_Name, Information.Is_Retained ? " [retained]" : "", Result, Application_Message, Information.QoS, (unsigned int) time(NULL) - Information.Reception_Time, Information.Updates_Count);
+			Topics_Count++;
+		}
+		printf("--- %d topics ---\n", Topics_Count);
+	} while (poll(&Poll_Descriptor, 1, 1000) == 0);
+	
+	// Disconnect from the server, the receiving thread stops when the server closes the connection
+	MQTTDisconnect(&MQTT_Context);
+	if (write(Retained_Cache_Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	{
+		printf("Error : failed to send MQTT DISCONNECT packet (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	shutdown(Retained_Cache_Socket, SHUT_WR);
+	pthread_join(Receiving_Thread, NULL);
+	close(Retained_Cache_Socket);
+	return 0;
+}
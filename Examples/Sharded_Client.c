@@ -0,0 +1,192 @@
+/** @file Sharded_Client.c
+ * Several threads publish QoS 1 messages to many topics through a sharded client, then the statistics of each shard are displayed.
+ * @author Adrien RICCIARDI
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <MQTT.h>
+#include <MQTT_Sharded_Client.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many shards can be used at most. */
+#define SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT 16
+/** How many producer threads can be started at most. */
+#define SHARDED_CLIENT_MAXIMUM_PRODUCERS_COUNT 64
+/** How many packets each shard queue can hold. */
+#define SHARDED_CLIENT_QUEUE_SLOTS_COUNT 256
+/** The biggest packet size. */
+#define SHARDED_CLIENT_QUEUE_SLOT_BUFFER_SIZE 128
+/** The decoder buffer size, the server sends only small acknowledges. */
+#define SHARDED_CLIENT_DECODER_BUFFER_SIZE 256
+/** How many topics each producer publishes to. */
+#define SHARDED_CLIENT_TOPICS_PER_PRODUCER 8
+/** How many seconds to wait for the last acknowledges. */
+#define SHARDED_CLIENT_ACKNOWLEDGE_TIMEOUT 10
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** The client shared by all producers. */
+static TMQTTShardedClient Sharded_Client;
+/** How many messages each producer publishes. */
+static int Sharded_Client_Messages_Count;
+/** How many shards have been disconnected because of an error. */
+static atomic_int Sharded_Client_Closed_Shards_Count;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time.
+ * @return The time in seconds.
+ */
+static double ShardedClientGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return Time.tv_sec + Time.tv_nsec / 1000000000.0;
+}
+
+/** Tell that a shard has been lost.
+ * @param Pointer_Shard The disconnected shard.
+ */
+static void ShardedClientCloseHandler(TMQTTShardedClientShard *Pointer_Shard)
+{
+	printf("Error : shard %d has been closed by the server or because of a network error.\n", MQTT_SHARDED_CLIENT_GET_SHARD_INDEX(Pointer_Shard));
+	atomic_fetch_add(&Sharded_Client_Closed_Shards_Count, 1);
+}
+
+/** Publish messages to several topics specific to the thread.
+ * @param Pointer_Parameter The producer number.
+ * @return Always NULL.
+ */
+static void *ShardedClientProducerThread(void *Pointer_Parameter)
+{
+	char String_Topic_Name[64], String_Message[32];
+	int Producer_Index = (int) (long) Pointer_Parameter, i;
+	
+	for (i = 0; i < Sharded_Client_Messages_Count; i++)
+	{
+		snprintf(String_Topic_Name, sizeof(String_Topic_Name), "sharded_client/%d/%d", Producer_Index, i % SHARDED_CLIENT_TOPICS_PER_PRODUCER);
+		snprintf(String_Message, sizeof(String_Message), "message %d", i);
+		
+		// Let the worker threads run when the shard queue is full, give up if the shard has been lost
+		while (MQTTShardedClientPublish(&Sharded_Client, String_Topic_Name, MQTT_PUBLISH_FLAG_QOS_1, String_Message, strlen(String_Message)) != 0)
+		{
+			if (atomic_load(&Sharded_Client_Closed_Shards_Count) > 0) return NULL;
+			sched_yield();
+		}
+	}
+	
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Queue_Buffers[SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT][SHARDED_CLIENT_QUEUE_SLOTS_COUNT * SHARDED_CLIENT_QUEUE_SLOT_BUFFER_SIZE], Decoder_Buffers[SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT][SHARDED_CLIENT_DECODER_BUFFER_SIZE], Buffer[256];
+	static TMQTTPublishQueueSlot Queue_Slots[SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT][SHARDED_CLIENT_QUEUE_SLOTS_COUNT];
+	static TMQTTShardedClientShard Shards[SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT];
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTShardedClientStatistics Statistics;
+	struct sockaddr_in Address;
+	pthread_t Threads[SHARDED_CLIENT_MAXIMUM_PRODUCERS_COUNT];
+	unsigned long long Acknowledged_Messages_Count, Total_Sent_Packets_Count = 0, Total_System_Calls_Count = 0;
+	double Start_Time, Duration;
+	int Shards_Count, Producers_Count, i;
+	
+	// Check parameters
+	if (argc != 6)
+	{
+		printf("Usage : %s MQTT_Server_IP_Address MQTT_Server_Port Shards_Count Producers_Count Messages_Per_Producer\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	Shards_Count = atoi(argv[3]);
+	Producers_Count = atoi(argv[4]);
+	Sharded_Client_Messages_Count = atoi(argv[5]);
+	if ((Shards_Count <= 0) || (Shards_Count > SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT) || (Producers_Count <= 0) || (Producers_Count > SHARDED_CLIENT_MAXIMUM_PRODUCERS_COUNT) || (Sharded_Client_Messages_Count <= 0))
+	{
+		printf("Error : shards count must be in range [1; %d], producers count must be in range [1; %d] and messages count must be a positive value.\n", SHARDED_CLIENT_MAXIMUM_SHARDS_COUNT, SHARDED_CLIENT_MAXIMUM_PRODUCERS_COUNT);
+		return EXIT_FAILURE;
+	}
+	
+	// All shards must be initialized before the client
+	for (i = 0; i < Shards_Count; i++) MQTTShardedClientInitializeShard(&Shards[i], Queue_Slots[i], SHARDED_CLIENT_QUEUE_SLOTS_COUNT, Queue_Buffers[i], SHARDED_CLIENT_QUEUE_SLOT_BUFFER_SIZE, Decoder_Buffers[i], SHARDED_CLIENT_DECODER_BUFFER_SIZE);
+	MQTTShardedClientInitialize(&Sharded_Client, Shards, Shards_Count);
+	Sharded_Client.Close_Handler = ShardedClientCloseHandler;
+	atomic_init(&Sharded_Client_Closed_Shards_Count, 0);
+	
+	// Connect all shards
+	Address.sin_family = AF_INET;
+	Address.sin_addr.s_addr = inet_addr(argv[1]);
+	Address.sin_port = htons(atoi(argv[2]));
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "MQTT library sharded client";
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	if (MQTTShardedClientConnect(&Sharded_Client, (struct sockaddr *) &Address, sizeof(Address), &MQTT_Connection_Parameters) != 0)
+	{
+		printf("Error : failed to connect to MQTT server (%s).\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+	
+	// Start all producers
+	Start_Time = ShardedClientGetTime();
+	for (i = 0; i < Producers_Count; i++)
+	{
+		if (pthread_create(&Threads[i], NULL, ShardedClientProducerThread, (void *) (long) i) != 0)
+		{
+			printf("Error : failed to create producer thread %d.\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+	for (i = 0; i < Producers_Count; i++) pthread_join(Threads[i], NULL);
+	
+	// Wait for all messages to be acknowledged
+	do
+	{
+		Acknowledged_Messages_Count = 0;
+		for (i = 0; i < Shards_Count; i++)
+		{
+			MQTTShardedClientGetStatistics(&Sharded_Client, i, &Statistics);
+			Acknowledged_Messages_Count += Statistics.Acknowledged_Messages_Count;
+		}
+		if (Acknowledged_Messages_Count >= (unsigned long long) Producers_Count * Sharded_Client_Messages_Count) break;
+		usleep(1000);
+	} while ((atomic_load(&Sharded_Client_Closed_Shards_Count) == 0) && (ShardedClientGetTime() - Start_Time < SHARDED_CLIENT_ACKNOWLEDGE_TIMEOUT));
+	Duration = ShardedClientGetTime() - Start_Time;
+	
+	// Display each shard share of the work
+	printf("Shard | Sent packets | Sent bytes | Acknowledged | Rejected | System calls\n");
+	for (i = 0; i < Shards_Count; i++)
+	{
+		MQTTShardedClientGetStatistics(&Sharded_Client, i, &Statistics);
+		printf("%5d | %12llu | %10llu | %12llu | %8llu | %12llu\n", i, Statistics.Sent_Packets_Count, Statistics.Sent_Bytes_Count, Statistics.Acknowledged_Messages_Count, Statistics.Rejected_Messages_Count, Statistics.System_Calls_Count);
+		Total_Sent_Packets_Count += Statistics.Sent_Packets_Count;
+		Total_System_Calls_Count += Statistics.System_Calls_Count;
+	}
+	printf("%llu messages have been acknowledged in %.3f seconds (%.0f messages per second, %llu packets sent with %llu system calls).\n", Acknowledged_Messages_Count, Duration, Acknowledged_Messages_Count / Duration, Total_Sent_Packets_Count, Total_System_Calls_Count);
+	
+	// Send the remaining packets and close the connections
+	MQTTShardedClientDisconnect(&Sharded_Client);
+	if (Acknowledged_Messages_Count < (unsigned long long) Producers_Count * Sharded_Client_Messages_Count)
+	{
+		printf("Error : not all messages have been acknowledged.\n");
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
@@ -5,8 +5,10 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <MQTT.h>
+#include <MQTT_Topic_Tree.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,19 +16,44 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Display a received message.
+ * @param Pointer_Packet The received PUBLISH packet.
+ * @param Pointer_User_Data The topic filter the message matched.
+ */
+static void SubscribeDisplayMessage(TMQTTPacket *Pointer_Packet, void *Pointer_User_Data)
+{
+	printf("Received PUBLISH packet matching filter '%s', topic : '%.*s', application message : '%.*s'.\n", (char *) Pointer_User_Data, Pointer_Packet->Topic_Name_Size, Pointer_Packet->Pointer_Topic_Name, Pointer_Packet->Payload_Size, Pointer_Packet->Pointer_Payload);
+}
+
 //-------------------------------------------------------------------------------------------------
 // Entry point
 //-------------------------------------------------------------------------------------------------
 int main(int argc, char *argv[])
 {
-	static unsigned char Buffer[1024]; // Avoid storing a big buffer on the stack
+	static unsigned char Buffer[1024], Received_Data_Buffer[1024], Decoder_Buffer[4096], Topic_Tree_Buffer[1024]; // Avoid storing big buffers on the stack
 	char *Pointer_String_Server_IP_Address;
 	unsigned short Server_Port;
-	int Socket, Result;
+	int Socket, Result, Is_Session_Present;
 	TMQTTContext MQTT_Context;
 	TMQTTConnectionParameters MQTT_Connection_Parameters;
 	struct sockaddr_in Address;
 	ssize_t Read_Bytes_Count;
+	TMQTTDecoder MQTT_Decoder;
+	TMQTTPacket MQTT_Packet;
+	TMQTTTopicTree MQTT_Topic_Tree;
+	TMQTTSubscription Subscriptions[] =
+	{
+		{ "le topic est lui aussi assez long pour que le message publish dépasse 127 caractères et qu'il faille calculer la taille sur deux octets", 0, 0 },
+		{ "test1", 1, 0 },
+		{ "topic/+", 2, 0 }
+	};
+	int i, Subscriptions_Count;
+	unsigned short Subscribe_Packet_Identifier;
+	struct pollfd Poll_Descriptors[2];
+	unsigned char *Pointer_Received_Data;
 	
 	// Check parameters
 	if (argc != 3)
@@ -62,9 +89,16 @@ int main(int argc, char *argv[])
 	MQTT_Connection_Parameters.Pointer_String_Client_Identifier = "ID du client SUBSCRIBE";
 	MQTT_Connection_Parameters.Pointer_String_User_Name = "Ceci est un message bien plus long pour voir si le calcul d'une taille de paquet supérieure à 127 octets fonctionne correctement pour SUBSCRIBE";
 	MQTT_Connection_Parameters.Pointer_String_Password = "Ce champ aussi est allongé dans le but décrit exhaustivement dans le champ précédent";
-	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 0; // Keep the subscriptions on the server, so they are still active after a reconnection
 	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_String_Will_Topic = "subscribe/status";
+	MQTT_Connection_Parameters.Pointer_Will_Message = "connection lost";
+	MQTT_Connection_Parameters.Will_Message_Size = sizeof("connection lost") - 1;
+	MQTT_Connection_Parameters.Will_Flags = MQTT_PUBLISH_FLAG_QOS_1 | MQTT_PUBLISH_FLAG_RETAIN;
+	MQTT_Connection_Parameters.Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+	MQTT_Connection_Parameters.Session_Expiry_Interval = 0;
 	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
 	MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters);
 	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
 	{
@@ -75,23 +109,102 @@ int main(int argc, char *argv[])
 	// Specifications allow to send control packets without waiting for CONNACK, but if the client is too fast the server can't keep up, so wait for the CONNACK
 	printf("Waiting for CONNACK packet...\n");
 	Read_Bytes_Count = read(Socket, Buffer, sizeof(Buffer));
-	Result = MQTTIsConnectionEstablished(Buffer, Read_Bytes_Count);
+	Result = MQTTIsConnectionEstablishedExtended(Buffer, Read_Bytes_Count, &Is_Session_Present);
 	if (Result != 0)
 	{
 		printf("Error : server rejected connection. CONNACK return code : 0x%X\n", Result);
 		return EXIT_FAILURE;
 	}
 	
-	// Subscribe to a topic
-	printf("Sending SUBSCRIBE packet...\n");
-	MQTTSubscribe(&MQTT_Context, "le topic est lui aussi assez long pour que le message publish dépasse 127 caractères et qu'il faille calculer la taille sur deux octets");
-	if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+	// The server still knows all subscriptions when it resumed the previous session
+	if (Is_Session_Present)
 	{
-		printf("Error : failed to send MQTT SUBSCRIBE packet (%s).\n", strerror(errno));
-		return EXIT_FAILURE;
+		printf("Session is present, no need to subscribe again.\n");
+		Subscribe_Packet_Identifier = 0; // No SUBACK is expected
+		Subscriptions_Count = sizeof(Subscriptions) / sizeof(Subscriptions[0]);
+	}
+	else
+	{
+		// Subscribe to all topics
+		printf("Sending SUBSCRIBE packet...\n");
+		Subscribe_Packet_Identifier = MQTTAllocatePacketIdentifier(&MQTT_Context);
+		Subscriptions_Count = MQTTSubscribe(&MQTT_Context, Subscribe_Packet_Identifier, Subscriptions, sizeof(Subscriptions) / sizeof(Subscriptions[0])); // All topic filters fit in the buffer
+		if (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context))
+		{
+			printf("Error : failed to send MQTT SUBSCRIBE packet (%s).\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
 	}
 	
-	getchar();
+	// Route received messages to the matching filter handler
+	MQTTTopicTreeInitialize(&MQTT_Topic_Tree, Topic_Tree_Buffer, sizeof(Topic_Tree_Buffer));
+	for (i = 0; i < Subscriptions_Count; i++) MQTTTopicTreeAddFilter(&MQTT_Topic_Tree, Subscriptions[i].Pointer_String_Topic_Filter, SubscribeDisplayMessage, Subscriptions[i].Pointer_String_Topic_Filter);
+	
+	// Display received packets until the user presses enter
+	printf("Press enter to exit.\n");
+	MQTTDecoderInitialize(&MQTT_Decoder, Decoder_Buffer, sizeof(Decoder_Buffer));
+	Poll_Descriptors[0].fd = STDIN_FILENO;
+	Poll_Descriptors[0].events = POLLIN;
+	Poll_Descriptors[1].fd = Socket;
+	Poll_Descriptors[1].events = POLLIN;
+	while (1)
+	{
+		if (poll(Poll_Descriptors, 2, -1) == -1)
+		{
+			printf("Error : failed to wait for events (%s).\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+		if (Poll_Descriptors[0].revents & POLLIN) break;
+		
+		// Received data can contain any number of packets, even incomplete ones
+		Read_Bytes_Count = read(Socket, Received_Data_Buffer, sizeof(Received_Data_Buffer));
+		if (Read_Bytes_Count <= 0)
+		{
+			printf("Error : connection closed by server.\n");
+			return EXIT_FAILURE;
+		}
+		Pointer_Received_Data = Received_Data_Buffer;
+		while (Read_Bytes_Count > 0)
+		{
+			Result = MQTTDecode(&MQTT_Decoder, Pointer_Received_Data, Read_Bytes_Count, &MQTT_Packet);
+			if (Result < 0)
+			{
+				printf("Error : received a malformed packet.\n");
+				return EXIT_FAILURE;
+			}
+			Pointer_Received_Data += Result;
+			Read_Bytes_Count -= Result;
+			
+			if ((MQTT_Packet.Type == MQTT_PACKET_TYPE_SUBACK) && (MQTT_Packet.Packet_Identifier == Subscribe_Packet_Identifier))
+			{
+				if (MQTTProcessSubscribeAcknowledge(&MQTT_Packet, Subscriptions, Subscriptions_Count) < 0) printf("Error : received a SUBACK packet with a wrong return codes count.\n");
+				else for (i = 0; i < Subscriptions_Count; i++) printf("Received SUBACK packet, topic filter '%s' return code : 0x%X.\n", Subscriptions[i].Pointer_String_Topic_Filter, Subscriptions[i].Return_Code);
+			}
+			else if (MQTT_Packet.Type == MQTT_PACKET_TYPE_PUBLISH)
+			{
+				MQTTTopicTreeDispatch(&MQTT_Topic_Tree, &MQTT_Packet);
+				
+				// Acknowledge QoS 1 and QoS 2 messages, otherwise the server sends them again on each reconnection of this persistent session
+				if (MQTT_Packet.Flags & MQTT_PUBLISH_FLAG_QOS_1) Result = MQTTAcknowledgePublish(&MQTT_Context, MQTT_PACKET_TYPE_PUBACK, MQTT_Packet.Packet_Identifier);
+				else if (MQTT_Packet.Flags & MQTT_PUBLISH_FLAG_QOS_2) Result = MQTTAcknowledgePublish(&MQTT_Context, MQTT_PACKET_TYPE_PUBREC, MQTT_Packet.Packet_Identifier);
+				else continue;
+				if ((Result != 0) || (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)))
+				{
+					printf("Error : failed to acknowledge a PUBLISH packet (%s).\n", strerror(errno));
+					return EXIT_FAILURE;
+				}
+			}
+			// Complete QoS 2 messages delivery
+			else if (MQTT_Packet.Type == MQTT_PACKET_TYPE_PUBREL)
+			{
+				if ((MQTTAcknowledgePublish(&MQTT_Context, MQTT_PACKET_TYPE_PUBCOMP, MQTT_Packet.Packet_Identifier) != 0) || (write(Socket, MQTT_GET_MESSAGE_BUFFER(&MQTT_Context), MQTT_GET_MESSAGE_SIZE(&MQTT_Context)) != MQTT_GET_MESSAGE_SIZE(&MQTT_Context)))
+				{
+					printf("Error : failed to send MQTT PUBCOMP packet (%s).\n", strerror(errno));
+					return EXIT_FAILURE;
+				}
+			}
+		}
+	}
 	
 	// Disconnect from MQTT server
 	MQTTDisconnect(&MQTT_Context);
@@ -5,6 +5,11 @@
 #include <assert.h>
 #include <MQTT.h>
 #include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+	#include <immintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
 
 //-------------------------------------------------------------------------------------------------
 // Private constants and macros
@@ -18,6 +23,46 @@
 /** How big can be the MQTT fixed header when the "remaining length" field uses all its available bytes. */
 #define MQTT_FIXED_HEADER_MAXIMUM_SIZE 5
 
+/** The longest string or binary data, their length field is 16-bit wide (see specification section 1.5.3). */
+#define MQTT_STRING_MAXIMUM_LENGTH 65535
+
+/** Extract the QoS value from PUBLISH flags.
+ * @param Flags The PUBLISH fixed header flags.
+ */
+#define MQTT_GET_PUBLISH_FLAGS_QOS(Flags) (((Flags) >> 1) & 0x03)
+
+/** Biggest packet identifier allocated by an in-flight window. Upper identifiers are left to other packets needing one. */
+#define MQTT_IN_FLIGHT_WINDOW_PACKET_IDENTIFIER_MAXIMUM_VALUE 0x7FFF
+
+/** Tell that an in-flight window list is empty or has no following element. */
+#define MQTT_IN_FLIGHT_WINDOW_NO_SLOT -1
+
+/** MQTT 5 "session expiry interval" property identifier. */
+#define MQTT_PROPERTY_IDENTIFIER_SESSION_EXPIRY_INTERVAL 0x11
+/** MQTT 5 "topic alias maximum" property identifier. */
+#define MQTT_PROPERTY_IDENTIFIER_TOPIC_ALIAS_MAXIMUM 0x22
+/** MQTT 5 "topic alias" property identifier. */
+#define MQTT_PROPERTY_IDENTIFIER_TOPIC_ALIAS 0x23
+
+/** Tell whether a context forges MQTT 5 packets.
+ * @param Pointer_Context The context.
+ */
+#define MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context) ((Pointer_Context)->Protocol_Version == MQTT_PROTOCOL_VERSION_5)
+
+// Statistics hooks vanish when statistics are disabled
+#ifdef MQTT_ENABLE_STATISTICS
+	#define MQTT_STATISTICS_COUNT_ENCODED_PACKET(Pointer_Context, Remaining_Length_Size) MQTTStatisticsCountEncodedPacket(Pointer_Context, Remaining_Length_Size)
+	#define MQTT_STATISTICS_COUNT_DECODED_PACKET(Pointer_Decoder, Pointer_Packet, Buffer_Used_Size) MQTTStatisticsCountDecodedPacket(Pointer_Decoder, Pointer_Packet, Buffer_Used_Size)
+	#define MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder) do { if ((Pointer_Decoder)->Pointer_Statistics_Slot != NULL) MQTT_STATISTICS_ADD(&(Pointer_Decoder)->Pointer_Statistics_Slot->Decoding_Errors_Count, 1); } while (0)
+	
+	/** Increase a slot counter. A slot is written by a single thread, so a relaxed load followed by a relaxed store is enough to never expose a torn value to MQTTStatisticsSnapshot(), without the cost of an atomic read-modify-write instruction. */
+	#define MQTT_STATISTICS_ADD(Pointer_Counter, Value) atomic_store_explicit(Pointer_Counter, atomic_load_explicit(Pointer_Counter, memory_order_relaxed) + (Value), memory_order_relaxed)
+#else
+	#define MQTT_STATISTICS_COUNT_ENCODED_PACKET(Pointer_Context, Remaining_Length_Size)
+	#define MQTT_STATISTICS_COUNT_DECODED_PACKET(Pointer_Decoder, Pointer_Packet, Buffer_Used_Size)
+	#define MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder)
+#endif
+
 //-------------------------------------------------------------------------------------------------
 // Private types
 //-------------------------------------------------------------------------------------------------
@@ -27,10 +72,33 @@ typedef enum
 	MQTT_CONTROL_PACKET_TYPE_CONNECT = 1 << 4,
 	MQTT_CONTROL_PACKET_TYPE_CONNACK = 2 << 4,
 	MQTT_CONTROL_PACKET_TYPE_PUBLISH = 3 << 4,
+	MQTT_CONTROL_PACKET_TYPE_PUBACK = 4 << 4,
+	MQTT_CONTROL_PACKET_TYPE_PUBREC = 5 << 4,
+	MQTT_CONTROL_PACKET_TYPE_PUBREL = (6 << 4) | 0x02, // Bit 1 must always be set, see specification chapter 3.6.1 for details.
+	MQTT_CONTROL_PACKET_TYPE_PUBCOMP = 7 << 4,
 	MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE = (8 << 4) | 0x02, // Bit 1 must always be set, see specification chapter 3.8.1 for details.
+	MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE = (10 << 4) | 0x02, // Bit 1 must always be set, see specification chapter 3.10.1 for details.
+	MQTT_CONTROL_PACKET_TYPE_PINGREQ = 12 << 4,
 	MQTT_CONTROL_PACKET_TYPE_DISCONNECT = 14 << 4
 } TMQTTControlPacketType;
 
+/** All states an in-flight message can be in. */
+typedef enum
+{
+	MQTT_IN_FLIGHT_MESSAGE_STATE_FREE,
+	MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBACK,
+	MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBREC,
+	MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBCOMP
+} TMQTTInFlightMessageState;
+
+/** All decoder states. */
+typedef enum
+{
+	MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE,
+	MQTT_DECODER_STATE_REMAINING_LENGTH,
+	MQTT_DECODER_STATE_VARIABLE_HEADER_AND_PAYLOAD
+} TMQTTDecoderState;
+
 /** CONNECT message variable headers. */
 typedef struct __attribute__((packed))
 {
@@ -44,42 +112,256 @@ typedef struct __attribute__((packed))
 //-------------------------------------------------------------------------------------------------
 // Private functions
 //-------------------------------------------------------------------------------------------------
-/** Append string data to the provided payload buffer.
+/** Append binary data preceded by its length to the provided payload buffer.
  * @param Pointer_Pointer_Payload_Buffer A pointer on the payload's pointer. Payload's pointer is updated with the appended data size when function exits.
- * @param Pointer_String The string data to append.
+ * @param Pointer_Data The data to append.
+ * @param Length The data size in bytes.
  * @return How many bytes of payload have been added.
  */
-static int MQTTAppendString(unsigned char **Pointer_Pointer_Payload_Buffer, char *Pointer_String)
+static int MQTTAppendData(unsigned char **Pointer_Pointer_Payload_Buffer, void *Pointer_Data, unsigned short Length)
 {
 	unsigned char *Pointer_Payload;
-	unsigned short Length, *Pointer_Word;
+	unsigned short *Pointer_Word;
 	
 	Pointer_Payload = *Pointer_Pointer_Payload_Buffer;
 	
 	// Set length field
-	Length = (unsigned short) strlen(Pointer_String);
 	Pointer_Word = (unsigned short *) Pointer_Payload;
 	*Pointer_Word = MQTT_CONVERT_WORD_TO_BIG_ENDIAN(Length);
 	Pointer_Payload += 2;
 	
 	// Set data field
-	memcpy(Pointer_Payload, Pointer_String, Length);
+	memcpy(Pointer_Payload, Pointer_Data, Length);
 	Pointer_Payload += Length;
 	
 	*Pointer_Pointer_Payload_Buffer = Pointer_Payload;
 	return Length + 2; // +2 for the length field
 }
 
+/** Append string data to the provided payload buffer.
+ * @param Pointer_Pointer_Payload_Buffer A pointer on the payload's pointer. Payload's pointer is updated with the appended data size when function exits.
+ * @param Pointer_String The string data to append.
+ * @return How many bytes of payload have been added.
+ */
+static inline int MQTTAppendString(unsigned char **Pointer_Pointer_Payload_Buffer, char *Pointer_String)
+{
+	return MQTTAppendData(Pointer_Pointer_Payload_Buffer, Pointer_String, (unsigned short) strlen(Pointer_String));
+}
+
+/** Find how many leading bytes of a string are ASCII characters that need no further check, testing a whole block of bytes at once.
+ * @param Pointer_String The string.
+ * @param Size The string size in bytes.
+ * @param Is_Wildcard_Forbidden Set to 1 to stop at '+' and '#' characters too.
+ * @return How many bytes can be skipped. The following block contains a NUL, a non-ASCII or a wildcard character, or the string is shorter than a block.
+ * @note With vector instructions, the last block overlaps the previous one when the size is not a multiple of the block size, so the string end is not checked byte per byte. The few remaining bytes are checked one by one otherwise.
+ */
+static inline int MQTTSkipPlainCharacters(unsigned char *Pointer_String, int Size, int Is_Wildcard_Forbidden)
+{
+	int Offset = 0;
+	
+	#if defined(__AVX2__)
+		int Block_Offset;
+		__m256i Vector, Special, Zero = _mm256_setzero_si256(), Plus = _mm256_set1_epi8('+'), Hash = _mm256_set1_epi8('#');
+		
+		while ((Offset < Size) && (Size >= 32))
+		{
+			Block_Offset = (Offset + 32 <= Size) ? Offset : Size - 32;
+			
+			// Non-ASCII bytes have their most significant bit set, and so do the NUL bytes comparison results
+			Vector = _mm256_loadu_si256((__m256i *) (Pointer_String + Block_Offset));
+			Special = _mm256_or_si256(Vector, _mm256_cmpeq_epi8(Vector, Zero));
+			if (Is_Wildcard_Forbidden) Special = _mm256_or_si256(Special, _mm256_or_si256(_mm256_cmpeq_epi8(Vector, Plus), _mm256_cmpeq_epi8(Vector, Hash)));
+			if (_mm256_movemask_epi8(Special) != 0) break;
+			Offset = Block_Offset + 32;
+		}
+	#elif defined(__SSE2__)
+		int Block_Offset;
+		__m128i Vector, Special, Zero = _mm_setzero_si128(), Plus = _mm_set1_epi8('+'), Hash = _mm_set1_epi8('#');
+		
+		while ((Offset < Size) && (Size >= 16))
+		{
+			Block_Offset = (Offset + 16 <= Size) ? Offset : Size - 16;
+			
+			// Non-ASCII bytes have their most significant bit set, and so do the NUL bytes comparison results
+			Vector = _mm_loadu_si128((__m128i *) (Pointer_String + Block_Offset));
+			Special = _mm_or_si128(Vector, _mm_cmpeq_epi8(Vector, Zero));
+			if (Is_Wildcard_Forbidden) Special = _mm_or_si128(Special, _mm_or_si128(_mm_cmpeq_epi8(Vector, Plus), _mm_cmpeq_epi8(Vector, Hash)));
+			if (_mm_movemask_epi8(Special) != 0) break;
+			Offset = Block_Offset + 16;
+		}
+	#elif defined(__ARM_NEON)
+		int Block_Offset;
+		uint8x16_t Vector, Special;
+		uint8x8_t Folded_Special;
+		
+		while ((Offset < Size) && (Size >= 16))
+		{
+			Block_Offset = (Offset + 16 <= Size) ? Offset : Size - 16;
+			Vector = vld1q_u8(Pointer_String + Block_Offset);
+			Special = vorrq_u8(vcgeq_u8(Vector, vdupq_n_u8(0x80)), vceqq_u8(Vector, vdupq_n_u8(0)));
+			if (Is_Wildcard_Forbidden) Special = vorrq_u8(Special, vorrq_u8(vceqq_u8(Vector, vdupq_n_u8('+')), vceqq_u8(Vector, vdupq_n_u8('#'))));
+			
+			// Fold the comparison results to a 64-bit value, because horizontal operations are not available on 32-bit cores
+			Folded_Special = vorr_u8(vget_low_u8(Special), vget_high_u8(Special));
+			if (vget_lane_u64(vreinterpret_u64_u8(Folded_Special), 0) != 0) break;
+			Offset = Block_Offset + 16;
+		}
+	#else
+		unsigned long Word, Special, Plus_Word, Hash_Word, Ones = (unsigned long) -1 / 0xFF, High_Bits = Ones * 0x80;
+		
+		// Test a machine word at once, (Word - Ones) & ~Word sets the most significant bit of the lowest zero byte (upper bytes are tested anyway when there is no zero byte)
+		while (Offset + (int) sizeof(Word) <= Size)
+		{
+			memcpy(&Word, Pointer_String + Offset, sizeof(Word)); // The string may not be aligned
+			Special = Word | ((Word - Ones) & ~Word);
+			if (Is_Wildcard_Forbidden)
+			{
+				Plus_Word = Word ^ (Ones * '+');
+				Hash_Word = Word ^ (Ones * '#');
+				Special |= ((Plus_Word - Ones) & ~Plus_Word) | ((Hash_Word - Ones) & ~Hash_Word);
+			}
+			if ((Special & High_Bits) != 0) break;
+			Offset += sizeof(Word);
+		}
+	#endif
+	
+	return Offset;
+}
+
+/** Check that a string is well-formed UTF-8 without U+0000 characters nor surrogate code points (see specification section 1.5.3).
+ * @param Pointer_String The string, it does not need to be terminated.
+ * @param Size The string size in bytes.
+ * @param Is_Wildcard_Forbidden Set to 1 to reject '+' and '#' characters too.
+ * @return -1 if the string is not valid,
+ * @return 0 if the string is valid.
+ */
+static int MQTTCheckCharacters(unsigned char *Pointer_String, int Size, int Is_Wildcard_Forbidden)
+{
+	unsigned char Byte, Minimum, Maximum;
+	int Offset = 0, Length, i;
+	
+	if ((Size < 0) || (Size > MQTT_STRING_MAXIMUM_LENGTH)) return -1;
+	
+	while (1)
+	{
+		// Most strings are plain ASCII, so only the blocks containing other characters are decoded
+		Offset += MQTTSkipPlainCharacters(Pointer_String + Offset, Size - Offset, Is_Wildcard_Forbidden);
+		if (Offset >= Size) return 0;
+		
+		// Check the remaining ASCII characters one by one, until the next multibyte sequence
+		while (1)
+		{
+			Byte = Pointer_String[Offset];
+			if (Byte >= 0x80) break;
+			if ((Byte == 0) || (Is_Wildcard_Forbidden && ((Byte == '+') || (Byte == '#')))) return -1;
+			Offset++;
+			if (Offset >= Size) return 0;
+		}
+		
+		// Find the sequence length and the allowed range of its second byte, which rejects overlong encodings, surrogates and code points above U+10FFFF (see RFC 3629 section 4)
+		if (Byte < 0xC2) return -1; // Continuation byte without leading byte, or overlong 2-byte sequence
+		else if (Byte < 0xE0)
+		{
+			Length = 2;
+			Minimum = 0x80;
+			Maximum = 0xBF;
+		}
+		else if (Byte < 0xF0)
+		{
+			Length = 3;
+			Minimum = (Byte == 0xE0) ? 0xA0 : 0x80;
+			Maximum = (Byte == 0xED) ? 0x9F : 0xBF;
+		}
+		else if (Byte < 0xF5)
+		{
+			Length = 4;
+			Minimum = (Byte == 0xF0) ? 0x90 : 0x80;
+			Maximum = (Byte == 0xF4) ? 0x8F : 0xBF;
+		}
+		else return -1;
+		
+		if (Offset + Length > Size) return -1;
+		if ((Pointer_String[Offset + 1] < Minimum) || (Pointer_String[Offset + 1] > Maximum)) return -1;
+		for (i = 2; i < Length; i++)
+		{
+			if ((Pointer_String[Offset + i] & 0xC0) != 0x80) return -1;
+		}
+		Offset += Length;
+	}
+}
+
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Update the counters of a traffic direction with a packet.
+	 * @param Pointer_Direction The counters to update.
+	 * @param Packet_Type The packet type.
+	 * @param Packet_Size The whole packet size in bytes.
+	 * @param Remaining_Length_Size How many bytes the "remaining length" field is made of.
+	 * @param Topic_Name_Length The PUBLISH packet topic name length, it is ignored for other packets.
+	 * @param Buffer_Used_Size How many bytes of the context or decoder buffer the packet needed.
+	 */
+	static void MQTTStatisticsCountPacket(TMQTTStatisticsSlotDirection *Pointer_Direction, int Packet_Type, int Packet_Size, int Remaining_Length_Size, int Topic_Name_Length, int Buffer_Used_Size)
+	{
+		int Bucket_Index;
+		
+		MQTT_STATISTICS_ADD(&Pointer_Direction->Packets_Counts[Packet_Type], 1);
+		MQTT_STATISTICS_ADD(&Pointer_Direction->Bytes_Count, (unsigned long long) Packet_Size);
+		MQTT_STATISTICS_ADD(&Pointer_Direction->Remaining_Length_Sizes_Counts[Remaining_Length_Size - 1], 1);
+		if (Buffer_Used_Size > atomic_load_explicit(&Pointer_Direction->Buffer_High_Water_Mark, memory_order_relaxed)) atomic_store_explicit(&Pointer_Direction->Buffer_High_Water_Mark, Buffer_Used_Size, memory_order_relaxed);
+		
+		// The bucket index is the topic name length bits count
+		if (Packet_Type == MQTT_PACKET_TYPE_PUBLISH)
+		{
+			for (Bucket_Index = 0; (Topic_Name_Length > 0) && (Bucket_Index < MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT - 1); Bucket_Index++) Topic_Name_Length >>= 1;
+			MQTT_STATISTICS_ADD(&Pointer_Direction->Topic_Name_Lengths_Counts[Bucket_Index], 1);
+		}
+	}
+	
+	/** Count the packet that has just been forged by a context.
+	 * @param Pointer_Context The context.
+	 * @param Remaining_Length_Size How many bytes the packet "remaining length" field is made of.
+	 */
+	static void MQTTStatisticsCountEncodedPacket(TMQTTContext *Pointer_Context, int Remaining_Length_Size)
+	{
+		unsigned char *Pointer_Packet = Pointer_Context->Pointer_Message_Buffer;
+		int Topic_Name_Length = 0;
+		
+		if (Pointer_Context->Pointer_Statistics_Slot == NULL) return;
+		
+		// PUBLISH topic name length field is located right after the fixed header
+		if ((Pointer_Packet[0] >> 4) == MQTT_PACKET_TYPE_PUBLISH) Topic_Name_Length = (Pointer_Packet[1 + Remaining_Length_Size] << 8) | Pointer_Packet[2 + Remaining_Length_Size];
+		
+		MQTTStatisticsCountPacket(&Pointer_Context->Pointer_Statistics_Slot->Encoded, Pointer_Packet[0] >> 4, Pointer_Context->Message_Size, Remaining_Length_Size, Topic_Name_Length, (int) (Pointer_Packet - Pointer_Context->Pointer_Buffer) + Pointer_Context->Message_Size);
+	}
+	
+	/** Count the packet that has just been extracted by a decoder.
+	 * @param Pointer_Decoder The decoder.
+	 * @param Pointer_Packet The decoded packet.
+	 * @param Buffer_Used_Size How many bytes of the reassembly buffer the packet needed (0 if it was decoded in place).
+	 */
+	static void MQTTStatisticsCountDecodedPacket(TMQTTDecoder *Pointer_Decoder, TMQTTPacket *Pointer_Packet, int Buffer_Used_Size)
+	{
+		int Remaining_Length_Size;
+		
+		if (Pointer_Decoder->Pointer_Statistics_Slot == NULL) return;
+		
+		Remaining_Length_Size = Pointer_Decoder->Remaining_Length_Shift / 7; // The shift is increased by 7 for each received byte
+		MQTTStatisticsCountPacket(&Pointer_Decoder->Pointer_Statistics_Slot->Decoded, Pointer_Packet->Type, 1 + Remaining_Length_Size + Pointer_Decoder->Remaining_Length, Remaining_Length_Size, Pointer_Packet->Topic_Name_Size, Buffer_Used_Size);
+	}
+#endif
+
 /** Compute the fixed header fields and set Pointer_Context->Pointer_Message_Buffer to the beginning of the message.
  * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
- * @param Control_Packet_Type The packet type.
+ * @param Control_Packet_Type_And_Flags The packet type (as a TMQTTControlPacketType value) and the packet specific flags.
  * @param Variable_Header_And_Payload_Size Message payload plus specific message variable header length.
  */
-static void MQTTAddFixedHeader(TMQTTContext *Pointer_Context, TMQTTControlPacketType Control_Packet_Type, int Variable_Header_And_Payload_Size)
+static void MQTTAddFixedHeader(TMQTTContext *Pointer_Context, unsigned char Control_Packet_Type_And_Flags, int Variable_Header_And_Payload_Size)
 {
 	unsigned char *Pointer_Fixed_Header;
 	int Fixed_Header_Size;
 	
+	// Do some safety checks on parameters
+	assert(Variable_Header_And_Payload_Size <= MQTT_REMAINING_LENGTH_MAXIMUM_VALUE);
+	
 	// Compute remaining length (see specification section 2.2.3 to get information about remaining length computation)
 	if (Variable_Header_And_Payload_Size <= 127)
 	{
@@ -104,24 +386,574 @@ static void MQTTAddFixedHeader(TMQTTContext *Pointer_Context, TMQTTControlPacket
 		Pointer_Fixed_Header[1] = (Variable_Header_And_Payload_Size % 128) | 0x80; // Set bit 7 to tell there is a following "remaining length" byte
 		Pointer_Fixed_Header[2] = (Variable_Header_And_Payload_Size >> 7) % 128; // Fast division by 128
 	}
-	else assert(0); // TODO implement bigger sizes
+	else if (Variable_Header_And_Payload_Size <= 2097151)
+	{
+		// Fixed header is 4-byte long
+		Fixed_Header_Size = 4;
+		
+		// Remaining length field fits on three bytes
+		Pointer_Fixed_Header = Pointer_Context->Pointer_Buffer + MQTT_FIXED_HEADER_MAXIMUM_SIZE - Fixed_Header_Size;
+		
+		// Set remaining length field
+		Pointer_Fixed_Header[1] = (Variable_Header_And_Payload_Size % 128) | 0x80;
+		Pointer_Fixed_Header[2] = ((Variable_Header_And_Payload_Size >> 7) % 128) | 0x80;
+		Pointer_Fixed_Header[3] = (Variable_Header_And_Payload_Size >> 14) % 128;
+	}
+	else
+	{
+		// Fixed header uses all available bytes
+		Fixed_Header_Size = MQTT_FIXED_HEADER_MAXIMUM_SIZE;
+		
+		// Remaining length field needs four bytes
+		Pointer_Fixed_Header = Pointer_Context->Pointer_Buffer;
+		
+		// Set remaining length field
+		Pointer_Fixed_Header[1] = (Variable_Header_And_Payload_Size % 128) | 0x80;
+		Pointer_Fixed_Header[2] = ((Variable_Header_And_Payload_Size >> 7) % 128) | 0x80;
+		Pointer_Fixed_Header[3] = ((Variable_Header_And_Payload_Size >> 14) % 128) | 0x80;
+		Pointer_Fixed_Header[4] = (Variable_Header_And_Payload_Size >> 21) % 128;
+	}
 	
-	// Set control packet type and flags // TODO add flags support
-	Pointer_Fixed_Header[0] = (unsigned char) Control_Packet_Type;
+	// Set control packet type and flags
+	Pointer_Fixed_Header[0] = Control_Packet_Type_And_Flags;
 	
 	// Set final message starting offset and total size
 	Pointer_Context->Pointer_Message_Buffer = Pointer_Fixed_Header;
 	Pointer_Context->Message_Size = Fixed_Header_Size + Variable_Header_And_Payload_Size;
+	MQTT_STATISTICS_COUNT_ENCODED_PACKET(Pointer_Context, Fixed_Header_Size - 1);
+}
+
+/** Compute the buffer size needed to forge a PUBLISH packet from its topic name length.
+ * @param Topic_Name_Length The topic name length in bytes.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return The needed buffer size in bytes.
+ */
+static inline int MQTTComputePublishBufferSizeFromLength(int Topic_Name_Length, int Flags, int Application_Message_Size)
+{
+	int Size;
+	
+	// Room for the biggest fixed header, the topic name and its length field
+	Size = MQTT_FIXED_HEADER_MAXIMUM_SIZE + 2 + Topic_Name_Length;
+	
+	// Packet identifier is present only when QoS is greater than 0
+	if (MQTT_GET_PUBLISH_FLAGS_QOS(Flags) > 0) Size += 2;
+	
+	if (Application_Message_Size > 0) Size += Application_Message_Size;
+	return Size;
+}
+
+/** Compute the buffer size needed to forge a PUBLISH packet with a specific context.
+ * @param Pointer_Context The context the packet will be forged with.
+ * @param Topic_Name_Length The topic name length in bytes.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return The needed buffer size in bytes.
+ */
+static inline int MQTTComputeContextPublishBufferSize(TMQTTContext *Pointer_Context, int Topic_Name_Length, int Flags, int Application_Message_Size)
+{
+	int Size;
+	
+	Size = MQTTComputePublishBufferSizeFromLength(Topic_Name_Length, Flags, Application_Message_Size);
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context)) Size += MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE;
+	return Size;
+}
+
+/** Make sure a PUBLISH packet can be forged with a specific context.
+ * @param Pointer_Context The context the packet will be forged with.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Topic_Name_Length The topic name length in bytes, computed once by the caller so the string is not scanned again.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return -1 if the topic name is not valid or if the packet does not fit in the context buffer,
+ * @return 0 if the packet can be forged.
+ */
+static inline int MQTTCheckPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, int Topic_Name_Length, int Flags, int Application_Message_Size)
+{
+	// A server closes the connection when it receives a malformed topic name, so never send one
+	if (MQTTCheckTopicName(Pointer_String_Topic_Name, Topic_Name_Length) != 0) return -1;
+	if (MQTTComputeContextPublishBufferSize(Pointer_Context, Topic_Name_Length, Flags, Application_Message_Size) > Pointer_Context->Buffer_Size) return -1;
+	return 0;
+}
+
+/** Find the topic alias mapped to a topic name, map a new alias if the topic name is not known.
+ * @param Pointer_Table The topic aliases.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Pointer_Is_Topic_Name_Needed On output, tell whether the topic name must be sent along with the alias (this is the case when the alias is mapped to a new topic name).
+ * @return 0 if no alias can be used for this topic name,
+ * @return The topic alias.
+ */
+static int MQTTTopicAliasTableMap(TMQTTTopicAliasTable *Pointer_Table, char *Pointer_String_Topic_Name, int *Pointer_Is_Topic_Name_Needed)
+{
+	unsigned int Hash = 2166136261U;
+	int Length, i;
+	
+	*Pointer_Is_Topic_Name_Needed = 1;
+	
+	// Compute topic name FNV-1a hash and length at the same time
+	for (Length = 0; Pointer_String_Topic_Name[Length] != 0; Length++)
+	{
+		Hash ^= (unsigned char) Pointer_String_Topic_Name[Length];
+		Hash *= 16777619U;
+	}
+	if ((Length > MQTT_TOPIC_ALIAS_MAXIMUM_TOPIC_NAME_LENGTH) || (Pointer_Table->Aliases_Count == 0)) return 0;
+	
+	// Is the topic name mapped yet ?
+	for (i = 0; i < Pointer_Table->Used_Aliases_Count; i++)
+	{
+		if ((Pointer_Table->Topic_Name_Hashes[i] == Hash) && (strcmp(Pointer_Table->Strings_Topic_Names[i], Pointer_String_Topic_Name) == 0))
+		{
+			*Pointer_Is_Topic_Name_Needed = 0;
+			return i + 1;
+		}
+	}
+	
+	// Use a free alias, or replace the oldest mapped one
+	if (Pointer_Table->Used_Aliases_Count < Pointer_Table->Aliases_Count)
+	{
+		i = Pointer_Table->Used_Aliases_Count;
+		Pointer_Table->Used_Aliases_Count++;
+	}
+	else
+	{
+		i = Pointer_Table->Next_Replaced_Alias_Index;
+		Pointer_Table->Next_Replaced_Alias_Index = (i + 1) % Pointer_Table->Aliases_Count;
+	}
+	memcpy(Pointer_Table->Strings_Topic_Names[i], Pointer_String_Topic_Name, Length + 1);
+	Pointer_Table->Topic_Name_Hashes[i] = Hash;
+	return i + 1;
+}
+
+/** Append the PUBLISH variable header right after the room reserved for the fixed header.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_Pointer_Next_Data On output, contain the address where the application message can be appended.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Topic_Name_Length The topic name length in bytes.
+ * @param Flags The PUBLISH flags, they tell whether a packet identifier is needed.
+ * @param Packet_Identifier The packet identifier, it is ignored if QoS is 0.
+ * @return The variable header size in bytes.
+ * @note On a MQTT 5 connection, the topic name is replaced by a topic alias when the context has a topic aliases table.
+ */
+static int MQTTAppendPublishVariableHeader(TMQTTContext *Pointer_Context, unsigned char **Pointer_Pointer_Next_Data, char *Pointer_String_Topic_Name, int Topic_Name_Length, int Flags, unsigned short Packet_Identifier)
+{
+	unsigned char *Pointer_Variable_Header;
+	int Size, Topic_Alias = 0, Is_Topic_Name_Needed = 1;
+	
+	// Cache message relevant parts access
+	Pointer_Variable_Header = (unsigned char *) (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer); // Keep enough room at the buffer beginning to store the biggest possible fixed header
+	
+	// Add topic name (this field is mandatory, but it can be empty when a known topic alias is used)
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context) && (Pointer_Context->Pointer_Topic_Alias_Table != NULL)) Topic_Alias = MQTTTopicAliasTableMap(Pointer_Context->Pointer_Topic_Alias_Table, Pointer_String_Topic_Name, &Is_Topic_Name_Needed);
+	if (Is_Topic_Name_Needed) Size = MQTTAppendData(&Pointer_Variable_Header, Pointer_String_Topic_Name, (unsigned short) Topic_Name_Length);
+	else
+	{
+		Pointer_Variable_Header[0] = 0;
+		Pointer_Variable_Header[1] = 0;
+		Pointer_Variable_Header += 2;
+		Size = 2;
+	}
+	
+	// Add packet identifier if QoS > 0
+	if (MQTT_GET_PUBLISH_FLAGS_QOS(Flags) > 0)
+	{
+		Pointer_Variable_Header[0] = (unsigned char) (Packet_Identifier >> 8);
+		Pointer_Variable_Header[1] = (unsigned char) Packet_Identifier;
+		Pointer_Variable_Header += 2;
+		Size += 2;
+	}
+	
+	// Add MQTT 5 properties, only the topic alias can be sent
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context))
+	{
+		if (Topic_Alias == 0)
+		{
+			Pointer_Variable_Header[0] = 0; // No property
+			Pointer_Variable_Header++;
+			Size++;
+		}
+		else
+		{
+			Pointer_Variable_Header[0] = 3; // Properties length
+			Pointer_Variable_Header[1] = MQTT_PROPERTY_IDENTIFIER_TOPIC_ALIAS;
+			Pointer_Variable_Header[2] = (unsigned char) (Topic_Alias >> 8);
+			Pointer_Variable_Header[3] = (unsigned char) Topic_Alias;
+			Pointer_Variable_Header += 4;
+			Size += 4;
+		}
+	}
+	
+	*Pointer_Pointer_Next_Data = Pointer_Variable_Header;
+	return Size;
+}
+
+/** Remove a message from the in-flight window sending order list.
+ * @param Pointer_Window The window.
+ * @param Slot_Index The message slot.
+ */
+static void MQTTInFlightWindowUnlinkMessage(TMQTTInFlightWindow *Pointer_Window, int Slot_Index)
+{
+	TMQTTInFlightMessage *Pointer_Message = &Pointer_Window->Messages[Slot_Index];
+	
+	if (Pointer_Message->Previous_Slot_Index == MQTT_IN_FLIGHT_WINDOW_NO_SLOT) Pointer_Window->Oldest_Slot_Index = Pointer_Message->Next_Slot_Index;
+	else Pointer_Window->Messages[Pointer_Message->Previous_Slot_Index].Next_Slot_Index = Pointer_Message->Next_Slot_Index;
+	
+	if (Pointer_Message->Next_Slot_Index == MQTT_IN_FLIGHT_WINDOW_NO_SLOT) Pointer_Window->Newest_Slot_Index = Pointer_Message->Previous_Slot_Index;
+	else Pointer_Window->Messages[Pointer_Message->Next_Slot_Index].Previous_Slot_Index = Pointer_Message->Previous_Slot_Index;
+}
+
+/** Append a message to the end of the in-flight window sending order list.
+ * @param Pointer_Window The window.
+ * @param Slot_Index The message slot.
+ * @param Current_Time The message sending time.
+ */
+static void MQTTInFlightWindowLinkMessage(TMQTTInFlightWindow *Pointer_Window, int Slot_Index, unsigned int Current_Time)
+{
+	TMQTTInFlightMessage *Pointer_Message = &Pointer_Window->Messages[Slot_Index];
+	
+	Pointer_Message->Sending_Time = Current_Time;
+	Pointer_Message->Previous_Slot_Index = Pointer_Window->Newest_Slot_Index;
+	Pointer_Message->Next_Slot_Index = MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	
+	if (Pointer_Window->Newest_Slot_Index == MQTT_IN_FLIGHT_WINDOW_NO_SLOT) Pointer_Window->Oldest_Slot_Index = Slot_Index;
+	else Pointer_Window->Messages[Pointer_Window->Newest_Slot_Index].Next_Slot_Index = Slot_Index;
+	Pointer_Window->Newest_Slot_Index = Slot_Index;
+}
+
+/** Retrieve the in-flight message matching a packet identifier.
+ * @param Pointer_Window The window.
+ * @param Packet_Identifier The packet identifier received from the server.
+ * @param State The state the message must be in.
+ * @return MQTT_IN_FLIGHT_WINDOW_NO_SLOT if no message is matching,
+ * @return The message slot index.
+ */
+static int MQTTInFlightWindowFindMessage(TMQTTInFlightWindow *Pointer_Window, unsigned short Packet_Identifier, TMQTTInFlightMessageState State)
+{
+	int Slot_Index;
+	
+	// Packet identifiers are built from the slot index, so there is no need to search for the message
+	if ((Packet_Identifier == 0) || (Packet_Identifier > MQTT_IN_FLIGHT_WINDOW_PACKET_IDENTIFIER_MAXIMUM_VALUE)) return MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	Slot_Index = (Packet_Identifier - 1) % MQTT_IN_FLIGHT_WINDOW_SIZE;
+	
+	// Discard acknowledges of messages that were released yet
+	if ((Pointer_Window->Messages[Slot_Index].Packet_Identifier != Packet_Identifier) || (Pointer_Window->Messages[Slot_Index].State != State)) return MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	return Slot_Index;
+}
+
+/** Read a 16-bit big endian value.
+ * @param Pointer_Buffer The value first byte.
+ * @return The value.
+ */
+static inline unsigned short MQTTReadWord(unsigned char *Pointer_Buffer)
+{
+	return (unsigned short) ((Pointer_Buffer[0] << 8) | Pointer_Buffer[1]);
+}
+
+/** Read a variable byte integer (see MQTT 5 specification section 1.5.5).
+ * @param Pointer_Pointer_Data A pointer on the data pointer, it is updated to point after the integer.
+ * @param Pointer_Size The available data size in bytes, it is updated with the integer size.
+ * @param Pointer_Value On output, contain the integer value.
+ * @return -1 if the integer is malformed or truncated,
+ * @return 0 on success.
+ */
+static int MQTTReadVariableByteInteger(unsigned char **Pointer_Pointer_Data, int *Pointer_Size, int *Pointer_Value)
+{
+	unsigned char *Pointer_Data = *Pointer_Pointer_Data, Byte;
+	int Value = 0, Shift = 0, Size = *Pointer_Size;
+	
+	do
+	{
+		// An integer can't be longer than 4 bytes
+		if ((Size <= 0) || (Shift >= 28)) return -1;
+		Byte = *Pointer_Data;
+		Pointer_Data++;
+		Size--;
+		Value |= (Byte & 0x7F) << Shift;
+		Shift += 7;
+	} while (Byte & 0x80);
+	
+	*Pointer_Pointer_Data = Pointer_Data;
+	*Pointer_Size = Size;
+	*Pointer_Value = Value;
+	return 0;
+}
+
+/** Read MQTT 5 properties, keep the useful ones and skip the others.
+ * @param Pointer_Pointer_Data A pointer on the data pointer, it is updated to point after the properties.
+ * @param Pointer_Size The available data size in bytes, it is updated with the properties size.
+ * @param Pointer_Packet On output, contain the retrieved properties values.
+ * @return -1 if the properties are malformed,
+ * @return 0 on success.
+ */
+static int MQTTReadProperties(unsigned char **Pointer_Pointer_Data, int *Pointer_Size, TMQTTPacket *Pointer_Packet)
+{
+	unsigned char *Pointer_Properties, Identifier;
+	int Properties_Size, Property_Size, Value;
+	
+	// Properties are preceded by their total size
+	if (MQTTReadVariableByteInteger(Pointer_Pointer_Data, Pointer_Size, &Properties_Size) != 0) return -1;
+	if (Properties_Size > *Pointer_Size) return -1;
+	Pointer_Properties = *Pointer_Pointer_Data;
+	*Pointer_Pointer_Data += Properties_Size;
+	*Pointer_Size -= Properties_Size;
+	
+	while (Properties_Size > 0)
+	{
+		// All identifiers defined by the specification fit in a single byte
+		Identifier = *Pointer_Properties;
+		Pointer_Properties++;
+		Properties_Size--;
+		
+		// Find the property value size from its type (see MQTT 5 specification section 2.2.2.2)
+		switch (Identifier)
+		{
+			case MQTT_PROPERTY_IDENTIFIER_TOPIC_ALIAS_MAXIMUM:
+				if (Properties_Size < 2) return -1;
+				Pointer_Packet->Topic_Alias_Maximum = MQTTReadWord(Pointer_Properties);
+				Property_Size = 2;
+				break;
+				
+			// Byte properties : payload format indicator, request problem information, request response information, maximum QoS, retain available, wildcard subscription available, subscription identifier available, shared subscription available
+			case 0x01:
+			case 0x17:
+			case 0x19:
+			case 0x24:
+			case 0x25:
+			case 0x28:
+			case 0x29:
+			case 0x2A:
+				Property_Size = 1;
+				break;
+				
+			// Two byte integer properties : server keep alive, receive maximum, topic alias
+			case 0x13:
+			case 0x21:
+			case MQTT_PROPERTY_IDENTIFIER_TOPIC_ALIAS:
+				Property_Size = 2;
+				break;
+				
+			// Four byte integer properties : message expiry interval, session expiry interval, will delay interval, maximum packet size
+			case 0x02:
+			case MQTT_PROPERTY_IDENTIFIER_SESSION_EXPIRY_INTERVAL:
+			case 0x18:
+			case 0x27:
+				Property_Size = 4;
+				break;
+				
+			// Variable byte integer property : subscription identifier
+			case 0x0B:
+				if (MQTTReadVariableByteInteger(&Pointer_Properties, &Properties_Size, &Value) != 0) return -1;
+				Property_Size = 0;
+				break;
+				
+			// Binary data properties : correlation data, authentication data
+			case 0x09:
+			case 0x16:
+				if (Properties_Size < 2) return -1;
+				Property_Size = 2 + MQTTReadWord(Pointer_Properties);
+				break;
+				
+			// UTF-8 string properties : content type, response topic, assigned client identifier, authentication method, response information, server reference, reason string
+			case 0x03:
+			case 0x08:
+			case 0x12:
+			case 0x15:
+			case 0x1A:
+			case 0x1C:
+			case 0x1F:
+				if (Properties_Size < 2) return -1;
+				Property_Size = 2 + MQTTReadWord(Pointer_Properties);
+				if ((Property_Size > Properties_Size) || (MQTTCheckString(Pointer_Properties + 2, Property_Size - 2) != 0)) return -1;
+				break;
+				
+			// UTF-8 string pair property : user property
+			case 0x26:
+				if (Properties_Size < 2) return -1;
+				Property_Size = 2 + MQTTReadWord(Pointer_Properties);
+				if ((Properties_Size < Property_Size + 2) || (MQTTCheckString(Pointer_Properties + 2, Property_Size - 2) != 0)) return -1;
+				Value = MQTTReadWord(Pointer_Properties + Property_Size);
+				if ((Properties_Size < Property_Size + 2 + Value) || (MQTTCheckString(Pointer_Properties + Property_Size + 2, Value) != 0)) return -1;
+				Property_Size += 2 + Value;
+				break;
+				
+			default:
+				return -1;
+		}
+		
+		if (Property_Size > Properties_Size) return -1;
+		Pointer_Properties += Property_Size;
+		Properties_Size -= Property_Size;
+	}
+	return 0;
+}
+
+/** Extract a packet fields from its variable header and payload.
+ * @param Fixed_Header_First_Byte The packet type and flags.
+ * @param Pointer_Data The variable header and payload.
+ * @param Size The variable header and payload size in bytes.
+ * @param Protocol_Version The protocol version the packet is encoded with.
+ * @param Pointer_Packet On output, contain the decoded packet.
+ * @return 0 if the packet is valid,
+ * @return -1 if the packet is malformed or can't be sent by a server.
+ */
+static int MQTTDecodePacket(unsigned char Fixed_Header_First_Byte, unsigned char *Pointer_Data, int Size, int Protocol_Version, TMQTTPacket *Pointer_Packet)
+{
+	int QoS;
+	
+	memset(Pointer_Packet, 0, sizeof(TMQTTPacket));
+	Pointer_Packet->Flags = Fixed_Header_First_Byte & 0x0F;
+	
+	switch (Fixed_Header_First_Byte >> 4)
+	{
+		case MQTT_PACKET_TYPE_CONNACK:
+			if (Protocol_Version == MQTT_PROTOCOL_VERSION_5)
+			{
+				// Properties follow the connect acknowledge flags and the reason code
+				if (Size < 2) return -1;
+			}
+			else if (Size != 2) return -1;
+			Pointer_Packet->Is_Session_Present = Pointer_Data[0] & 0x01;
+			Pointer_Packet->Return_Code = Pointer_Data[1];
+			Pointer_Data += 2;
+			Size -= 2;
+			
+			// Some servers omit the properties when the connection is refused
+			if ((Size > 0) && ((MQTTReadProperties(&Pointer_Data, &Size, Pointer_Packet) != 0) || (Size != 0))) return -1;
+			break;
+			
+		case MQTT_PACKET_TYPE_PUBLISH:
+			// Topic name length must be present
+			if (Size < 2) return -1;
+			Pointer_Packet->Topic_Name_Size = MQTTReadWord(Pointer_Data);
+			Pointer_Data += 2;
+			Size -= 2;
+			
+			// Topic name, it can be empty only when a MQTT 5 topic alias is used
+			if (Pointer_Packet->Topic_Name_Size > Size) return -1;
+			if (((Pointer_Packet->Topic_Name_Size > 0) || (Protocol_Version != MQTT_PROTOCOL_VERSION_5)) && (MQTTCheckTopicName(Pointer_Data, Pointer_Packet->Topic_Name_Size) != 0)) return -1;
+			Pointer_Packet->Pointer_Topic_Name = Pointer_Data;
+			Pointer_Data += Pointer_Packet->Topic_Name_Size;
+			Size -= Pointer_Packet->Topic_Name_Size;
+			
+			// Packet identifier is present only when QoS is 1 or 2
+			QoS = (Pointer_Packet->Flags >> 1) & 0x03;
+			if (QoS == 3) return -1; // This value is forbidden by specifications
+			if (QoS > 0)
+			{
+				if (Size < 2) return -1;
+				Pointer_Packet->Packet_Identifier = MQTTReadWord(Pointer_Data);
+				Pointer_Data += 2;
+				Size -= 2;
+			}
+			
+			// MQTT 5 properties are located before the application message
+			if ((Protocol_Version == MQTT_PROTOCOL_VERSION_5) && (MQTTReadProperties(&Pointer_Data, &Size, Pointer_Packet) != 0)) return -1;
+			
+			// All remaining data is the application message
+			Pointer_Packet->Pointer_Payload = Pointer_Data;
+			Pointer_Packet->Payload_Size = Size;
+			break;
+			
+		case MQTT_PACKET_TYPE_PUBACK:
+		case MQTT_PACKET_TYPE_PUBREC:
+		case MQTT_PACKET_TYPE_PUBREL:
+		case MQTT_PACKET_TYPE_PUBCOMP:
+			if (Protocol_Version == MQTT_PROTOCOL_VERSION_5)
+			{
+				// The reason code and the properties can be omitted (see MQTT 5 specification section 3.4.2.1)
+				if (Size < 2) return -1;
+				Pointer_Packet->Packet_Identifier = MQTTReadWord(Pointer_Data);
+				if (Size == 2) break;
+				Pointer_Packet->Return_Code = Pointer_Data[2];
+				Pointer_Data += 3;
+				Size -= 3;
+				if ((Size > 0) && ((MQTTReadProperties(&Pointer_Data, &Size, Pointer_Packet) != 0) || (Size != 0))) return -1;
+				break;
+			}
+			if (Size != 2) return -1;
+			Pointer_Packet->Packet_Identifier = MQTTReadWord(Pointer_Data);
+			break;
+			
+		case MQTT_PACKET_TYPE_SUBACK:
+		case MQTT_PACKET_TYPE_UNSUBACK:
+			// MQTT 3.1.1 UNSUBACK has no payload
+			if ((Protocol_Version != MQTT_PROTOCOL_VERSION_5) && ((Fixed_Header_First_Byte >> 4) == MQTT_PACKET_TYPE_UNSUBACK))
+			{
+				if (Size != 2) return -1;
+				Pointer_Packet->Packet_Identifier = MQTTReadWord(Pointer_Data);
+				break;
+			}
+			
+			if (Size < 2) return -1;
+			Pointer_Packet->Packet_Identifier = MQTTReadWord(Pointer_Data);
+			Pointer_Data += 2;
+			Size -= 2;
+			if ((Protocol_Version == MQTT_PROTOCOL_VERSION_5) && (MQTTReadProperties(&Pointer_Data, &Size, Pointer_Packet) != 0)) return -1;
+			
+			// There must be at least one return code
+			if (Size < 1) return -1;
+			Pointer_Packet->Pointer_Payload = Pointer_Data;
+			Pointer_Packet->Payload_Size = Size;
+			break;
+			
+		case MQTT_PACKET_TYPE_PINGRESP:
+			if (Size != 0) return -1;
+			break;
+			
+		// MQTT 5 servers tell why they close the connection
+		case MQTT_PACKET_TYPE_DISCONNECT:
+			if (Protocol_Version != MQTT_PROTOCOL_VERSION_5) return -1;
+			if (Size == 0) break; // The reason code can be omitted when it is 0
+			Pointer_Packet->Return_Code = Pointer_Data[0];
+			Pointer_Data++;
+			Size--;
+			if ((Size > 0) && ((MQTTReadProperties(&Pointer_Data, &Size, Pointer_Packet) != 0) || (Size != 0))) return -1;
+			break;
+			
+		// Other packets are sent by clients only
+		default:
+			return -1;
+	}
+	
+	Pointer_Packet->Type = Fixed_Header_First_Byte >> 4;
+	return 0;
 }
 
 //-------------------------------------------------------------------------------------------------
 // Public functions
 //-------------------------------------------------------------------------------------------------
-void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Pointer_Connection_Parameters)
+int MQTTComputeConnectBufferSize(TMQTTConnectionParameters *Pointer_Connection_Parameters)
+{
+	int Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Connection_Parameters != NULL);
+	assert(Pointer_Connection_Parameters->Pointer_String_Client_Identifier != NULL);
+	
+	// Room for the biggest fixed header, the variable header and the client identifier
+	Size = MQTT_FIXED_HEADER_MAXIMUM_SIZE + sizeof(TMQTTHeaderConnect) + 2 + (int) strlen(Pointer_Connection_Parameters->Pointer_String_Client_Identifier);
+	
+	// Add optional strings
+	if (Pointer_Connection_Parameters->Pointer_String_User_Name != NULL) Size += 2 + (int) strlen(Pointer_Connection_Parameters->Pointer_String_User_Name);
+	if (Pointer_Connection_Parameters->Pointer_String_Password != NULL) Size += 2 + (int) strlen(Pointer_Connection_Parameters->Pointer_String_Password);
+	if (Pointer_Connection_Parameters->Pointer_String_Will_Topic != NULL) Size += 2 + (int) strlen(Pointer_Connection_Parameters->Pointer_String_Will_Topic) + 2 + Pointer_Connection_Parameters->Will_Message_Size;
+	
+	// Add MQTT 5 properties length fields and session expiry interval
+	if (Pointer_Connection_Parameters->Protocol_Version == MQTT_PROTOCOL_VERSION_5)
+	{
+		Size++;
+		if (Pointer_Connection_Parameters->Session_Expiry_Interval != 0) Size += 5;
+		if (Pointer_Connection_Parameters->Pointer_String_Will_Topic != NULL) Size++;
+	}
+	
+	return Size;
+}
+
+int MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Pointer_Connection_Parameters)
 {
 	TMQTTHeaderConnect *Pointer_Variable_Header;
 	unsigned char *Pointer_Payload;
-	int Payload_Size;
+	int Payload_Size = 0;
+	unsigned int Session_Expiry_Interval;
 	
 	// Do some safety checks on parameters
 	assert(Pointer_Context != NULL);
@@ -129,8 +961,22 @@ void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Point
 	assert(Pointer_Connection_Parameters->Pointer_String_Client_Identifier != NULL);
 	assert(Pointer_Connection_Parameters->Pointer_Buffer != NULL);
 	
+	// Make sure all strings are valid, a server closes the connection as soon as it receives a malformed one
+	if (MQTTCheckString(Pointer_Connection_Parameters->Pointer_String_Client_Identifier, (int) strlen(Pointer_Connection_Parameters->Pointer_String_Client_Identifier)) != 0) return -1;
+	if ((Pointer_Connection_Parameters->Pointer_String_User_Name != NULL) && (MQTTCheckString(Pointer_Connection_Parameters->Pointer_String_User_Name, (int) strlen(Pointer_Connection_Parameters->Pointer_String_User_Name)) != 0)) return -1;
+	if ((Pointer_Connection_Parameters->Pointer_String_Password != NULL) && (strlen(Pointer_Connection_Parameters->Pointer_String_Password) > MQTT_STRING_MAXIMUM_LENGTH)) return -1; // The password is binary data, only its length is checked
+	if (Pointer_Connection_Parameters->Pointer_String_Will_Topic != NULL)
+	{
+		if (MQTTCheckTopicName(Pointer_Connection_Parameters->Pointer_String_Will_Topic, (int) strlen(Pointer_Connection_Parameters->Pointer_String_Will_Topic)) != 0) return -1;
+		if ((Pointer_Connection_Parameters->Will_Message_Size < 0) || (Pointer_Connection_Parameters->Will_Message_Size > MQTT_STRING_MAXIMUM_LENGTH)) return -1;
+	}
+	
+	// Make sure the whole packet fits in the buffer
+	if (MQTTComputeConnectBufferSize(Pointer_Connection_Parameters) > Pointer_Connection_Parameters->Buffer_Size) return -1;
+	
 	// Initialize context
-	Pointer_Context->Pointer_Buffer = Pointer_Connection_Parameters->Pointer_Buffer;
+	MQTTInitializeContext(Pointer_Context, Pointer_Connection_Parameters->Pointer_Buffer, Pointer_Connection_Parameters->Buffer_Size);
+	if (Pointer_Connection_Parameters->Protocol_Version == MQTT_PROTOCOL_VERSION_5) Pointer_Context->Protocol_Version = MQTT_PROTOCOL_VERSION_5;
 	
 	// Cache message relevant parts access
 	Pointer_Variable_Header = (TMQTTHeaderConnect *) (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer); // Keep enough room at the buffer beginning to store the biggest possible fixed header
@@ -142,12 +988,51 @@ void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Point
 	Pointer_Variable_Header->Protocol_Name_Characters[1] = 'Q';
 	Pointer_Variable_Header->Protocol_Name_Characters[2] = 'T';
 	Pointer_Variable_Header->Protocol_Name_Characters[3] = 'T';
-	Pointer_Variable_Header->Protocol_Level = 4;
+	Pointer_Variable_Header->Protocol_Level = Pointer_Context->Protocol_Version;
 	Pointer_Variable_Header->Connect_Flags = 0; // Reset flags
 	Pointer_Variable_Header->Keep_Alive = MQTT_CONVERT_WORD_TO_BIG_ENDIAN(Pointer_Connection_Parameters->Keep_Alive);
 	
+	// MQTT 5 variable header ends with properties, the session expiry interval is sent only if it is not the default value
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context))
+	{
+		Session_Expiry_Interval = Pointer_Connection_Parameters->Session_Expiry_Interval;
+		if (Session_Expiry_Interval == 0)
+		{
+			Pointer_Payload[0] = 0; // No property
+			Payload_Size = 1;
+		}
+		else
+		{
+			Pointer_Payload[0] = 5; // Properties length
+			Pointer_Payload[1] = MQTT_PROPERTY_IDENTIFIER_SESSION_EXPIRY_INTERVAL;
+			Pointer_Payload[2] = (unsigned char) (Session_Expiry_Interval >> 24);
+			Pointer_Payload[3] = (unsigned char) (Session_Expiry_Interval >> 16);
+			Pointer_Payload[4] = (unsigned char) (Session_Expiry_Interval >> 8);
+			Pointer_Payload[5] = (unsigned char) Session_Expiry_Interval;
+			Payload_Size = 6;
+		}
+		Pointer_Payload += Payload_Size;
+	}
+	
 	// Add client identifier (this field is mandatory)
-	Payload_Size = MQTTAppendString(&Pointer_Payload, Pointer_Connection_Parameters->Pointer_String_Client_Identifier);
+	Payload_Size += MQTTAppendString(&Pointer_Payload, Pointer_Connection_Parameters->Pointer_String_Client_Identifier);
+	
+	// Is a will message provided ?
+	if (Pointer_Connection_Parameters->Pointer_String_Will_Topic != NULL)
+	{
+		// MQTT 5 will properties are located before the will topic, none is sent
+		if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context))
+		{
+			*Pointer_Payload = 0;
+			Pointer_Payload++;
+			Payload_Size++;
+		}
+		Payload_Size += MQTTAppendString(&Pointer_Payload, Pointer_Connection_Parameters->Pointer_String_Will_Topic);
+		Payload_Size += MQTTAppendData(&Pointer_Payload, Pointer_Connection_Parameters->Pointer_Will_Message, (unsigned short) Pointer_Connection_Parameters->Will_Message_Size);
+		// Set will flag, will QoS (bits 3-4) and will retain flag (bit 5)
+		Pointer_Variable_Header->Connect_Flags |= 0x04 | ((Pointer_Connection_Parameters->Will_Flags & (MQTT_PUBLISH_FLAG_QOS_1 | MQTT_PUBLISH_FLAG_QOS_2)) << 2);
+		if (Pointer_Connection_Parameters->Will_Flags & MQTT_PUBLISH_FLAG_RETAIN) Pointer_Variable_Header->Connect_Flags |= 0x20;
+	}
 	
 	// Is a user name provided ?
 	if (Pointer_Connection_Parameters->Pointer_String_User_Name != NULL)
@@ -170,14 +1055,65 @@ void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Point
 	
 	// Terminate message
 	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_CONNECT, sizeof(TMQTTHeaderConnect) + Payload_Size);
+	return 0;
+}
+
+void MQTTInitializeContext(TMQTTContext *Pointer_Context, void *Pointer_Buffer, int Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Buffer != NULL);
+	
+	Pointer_Context->Pointer_Buffer = Pointer_Buffer;
+	Pointer_Context->Buffer_Size = Buffer_Size;
+	Pointer_Context->Next_Packet_Identifier = MQTT_IN_FLIGHT_WINDOW_PACKET_IDENTIFIER_MAXIMUM_VALUE + 1;
+	Pointer_Context->Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+	Pointer_Context->Pointer_Topic_Alias_Table = NULL;
+	#ifdef MQTT_ENABLE_STATISTICS
+		Pointer_Context->Pointer_Statistics_Slot = NULL;
+	#endif
+}
+
+void MQTTEnableTopicAliases(TMQTTContext *Pointer_Context, TMQTTTopicAliasTable *Pointer_Table, int Topic_Alias_Maximum)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context));
+	assert(Topic_Alias_Maximum >= 0);
+	
+	// Aliases are bound to a network connection, so start from an empty table
+	Pointer_Context->Pointer_Topic_Alias_Table = Pointer_Table;
+	if (Pointer_Table == NULL) return;
+	if (Topic_Alias_Maximum > MQTT_TOPIC_ALIAS_TABLE_SIZE) Topic_Alias_Maximum = MQTT_TOPIC_ALIAS_TABLE_SIZE;
+	Pointer_Table->Aliases_Count = Topic_Alias_Maximum;
+	Pointer_Table->Used_Aliases_Count = 0;
+	Pointer_Table->Next_Replaced_Alias_Index = 0;
+}
+
+void MQTTSetBuffer(TMQTTContext *Pointer_Context, void *Pointer_Buffer, int Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Buffer != NULL);
+	
+	Pointer_Context->Pointer_Buffer = Pointer_Buffer;
+	Pointer_Context->Buffer_Size = Buffer_Size;
 }
 
 int MQTTIsConnectionEstablished(void *Pointer_Message_Buffer, int Message_Size)
+{
+	int Is_Session_Present;
+	
+	return MQTTIsConnectionEstablishedExtended(Pointer_Message_Buffer, Message_Size, &Is_Session_Present);
+}
+
+int MQTTIsConnectionEstablishedExtended(void *Pointer_Message_Buffer, int Message_Size, int *Pointer_Is_Session_Present)
 {
 	unsigned char *Pointer_Buffer;
 	
 	// Do some safety checks on parameters
 	assert(Pointer_Message_Buffer != NULL);
+	assert(Pointer_Is_Session_Present != NULL);
 	
 	// Make sure message is well-formed
 	if (Message_Size < MQTT_CONNACK_MESSAGE_SIZE) return -1;
@@ -186,26 +1122,86 @@ int MQTTIsConnectionEstablished(void *Pointer_Message_Buffer, int Message_Size)
 	Pointer_Buffer = Pointer_Message_Buffer;
 	if (Pointer_Buffer[0] != (unsigned char) MQTT_CONTROL_PACKET_TYPE_CONNACK) return -1;
 	
+	// Session present flag is bit 0 of the connect acknowledge flags, it must be cleared when the connection is refused (see specification section 3.2.2.2)
+	if (Pointer_Buffer[3] == 0) *Pointer_Is_Session_Present = Pointer_Buffer[2] & 0x01;
+	else *Pointer_Is_Session_Present = 0;
+	
 	// Retrieve response code
 	return Pointer_Buffer[3];
 }
 
-void MQTTPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size)
+int MQTTCheckString(void *Pointer_String, int Size)
+{
+	// Do some safety checks on parameters
+	assert((Pointer_String != NULL) || (Size == 0));
+	
+	return MQTTCheckCharacters(Pointer_String, Size, 0);
+}
+
+int MQTTCheckTopicName(void *Pointer_Topic_Name, int Size)
+{
+	// Do some safety checks on parameters
+	assert((Pointer_Topic_Name != NULL) || (Size == 0));
+	
+	// A topic name contains at least one character and no wildcard (see specification section 4.7.3)
+	if (Size == 0) return -1;
+	return MQTTCheckCharacters(Pointer_Topic_Name, Size, 1);
+}
+
+int MQTTCheckTopicFilter(void *Pointer_Topic_Filter, int Size)
+{
+	unsigned char *Pointer_Filter = Pointer_Topic_Filter;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert((Pointer_Topic_Filter != NULL) || (Size == 0));
+	
+	if ((Size == 0) || (MQTTCheckCharacters(Pointer_Filter, Size, 0) != 0)) return -1;
+	
+	// Wildcards must fill a whole topic level, and the multi-level wildcard must be the last level (see specification section 4.7.1)
+	for (i = 0; i < Size; i++)
+	{
+		if ((Pointer_Filter[i] != '+') && (Pointer_Filter[i] != '#')) continue;
+		if ((i > 0) && (Pointer_Filter[i - 1] != '/')) return -1;
+		if (Pointer_Filter[i] == '#')
+		{
+			if (i != Size - 1) return -1;
+		}
+		else if ((i < Size - 1) && (Pointer_Filter[i + 1] != '/')) return -1;
+	}
+	return 0;
+}
+
+int MQTTComputePublishBufferSize(char *Pointer_String_Topic_Name, int Flags, int Application_Message_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_String_Topic_Name != NULL);
+	
+	return MQTTComputePublishBufferSizeFromLength((int) strlen(Pointer_String_Topic_Name), Flags, Application_Message_Size);
+}
+
+int MQTTPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size)
+{
+	return MQTTPublishExtended(Pointer_Context, Pointer_String_Topic_Name, 0, 0, Pointer_Application_Message, Application_Message_Size);
+}
+
+int MQTTPublishExtended(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, int Flags, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size)
 {
 	unsigned char *Pointer_Variable_Header;
-	int Data_Size;
+	int Data_Size, Topic_Name_Length;
 	
 	// Do some safety checks on parameters
 	assert(Pointer_Context != NULL);
 	assert(Pointer_String_Topic_Name != NULL);
+	assert((Flags & ~0x0F) == 0);
+	assert(MQTT_GET_PUBLISH_FLAGS_QOS(Flags) <= 2);
 	
-	// Cache message relevant parts access
-	Pointer_Variable_Header = (unsigned char *) (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer); // Keep enough room at the buffer beginning to store the biggest possible fixed header
-	
-	// Add topic name (this field is mandatory)
-	Data_Size = MQTTAppendString(&Pointer_Variable_Header, Pointer_String_Topic_Name);
+	// Make sure the topic name is valid and the whole packet fits in the buffer (the topic name length is computed once for the check, the size computation and the copy)
+	Topic_Name_Length = (int) strlen(Pointer_String_Topic_Name);
+	if (MQTTCheckPublish(Pointer_Context, Pointer_String_Topic_Name, Topic_Name_Length, Flags, Application_Message_Size) != 0) return -1;
 	
-	// TODO add packet identifier if QoS > 0
+	// Add topic name (this field is mandatory) and packet identifier (if needed)
+	Data_Size = MQTTAppendPublishVariableHeader(Pointer_Context, &Pointer_Variable_Header, Pointer_String_Topic_Name, Topic_Name_Length, Flags, Packet_Identifier);
 	
 	// Add application message (if any)
 	if (Application_Message_Size > 0)
@@ -215,42 +1211,308 @@ void MQTTPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name,
 	}
 	
 	// Terminate message
-	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_PUBLISH, Data_Size);
+	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_PUBLISH | Flags, Data_Size);
+	return 0;
 }
 
-void MQTTSubscribe(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name)
+int MQTTPreparePublish(TMQTTPreparedPublish *Pointer_Prepared_Publish, void *Pointer_Buffer, int Buffer_Size, char *Pointer_String_Topic_Name, int Flags, int Protocol_Version)
+{
+	unsigned char *Pointer_Application_Message;
+	int Topic_Name_Length;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Prepared_Publish != NULL);
+	assert(Pointer_Buffer != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	assert((Flags & ~0x0F) == 0);
+	assert(MQTT_GET_PUBLISH_FLAGS_QOS(Flags) <= 2);
+	
+	// Topic aliases can't be used, because the topic name is sent with each message
+	Pointer_Prepared_Publish->Context.Pointer_Buffer = Pointer_Buffer;
+	Pointer_Prepared_Publish->Context.Buffer_Size = Buffer_Size;
+	if (Protocol_Version == MQTT_PROTOCOL_VERSION_5) Pointer_Prepared_Publish->Context.Protocol_Version = MQTT_PROTOCOL_VERSION_5;
+	else Pointer_Prepared_Publish->Context.Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+	Pointer_Prepared_Publish->Context.Pointer_Topic_Alias_Table = NULL;
+	#ifdef MQTT_ENABLE_STATISTICS
+		Pointer_Prepared_Publish->Context.Pointer_Statistics_Slot = NULL;
+	#endif
+	
+	// Make sure the topic name is valid and fits in the buffer
+	Topic_Name_Length = (int) strlen(Pointer_String_Topic_Name);
+	if (MQTTCheckPublish(&Pointer_Prepared_Publish->Context, Pointer_String_Topic_Name, Topic_Name_Length, Flags, 0) != 0) return -1;
+	
+	// Encode topic name once for all, a room is left for the packet identifier if needed
+	Pointer_Prepared_Publish->Flags = Flags;
+	Pointer_Prepared_Publish->Variable_Header_Size = MQTTAppendPublishVariableHeader(&Pointer_Prepared_Publish->Context, &Pointer_Application_Message, Pointer_String_Topic_Name, Topic_Name_Length, Flags, 0);
+	return 0;
+}
+
+int MQTTPublishPrepared(TMQTTPreparedPublish *Pointer_Prepared_Publish, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size)
+{
+	unsigned char *Pointer_Data, *Pointer_Packet_Identifier;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Prepared_Publish != NULL);
+	
+	// Make sure the application message fits after the prepared headers
+	if (Application_Message_Size < 0) Application_Message_Size = 0;
+	if (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Prepared_Publish->Variable_Header_Size + Application_Message_Size > Pointer_Prepared_Publish->Context.Buffer_Size) return -1;
+	
+	// Patch packet identifier, it is located at the end of the variable header (right before the empty MQTT 5 properties)
+	Pointer_Data = Pointer_Prepared_Publish->Context.Pointer_Buffer + MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Prepared_Publish->Variable_Header_Size;
+	if (MQTT_GET_PUBLISH_FLAGS_QOS(Pointer_Prepared_Publish->Flags) > 0)
+	{
+		Pointer_Packet_Identifier = Pointer_Data - 2;
+		if (MQTT_IS_PROTOCOL_VERSION_5(&Pointer_Prepared_Publish->Context)) Pointer_Packet_Identifier--;
+		Pointer_Packet_Identifier[0] = (unsigned char) (Packet_Identifier >> 8);
+		Pointer_Packet_Identifier[1] = (unsigned char) Packet_Identifier;
+	}
+	
+	// Add application message (if any)
+	if (Application_Message_Size > 0) memcpy(Pointer_Data, Pointer_Application_Message, Application_Message_Size);
+	
+	// Terminate message
+	MQTTAddFixedHeader(&Pointer_Prepared_Publish->Context, MQTT_CONTROL_PACKET_TYPE_PUBLISH | Pointer_Prepared_Publish->Flags, Pointer_Prepared_Publish->Variable_Header_Size + Application_Message_Size);
+	return 0;
+}
+
+int MQTTPublishStreamBegin(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, int Application_Message_Size)
 {
 	unsigned char *Pointer_Variable_Header;
-	int Data_Size;
+	int Variable_Header_Size, Topic_Name_Length;
 	
 	// Do some safety checks on parameters
 	assert(Pointer_Context != NULL);
 	assert(Pointer_String_Topic_Name != NULL);
+	assert(Application_Message_Size >= 0);
+	
+	// Only the headers need to fit in the buffer
+	Topic_Name_Length = (int) strlen(Pointer_String_Topic_Name);
+	if (MQTTCheckPublish(Pointer_Context, Pointer_String_Topic_Name, Topic_Name_Length, 0, 0) != 0) return -1;
+	
+	// The remaining length field can't encode a bigger packet, check it before a topic alias is mapped (using a topic alias can only make the variable header smaller)
+	Variable_Header_Size = MQTTComputeContextPublishBufferSize(Pointer_Context, Topic_Name_Length, 0, 0) - MQTT_FIXED_HEADER_MAXIMUM_SIZE;
+	if (Application_Message_Size > MQTT_REMAINING_LENGTH_MAXIMUM_VALUE - Variable_Header_Size) return -1;
+	
+	// Forge the variable header only, application message will be sent by the user
+	Variable_Header_Size = MQTTAppendPublishVariableHeader(Pointer_Context, &Pointer_Variable_Header, Pointer_String_Topic_Name, Topic_Name_Length, 0, 0);
+	
+	// Remaining length must account for the application message even if it is not stored in the context buffer
+	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_PUBLISH, Variable_Header_Size + Application_Message_Size);
+	
+	// Context message is made of the headers only
+	Pointer_Context->Message_Size -= Application_Message_Size;
+	return 0;
+}
+
+int MQTTPublishSegmented(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size, TMQTTBufferSegment *Pointer_Segments)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Segments != NULL);
+	
+	// Forge the headers only, application message is left where it is
+	if (Application_Message_Size < 0) Application_Message_Size = 0;
+	if (MQTTPublishStreamBegin(Pointer_Context, Pointer_String_Topic_Name, Application_Message_Size) != 0) return -1;
+	
+	Pointer_Segments[0].Pointer_Buffer = Pointer_Context->Pointer_Message_Buffer;
+	Pointer_Segments[0].Size = Pointer_Context->Message_Size;
+	if (Application_Message_Size == 0) return 1;
+	
+	// Application message is directly referenced from user memory
+	Pointer_Segments[1].Pointer_Buffer = Pointer_Application_Message;
+	Pointer_Segments[1].Size = Application_Message_Size;
+	return 2;
+}
+
+unsigned short MQTTAllocatePacketIdentifier(TMQTTContext *Pointer_Context)
+{
+	unsigned short Packet_Identifier;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	
+	// Cycle through the identifiers that are not used by in-flight windows
+	Packet_Identifier = Pointer_Context->Next_Packet_Identifier;
+	if (Packet_Identifier == 0xFFFF) Pointer_Context->Next_Packet_Identifier = MQTT_IN_FLIGHT_WINDOW_PACKET_IDENTIFIER_MAXIMUM_VALUE + 1;
+	else Pointer_Context->Next_Packet_Identifier++;
+	return Packet_Identifier;
+}
+
+int MQTTSubscribe(TMQTTContext *Pointer_Context, unsigned short Packet_Identifier, TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count)
+{
+	unsigned char *Pointer_Variable_Header;
+	int Data_Size, Available_Size, Topic_Filter_Length, i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Packet_Identifier != 0);
+	assert(Pointer_Subscriptions != NULL);
+	assert(Subscriptions_Count > 0);
 	
 	// Cache message relevant parts access
 	Pointer_Variable_Header = (unsigned char *) (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer); // Keep enough room at the buffer beginning to store the biggest possible fixed header
+	Available_Size = Pointer_Context->Buffer_Size - MQTT_FIXED_HEADER_MAXIMUM_SIZE;
+	if (Available_Size < 3) return -1;
 	
-	// Add packet identifier (a zero value means that no QoS is used) TODO get it from function parameters when needed
-	Pointer_Variable_Header[0] = 0;
-	Pointer_Variable_Header[1] = 0;
+	// Add packet identifier
+	Pointer_Variable_Header[0] = (unsigned char) (Packet_Identifier >> 8);
+	Pointer_Variable_Header[1] = (unsigned char) Packet_Identifier;
 	Pointer_Variable_Header += 2;
 	Data_Size = 2;
 	
-	// Add topic
-	Data_Size += MQTTAppendString(&Pointer_Variable_Header, Pointer_String_Topic_Name);
+	// MQTT 5 variable header ends with properties, none is sent
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context))
+	{
+		*Pointer_Variable_Header = 0;
+		Pointer_Variable_Header++;
+		Data_Size++;
+	}
 	
-	// Add requested QoS for this topic TODO get QoS from function parameter
-	*Pointer_Variable_Header = 0; // No QoS for now
-	Data_Size++;
+	// Add as many topic filters as possible
+	for (i = 0; i < Subscriptions_Count; i++)
+	{
+		assert(Pointer_Subscriptions[i].Pointer_String_Topic_Filter != NULL);
+		assert((Pointer_Subscriptions[i].QoS >= 0) && (Pointer_Subscriptions[i].QoS <= 2));
+		
+		// Stop at an invalid topic filter, so the next call reports it, or when the buffer is full
+		Topic_Filter_Length = (int) strlen(Pointer_Subscriptions[i].Pointer_String_Topic_Filter);
+		if (MQTTCheckTopicFilter(Pointer_Subscriptions[i].Pointer_String_Topic_Filter, Topic_Filter_Length) != 0) break;
+		if (Data_Size + 2 + Topic_Filter_Length + 1 > Available_Size) break; // Length field, filter string and requested QoS
+		
+		// Add topic filter
+		Data_Size += MQTTAppendString(&Pointer_Variable_Header, Pointer_Subscriptions[i].Pointer_String_Topic_Filter);
+		
+		// Add requested QoS for this topic filter
+		*Pointer_Variable_Header = (unsigned char) Pointer_Subscriptions[i].QoS;
+		Pointer_Variable_Header++;
+		Data_Size++;
+	}
+	if (i == 0) return -1;
 	
 	// Terminate message
 	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_SUBSCRIBE, Data_Size);
+	return i;
+}
+
+int MQTTComputeSubscribeBufferSize(TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count)
+{
+	int Size, i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Subscriptions != NULL);
+	
+	// Room for the biggest fixed header, the packet identifier and the MQTT 5 properties length, then each topic filter with its length field and its requested QoS
+	Size = MQTT_FIXED_HEADER_MAXIMUM_SIZE + 2 + 1;
+	for (i = 0; i < Subscriptions_Count; i++) Size += 2 + (int) strlen(Pointer_Subscriptions[i].Pointer_String_Topic_Filter) + 1;
+	return Size;
 }
 
-void MQTTDisconnect(TMQTTContext *Pointer_Context)
+int MQTTProcessSubscribeAcknowledge(TMQTTPacket *Pointer_Packet, TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count)
 {
+	int i, Failures_Count = 0;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Packet != NULL);
+	assert(Pointer_Subscriptions != NULL);
+	
+	// There must be exactly one return code per subscription
+	if ((Pointer_Packet->Type != MQTT_PACKET_TYPE_SUBACK) || (Pointer_Packet->Payload_Size != Subscriptions_Count)) return -1;
+	
+	for (i = 0; i < Subscriptions_Count; i++)
+	{
+		Pointer_Subscriptions[i].Return_Code = Pointer_Packet->Pointer_Payload[i];
+		if (Pointer_Subscriptions[i].Return_Code >= MQTT_SUBACK_RETURN_CODE_FAILURE) Failures_Count++; // MQTT 5 servers use several failure reason codes
+	}
+	return Failures_Count;
+}
+
+int MQTTComputeUnsubscribeBufferSize(char **Pointer_Strings_Topic_Filters, int Topic_Filters_Count)
+{
+	int Size, i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Strings_Topic_Filters != NULL);
+	
+	// Room for the biggest fixed header, the packet identifier and the MQTT 5 properties length, then each topic filter with its length field
+	Size = MQTT_FIXED_HEADER_MAXIMUM_SIZE + 2 + 1;
+	for (i = 0; i < Topic_Filters_Count; i++) Size += 2 + (int) strlen(Pointer_Strings_Topic_Filters[i]);
+	return Size;
+}
+
+int MQTTUnsubscribe(TMQTTContext *Pointer_Context, unsigned short Packet_Identifier, char **Pointer_Strings_Topic_Filters, int Topic_Filters_Count)
+{
+	unsigned char *Pointer_Variable_Header;
+	int Data_Size, Available_Size, Topic_Filter_Length, i;
+	
 	// Do some safety checks on parameters
 	assert(Pointer_Context != NULL);
+	assert(Packet_Identifier != 0);
+	assert(Pointer_Strings_Topic_Filters != NULL);
+	assert(Topic_Filters_Count > 0);
+	
+	// Cache message relevant parts access
+	Pointer_Variable_Header = (unsigned char *) (MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer); // Keep enough room at the buffer beginning to store the biggest possible fixed header
+	Available_Size = Pointer_Context->Buffer_Size - MQTT_FIXED_HEADER_MAXIMUM_SIZE;
+	if (Available_Size < 3) return -1;
+	
+	// Add packet identifier
+	Pointer_Variable_Header[0] = (unsigned char) (Packet_Identifier >> 8);
+	Pointer_Variable_Header[1] = (unsigned char) Packet_Identifier;
+	Pointer_Variable_Header += 2;
+	Data_Size = 2;
+	
+	// MQTT 5 variable header ends with properties, none is sent
+	if (MQTT_IS_PROTOCOL_VERSION_5(Pointer_Context))
+	{
+		*Pointer_Variable_Header = 0;
+		Pointer_Variable_Header++;
+		Data_Size++;
+	}
+	
+	// Add as many topic filters as possible
+	for (i = 0; i < Topic_Filters_Count; i++)
+	{
+		assert(Pointer_Strings_Topic_Filters[i] != NULL);
+		
+		// Stop at an invalid topic filter, so the next call reports it, or when the buffer is full
+		Topic_Filter_Length = (int) strlen(Pointer_Strings_Topic_Filters[i]);
+		if (MQTTCheckTopicFilter(Pointer_Strings_Topic_Filters[i], Topic_Filter_Length) != 0) break;
+		if (Data_Size + 2 + Topic_Filter_Length > Available_Size) break;
+		Data_Size += MQTTAppendString(&Pointer_Variable_Header, Pointer_Strings_Topic_Filters[i]);
+	}
+	if (i == 0) return -1;
+	
+	// Terminate message
+	MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_UNSUBSCRIBE, Data_Size);
+	return i;
+}
+
+int MQTTPing(TMQTTContext *Pointer_Context)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	
+	// Packet is made of the fixed header only
+	if (Pointer_Context->Buffer_Size < 2) return -1;
+	
+	// Fill fixed header
+	Pointer_Context->Pointer_Buffer[0] = MQTT_CONTROL_PACKET_TYPE_PINGREQ;
+	Pointer_Context->Pointer_Buffer[1] = 0;
+	
+	// Terminate message
+	Pointer_Context->Pointer_Message_Buffer = Pointer_Context->Pointer_Buffer;
+	Pointer_Context->Message_Size = 2;
+	MQTT_STATISTICS_COUNT_ENCODED_PACKET(Pointer_Context, 1);
+	return 0;
+}
+
+int MQTTDisconnect(TMQTTContext *Pointer_Context)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	
+	// Packet is made of the fixed header only
+	if (Pointer_Context->Buffer_Size < 2) return -1;
 	
 	// Fill fixed header
 	Pointer_Context->Pointer_Buffer[0] = MQTT_CONTROL_PACKET_TYPE_DISCONNECT;
@@ -259,4 +1521,417 @@ void MQTTDisconnect(TMQTTContext *Pointer_Context)
 	// Terminate message
 	Pointer_Context->Pointer_Message_Buffer = Pointer_Context->Pointer_Buffer;
 	Pointer_Context->Message_Size = 2;
+	MQTT_STATISTICS_COUNT_ENCODED_PACKET(Pointer_Context, 1);
+	return 0;
+}
+
+void MQTTBatchInitialize(TMQTTBatch *Pointer_Batch, void *Pointer_Buffer, int Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Batch != NULL);
+	assert(Pointer_Buffer != NULL);
+	
+	Pointer_Batch->Pointer_Buffer = Pointer_Buffer;
+	Pointer_Batch->Size = 0;
+	Pointer_Batch->Capacity = Buffer_Size;
+}
+
+int MQTTBatchAppend(TMQTTBatch *Pointer_Batch, TMQTTContext *Pointer_Context)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Batch != NULL);
+	assert(Pointer_Context != NULL);
+	
+	// Make sure the whole message can be stored
+	if (Pointer_Context->Message_Size > Pointer_Batch->Capacity - Pointer_Batch->Size) return -1;
+	
+	// Message has been forged yet, just put it after the previous one
+	memcpy(Pointer_Batch->Pointer_Buffer + Pointer_Batch->Size, Pointer_Context->Pointer_Message_Buffer, Pointer_Context->Message_Size);
+	Pointer_Batch->Size += Pointer_Context->Message_Size;
+	return 0;
 }
+
+void MQTTDecoderInitialize(TMQTTDecoder *Pointer_Decoder, void *Pointer_Buffer, int Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Decoder != NULL);
+	assert(Pointer_Buffer != NULL);
+	
+	Pointer_Decoder->State = MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE;
+	Pointer_Decoder->Pointer_Buffer = Pointer_Buffer;
+	Pointer_Decoder->Buffer_Size = Buffer_Size;
+	Pointer_Decoder->Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+	#ifdef MQTT_ENABLE_STATISTICS
+		Pointer_Decoder->Pointer_Statistics_Slot = NULL;
+	#endif
+}
+
+void MQTTDecoderSetProtocolVersion(TMQTTDecoder *Pointer_Decoder, int Protocol_Version)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Decoder != NULL);
+	
+	if (Protocol_Version == MQTT_PROTOCOL_VERSION_5) Pointer_Decoder->Protocol_Version = MQTT_PROTOCOL_VERSION_5;
+	else Pointer_Decoder->Protocol_Version = MQTT_PROTOCOL_VERSION_3_1_1;
+}
+
+int MQTTDecode(TMQTTDecoder *Pointer_Decoder, void *Pointer_Data, int Data_Size, TMQTTPacket *Pointer_Packet)
+{
+	unsigned char *Pointer_Bytes = Pointer_Data, Byte;
+	int Consumed_Size = 0, Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Decoder != NULL);
+	assert(Pointer_Data != NULL);
+	assert(Pointer_Packet != NULL);
+	
+	Pointer_Packet->Type = 0;
+	
+	while (Consumed_Size < Data_Size)
+	{
+		switch (Pointer_Decoder->State)
+		{
+			case MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE:
+				Pointer_Decoder->Fixed_Header_First_Byte = Pointer_Bytes[Consumed_Size];
+				Consumed_Size++;
+				Pointer_Decoder->Remaining_Length = 0;
+				Pointer_Decoder->Remaining_Length_Shift = 0;
+				Pointer_Decoder->Received_Size = 0;
+				Pointer_Decoder->State = MQTT_DECODER_STATE_REMAINING_LENGTH;
+				break;
+				
+			case MQTT_DECODER_STATE_REMAINING_LENGTH:
+				// See specification section 2.2.3 for "remaining length" decoding algorithm
+				Byte = Pointer_Bytes[Consumed_Size];
+				Consumed_Size++;
+				Pointer_Decoder->Remaining_Length |= (Byte & 0x7F) << Pointer_Decoder->Remaining_Length_Shift;
+				Pointer_Decoder->Remaining_Length_Shift += 7;
+				
+				// Is there a following byte ?
+				if (Byte & 0x80)
+				{
+					// "Remaining length" field can't be longer than 4 bytes
+					if (Pointer_Decoder->Remaining_Length_Shift >= 28)
+					{
+						MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder);
+						return -1;
+					}
+					break;
+				}
+				
+				// Packets without variable header nor payload are complete yet
+				if (Pointer_Decoder->Remaining_Length == 0)
+				{
+					Pointer_Decoder->State = MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE;
+					if (MQTTDecodePacket(Pointer_Decoder->Fixed_Header_First_Byte, NULL, 0, Pointer_Decoder->Protocol_Version, Pointer_Packet) != 0)
+					{
+						MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder);
+						return -1;
+					}
+					MQTT_STATISTICS_COUNT_DECODED_PACKET(Pointer_Decoder, Pointer_Packet, 0);
+					return Consumed_Size;
+				}
+				
+				// Directly decode the packet from the provided data if it is fully available, this avoids copying it
+				Pointer_Decoder->State = MQTT_DECODER_STATE_VARIABLE_HEADER_AND_PAYLOAD;
+				if (Data_Size - Consumed_Size >= Pointer_Decoder->Remaining_Length)
+				{
+					Pointer_Decoder->State = MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE;
+					if (MQTTDecodePacket(Pointer_Decoder->Fixed_Header_First_Byte, Pointer_Bytes + Consumed_Size, Pointer_Decoder->Remaining_Length, Pointer_Decoder->Protocol_Version, Pointer_Packet) != 0)
+					{
+						MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder);
+						return -1;
+					}
+					MQTT_STATISTICS_COUNT_DECODED_PACKET(Pointer_Decoder, Pointer_Packet, 0);
+					return Consumed_Size + Pointer_Decoder->Remaining_Length;
+				}
+				
+				// Packet must be reassembled, make sure it fits in the buffer
+				if (Pointer_Decoder->Remaining_Length > Pointer_Decoder->Buffer_Size)
+				{
+					MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder);
+					return -1;
+				}
+				break;
+				
+			case MQTT_DECODER_STATE_VARIABLE_HEADER_AND_PAYLOAD:
+				// Store as much data as possible
+				Size = Pointer_Decoder->Remaining_Length - Pointer_Decoder->Received_Size;
+				if (Size > Data_Size - Consumed_Size) Size = Data_Size - Consumed_Size;
+				memcpy(Pointer_Decoder->Pointer_Buffer + Pointer_Decoder->Received_Size, Pointer_Bytes + Consumed_Size, Size);
+				Pointer_Decoder->Received_Size += Size;
+				Consumed_Size += Size;
+				
+				// Wait for more data if the packet is not complete
+				if (Pointer_Decoder->Received_Size < Pointer_Decoder->Remaining_Length) break;
+				
+				Pointer_Decoder->State = MQTT_DECODER_STATE_FIXED_HEADER_FIRST_BYTE;
+				if (MQTTDecodePacket(Pointer_Decoder->Fixed_Header_First_Byte, Pointer_Decoder->Pointer_Buffer, Pointer_Decoder->Remaining_Length, Pointer_Decoder->Protocol_Version, Pointer_Packet) != 0)
+				{
+					MQTT_STATISTICS_COUNT_DECODING_ERROR(Pointer_Decoder);
+					return -1;
+				}
+				MQTT_STATISTICS_COUNT_DECODED_PACKET(Pointer_Decoder, Pointer_Packet, Pointer_Decoder->Remaining_Length);
+				return Consumed_Size;
+		}
+	}
+	
+	return Consumed_Size;
+}
+
+int MQTTAcknowledgePublish(TMQTTContext *Pointer_Context, TMQTTPacketType Packet_Type, unsigned short Packet_Identifier)
+{
+	unsigned char *Pointer_Variable_Header;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert((Packet_Type >= MQTT_PACKET_TYPE_PUBACK) && (Packet_Type <= MQTT_PACKET_TYPE_PUBCOMP));
+	
+	// Make sure the packet identifier fits after the room reserved for the fixed header
+	if (Pointer_Context->Buffer_Size < MQTT_FIXED_SIZE_PACKETS_BUFFER_SIZE) return -1;
+	
+	// Add packet identifier
+	Pointer_Variable_Header = MQTT_FIXED_HEADER_MAXIMUM_SIZE + Pointer_Context->Pointer_Buffer;
+	Pointer_Variable_Header[0] = (unsigned char) (Packet_Identifier >> 8);
+	Pointer_Variable_Header[1] = (unsigned char) Packet_Identifier;
+	
+	// Terminate message
+	if (Packet_Type == MQTT_PACKET_TYPE_PUBREL) MQTTAddFixedHeader(Pointer_Context, MQTT_CONTROL_PACKET_TYPE_PUBREL, 2);
+	else MQTTAddFixedHeader(Pointer_Context, Packet_Type << 4, 2);
+	return 0;
+}
+
+void MQTTInFlightWindowInitialize(TMQTTInFlightWindow *Pointer_Window)
+{
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Window != NULL);
+	
+	// Chain all slots in the free list
+	for (i = 0; i < MQTT_IN_FLIGHT_WINDOW_SIZE; i++)
+	{
+		Pointer_Window->Messages[i].State = MQTT_IN_FLIGHT_MESSAGE_STATE_FREE;
+		Pointer_Window->Messages[i].Packet_Identifier = i + 1;
+		Pointer_Window->Messages[i].Next_Slot_Index = i + 1;
+	}
+	Pointer_Window->Messages[MQTT_IN_FLIGHT_WINDOW_SIZE - 1].Next_Slot_Index = MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	Pointer_Window->Free_Slot_Index = 0;
+	
+	// No message is in flight
+	Pointer_Window->Oldest_Slot_Index = MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	Pointer_Window->Newest_Slot_Index = MQTT_IN_FLIGHT_WINDOW_NO_SLOT;
+	Pointer_Window->Full_Retransmission_Remaining_Count = -1;
+	Pointer_Window->Messages_Count = 0;
+}
+
+int MQTTInFlightWindowPublish(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size, unsigned int Current_Time)
+{
+	int Slot_Index, Packet_Identifier;
+	TMQTTInFlightMessage *Pointer_Message;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Window != NULL);
+	assert((MQTT_GET_PUBLISH_FLAGS_QOS(Flags) == 1) || (MQTT_GET_PUBLISH_FLAGS_QOS(Flags) == 2));
+	
+	// Make sure the packet can be forged before tracking it
+	if (MQTTCheckPublish(Pointer_Context, Pointer_String_Topic_Name, (int) strlen(Pointer_String_Topic_Name), Flags, Application_Message_Size) != 0) return -1;
+	
+	// Take a free slot
+	Slot_Index = Pointer_Window->Free_Slot_Index;
+	if (Slot_Index == MQTT_IN_FLIGHT_WINDOW_NO_SLOT) return -1;
+	Pointer_Message = &Pointer_Window->Messages[Slot_Index];
+	Pointer_Window->Free_Slot_Index = Pointer_Message->Next_Slot_Index;
+	
+	// Use the next packet identifier bound to this slot, so a late acknowledge of a previous message using this slot is not mistaken for the new message one
+	Packet_Identifier = Pointer_Message->Packet_Identifier + MQTT_IN_FLIGHT_WINDOW_SIZE;
+	if (Packet_Identifier > MQTT_IN_FLIGHT_WINDOW_PACKET_IDENTIFIER_MAXIMUM_VALUE) Packet_Identifier = Slot_Index + 1;
+	
+	// Keep everything needed to send the message again
+	Pointer_Message->Pointer_String_Topic_Name = Pointer_String_Topic_Name;
+	Pointer_Message->Pointer_Application_Message = Pointer_Application_Message;
+	Pointer_Message->Application_Message_Size = Application_Message_Size;
+	Pointer_Message->Flags = (unsigned char) (Flags & ~MQTT_PUBLISH_FLAG_DUP);
+	Pointer_Message->Packet_Identifier = (unsigned short) Packet_Identifier;
+	if (MQTT_GET_PUBLISH_FLAGS_QOS(Flags) == 1) Pointer_Message->State = MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBACK;
+	else Pointer_Message->State = MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBREC;
+	MQTTInFlightWindowLinkMessage(Pointer_Window, Slot_Index, Current_Time);
+	Pointer_Window->Messages_Count++;
+	
+	MQTTPublishExtended(Pointer_Context, Pointer_String_Topic_Name, Pointer_Message->Flags, Pointer_Message->Packet_Identifier, Pointer_Application_Message, Application_Message_Size);
+	return Packet_Identifier;
+}
+
+int MQTTInFlightWindowProcessPacket(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, TMQTTPacket *Pointer_Packet, unsigned int Current_Time)
+{
+	int Slot_Index;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Window != NULL);
+	assert(Pointer_Packet != NULL);
+	
+	switch (Pointer_Packet->Type)
+	{
+		// Server acknowledges a QoS 1 message, it can be released
+		case MQTT_PACKET_TYPE_PUBACK:
+			Slot_Index = MQTTInFlightWindowFindMessage(Pointer_Window, Pointer_Packet->Packet_Identifier, MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBACK);
+			break;
+			
+		// Server received a QoS 2 message, release it
+		case MQTT_PACKET_TYPE_PUBREC:
+			Slot_Index = MQTTInFlightWindowFindMessage(Pointer_Window, Pointer_Packet->Packet_Identifier, MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBREC);
+			
+			// A MQTT 5 server refused the message, the exchange is over and no PUBREL must be sent (see MQTT 5 specification section 4.3.3)
+			if (Pointer_Packet->Return_Code >= 0x80) break;
+			
+			if (Slot_Index != MQTT_IN_FLIGHT_WINDOW_NO_SLOT)
+			{
+				// Message is now waiting for PUBCOMP, the PUBREL packet will be sent again on time-out
+				Pointer_Window->Messages[Slot_Index].State = MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBCOMP;
+				MQTTInFlightWindowUnlinkMessage(Pointer_Window, Slot_Index);
+				MQTTInFlightWindowLinkMessage(Pointer_Window, Slot_Index, Current_Time);
+			}
+			// Always answer, the server may have lost a previous PUBREL
+			if (MQTTAcknowledgePublish(Pointer_Context, MQTT_PACKET_TYPE_PUBREL, Pointer_Packet->Packet_Identifier) != 0) return -1;
+			return 1;
+			
+		// Server completed a QoS 2 message delivery
+		case MQTT_PACKET_TYPE_PUBCOMP:
+			Slot_Index = MQTTInFlightWindowFindMessage(Pointer_Window, Pointer_Packet->Packet_Identifier, MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBCOMP);
+			break;
+			
+		// Acknowledge messages sent by the server
+		case MQTT_PACKET_TYPE_PUBLISH:
+			switch (MQTT_GET_PUBLISH_FLAGS_QOS(Pointer_Packet->Flags))
+			{
+				case 1:
+					if (MQTTAcknowledgePublish(Pointer_Context, MQTT_PACKET_TYPE_PUBACK, Pointer_Packet->Packet_Identifier) != 0) return -1;
+					return 1;
+				case 2:
+					if (MQTTAcknowledgePublish(Pointer_Context, MQTT_PACKET_TYPE_PUBREC, Pointer_Packet->Packet_Identifier) != 0) return -1;
+					return 1;
+				default:
+					return 0;
+			}
+			
+		case MQTT_PACKET_TYPE_PUBREL:
+			if (MQTTAcknowledgePublish(Pointer_Context, MQTT_PACKET_TYPE_PUBCOMP, Pointer_Packet->Packet_Identifier) != 0) return -1;
+			return 1;
+			
+		// Other packets are not related to message delivery
+		default:
+			return 0;
+	}
+	
+	// Release the acknowledged message slot
+	if (Slot_Index != MQTT_IN_FLIGHT_WINDOW_NO_SLOT)
+	{
+		MQTTInFlightWindowUnlinkMessage(Pointer_Window, Slot_Index);
+		Pointer_Window->Messages[Slot_Index].State = MQTT_IN_FLIGHT_MESSAGE_STATE_FREE;
+		Pointer_Window->Messages[Slot_Index].Next_Slot_Index = Pointer_Window->Free_Slot_Index;
+		Pointer_Window->Free_Slot_Index = Slot_Index;
+		Pointer_Window->Messages_Count--;
+	}
+	return 0;
+}
+
+int MQTTInFlightWindowRetransmit(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, unsigned int Current_Time, unsigned int Timeout)
+{
+	int Slot_Index;
+	TMQTTInFlightMessage *Pointer_Message;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Window != NULL);
+	
+	// Messages are sorted by sending time, so only the oldest one needs to be checked
+	Slot_Index = Pointer_Window->Oldest_Slot_Index;
+	if (Timeout == 0)
+	{
+		// A full retransmission sends each message once without looking at its age, because the sent messages become the newest ones and would be sent again forever
+		if ((Pointer_Window->Full_Retransmission_Remaining_Count < 0) || (Pointer_Window->Full_Retransmission_Remaining_Count > Pointer_Window->Messages_Count)) Pointer_Window->Full_Retransmission_Remaining_Count = Pointer_Window->Messages_Count;
+		if (Pointer_Window->Full_Retransmission_Remaining_Count == 0)
+		{
+			Pointer_Window->Full_Retransmission_Remaining_Count = -1; // The next call starts a new full retransmission
+			return 0;
+		}
+	}
+	else if ((Slot_Index == MQTT_IN_FLIGHT_WINDOW_NO_SLOT) || (Current_Time - Pointer_Window->Messages[Slot_Index].Sending_Time <= Timeout)) return 0; // Unsigned arithmetic handles time counter wrapping
+	Pointer_Message = &Pointer_Window->Messages[Slot_Index];
+	
+	// Send the message again (or only its release if the server received it yet), the message is left untouched if the packet can't be forged
+	if (Pointer_Message->State == MQTT_IN_FLIGHT_MESSAGE_STATE_WAITING_FOR_PUBCOMP)
+	{
+		if (MQTTAcknowledgePublish(Pointer_Context, MQTT_PACKET_TYPE_PUBREL, Pointer_Message->Packet_Identifier) != 0) return -1;
+	}
+	else if (MQTTPublishExtended(Pointer_Context, Pointer_Message->Pointer_String_Topic_Name, Pointer_Message->Flags | MQTT_PUBLISH_FLAG_DUP, Pointer_Message->Packet_Identifier, Pointer_Message->Pointer_Application_Message, Pointer_Message->Application_Message_Size) != 0) return -1;
+	
+	// Message becomes the most recently sent one
+	MQTTInFlightWindowUnlinkMessage(Pointer_Window, Slot_Index);
+	MQTTInFlightWindowLinkMessage(Pointer_Window, Slot_Index, Current_Time);
+	if (Timeout == 0) Pointer_Window->Full_Retransmission_Remaining_Count--;
+	return 1;
+}
+
+#ifdef MQTT_ENABLE_STATISTICS
+	void MQTTStatisticsInitialize(TMQTTStatisticsSlot *Pointer_Slots, int Slots_Count)
+	{
+		// Do some safety checks on parameters
+		assert(Pointer_Slots != NULL);
+		assert(Slots_Count > 0);
+		
+		memset(Pointer_Slots, 0, Slots_Count * sizeof(TMQTTStatisticsSlot));
+	}
+	
+	void MQTTSetStatisticsSlot(TMQTTContext *Pointer_Context, TMQTTStatisticsSlot *Pointer_Slot)
+	{
+		// Do some safety checks on parameters
+		assert(Pointer_Context != NULL);
+		
+		Pointer_Context->Pointer_Statistics_Slot = Pointer_Slot;
+	}
+	
+	void MQTTDecoderSetStatisticsSlot(TMQTTDecoder *Pointer_Decoder, TMQTTStatisticsSlot *Pointer_Slot)
+	{
+		// Do some safety checks on parameters
+		assert(Pointer_Decoder != NULL);
+		
+		Pointer_Decoder->Pointer_Statistics_Slot = Pointer_Slot;
+	}
+	
+	void MQTTStatisticsSnapshot(TMQTTStatisticsSlot *Pointer_Slots, int Slots_Count, TMQTTStatisticsCounters *Pointer_Counters)
+	{
+		TMQTTStatisticsDirection *Pointer_Sums[2];
+		TMQTTStatisticsSlotDirection *Pointer_Slot_Directions[2];
+		int Buffer_High_Water_Mark;
+		int i, j, k;
+		
+		// Do some safety checks on parameters
+		assert(Pointer_Slots != NULL);
+		assert(Pointer_Counters != NULL);
+		
+		memset(Pointer_Counters, 0, sizeof(TMQTTStatisticsCounters));
+		Pointer_Sums[0] = &Pointer_Counters->Encoded;
+		Pointer_Sums[1] = &Pointer_Counters->Decoded;
+		
+		for (i = 0; i < Slots_Count; i++)
+		{
+			Pointer_Slot_Directions[0] = &Pointer_Slots[i].Encoded;
+			Pointer_Slot_Directions[1] = &Pointer_Slots[i].Decoded;
+			
+			// Both directions have the same counters
+			for (j = 0; j < 2; j++)
+			{
+				for (k = 0; k < (int) (sizeof(Pointer_Sums[j]->Packets_Counts) / sizeof(Pointer_Sums[j]->Packets_Counts[0])); k++) Pointer_Sums[j]->Packets_Counts[k] += atomic_load_explicit(&Pointer_Slot_Directions[j]->Packets_Counts[k], memory_order_relaxed);
+				Pointer_Sums[j]->Bytes_Count += atomic_load_explicit(&Pointer_Slot_Directions[j]->Bytes_Count, memory_order_relaxed);
+				for (k = 0; k < 4; k++) Pointer_Sums[j]->Remaining_Length_Sizes_Counts[k] += atomic_load_explicit(&Pointer_Slot_Directions[j]->Remaining_Length_Sizes_Counts[k], memory_order_relaxed);
+				for (k = 0; k < MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT; k++) Pointer_Sums[j]->Topic_Name_Lengths_Counts[k] += atomic_load_explicit(&Pointer_Slot_Directions[j]->Topic_Name_Lengths_Counts[k], memory_order_relaxed);
+				Buffer_High_Water_Mark = atomic_load_explicit(&Pointer_Slot_Directions[j]->Buffer_High_Water_Mark, memory_order_relaxed);
+				if (Buffer_High_Water_Mark > Pointer_Sums[j]->Buffer_High_Water_Mark) Pointer_Sums[j]->Buffer_High_Water_Mark = Buffer_High_Water_Mark;
+			}
+			Pointer_Counters->Decoding_Errors_Count += atomic_load_explicit(&Pointer_Slots[i].Decoding_Errors_Count, memory_order_relaxed);
+		}
+	}
+#endif
@@ -1,14 +1,118 @@
 /** @file MQTT.h
  * Simple MQTT 3.1.1 library targeted to 32-bit embedded systems providing a standard C library.
  * Implementation is based on MQTT specifications version 3.1.1 : http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html.
+ * MQTT 5 can be selected when connecting : https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html. Properties are encoded and decoded, topic aliases are supported when publishing, other MQTT 5 features are not.
  * @author Adrien RICCIARDI
  */
 #ifndef H_MQTT_H
 #define H_MQTT_H
 
+#ifdef MQTT_ENABLE_STATISTICS
+	#include <stdatomic.h>
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** How many QoS 1 and QoS 2 messages can wait for acknowledge at the same time. Define it in the makefile to change the value. */
+#ifndef MQTT_IN_FLIGHT_WINDOW_SIZE
+	#define MQTT_IN_FLIGHT_WINDOW_SIZE 16
+#endif
+
+/** How many topic aliases can be used at most on a MQTT 5 connection, the server can allow less. Define it in the makefile to change the value. */
+#ifndef MQTT_TOPIC_ALIAS_TABLE_SIZE
+	#define MQTT_TOPIC_ALIAS_TABLE_SIZE 16
+#endif
+
+/** Longer topic names are never replaced by a topic alias. Define it in the makefile to change the value. */
+#ifndef MQTT_TOPIC_ALIAS_MAXIMUM_TOPIC_NAME_LENGTH
+	#define MQTT_TOPIC_ALIAS_MAXIMUM_TOPIC_NAME_LENGTH 64
+#endif
+
+// Define MQTT_ENABLE_STATISTICS in the makefile to count the encoded and decoded packets. When it is not defined, no statistics code nor data is compiled.
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Statistics slots are aligned on this size, so counters updated by different threads never share a cache line. Define it in the makefile to change the value. */
+	#ifndef MQTT_STATISTICS_CACHE_LINE_SIZE
+		#define MQTT_STATISTICS_CACHE_LINE_SIZE 64
+	#endif
+	
+	/** How many buckets the topic name lengths histogram has. Bucket 0 counts empty topic names, bucket N counts lengths in range [2^(N-1); 2^N - 1], the last bucket also counts all longer names. Define it in the makefile to change the value. */
+	#ifndef MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT
+		#define MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT 8
+	#endif
+#endif
+
 //-------------------------------------------------------------------------------------------------
 // Types
 //-------------------------------------------------------------------------------------------------
+/** All MQTT control packet types, as found in the fixed header upper nibble. */
+typedef enum
+{
+	MQTT_PACKET_TYPE_CONNECT = 1,
+	MQTT_PACKET_TYPE_CONNACK,
+	MQTT_PACKET_TYPE_PUBLISH,
+	MQTT_PACKET_TYPE_PUBACK,
+	MQTT_PACKET_TYPE_PUBREC,
+	MQTT_PACKET_TYPE_PUBREL,
+	MQTT_PACKET_TYPE_PUBCOMP,
+	MQTT_PACKET_TYPE_SUBSCRIBE,
+	MQTT_PACKET_TYPE_SUBACK,
+	MQTT_PACKET_TYPE_UNSUBSCRIBE,
+	MQTT_PACKET_TYPE_UNSUBACK,
+	MQTT_PACKET_TYPE_PINGREQ,
+	MQTT_PACKET_TYPE_PINGRESP,
+	MQTT_PACKET_TYPE_DISCONNECT
+} TMQTTPacketType;
+
+/** Topic names mapped to topic aliases on a MQTT 5 connection. Topic names are copied, so the user can reuse their memory. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	char Strings_Topic_Names[MQTT_TOPIC_ALIAS_TABLE_SIZE][MQTT_TOPIC_ALIAS_MAXIMUM_TOPIC_NAME_LENGTH + 1]; //!< The topic name of each alias (alias values start from 1).
+	unsigned int Topic_Name_Hashes[MQTT_TOPIC_ALIAS_TABLE_SIZE]; //!< Each topic name hash, so most comparisons are done on a single integer.
+	int Aliases_Count; //!< How many aliases can be used, as allowed by the server.
+	int Used_Aliases_Count; //!< How many aliases are mapped to a topic name.
+	int Next_Replaced_Alias_Index; //!< When all aliases are used, they are mapped to new topic names in a round-robin way.
+} TMQTTTopicAliasTable;
+
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Counters of a traffic direction. */
+	typedef struct
+	{
+		unsigned int Packets_Counts[16]; //!< How many packets of each type were processed, indexed by TMQTTPacketType values.
+		unsigned long long Bytes_Count; //!< How many bytes all packets are made of, fixed headers included.
+		unsigned int Remaining_Length_Sizes_Counts[4]; //!< How many packets have a "remaining length" field of 1, 2, 3 and 4 bytes.
+		unsigned int Topic_Name_Lengths_Counts[MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT]; //!< PUBLISH packets topic name lengths histogram (a topic replaced by a topic alias has a length of 0).
+		int Buffer_High_Water_Mark; //!< The biggest amount of bytes a packet needed in a context buffer (streamed application messages included) or in a decoder reassembly buffer.
+	} TMQTTStatisticsDirection;
+	
+	/** All counters. */
+	typedef struct
+	{
+		TMQTTStatisticsDirection Encoded; //!< Packets forged by contexts.
+		TMQTTStatisticsDirection Decoded; //!< Packets extracted by decoders.
+		unsigned int Decoding_Errors_Count; //!< How many times a decoder found malformed data.
+	} TMQTTStatisticsCounters;
+	
+	/** The counters of a traffic direction as stored in a slot. They are atomic so they can be read while they are updated. */
+	typedef struct
+	{
+		atomic_uint Packets_Counts[16]; //!< See TMQTTStatisticsDirection.
+		atomic_ullong Bytes_Count; //!< See TMQTTStatisticsDirection.
+		atomic_uint Remaining_Length_Sizes_Counts[4]; //!< See TMQTTStatisticsDirection.
+		atomic_uint Topic_Name_Lengths_Counts[MQTT_STATISTICS_TOPIC_NAME_LENGTH_BUCKETS_COUNT]; //!< See TMQTTStatisticsDirection.
+		atomic_int Buffer_High_Water_Mark; //!< See TMQTTStatisticsDirection.
+	} TMQTTStatisticsSlotDirection;
+	
+	/** The counters updated by a single thread. Use MQTTStatisticsSnapshot() to read them. */
+	typedef struct
+	{
+		_Alignas(MQTT_STATISTICS_CACHE_LINE_SIZE) TMQTTStatisticsSlotDirection Encoded; //!< Packets forged by contexts.
+		TMQTTStatisticsSlotDirection Decoded; //!< Packets extracted by decoders.
+		atomic_uint Decoding_Errors_Count; //!< How many times a decoder found malformed data.
+	} TMQTTStatisticsSlot;
+#endif
+
 /** Context shared across MQTT functions. */
 typedef struct
 {
@@ -16,6 +120,13 @@ typedef struct
 	unsigned char *Pointer_Message_Buffer; //!< This is the real beginning of the message. Use MQTT_GET_MESSAGE_BUFFER() to get this field.
 	int Message_Size; //!< How many bytes in the current message. Use MQTT_GET_MESSAGE_SIZE() to get this field.
 	unsigned char *Pointer_Buffer; //!< The buffer in which messages are forged. A message does not necessarily start from offset 0. Only Pointer_Message_Buffer pointer tells the message beginning.
+	int Buffer_Size; //!< The buffer size in bytes.
+	unsigned short Next_Packet_Identifier; //!< The identifier MQTTAllocatePacketIdentifier() will return.
+	unsigned char Protocol_Version; //!< The protocol version packets are forged for. Use MQTT_GET_PROTOCOL_VERSION() to get this field.
+	TMQTTTopicAliasTable *Pointer_Topic_Alias_Table; //!< The topic aliases used by MQTTPublish() and MQTTPublishExtended(), or NULL if topic aliases are not used.
+	#ifdef MQTT_ENABLE_STATISTICS
+		TMQTTStatisticsSlot *Pointer_Statistics_Slot; //!< The counters updated when a packet is forged, or NULL if the packets are not counted.
+	#endif
 } TMQTTContext;
 
 /** Parameters to provide when establishing a MQTT connection to the server. */
@@ -26,16 +137,147 @@ typedef struct
 	char *Pointer_String_Password; //!< Set to NULL if no password is provided.
 	int Is_Clean_Session_Enabled; //!< Set to 1 to tell the server to clean any previous saved state.
 	unsigned short Keep_Alive;
-	// TODO : add will support
-	void *Pointer_Buffer; //!< The buffer in which messages will be forged. Make sure it is big enough.
+	int Protocol_Version; //!< MQTT_PROTOCOL_VERSION_3_1_1 or MQTT_PROTOCOL_VERSION_5. A value of 0 selects MQTT 3.1.1.
+	unsigned int Session_Expiry_Interval; //!< MQTT 5 only : how many seconds the server keeps the session after the connection is closed. 0 ends the session with the connection, 0xFFFFFFFF keeps it forever.
+	char *Pointer_String_Will_Topic; //!< The topic the server publishes the will message to if the connection is lost without a DISCONNECT packet. Set to NULL if no will message is provided.
+	void *Pointer_Will_Message; //!< The will message.
+	int Will_Message_Size; //!< The will message size in bytes.
+	int Will_Flags; //!< A combination of MQTT_PUBLISH_FLAG_RETAIN, MQTT_PUBLISH_FLAG_QOS_1 and MQTT_PUBLISH_FLAG_QOS_2 values.
+	void *Pointer_Buffer; //!< The buffer in which messages will be forged. Encoders report an error when a packet does not fit in, use the MQTTComputeXxxBufferSize() functions to know how much memory a packet needs.
+	int Buffer_Size; //!< The buffer size in bytes.
 } TMQTTConnectionParameters;
 
+/** A topic filter to subscribe to. */
+typedef struct
+{
+	char *Pointer_String_Topic_Filter; //!< The topic filter, wildcards are allowed.
+	int QoS; //!< The maximum QoS the server can use to send messages matching this filter (0, 1 or 2).
+	int Return_Code; //!< Filled by MQTTProcessSubscribeAcknowledge() with the granted QoS, or a value greater or equal to MQTT_SUBACK_RETURN_CODE_FAILURE if the subscription was refused (MQTT 5 servers tell the refusal reason).
+} TMQTTSubscription;
+
+/** A contiguous chunk of memory being a part of a message. A message can be sent by writing all its segments in order (using writev() or sendmsg() for instance). */
+typedef struct
+{
+	void *Pointer_Buffer; //!< Segment first byte.
+	int Size; //!< Segment size in bytes.
+} TMQTTBufferSegment;
+
+/** Several forged messages stored back to back, so they can be sent with a single system call. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	unsigned char *Pointer_Buffer; //!< The user-provided buffer in which messages are appended. Use MQTT_GET_BATCH_BUFFER() to get this field.
+	int Size; //!< How many bytes are stored in the buffer. Use MQTT_GET_BATCH_SIZE() to get this field.
+	int Capacity; //!< The buffer size in bytes.
+} TMQTTBatch;
+
+/** A PUBLISH packet whose topic name is encoded once, so messages can be quickly published many times to the same topic. */
+typedef struct
+{
+	TMQTTContext Context; //!< The context containing the message forged by MQTTPublishPrepared(). Use MQTT_GET_MESSAGE_BUFFER() and MQTT_GET_MESSAGE_SIZE() on it to retrieve the message.
+	// Following fields are for internal usage only, do not modify or use
+	int Flags; //!< The PUBLISH flags.
+	int Variable_Header_Size; //!< The topic name, packet identifier and properties size.
+} TMQTTPreparedPublish;
+
+/** Resumable decoder extracting control packets from the data stream sent by the server. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	int State; //!< What part of the packet is currently decoded.
+	unsigned char Fixed_Header_First_Byte; //!< Control packet type and flags of the packet being decoded.
+	int Remaining_Length; //!< Size of the packet variable header and payload.
+	int Remaining_Length_Shift; //!< Bits position of the next "remaining length" byte.
+	int Received_Size; //!< How many bytes of variable header and payload have been stored in the buffer.
+	unsigned char *Pointer_Buffer; //!< The buffer in which packets split across several data chunks are reassembled.
+	int Buffer_Size; //!< The reassembly buffer size in bytes.
+	int Protocol_Version; //!< Tell how to decode variable headers.
+	#ifdef MQTT_ENABLE_STATISTICS
+		TMQTTStatisticsSlot *Pointer_Statistics_Slot; //!< The counters updated when a packet is decoded, or NULL if the packets are not counted.
+	#endif
+} TMQTTDecoder;
+
+/** A control packet extracted by MQTTDecode(). All pointers reference the decoder buffer or the data provided to MQTTDecode(), so they are valid until this memory is reused. */
+typedef struct
+{
+	TMQTTPacketType Type; //!< The control packet type, or 0 if no packet has been fully decoded yet.
+	unsigned char Flags; //!< The fixed header flags (for PUBLISH packets, bit 0 is RETAIN, bits 1-2 are QoS and bit 3 is DUP).
+	unsigned short Packet_Identifier; //!< Valid for PUBLISH with QoS greater than 0, PUBACK, PUBREC, PUBREL, PUBCOMP, SUBACK and UNSUBACK packets.
+	int Return_Code; //!< CONNACK return code. MQTT 5 servers also provide a reason code in PUBACK, PUBREC, PUBREL, PUBCOMP and DISCONNECT packets (0 means success).
+	int Topic_Alias_Maximum; //!< MQTT 5 CONNACK only : how many topic aliases the client can use, give it to MQTTEnableTopicAliases().
+	int Is_Session_Present; //!< CONNACK session present flag, set to 1 when the server kept the subscriptions and messages of a previous connection.
+	unsigned char *Pointer_Topic_Name; //!< PUBLISH topic name. The string is not terminated.
+	int Topic_Name_Size; //!< PUBLISH topic name length in bytes.
+	unsigned char *Pointer_Payload; //!< PUBLISH application message, SUBACK return codes or MQTT 5 UNSUBACK reason codes.
+	int Payload_Size; //!< Payload size in bytes.
+} TMQTTPacket;
+
+/** A QoS 1 or QoS 2 message sent to the server that is not fully acknowledged yet. */
+typedef struct
+{
+	char *Pointer_String_Topic_Name; //!< The user topic name, kept to send the message again.
+	void *Pointer_Application_Message; //!< The user application message, kept to send the message again.
+	int Application_Message_Size; //!< The application message size in bytes.
+	unsigned char Flags; //!< The PUBLISH flags.
+	unsigned char State; //!< Which acknowledge is expected from the server.
+	unsigned short Packet_Identifier; //!< The packet identifier currently or lastly used by this slot.
+	unsigned int Sending_Time; //!< When the message was last sent.
+	int Previous_Slot_Index; //!< The previously sent message in sending order.
+	int Next_Slot_Index; //!< The next sent message in sending order, or the next free slot when the slot is free.
+} TMQTTInFlightMessage;
+
+/** All QoS 1 and QoS 2 messages sent to the server and waiting for acknowledge. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTInFlightMessage Messages[MQTT_IN_FLIGHT_WINDOW_SIZE]; //!< All messages slots.
+	int Free_Slot_Index; //!< The free slots list head.
+	int Oldest_Slot_Index; //!< The in-flight message sent the longest time ago.
+	int Newest_Slot_Index; //!< The in-flight message sent the most recently.
+	int Messages_Count; //!< How many messages are in flight. Use MQTT_GET_IN_FLIGHT_MESSAGES_COUNT() to get this field.
+	int Full_Retransmission_Remaining_Count; //!< How many messages are left to send again by the full retransmission in progress, or -1 if no full retransmission is in progress.
+} TMQTTInFlightWindow;
+
 //-------------------------------------------------------------------------------------------------
 // Constants and macros
 //-------------------------------------------------------------------------------------------------
-/** How many bytes are expected for a CONNACK message. */
+/** Select MQTT 3.1.1 protocol when connecting. */
+#define MQTT_PROTOCOL_VERSION_3_1_1 4
+/** Select MQTT 5 protocol when connecting. */
+#define MQTT_PROTOCOL_VERSION_5 5
+
+/** How many bytes MQTT 5 properties can add to a PUBLISH packet (the properties length and a topic alias). */
+#define MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE 4
+
+/** How many bytes are expected for a MQTT 3.1.1 CONNACK message. */
 #define MQTT_CONNACK_MESSAGE_SIZE 4
 
+/** The biggest variable header and payload size a packet can have (see specification section 2.2.3). */
+#define MQTT_REMAINING_LENGTH_MAXIMUM_VALUE 268435455
+
+/** How many segments MQTTPublishSegmented() can output at most. */
+#define MQTT_PUBLISH_SEGMENTS_MAXIMUM_COUNT 2
+
+/** Keep the message on the server to send it to future subscribers. */
+#define MQTT_PUBLISH_FLAG_RETAIN 0x01
+/** Deliver the message at least once. */
+#define MQTT_PUBLISH_FLAG_QOS_1 0x02
+/** Deliver the message exactly once. */
+#define MQTT_PUBLISH_FLAG_QOS_2 0x04
+/** Tell that the message has been sent before. */
+#define MQTT_PUBLISH_FLAG_DUP 0x08
+
+/** Buffer size needed by MQTTPing(), MQTTDisconnect() and MQTTAcknowledgePublish(). */
+#define MQTT_FIXED_SIZE_PACKETS_BUFFER_SIZE 7
+
+/** A constant PINGREQ packet, use it to initialize a const array that can be stored in flash (see Tools/Packet_Generator.c for CONNECT and SUBSCRIBE packets). */
+#define MQTT_PINGREQ_PACKET_INITIALIZER { 0xC0, 0x00 }
+/** A constant DISCONNECT packet, use it to initialize a const array that can be stored in flash. */
+#define MQTT_DISCONNECT_PACKET_INITIALIZER { 0xE0, 0x00 }
+
+/** SUBACK return code telling that a subscription was refused by the server. MQTT 5 servers use greater values to tell the refusal reason. */
+#define MQTT_SUBACK_RETURN_CODE_FAILURE 0x80
+
 /** Retrieve a message payload buffer.
  * @param Pointer_Context An initialized MQTT context containing a valid message.
  * @return A pointer on the message beginning.
@@ -48,14 +290,69 @@ typedef struct
  */
 #define MQTT_GET_MESSAGE_SIZE(Pointer_Context) (Pointer_Context)->Message_Size
 
+/** Retrieve the protocol version a context forges packets for.
+ * @param Pointer_Context An initialized MQTT context.
+ * @return MQTT_PROTOCOL_VERSION_3_1_1 or MQTT_PROTOCOL_VERSION_5.
+ */
+#define MQTT_GET_PROTOCOL_VERSION(Pointer_Context) (Pointer_Context)->Protocol_Version
+
+/** Retrieve the buffer containing all batched messages.
+ * @param Pointer_Batch An initialized batch.
+ * @return A pointer on the first batched message.
+ */
+#define MQTT_GET_BATCH_BUFFER(Pointer_Batch) (Pointer_Batch)->Pointer_Buffer
+
+/** Retrieve the size of all batched messages.
+ * @param Pointer_Batch An initialized batch.
+ * @return How many bytes to send.
+ */
+#define MQTT_GET_BATCH_SIZE(Pointer_Batch) (Pointer_Batch)->Size
+
+/** Retrieve how many messages are waiting for acknowledge.
+ * @param Pointer_Window An initialized in-flight window.
+ * @return How many messages are in flight (MQTT_IN_FLIGHT_WINDOW_SIZE means that the window is full).
+ */
+#define MQTT_GET_IN_FLIGHT_MESSAGES_COUNT(Pointer_Window) (Pointer_Window)->Messages_Count
+
 //-------------------------------------------------------------------------------------------------
 // Functions
 //-------------------------------------------------------------------------------------------------
+/** Compute the buffer size needed to forge a CONNECT packet, without forging it.
+ * @param Pointer_Connection_Parameters The connection parameters (the buffer fields are not used).
+ * @return The needed buffer size in bytes.
+ */
+int MQTTComputeConnectBufferSize(TMQTTConnectionParameters *Pointer_Connection_Parameters);
+
 /** Create a CONNECT packet to send to the server.
  * @param Pointer_Context On output, context will be fully initialized using provided parameters. User does not need to initialize anything from this variable.
  * @param Pointer_Connection_Parameters All connection parameters are defined in this structure. See TMQTTConnectionParameters for field details.
+ * @return -1 if a string is not valid (see MQTTCheckString() and MQTTCheckTopicName() for the will topic) or if the packet does not fit in the provided buffer (the context is not initialized),
+ * @return 0 on success.
  */
-void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Pointer_Connection_Parameters);
+int MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Pointer_Connection_Parameters);
+
+/** Initialize a context without forging a CONNECT packet, when the CONNECT packet is sent from constant data generated by Tools/Packet_Generator.c.
+ * @param Pointer_Context On output, the context is ready to forge the following messages.
+ * @param Pointer_Buffer The buffer in which messages are forged.
+ * @param Buffer_Size The buffer size in bytes.
+ */
+void MQTTInitializeContext(TMQTTContext *Pointer_Context, void *Pointer_Buffer, int Buffer_Size);
+
+/** Change the buffer in which a context forges messages, so a buffer can be borrowed for each packet (from a MQTT_Pool.c pool for instance). The packet identifiers state is kept.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_Buffer The new buffer. The message currently forged in the context is lost.
+ * @param Buffer_Size The buffer size in bytes.
+ */
+void MQTTSetBuffer(TMQTTContext *Pointer_Context, void *Pointer_Buffer, int Buffer_Size);
+
+/** Replace the topic names of the following PUBLISH packets by topic aliases. Call this function each time a MQTT 5 connection is established, because aliases are forgotten by the server when the connection is closed.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect() using MQTT 5 protocol.
+ * @param Pointer_Table The table mapping topic names to aliases, it must stay valid as long as the context is used. Set to NULL to disable topic aliases.
+ * @param Topic_Alias_Maximum How many aliases the server allows, as told by the Topic_Alias_Maximum field of the CONNACK packet. No alias is used if the value is 0.
+ * @note The first message published on a topic carries the full topic name, the following ones carry an empty topic name and the alias. When all aliases are used, the oldest mapped alias is given to the new topic name.
+ * @note Packets forged with aliases are bound to the current connection, do not store them in an outbox nor send them to another server.
+ */
+void MQTTEnableTopicAliases(TMQTTContext *Pointer_Context, TMQTTTopicAliasTable *Pointer_Table, int Topic_Alias_Maximum);
 
 /** Process a CONNACK message received from the server.
  * @param Pointer_Message_Buffer The CONNACK message sent by the server. See notes for detail.
@@ -63,28 +360,301 @@ void MQTTConnect(TMQTTContext *Pointer_Context, TMQTTConnectionParameters *Point
  * @return -1 if the message is malformed,
  * @return The server response code (0 or a positive value). A value of 0 tells that connection is granted, all other values indicate an error (see specifications for details).
  * @note After sending a CONNECT message using MQTTConnect(), wait for the server to send a MQTT_CONNACK_MESSAGE_SIZE bytes packet. Then use MQTTIsConnectionEstablished() to retrieve the server response code.
+ * @note MQTT 5 CONNACK packets contain properties, decode them with MQTTDecode().
  */
 int MQTTIsConnectionEstablished(void *Pointer_Message_Buffer, int Message_Size);
 
+/** Process a CONNACK message received from the server and tell whether the server resumed a previous session. When the session is present, the subscriptions made during the previous connection are still active, so there is no need to subscribe again.
+ * @param Pointer_Message_Buffer The CONNACK message sent by the server.
+ * @param Message_Size How many bytes of data were read from the server.
+ * @param Pointer_Is_Session_Present On output, contain 1 if the server kept the previous session state or 0 if a new session has been created. It is always 0 if the connection has been refused.
+ * @return -1 if the message is malformed,
+ * @return The server response code (0 or a positive value). A value of 0 tells that connection is granted, all other values indicate an error (see specifications for details).
+ * @note The session can be present only if the clean session flag was not set in the CONNECT packet.
+ */
+int MQTTIsConnectionEstablishedExtended(void *Pointer_Message_Buffer, int Message_Size, int *Pointer_Is_Session_Present);
+
+/** Check that a string can be sent to or received from a server : it must be well-formed UTF-8, it must not contain U+0000 characters and it must not be longer than 65535 bytes (see specification section 1.5.3).
+ * @param Pointer_String The string, it does not need to be terminated.
+ * @param Size The string size in bytes.
+ * @return -1 if the string is not valid,
+ * @return 0 if the string is valid.
+ * @note Plain ASCII characters are checked several at once with AVX2, SSE2 or NEON instructions when the compiler targets them, or a machine word at once otherwise.
+ */
+int MQTTCheckString(void *Pointer_String, int Size);
+
+/** Check that a topic name is a valid string, that it is not empty and that it does not contain wildcard characters. This check is done by all functions forging PUBLISH packets and by MQTTDecode().
+ * @param Pointer_Topic_Name The topic name, it does not need to be terminated.
+ * @param Size The topic name size in bytes.
+ * @return -1 if the topic name is not valid,
+ * @return 0 if the topic name is valid.
+ */
+int MQTTCheckTopicName(void *Pointer_Topic_Name, int Size);
+
+/** Check that a topic filter is a valid string, that it is not empty and that its wildcard characters fill whole topic levels, the '#' wildcard being the last level. This check is done by MQTTSubscribe() and MQTTUnsubscribe().
+ * @param Pointer_Topic_Filter The topic filter, it does not need to be terminated.
+ * @param Size The topic filter size in bytes.
+ * @return -1 if the topic filter is not valid,
+ * @return 0 if the topic filter is valid.
+ */
+int MQTTCheckTopicFilter(void *Pointer_Topic_Filter, int Size);
+
+/** Compute the buffer size needed to forge a PUBLISH packet, without forging it.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Application_Message_Size The application message size in bytes. Use 0 to get the size needed by MQTTPreparePublish(), MQTTPublishStreamBegin() and MQTTPublishSegmented(), which do not store the application message with the topic name.
+ * @return The needed buffer size in bytes.
+ * @note Add MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE to the returned value when publishing on a MQTT 5 connection.
+ */
+int MQTTComputePublishBufferSize(char *Pointer_String_Topic_Name, int Flags, int Application_Message_Size);
+
 /** Create a PUBLISH packet to send to the server.
  * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
  * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
  * @param Pointer_Application_Message Data to send for the specified topic, it can by binary data. This pointer does not need to be valid if Application_Message_Size is equal to zero.
  * @param Application_Message_Size How many bytes of application message to send. Set to zero if there is no application data.
+ * @return -1 if the topic name is not valid or if the packet does not fit in the context buffer,
+ * @return 0 on success.
  */
-void MQTTPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size);
+int MQTTPublish(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size);
 
-/** Create a SUBSCRIBE packet to send to the server.
+/** Create a PUBLISH packet with all its options.
  * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
  * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
- * @note Only one topic can be specified at a time (specifications allow multiple ones). Just send multiple SUBSCRIBE messages to carry the same operation.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values. Use 0 to get the same packet than MQTTPublish().
+ * @param Packet_Identifier A non-zero value that must be unique among all not acknowledged packets. It is ignored for QoS 0 messages.
+ * @param Pointer_Application_Message Data to send for the specified topic, it can by binary data. This pointer does not need to be valid if Application_Message_Size is equal to zero.
+ * @param Application_Message_Size How many bytes of application message to send. Set to zero if there is no application data.
+ * @return -1 if the topic name is not valid or if the packet does not fit in the context buffer,
+ * @return 0 on success.
+ * @note Use an in-flight window to have QoS 1 and QoS 2 messages automatically acknowledged and sent again.
+ */
+int MQTTPublishExtended(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, int Flags, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size);
+
+/** Encode the parts of a PUBLISH packet that do not change from a message to another.
+ * @param Pointer_Prepared_Publish The prepared packet to initialize.
+ * @param Pointer_Buffer The buffer in which messages will be forged. It must be dedicated to this prepared packet, because the encoded topic name is kept in it.
+ * @param Buffer_Size The buffer size in bytes. It bounds the biggest application message that can be published.
+ * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Protocol_Version The protocol version of the connection the messages will be sent on, as returned by MQTT_GET_PROTOCOL_VERSION(). Topic aliases are never used by prepared packets.
+ * @return -1 if the topic name is not valid or does not fit in the buffer,
+ * @return 0 on success.
+ */
+int MQTTPreparePublish(TMQTTPreparedPublish *Pointer_Prepared_Publish, void *Pointer_Buffer, int Buffer_Size, char *Pointer_String_Topic_Name, int Flags, int Protocol_Version);
+
+/** Create a PUBLISH packet from a prepared one. Only the packet identifier, the application message and the "remaining length" field are written.
+ * @param Pointer_Prepared_Publish A prepared packet initialized with MQTTPreparePublish().
+ * @param Packet_Identifier A non-zero value that must be unique among all not acknowledged packets. It is ignored for QoS 0 messages.
+ * @param Pointer_Application_Message Data to send for the prepared topic, it can by binary data. This pointer does not need to be valid if Application_Message_Size is equal to zero.
+ * @param Application_Message_Size How many bytes of application message to send. Set to zero if there is no application data.
+ * @return -1 if the application message does not fit in the prepared packet buffer,
+ * @return 0 on success.
+ */
+int MQTTPublishPrepared(TMQTTPreparedPublish *Pointer_Prepared_Publish, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size);
+
+/** Start a PUBLISH packet whose application message is streamed by the user, so the application message can be sent in chunks of any size from flash memory or a file.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
+ * @param Application_Message_Size The total application message size in bytes (it can be up to MQTT_REMAINING_LENGTH_MAXIMUM_VALUE minus the topic name size).
+ * @return -1 if the topic name is not valid, if the headers do not fit in the context buffer or if the packet would be bigger than MQTT_REMAINING_LENGTH_MAXIMUM_VALUE,
+ * @return 0 on success.
+ * @note Only the fixed header and the topic name are forged in the context buffer. Send them first, then send exactly Application_Message_Size bytes of application message, in as many chunks as needed. No other packet can be sent until the whole application message has been sent.
+ */
+int MQTTPublishStreamBegin(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, int Application_Message_Size);
+
+/** Create a PUBLISH packet without copying the application message to the context buffer.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
+ * @param Pointer_Application_Message Data to send for the specified topic, it can by binary data. This pointer does not need to be valid if Application_Message_Size is equal to zero.
+ * @param Application_Message_Size How many bytes of application message to send. Set to zero if there is no application data.
+ * @param Pointer_Segments On output, contain the message segments to send in order. The array must be able to store MQTT_PUBLISH_SEGMENTS_MAXIMUM_COUNT segments.
+ * @return -1 if the topic name is not valid, if the headers do not fit in the context buffer or if the packet would be bigger than MQTT_REMAINING_LENGTH_MAXIMUM_VALUE,
+ * @return How many segments have been filled (1 if there is no application message, 2 otherwise).
+ * @note Only the fixed header and the topic name are forged in the context buffer, so MQTT_GET_MESSAGE_BUFFER() and MQTT_GET_MESSAGE_SIZE() return the headers only. The second segment directly points to the application message, which must stay valid until the message has been sent.
+ */
+int MQTTPublishSegmented(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name, void *Pointer_Application_Message, int Application_Message_Size, TMQTTBufferSegment *Pointer_Segments);
+
+/** Get a packet identifier for a SUBSCRIBE or UNSUBSCRIBE packet. Identifiers are taken from a range that is never used by in-flight windows.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @return A non-zero packet identifier.
+ */
+unsigned short MQTTAllocatePacketIdentifier(TMQTTContext *Pointer_Context);
+
+/** Compute the buffer size needed to forge a SUBSCRIBE packet containing all provided topic filters, without forging it.
+ * @param Pointer_Subscriptions The topic filters to subscribe to.
+ * @param Subscriptions_Count How many topic filters are provided.
+ * @return The needed buffer size in bytes.
+ */
+int MQTTComputeSubscribeBufferSize(TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count);
+
+/** Create a SUBSCRIBE packet containing as many topic filters as the context buffer can hold.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Packet_Identifier A non-zero value that must be unique among all not acknowledged packets. Use MQTTAllocatePacketIdentifier() to get one.
+ * @param Pointer_Subscriptions The topic filters to subscribe to.
+ * @param Subscriptions_Count How many topic filters are provided.
+ * @return -1 if the first topic filter is not valid or does not fit in the context buffer,
+ * @return How many topic filters have been added to the packet. If it is less than Subscriptions_Count, send the packet and call the function again with the remaining topic filters and a new packet identifier.
  */
-void MQTTSubscribe(TMQTTContext *Pointer_Context, char *Pointer_String_Topic_Name);
+int MQTTSubscribe(TMQTTContext *Pointer_Context, unsigned short Packet_Identifier, TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count);
+
+/** Retrieve the return code of each topic filter from a SUBACK packet.
+ * @param Pointer_Packet A SUBACK packet returned by MQTTDecode().
+ * @param Pointer_Subscriptions The topic filters sent in the matching SUBSCRIBE packet. Their Return_Code field is filled on output.
+ * @param Subscriptions_Count How many topic filters were sent in the matching SUBSCRIBE packet.
+ * @return -1 if the packet is not a SUBACK or if it does not contain one return code per topic filter,
+ * @return How many subscriptions were refused by the server.
+ */
+int MQTTProcessSubscribeAcknowledge(TMQTTPacket *Pointer_Packet, TMQTTSubscription *Pointer_Subscriptions, int Subscriptions_Count);
+
+/** Compute the buffer size needed to forge an UNSUBSCRIBE packet containing all provided topic filters, without forging it.
+ * @param Pointer_Strings_Topic_Filters The topic filters to unsubscribe from.
+ * @param Topic_Filters_Count How many topic filters are provided.
+ * @return The needed buffer size in bytes.
+ */
+int MQTTComputeUnsubscribeBufferSize(char **Pointer_Strings_Topic_Filters, int Topic_Filters_Count);
+
+/** Create an UNSUBSCRIBE packet containing as many topic filters as the context buffer can hold.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Packet_Identifier A non-zero value that must be unique among all not acknowledged packets. Use MQTTAllocatePacketIdentifier() to get one.
+ * @param Pointer_Strings_Topic_Filters The topic filters to unsubscribe from.
+ * @param Topic_Filters_Count How many topic filters are provided.
+ * @return -1 if the first topic filter is not valid or does not fit in the context buffer,
+ * @return How many topic filters have been added to the packet. If it is less than Topic_Filters_Count, send the packet and call the function again with the remaining topic filters and a new packet identifier.
+ */
+int MQTTUnsubscribe(TMQTTContext *Pointer_Context, unsigned short Packet_Identifier, char **Pointer_Strings_Topic_Filters, int Topic_Filters_Count);
+
+/** Create a PINGREQ packet to send to the server.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @return -1 if the context buffer is too small,
+ * @return 0 on success.
+ * @note Client must send a control packet before the keep alive time elapses, send a PINGREQ when there is nothing else to send.
+ */
+int MQTTPing(TMQTTContext *Pointer_Context);
 
 /** Create a DISCONNECT packet to send to the server.
  * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @return -1 if the context buffer is too small,
+ * @return 0 on success.
  * @note Client should close network connection after this packet has been sent.
  */
-void MQTTDisconnect(TMQTTContext *Pointer_Context);
+int MQTTDisconnect(TMQTTContext *Pointer_Context);
+
+/** Create a PUBACK, PUBREC, PUBREL or PUBCOMP packet.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Packet_Type The packet to create.
+ * @param Packet_Identifier The identifier of the acknowledged PUBLISH packet.
+ * @return -1 if the context buffer is smaller than MQTT_FIXED_SIZE_PACKETS_BUFFER_SIZE,
+ * @return 0 on success.
+ */
+int MQTTAcknowledgePublish(TMQTTContext *Pointer_Context, TMQTTPacketType Packet_Type, unsigned short Packet_Identifier);
+
+/** Prepare a batch to receive messages. This function can also be called to empty a batch after its content has been sent.
+ * @param Pointer_Batch The batch to initialize.
+ * @param Pointer_Buffer The buffer in which messages will be appended.
+ * @param Buffer_Size The buffer size in bytes.
+ */
+void MQTTBatchInitialize(TMQTTBatch *Pointer_Batch, void *Pointer_Buffer, int Buffer_Size);
+
+/** Append the message currently forged in a context to the end of a batch.
+ * @param Pointer_Batch An initialized batch.
+ * @param Pointer_Context A context containing a valid message (this message can be forged by any MQTT function).
+ * @return 0 if the message was appended,
+ * @return -1 if the message does not fit in the remaining batch space (the batch is left unmodified, send its content and initialize it again before retrying).
+ */
+int MQTTBatchAppend(TMQTTBatch *Pointer_Batch, TMQTTContext *Pointer_Context);
+
+/** Prepare a decoder to process a new data stream (call it each time a connection is established).
+ * @param Pointer_Decoder The decoder to initialize.
+ * @param Pointer_Buffer The buffer used to reassemble packets split across several data chunks. It must be as big as the biggest expected packet variable header and payload.
+ * @param Buffer_Size The reassembly buffer size in bytes.
+ */
+void MQTTDecoderInitialize(TMQTTDecoder *Pointer_Decoder, void *Pointer_Buffer, int Buffer_Size);
+
+/** Tell the decoder which protocol version the server packets are encoded with. An initialized decoder expects MQTT 3.1.1 packets.
+ * @param Pointer_Decoder An initialized decoder.
+ * @param Protocol_Version MQTT_PROTOCOL_VERSION_3_1_1 or MQTT_PROTOCOL_VERSION_5, use the same value as the connection parameters.
+ */
+void MQTTDecoderSetProtocolVersion(TMQTTDecoder *Pointer_Decoder, int Protocol_Version);
+
+/** Decode data received from the server. Data can be provided in chunks of any size, the decoder state is kept between calls.
+ * @param Pointer_Decoder An initialized decoder.
+ * @param Pointer_Data The received data.
+ * @param Data_Size How many bytes of data are available.
+ * @param Pointer_Packet On output, Type field is set to 0 if more data are needed, otherwise the structure describes the packet that has been fully decoded.
+ * @return -1 if the stream is malformed (including invalid strings and PUBLISH topic names) or a packet is too big for the reassembly buffer (the connection should be closed),
+ * @return How many bytes of data have been consumed. Call the function again with the remaining data until all data have been consumed.
+ * @note When a packet is fully contained in the provided data, its fields point directly to this data without copying it.
+ */
+int MQTTDecode(TMQTTDecoder *Pointer_Decoder, void *Pointer_Data, int Data_Size, TMQTTPacket *Pointer_Packet);
+
+/** Empty an in-flight window. Call it before sending the first message, or to discard all in-flight messages when a clean session is started.
+ * @param Pointer_Window The window to initialize.
+ */
+void MQTTInFlightWindowInitialize(TMQTTInFlightWindow *Pointer_Window);
+
+/** Create a QoS 1 or QoS 2 PUBLISH packet and keep track of it until it is acknowledged by the server.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_Window An initialized in-flight window.
+ * @param Pointer_String_Topic_Name Topic name is mandatory, user must always provide a string.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values, MQTT_PUBLISH_FLAG_QOS_1 or MQTT_PUBLISH_FLAG_QOS_2 must be present.
+ * @param Pointer_Application_Message Data to send for the specified topic, it can by binary data.
+ * @param Application_Message_Size How many bytes of application message to send.
+ * @param Current_Time The current time in any unit, it only needs to be consistent with the time values given to MQTTInFlightWindowRetransmit().
+ * @return -1 if the window is full (no packet has been created, wait for some messages to be acknowledged), if the topic name is not valid or if the packet does not fit in the context buffer,
+ * @return The allocated packet identifier.
+ * @note Topic name and application message are not copied, they must stay valid until the message is acknowledged (the matching PUBACK or PUBCOMP packet is given to MQTTInFlightWindowProcessPacket()).
+ */
+int MQTTInFlightWindowPublish(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size, unsigned int Current_Time);
+
+/** Handle a packet received from the server that is related to QoS 1 and QoS 2 messages delivery (PUBACK, PUBREC, PUBCOMP, as well as PUBLISH and PUBREL packets that must be acknowledged).
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_Window An initialized in-flight window.
+ * @param Pointer_Packet A packet returned by MQTTDecode(). Packets not related to message delivery are ignored.
+ * @param Current_Time The current time.
+ * @return -1 if the response packet does not fit in the context buffer,
+ * @return 0 if there is nothing to send,
+ * @return 1 if a response packet has been created in the context and must be sent to the server.
+ * @note A MQTT 5 PUBREC packet with a failure reason code (0x80 or greater) releases the message without sending a PUBREL packet.
+ */
+int MQTTInFlightWindowProcessPacket(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, TMQTTPacket *Pointer_Packet, unsigned int Current_Time);
+
+/** Create a packet to send again the oldest in-flight message if it was not acknowledged in time. Call this function until it does not return 1.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Pointer_Window An initialized in-flight window.
+ * @param Current_Time The current time.
+ * @param Timeout How much time to wait for an acknowledge before sending the message again. Use 0 after a reconnection to send all in-flight messages again, each message is sent once even if it was sent at Current_Time.
+ * @return -1 if the packet to send again does not fit in the context buffer (the message is left untouched, so it will be retried on the next call),
+ * @return 0 if no message needs to be sent again,
+ * @return 1 if a PUBLISH packet with the DUP flag set (or a PUBREL packet) has been created in the context and must be sent to the server.
+ */
+int MQTTInFlightWindowRetransmit(TMQTTContext *Pointer_Context, TMQTTInFlightWindow *Pointer_Window, unsigned int Current_Time, unsigned int Timeout);
+
+#ifdef MQTT_ENABLE_STATISTICS
+	/** Reset the counters of several slots. Give one slot to each thread using the library.
+	 * @param Pointer_Slots The slots array.
+	 * @param Slots_Count How many slots the array holds.
+	 */
+	void MQTTStatisticsInitialize(TMQTTStatisticsSlot *Pointer_Slots, int Slots_Count);
+	
+	/** Count the packets forged by a context. All contexts and decoders sharing a slot must be used by the same thread.
+	 * @param Pointer_Context A context previously initialized with a call to MQTTConnect() or MQTTInitializeContext(), those functions detach the context from its slot.
+	 * @param Pointer_Slot The counters to update, or NULL to stop counting.
+	 */
+	void MQTTSetStatisticsSlot(TMQTTContext *Pointer_Context, TMQTTStatisticsSlot *Pointer_Slot);
+	
+	/** Count the packets extracted by a decoder. All contexts and decoders sharing a slot must be used by the same thread.
+	 * @param Pointer_Decoder A decoder previously initialized with a call to MQTTDecoderInitialize(), this function detaches the decoder from its slot.
+	 * @param Pointer_Slot The counters to update, or NULL to stop counting.
+	 */
+	void MQTTDecoderSetStatisticsSlot(TMQTTDecoder *Pointer_Decoder, TMQTTStatisticsSlot *Pointer_Slot);
+	
+	/** Sum the counters of several slots. This function can be called by any thread while the counters are updated, each counter is read atomically but counters are not synchronized with each other.
+	 * @param Pointer_Slots The slots array.
+	 * @param Slots_Count How many slots the array holds.
+	 * @param Pointer_Counters On output, contain the sum of all counters (buffer high-water marks are the maximum of all slots values).
+	 */
+	void MQTTStatisticsSnapshot(TMQTTStatisticsSlot *Pointer_Slots, int Slots_Count, TMQTTStatisticsCounters *Pointer_Counters);
+#endif
 
 #endif
@@ -0,0 +1,209 @@
+/** @file MQTT_Coalescer.c
+ * @see MQTT_Coalescer.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <MQTT_Coalescer.h>
+#include <stddef.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Tell that the dirty list is empty or that an entry is the last one of the list. */
+#define MQTT_COALESCER_NO_ENTRY -1
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Compute the size of the PUBLISH packet carrying an entry message.
+ * @param Topic_Name_Length The topic name length in bytes.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return The packet size in bytes.
+ */
+static int MQTTCoalescerComputePacketSize(int Topic_Name_Length, int Application_Message_Size)
+{
+	int Remaining_Length, Size;
+	
+	// Topic name with its length field and application message, there is no packet identifier for QoS 0 messages
+	Remaining_Length = 2 + Topic_Name_Length + Application_Message_Size;
+	
+	// Add the fixed header, the "remaining length" field uses one byte more for each 7 bits of the value
+	Size = 2 + Remaining_Length;
+	while (Remaining_Length > 127)
+	{
+		Size++;
+		Remaining_Length >>= 7;
+	}
+	return Size;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+void MQTTCoalescerInitialize(TMQTTCoalescer *Pointer_Coalescer, TMQTTCoalescerEntry *Pointer_Entries, int Entries_Count, void *Pointer_Buffer, int Maximum_Topic_Name_Length, int Maximum_Application_Message_Size, int Byte_Budget, unsigned int Flush_Interval)
+{
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Coalescer != NULL);
+	assert(Pointer_Entries != NULL);
+	assert(Entries_Count > 0);
+	assert((Entries_Count & (Entries_Count - 1)) == 0);
+	assert(Pointer_Buffer != NULL);
+	assert(Maximum_Topic_Name_Length > 0);
+	assert(Maximum_Application_Message_Size >= 0);
+	
+	Pointer_Coalescer->Pointer_Entries = Pointer_Entries;
+	Pointer_Coalescer->Pointer_Buffer = Pointer_Buffer;
+	Pointer_Coalescer->Entries_Mask = Entries_Count - 1;
+	Pointer_Coalescer->Maximum_Topic_Name_Length = Maximum_Topic_Name_Length;
+	Pointer_Coalescer->Maximum_Application_Message_Size = Maximum_Application_Message_Size;
+	Pointer_Coalescer->Entry_Buffer_Size = Maximum_Topic_Name_Length + 1 + Maximum_Application_Message_Size; // The topic name is stored with its terminating zero, so it can be directly given to MQTTPublishExtended()
+	Pointer_Coalescer->Dirty_List_Head_Index = MQTT_COALESCER_NO_ENTRY;
+	Pointer_Coalescer->Dirty_List_Tail_Index = MQTT_COALESCER_NO_ENTRY;
+	Pointer_Coalescer->Dirty_Entries_Count = 0;
+	Pointer_Coalescer->Pending_Size = 0;
+	Pointer_Coalescer->Byte_Budget = Byte_Budget;
+	Pointer_Coalescer->Flush_Interval = Flush_Interval;
+	Pointer_Coalescer->Last_Flush_Time = 0;
+	Pointer_Coalescer->Replaced_Messages_Count = 0;
+	
+	// All entries are free
+	for (i = 0; i < Entries_Count; i++)
+	{
+		Pointer_Entries[i].Topic_Name_Length = 0;
+		Pointer_Entries[i].Is_Dirty = 0;
+	}
+}
+
+int MQTTCoalescerPublish(TMQTTCoalescer *Pointer_Coalescer, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size)
+{
+	TMQTTCoalescerEntry *Pointer_Entry;
+	unsigned char *Pointer_Entry_Buffer;
+	unsigned int Hash = 2166136261U;
+	int Length, Index, Probes_Count;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Coalescer != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	assert((Flags & ~MQTT_PUBLISH_FLAG_RETAIN) == 0);
+	
+	if (Application_Message_Size < 0) Application_Message_Size = 0;
+	if (Application_Message_Size > Pointer_Coalescer->Maximum_Application_Message_Size) return -1;
+	
+	// Compute topic name FNV-1a hash and length at the same time
+	for (Length = 0; Pointer_String_Topic_Name[Length] != 0; Length++)
+	{
+		Hash ^= (unsigned char) Pointer_String_Topic_Name[Length];
+		Hash *= 16777619U;
+	}
+	if ((Length == 0) || (Length > Pointer_Coalescer->Maximum_Topic_Name_Length)) return -1;
+	
+	// Find the topic entry with linear probing, entries are never removed so the first free entry tells that the topic is not known
+	Index = Hash & Pointer_Coalescer->Entries_Mask;
+	for (Probes_Count = 0; Probes_Count <= Pointer_Coalescer->Entries_Mask; Probes_Count++)
+	{
+		Pointer_Entry = &Pointer_Coalescer->Pointer_Entries[Index];
+		Pointer_Entry_Buffer = Pointer_Coalescer->Pointer_Buffer + Index * Pointer_Coalescer->Entry_Buffer_Size;
+		
+		// Take a free entry for the new topic, the topic name is checked only once so flushing can not fail because of it
+		if (Pointer_Entry->Topic_Name_Length == 0)
+		{
+			if (MQTTCheckTopicName(Pointer_String_Topic_Name, Length) != 0) return -1;
+			memcpy(Pointer_Entry_Buffer, Pointer_String_Topic_Name, Length + 1);
+			Pointer_Entry->Topic_Name_Hash = Hash;
+			Pointer_Entry->Topic_Name_Length = Length;
+			break;
+		}
+		
+		if ((Pointer_Entry->Topic_Name_Hash == Hash) && (Pointer_Entry->Topic_Name_Length == Length) && (memcmp(Pointer_Entry_Buffer, Pointer_String_Topic_Name, Length) == 0)) break;
+		Index = (Index + 1) & Pointer_Coalescer->Entries_Mask;
+	}
+	if (Probes_Count > Pointer_Coalescer->Entries_Mask) return -1;
+	
+	// Replace the pending message, or append the entry to the dirty list so topics are flushed in their first update order
+	if (Pointer_Entry->Is_Dirty)
+	{
+		Pointer_Coalescer->Pending_Size -= MQTTCoalescerComputePacketSize(Length, Pointer_Entry->Application_Message_Size);
+		Pointer_Coalescer->Replaced_Messages_Count++;
+	}
+	else
+	{
+		Pointer_Entry->Is_Dirty = 1;
+		Pointer_Entry->Next_Dirty_Entry_Index = MQTT_COALESCER_NO_ENTRY;
+		if (Pointer_Coalescer->Dirty_List_Tail_Index == MQTT_COALESCER_NO_ENTRY) Pointer_Coalescer->Dirty_List_Head_Index = Index;
+		else Pointer_Coalescer->Pointer_Entries[Pointer_Coalescer->Dirty_List_Tail_Index].Next_Dirty_Entry_Index = Index;
+		Pointer_Coalescer->Dirty_List_Tail_Index = Index;
+		Pointer_Coalescer->Dirty_Entries_Count++;
+	}
+	
+	// Keep the latest message only
+	memcpy(Pointer_Entry_Buffer + Pointer_Coalescer->Maximum_Topic_Name_Length + 1, Pointer_Application_Message, Application_Message_Size);
+	Pointer_Entry->Application_Message_Size = Application_Message_Size;
+	Pointer_Entry->Flags = (unsigned char) Flags;
+	Pointer_Coalescer->Pending_Size += MQTTCoalescerComputePacketSize(Length, Application_Message_Size);
+	
+	if (Pointer_Coalescer->Pending_Size >= Pointer_Coalescer->Byte_Budget) return 1;
+	return 0;
+}
+
+int MQTTCoalescerIsFlushNeeded(TMQTTCoalescer *Pointer_Coalescer, unsigned int Current_Time)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Coalescer != NULL);
+	
+	if (Pointer_Coalescer->Dirty_Entries_Count == 0) return 0;
+	if (Pointer_Coalescer->Pending_Size >= Pointer_Coalescer->Byte_Budget) return 1;
+	if (Current_Time - Pointer_Coalescer->Last_Flush_Time >= Pointer_Coalescer->Flush_Interval) return 1; // Unsigned arithmetic handles time counter wrapping
+	return 0;
+}
+
+int MQTTCoalescerFlush(TMQTTCoalescer *Pointer_Coalescer, TMQTTContext *Pointer_Context, TMQTTBatch *Pointer_Batch, unsigned int Current_Time)
+{
+	TMQTTCoalescerEntry *Pointer_Entry;
+	unsigned char *Pointer_Entry_Buffer;
+	int Index, Messages_Count = 0, Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Coalescer != NULL);
+	assert(Pointer_Context != NULL);
+	assert(Pointer_Batch != NULL);
+	
+	Pointer_Coalescer->Last_Flush_Time = Current_Time;
+	
+	while (Pointer_Coalescer->Dirty_List_Head_Index != MQTT_COALESCER_NO_ENTRY)
+	{
+		Index = Pointer_Coalescer->Dirty_List_Head_Index;
+		Pointer_Entry = &Pointer_Coalescer->Pointer_Entries[Index];
+		Pointer_Entry_Buffer = Pointer_Coalescer->Pointer_Buffer + Index * Pointer_Coalescer->Entry_Buffer_Size;
+		
+		// Stop before forging a packet that would not fit in the batch, because forging it could map a topic alias the server would never receive
+		Size = MQTTComputePublishBufferSize((char *) Pointer_Entry_Buffer, Pointer_Entry->Flags, Pointer_Entry->Application_Message_Size);
+		if (MQTT_GET_PROTOCOL_VERSION(Pointer_Context) == MQTT_PROTOCOL_VERSION_5) Size += MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE;
+		if (Size > Pointer_Batch->Capacity - Pointer_Batch->Size)
+		{
+			// The message will never fit, give up instead of blocking all the following messages forever
+			if (Pointer_Batch->Size == 0) return -1;
+			break;
+		}
+		
+		// Keep the entry dirty, so it is tried again on the next flush, and do not lose the messages already appended to the batch
+		if (MQTTPublishExtended(Pointer_Context, (char *) Pointer_Entry_Buffer, Pointer_Entry->Flags, 0, Pointer_Entry_Buffer + Pointer_Coalescer->Maximum_Topic_Name_Length + 1, Pointer_Entry->Application_Message_Size) != 0)
+		{
+			if (Messages_Count == 0) return -1;
+			break;
+		}
+		MQTTBatchAppend(Pointer_Batch, Pointer_Context);
+		Messages_Count++;
+		
+		// The message has been sent, remove the entry from the dirty list
+		Pointer_Coalescer->Dirty_List_Head_Index = Pointer_Entry->Next_Dirty_Entry_Index;
+		if (Pointer_Coalescer->Dirty_List_Head_Index == MQTT_COALESCER_NO_ENTRY) Pointer_Coalescer->Dirty_List_Tail_Index = MQTT_COALESCER_NO_ENTRY;
+		Pointer_Entry->Is_Dirty = 0;
+		Pointer_Coalescer->Dirty_Entries_Count--;
+		Pointer_Coalescer->Pending_Size -= MQTTCoalescerComputePacketSize(Pointer_Entry->Topic_Name_Length, Pointer_Entry->Application_Message_Size);
+	}
+	
+	return Messages_Count;
+}
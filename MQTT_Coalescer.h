@@ -0,0 +1,112 @@
+/** @file MQTT_Coalescer.h
+ * Keep only the latest application message of each topic, so topics updated at a high rate do not send a packet for each update.
+ * Messages are stored in a fixed-size table indexed by the topic name hash. Topics updated since the last flush are chained in a dirty list, which is flushed as a single batch when a time interval elapsed or when the pending data reaches a byte budget.
+ * Only QoS 0 messages can be coalesced, because an acknowledged message must not be replaced by a newer one. All memory is provided by the user, no dynamic allocation is done. The coalescer is not thread-safe.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_COALESCER_H
+#define H_MQTT_COALESCER_H
+
+#include <MQTT.h>
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** The latest message of a topic. */
+typedef struct
+{
+	unsigned int Topic_Name_Hash; //!< Speed up topic names comparison.
+	int Topic_Name_Length; //!< The topic name length in bytes, 0 tells that the entry is free.
+	int Application_Message_Size; //!< The latest application message size in bytes.
+	int Next_Dirty_Entry_Index; //!< The following entry in the dirty list.
+	unsigned char Flags; //!< The latest message PUBLISH flags.
+	unsigned char Is_Dirty; //!< Tell whether the latest message has not been sent yet.
+} TMQTTCoalescerEntry;
+
+/** A last-value table. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTCoalescerEntry *Pointer_Entries; //!< All entries.
+	unsigned char *Pointer_Buffer; //!< Each entry topic name and latest application message.
+	int Entries_Mask; //!< Entries count minus one, the count is a power of two.
+	int Maximum_Topic_Name_Length; //!< The longest topic name an entry can store.
+	int Maximum_Application_Message_Size; //!< The biggest application message an entry can store.
+	int Entry_Buffer_Size; //!< How many bytes of the buffer each entry uses.
+	int Dirty_List_Head_Index; //!< The oldest updated entry.
+	int Dirty_List_Tail_Index; //!< The most recently updated entry.
+	int Dirty_Entries_Count; //!< How many entries are waiting to be sent.
+	int Pending_Size; //!< How many bytes the dirty entries PUBLISH packets use.
+	int Byte_Budget; //!< Flush when the pending size reaches this value.
+	unsigned int Flush_Interval; //!< Flush when this time elapsed since the last flush.
+	unsigned int Last_Flush_Time; //!< When the last flush occurred.
+	unsigned int Replaced_Messages_Count; //!< How many messages were dropped because a newer one was stored before they were sent.
+} TMQTTCoalescer;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Retrieve how many bytes the PUBLISH packets waiting to be flushed use.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @return The pending data size in bytes.
+ */
+#define MQTT_COALESCER_GET_PENDING_SIZE(Pointer_Coalescer) (Pointer_Coalescer)->Pending_Size
+
+/** Retrieve how many topics have a message waiting to be flushed.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @return The pending messages count.
+ */
+#define MQTT_COALESCER_GET_PENDING_MESSAGES_COUNT(Pointer_Coalescer) (Pointer_Coalescer)->Dirty_Entries_Count
+
+/** Retrieve how many messages have been replaced by a newer one before being sent, this is how many packets the coalescer saved.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @return The replaced messages count.
+ */
+#define MQTT_COALESCER_GET_REPLACED_MESSAGES_COUNT(Pointer_Coalescer) (Pointer_Coalescer)->Replaced_Messages_Count
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Create an empty coalescer.
+ * @param Pointer_Coalescer The coalescer to initialize.
+ * @param Pointer_Entries The entries array, there must be one entry per coalesced topic plus some free entries to keep the table fast.
+ * @param Entries_Count How many entries the array holds. It must be a power of two.
+ * @param Pointer_Buffer The memory used to store the topic names and the application messages, it must be Entries_Count * (Maximum_Topic_Name_Length + 1 + Maximum_Application_Message_Size) bytes long.
+ * @param Maximum_Topic_Name_Length The longest topic name that can be coalesced.
+ * @param Maximum_Application_Message_Size The biggest application message that can be coalesced.
+ * @param Byte_Budget MQTTCoalescerIsFlushNeeded() requests a flush when the pending PUBLISH packets use this amount of bytes. Use the batch capacity to fill each batch.
+ * @param Flush_Interval MQTTCoalescerIsFlushNeeded() requests a flush when this time elapsed since the last flush. The time unit is chosen by the user.
+ */
+void MQTTCoalescerInitialize(TMQTTCoalescer *Pointer_Coalescer, TMQTTCoalescerEntry *Pointer_Entries, int Entries_Count, void *Pointer_Buffer, int Maximum_Topic_Name_Length, int Maximum_Application_Message_Size, int Byte_Budget, unsigned int Flush_Interval);
+
+/** Store a message, replacing the previous message of the same topic if it has not been sent yet.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @param Pointer_String_Topic_Name The topic name. It is copied, so the string can be reused.
+ * @param Flags MQTT_PUBLISH_FLAG_RETAIN or 0. QoS must be 0.
+ * @param Pointer_Application_Message The application message, it is copied.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return -1 if the topic name is not valid, if the topic name or the application message is too long, or if the table is full (publish the message directly in this case),
+ * @return 0 if the message has been stored,
+ * @return 1 if the message has been stored and the byte budget is reached (call MQTTCoalescerFlush()).
+ */
+int MQTTCoalescerPublish(TMQTTCoalescer *Pointer_Coalescer, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size);
+
+/** Tell whether the pending messages should be flushed.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @param Current_Time The current time, in the same unit than the flush interval. The time counter is allowed to wrap.
+ * @return 1 if messages are pending and the flush interval elapsed or the byte budget is reached,
+ * @return 0 if no flush is needed.
+ */
+int MQTTCoalescerIsFlushNeeded(TMQTTCoalescer *Pointer_Coalescer, unsigned int Current_Time);
+
+/** Forge the pending messages as PUBLISH packets, from the oldest updated topic to the most recently updated one, and append them to a batch.
+ * @param Pointer_Coalescer An initialized coalescer.
+ * @param Pointer_Context The context used to forge the packets. Its buffer must be able to hold the biggest coalesced message.
+ * @param Pointer_Batch The batch to fill. The messages that do not fit are kept for the next flush. An empty batch must be able to hold the biggest coalesced message, which is a PUBLISH packet with a Maximum_Topic_Name_Length topic name and a Maximum_Application_Message_Size application message (plus MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE bytes with MQTT 5).
+ * @param Current_Time The current time, it becomes the last flush time.
+ * @return -1 if no message has been appended because the first message could not be forged in the context buffer or does not fit even in an empty batch,
+ * @return How many messages have been appended to the batch. A message that could not be forged after some messages have been appended is kept for the next flush.
+ */
+int MQTTCoalescerFlush(TMQTTCoalescer *Pointer_Coalescer, TMQTTContext *Pointer_Context, TMQTTBatch *Pointer_Batch, unsigned int Current_Time);
+
+#endif
@@ -0,0 +1,560 @@
+/** @file MQTT_Epoll.c
+ * @see MQTT_Epoll.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <MQTT_Epoll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** How many events can be retrieved by a single epoll_wait() call. */
+#define MQTT_EPOLL_EVENTS_MAXIMUM_COUNT 256
+
+/** How many milliseconds last a timer wheel tick. */
+#define MQTT_EPOLL_TICK_DURATION 1000
+
+/** How many seconds to wait for the connection to be established when keep alive is disabled. */
+#define MQTT_EPOLL_DEFAULT_CONNECTION_TIMEOUT 30
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** A PINGREQ packet never changes, so it is directly queued from here. */
+static const unsigned char MQTT_Epoll_Ping_Request_Packet[2] = MQTT_PINGREQ_PACKET_INITIALIZER;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time.
+ * @return The time in milliseconds.
+ */
+static long long MQTTEpollGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (long long) Time.tv_sec * 1000 + Time.tv_nsec / 1000000;
+}
+
+/** Remove a session from the timer wheel.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session, nothing is done if its timer is not armed.
+ */
+static void MQTTEpollDisarmTimer(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	if (Pointer_Session->Timer_Slot_Index < 0) return;
+	
+	if (Pointer_Session->Pointer_Previous_Timer == NULL) Pointer_Loop->Pointer_Timer_Wheel_Slots[Pointer_Session->Timer_Slot_Index] = Pointer_Session->Pointer_Next_Timer;
+	else Pointer_Session->Pointer_Previous_Timer->Pointer_Next_Timer = Pointer_Session->Pointer_Next_Timer;
+	if (Pointer_Session->Pointer_Next_Timer != NULL) Pointer_Session->Pointer_Next_Timer->Pointer_Previous_Timer = Pointer_Session->Pointer_Previous_Timer;
+	
+	Pointer_Session->Timer_Slot_Index = -1;
+}
+
+/** Link a session to a timer wheel slot.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session, its timer must not be armed.
+ * @param Slot_Index The slot.
+ */
+static void MQTTEpollLinkTimer(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, int Slot_Index)
+{
+	Pointer_Session->Timer_Slot_Index = Slot_Index;
+	Pointer_Session->Pointer_Previous_Timer = NULL;
+	Pointer_Session->Pointer_Next_Timer = Pointer_Loop->Pointer_Timer_Wheel_Slots[Slot_Index];
+	if (Pointer_Session->Pointer_Next_Timer != NULL) Pointer_Session->Pointer_Next_Timer->Pointer_Previous_Timer = Pointer_Session;
+	Pointer_Loop->Pointer_Timer_Wheel_Slots[Slot_Index] = Pointer_Session;
+}
+
+/** (Re)start a session timer.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @param Delay How many seconds to wait before the timer expires (it must be greater than zero).
+ */
+static void MQTTEpollArmTimer(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, unsigned int Delay)
+{
+	MQTTEpollDisarmTimer(Pointer_Loop, Pointer_Session);
+	
+	// The slot will be visited (Delay - 1) / slots count times before the expiration tick, because the current tick has been processed yet
+	Pointer_Session->Timer_Rounds = (Delay - 1) / MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT;
+	MQTTEpollLinkTimer(Pointer_Loop, Pointer_Session, (Pointer_Loop->Current_Tick + Delay) & (MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT - 1));
+}
+
+/** Close a session after an error and tell the user.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTEpollAbortSession(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	MQTTEpollClose(Pointer_Loop, Pointer_Session);
+	if (Pointer_Loop->Close_Handler != NULL) Pointer_Loop->Close_Handler(Pointer_Session);
+}
+
+/** Poll or stop polling a session socket for write readiness.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @param Is_Enabled Set to 1 to be notified when the socket can accept data, set to 0 to only be notified of received data.
+ * @return -1 if an error occurred,
+ * @return 0 on success.
+ */
+static int MQTTEpollSetWritableEvent(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, int Is_Enabled)
+{
+	struct epoll_event Event;
+	
+	if (Pointer_Session->Is_Writable_Event_Enabled == Is_Enabled) return 0;
+	
+	Event.events = EPOLLIN | EPOLLRDHUP;
+	if (Is_Enabled) Event.events |= EPOLLOUT;
+	Event.data.ptr = Pointer_Session;
+	if (epoll_ctl(Pointer_Loop->Epoll_Descriptor, EPOLL_CTL_MOD, Pointer_Session->Socket, &Event) != 0) return -1;
+	
+	Pointer_Session->Is_Writable_Event_Enabled = Is_Enabled;
+	return 0;
+}
+
+/** Send as much queued data as the socket can accept.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @return -1 if the connection is broken (the session has been closed),
+ * @return 0 on success.
+ */
+static int MQTTEpollFlushSendQueue(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	struct iovec IO_Vectors[2];
+	int IO_Vectors_Count, Contiguous_Size;
+	ssize_t Sent_Size;
+	
+	while (Pointer_Session->Send_Queue_Size > 0)
+	{
+		// Queued data can wrap around the circular buffer end
+		Contiguous_Size = Pointer_Session->Send_Queue_Capacity - Pointer_Session->Send_Queue_Read_Index;
+		IO_Vectors[0].iov_base = Pointer_Session->Pointer_Send_Queue + Pointer_Session->Send_Queue_Read_Index;
+		if (Pointer_Session->Send_Queue_Size <= Contiguous_Size)
+		{
+			IO_Vectors[0].iov_len = Pointer_Session->Send_Queue_Size;
+			IO_Vectors_Count = 1;
+		}
+		else
+		{
+			IO_Vectors[0].iov_len = Contiguous_Size;
+			IO_Vectors[1].iov_base = Pointer_Session->Pointer_Send_Queue;
+			IO_Vectors[1].iov_len = Pointer_Session->Send_Queue_Size - Contiguous_Size;
+			IO_Vectors_Count = 2;
+		}
+		
+		Sent_Size = writev(Pointer_Session->Socket, IO_Vectors, IO_Vectors_Count);
+		if (Sent_Size < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) break;
+			if (errno == EINTR) continue;
+			MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+			return -1;
+		}
+		
+		Pointer_Session->Send_Queue_Read_Index = (Pointer_Session->Send_Queue_Read_Index + (int) Sent_Size) % Pointer_Session->Send_Queue_Capacity;
+		Pointer_Session->Send_Queue_Size -= (int) Sent_Size;
+	}
+	
+	// Wait for the socket to accept more data only if there is something left to send
+	if (MQTTEpollSetWritableEvent(Pointer_Loop, Pointer_Session, Pointer_Session->Send_Queue_Size > 0) != 0)
+	{
+		MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+		return -1;
+	}
+	return 0;
+}
+
+/** Send data to the server, or queue them if the socket can't accept them now.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @param Pointer_Data The data to send.
+ * @param Size The data size in bytes.
+ * @return -1 if the data do not fit in the queue or the connection is broken (check the session state to know),
+ * @return 0 on success.
+ */
+static int MQTTEpollQueueData(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, const unsigned char *Pointer_Data, int Size)
+{
+	int Write_Index, Contiguous_Size;
+	ssize_t Sent_Size;
+	
+	if (Size > MQTT_EPOLL_GET_SEND_QUEUE_FREE_SIZE(Pointer_Session)) return -1;
+	
+	// Try to directly send the data if nothing is waiting before them
+	if ((Pointer_Session->Send_Queue_Size == 0) && (Pointer_Session->State != MQTT_EPOLL_SESSION_STATE_CONNECTING))
+	{
+		do
+		{
+			Sent_Size = send(Pointer_Session->Socket, Pointer_Data, Size, MSG_NOSIGNAL);
+		} while ((Sent_Size < 0) && (errno == EINTR));
+		
+		if (Sent_Size < 0)
+		{
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+			{
+				MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+				return -1;
+			}
+			Sent_Size = 0;
+		}
+		Pointer_Data += Sent_Size;
+		Size -= (int) Sent_Size;
+		if (Size == 0) return 0;
+	}
+	
+	// Queue the remaining data, they may wrap around the circular buffer end
+	Write_Index = (Pointer_Session->Send_Queue_Read_Index + Pointer_Session->Send_Queue_Size) % Pointer_Session->Send_Queue_Capacity;
+	Contiguous_Size = Pointer_Session->Send_Queue_Capacity - Write_Index;
+	if (Size <= Contiguous_Size) memcpy(Pointer_Session->Pointer_Send_Queue + Write_Index, Pointer_Data, Size);
+	else
+	{
+		memcpy(Pointer_Session->Pointer_Send_Queue + Write_Index, Pointer_Data, Contiguous_Size);
+		memcpy(Pointer_Session->Pointer_Send_Queue, Pointer_Data + Contiguous_Size, Size - Contiguous_Size);
+	}
+	Pointer_Session->Send_Queue_Size += Size;
+	
+	// Send the queued data when the socket is ready (a connecting socket will signal it when the connection is established)
+	if (MQTTEpollSetWritableEvent(Pointer_Loop, Pointer_Session, 1) != 0)
+	{
+		MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+		return -1;
+	}
+	return 0;
+}
+
+/** Read and decode all data received by a session.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTEpollReceiveData(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	ssize_t Read_Size;
+	unsigned char *Pointer_Data;
+	int Size, Decoded_Size;
+	TMQTTPacket Packet;
+	
+	do
+	{
+		Read_Size = read(Pointer_Session->Socket, Pointer_Loop->Receive_Buffer, sizeof(Pointer_Loop->Receive_Buffer));
+	} while ((Read_Size < 0) && (errno == EINTR));
+	if (Read_Size < 0)
+	{
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+		MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	// Server closed the connection
+	if (Read_Size == 0)
+	{
+		MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	
+	Pointer_Data = Pointer_Loop->Receive_Buffer;
+	Size = (int) Read_Size;
+	while (Size > 0)
+	{
+		Decoded_Size = MQTTDecode(&Pointer_Session->Decoder, Pointer_Data, Size, &Packet);
+		if (Decoded_Size < 0)
+		{
+			MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+			return;
+		}
+		Pointer_Data += Decoded_Size;
+		Size -= Decoded_Size;
+		
+		// More data are needed
+		if (Packet.Type == 0) continue;
+		
+		switch (Packet.Type)
+		{
+			case MQTT_PACKET_TYPE_CONNACK:
+				if ((Pointer_Session->State != MQTT_EPOLL_SESSION_STATE_WAITING_FOR_CONNACK) || (Packet.Return_Code != 0))
+				{
+					MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+					return;
+				}
+				Pointer_Session->State = MQTT_EPOLL_SESSION_STATE_CONNECTED;
+				Pointer_Session->Is_Session_Present = Packet.Is_Session_Present;
+				
+				// The connection timeout is over, start the keep alive period (if any)
+				if (Pointer_Session->Keep_Alive > 0) MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, Pointer_Session->Keep_Alive);
+				else MQTTEpollDisarmTimer(Pointer_Loop, Pointer_Session);
+				if (Pointer_Loop->Connection_Handler != NULL) Pointer_Loop->Connection_Handler(Pointer_Session);
+				break;
+			
+			// Server is alive
+			case MQTT_PACKET_TYPE_PINGRESP:
+				Pointer_Session->Is_Ping_Response_Pending = 0;
+				break;
+			
+			default:
+				if (Pointer_Session->State != MQTT_EPOLL_SESSION_STATE_CONNECTED)
+				{
+					MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+					return;
+				}
+				if (Pointer_Loop->Packet_Handler != NULL) Pointer_Loop->Packet_Handler(Pointer_Session, &Packet);
+				break;
+		}
+		
+		// User may have closed the session from a handler
+		if (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED) return;
+	}
+}
+
+/** Handle a session whose timer expired.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTEpollProcessTimer(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	// Connection could not be established in time, or server did not answer to the previous PINGREQ
+	if ((Pointer_Session->State != MQTT_EPOLL_SESSION_STATE_CONNECTED) || Pointer_Session->Is_Ping_Response_Pending)
+	{
+		MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	
+	// Keep alive is disabled, there is nothing to monitor
+	if (Pointer_Session->Keep_Alive == 0) return;
+	
+	// Nothing was sent during the keep alive period, tell the server that the client is alive
+	if (MQTTEpollQueueData(Pointer_Loop, Pointer_Session, MQTT_Epoll_Ping_Request_Packet, sizeof(MQTT_Epoll_Ping_Request_Packet)) != 0)
+	{
+		// The send queue is full, so data are waiting to be sent and the server will not consider the client as dead yet, try again on next tick
+		if (Pointer_Session->State != MQTT_EPOLL_SESSION_STATE_CLOSED) MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, 1);
+		return;
+	}
+	Pointer_Session->Is_Ping_Response_Pending = 1;
+	MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, Pointer_Session->Keep_Alive);
+}
+
+/** Process a timer wheel slot.
+ * @param Pointer_Loop The loop.
+ */
+static void MQTTEpollProcessTick(TMQTTEpollLoop *Pointer_Loop)
+{
+	TMQTTEpollSession *Pointer_Session, *Pointer_Next_Session;
+	int Slot_Index;
+	
+	Pointer_Loop->Current_Tick++;
+	Slot_Index = Pointer_Loop->Current_Tick & (MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT - 1);
+	
+	// Detach the whole slot list, so expired sessions can be armed again while the list is processed
+	Pointer_Session = Pointer_Loop->Pointer_Timer_Wheel_Slots[Slot_Index];
+	Pointer_Loop->Pointer_Timer_Wheel_Slots[Slot_Index] = NULL;
+	
+	while (Pointer_Session != NULL)
+	{
+		Pointer_Next_Session = Pointer_Session->Pointer_Next_Timer;
+		
+		if (Pointer_Session->Timer_Rounds > 0)
+		{
+			// Timer will expire during a next wheel turn
+			Pointer_Session->Timer_Rounds--;
+			MQTTEpollLinkTimer(Pointer_Loop, Pointer_Session, Slot_Index);
+		}
+		else
+		{
+			Pointer_Session->Timer_Slot_Index = -1;
+			MQTTEpollProcessTimer(Pointer_Loop, Pointer_Session);
+		}
+		
+		Pointer_Session = Pointer_Next_Session;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+int MQTTEpollInitialize(TMQTTEpollLoop *Pointer_Loop)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	
+	memset(Pointer_Loop, 0, sizeof(TMQTTEpollLoop));
+	Pointer_Loop->Epoll_Descriptor = epoll_create1(EPOLL_CLOEXEC);
+	if (Pointer_Loop->Epoll_Descriptor < 0) return -1;
+	Pointer_Loop->Next_Tick_Time = MQTTEpollGetTime() + MQTT_EPOLL_TICK_DURATION;
+	return 0;
+}
+
+void MQTTEpollUninitialize(TMQTTEpollLoop *Pointer_Loop)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	
+	close(Pointer_Loop->Epoll_Descriptor);
+}
+
+void MQTTEpollInitializeSession(TMQTTEpollSession *Pointer_Session, void *Pointer_Send_Queue_Buffer, int Send_Queue_Buffer_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Session != NULL);
+	assert(Pointer_Send_Queue_Buffer != NULL);
+	assert(Send_Queue_Buffer_Size > 0);
+	
+	memset(Pointer_Session, 0, sizeof(TMQTTEpollSession));
+	Pointer_Session->State = MQTT_EPOLL_SESSION_STATE_CLOSED;
+	Pointer_Session->Socket = -1;
+	Pointer_Session->Pointer_Send_Queue = Pointer_Send_Queue_Buffer;
+	Pointer_Session->Send_Queue_Capacity = Send_Queue_Buffer_Size;
+	Pointer_Session->Timer_Slot_Index = -1;
+	MQTTDecoderInitialize(&Pointer_Session->Decoder, Pointer_Decoder_Buffer, Decoder_Buffer_Size);
+}
+
+int MQTTEpollConnect(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters)
+{
+	struct epoll_event Event;
+	int Socket, Saved_Errno;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	assert(Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED);
+	assert(Pointer_Address != NULL);
+	assert(Pointer_Connection_Parameters != NULL);
+	
+	// Create a non-blocking socket
+	Socket = socket(Pointer_Address->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (Socket < 0) return -1;
+	
+	// Start connection, it will complete later, then get notified when the connection is established
+	Event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+	Event.data.ptr = Pointer_Session;
+	if (((connect(Socket, Pointer_Address, Address_Size) != 0) && (errno != EINPROGRESS)) || (epoll_ctl(Pointer_Loop->Epoll_Descriptor, EPOLL_CTL_ADD, Socket, &Event) != 0))
+	{
+		Saved_Errno = errno;
+		close(Socket);
+		errno = Saved_Errno;
+		return -1;
+	}
+	
+	// Reset session state
+	Pointer_Session->Socket = Socket;
+	Pointer_Session->State = MQTT_EPOLL_SESSION_STATE_CONNECTING;
+	Pointer_Session->Is_Writable_Event_Enabled = 1;
+	Pointer_Session->Send_Queue_Read_Index = 0;
+	Pointer_Session->Send_Queue_Size = 0;
+	Pointer_Session->Is_Ping_Response_Pending = 0;
+	Pointer_Session->Is_Session_Present = 0;
+	Pointer_Session->Keep_Alive = Pointer_Connection_Parameters->Keep_Alive;
+	MQTTDecoderInitialize(&Pointer_Session->Decoder, Pointer_Session->Decoder.Pointer_Buffer, Pointer_Session->Decoder.Buffer_Size);
+	MQTTDecoderSetProtocolVersion(&Pointer_Session->Decoder, Pointer_Connection_Parameters->Protocol_Version);
+	
+	// Queue the CONNECT packet, it will be sent as soon as the connection is established
+	if ((MQTTConnect(&Pointer_Session->Context, Pointer_Connection_Parameters) != 0) || (MQTTEpollQueueData(Pointer_Loop, Pointer_Session, MQTT_GET_MESSAGE_BUFFER(&Pointer_Session->Context), MQTT_GET_MESSAGE_SIZE(&Pointer_Session->Context)) != 0))
+	{
+		MQTTEpollClose(Pointer_Loop, Pointer_Session);
+		errno = ENOBUFS;
+		return -1;
+	}
+	
+	// Give up if the server does not grant the connection in time
+	if (Pointer_Session->Keep_Alive > 0) MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, Pointer_Session->Keep_Alive);
+	else MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, MQTT_EPOLL_DEFAULT_CONNECTION_TIMEOUT);
+	return 0;
+}
+
+int MQTTEpollSend(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	
+	if (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED) return -1;
+	if (MQTTEpollQueueData(Pointer_Loop, Pointer_Session, MQTT_GET_MESSAGE_BUFFER(&Pointer_Session->Context), MQTT_GET_MESSAGE_SIZE(&Pointer_Session->Context)) != 0) return -1;
+	
+	// A control packet has been sent, so there is no need to send a PINGREQ before the keep alive period elapses again
+	if ((Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CONNECTED) && (Pointer_Session->Keep_Alive > 0) && !Pointer_Session->Is_Ping_Response_Pending) MQTTEpollArmTimer(Pointer_Loop, Pointer_Session, Pointer_Session->Keep_Alive);
+	return 0;
+}
+
+void MQTTEpollClose(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	
+	if (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED) return;
+	
+	// Closing the socket removes it from the epoll instance
+	MQTTEpollDisarmTimer(Pointer_Loop, Pointer_Session);
+	close(Pointer_Session->Socket);
+	Pointer_Session->Socket = -1;
+	Pointer_Session->State = MQTT_EPOLL_SESSION_STATE_CLOSED;
+}
+
+int MQTTEpollProcessEvents(TMQTTEpollLoop *Pointer_Loop, int Maximum_Waiting_Time)
+{
+	struct epoll_event Events[MQTT_EPOLL_EVENTS_MAXIMUM_COUNT];
+	TMQTTEpollSession *Pointer_Session;
+	long long Current_Time;
+	int Events_Count, Waiting_Time, i, Error;
+	socklen_t Error_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	
+	// Do not wait past the next tick
+	Waiting_Time = (int) (Pointer_Loop->Next_Tick_Time - MQTTEpollGetTime());
+	if (Waiting_Time < 0) Waiting_Time = 0;
+	if ((Maximum_Waiting_Time >= 0) && (Maximum_Waiting_Time < Waiting_Time)) Waiting_Time = Maximum_Waiting_Time;
+	
+	Events_Count = epoll_wait(Pointer_Loop->Epoll_Descriptor, Events, MQTT_EPOLL_EVENTS_MAXIMUM_COUNT, Waiting_Time);
+	if (Events_Count < 0)
+	{
+		if (errno != EINTR) return -1;
+		Events_Count = 0;
+	}
+	
+	for (i = 0; i < Events_Count; i++)
+	{
+		Pointer_Session = Events[i].data.ptr;
+		
+		// Session may have been closed while processing a previous event
+		if (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED) continue;
+		
+		// Connection is established or has failed
+		if ((Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CONNECTING) && (Events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+		{
+			Error_Size = sizeof(Error);
+			if ((getsockopt(Pointer_Session->Socket, SOL_SOCKET, SO_ERROR, &Error, &Error_Size) != 0) || (Error != 0))
+			{
+				MQTTEpollAbortSession(Pointer_Loop, Pointer_Session);
+				continue;
+			}
+			Pointer_Session->State = MQTT_EPOLL_SESSION_STATE_WAITING_FOR_CONNACK;
+		}
+		
+		// Receive data first, the server may have sent data before closing the connection
+		if (Events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			MQTTEpollReceiveData(Pointer_Loop, Pointer_Session);
+			if (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CLOSED) continue;
+		}
+		
+		// Send queued data
+		if ((Events[i].events & EPOLLOUT) && (Pointer_Session->Send_Queue_Size > 0))
+		{
+			if (MQTTEpollFlushSendQueue(Pointer_Loop, Pointer_Session) != 0) continue;
+			if ((Pointer_Session->Send_Queue_Size == 0) && (Pointer_Session->State == MQTT_EPOLL_SESSION_STATE_CONNECTED) && (Pointer_Loop->Writable_Handler != NULL)) Pointer_Loop->Writable_Handler(Pointer_Session);
+		}
+	}
+	
+	// Process all elapsed ticks
+	Current_Time = MQTTEpollGetTime();
+	while (Current_Time >= Pointer_Loop->Next_Tick_Time)
+	{
+		MQTTEpollProcessTick(Pointer_Loop);
+		Pointer_Loop->Next_Tick_Time += MQTT_EPOLL_TICK_DURATION;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/** @file MQTT_Epoll.h
+ * Linux transport driving many MQTT sessions from a single thread with epoll.
+ * Sockets are non-blocking, partially sent messages are queued per session and keep alive is handled by sending PINGREQ packets when a session has been idle.
+ * Keep alive deadlines are stored in a hashed timer wheel, so each tick only processes the sessions expiring at this tick.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_EPOLL_H
+#define H_MQTT_EPOLL_H
+
+#include <MQTT.h>
+#include <sys/socket.h>
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** How many slots the keep alive timer wheel has. It must be a power of two. Define it in the makefile to change the value. */
+#ifndef MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT
+	#define MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT 256
+#endif
+
+/** How many bytes can be read from a socket at once. Define it in the makefile to change the value. */
+#ifndef MQTT_EPOLL_RECEIVE_BUFFER_SIZE
+	#define MQTT_EPOLL_RECEIVE_BUFFER_SIZE 16384
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** All states a session can be in. */
+typedef enum
+{
+	MQTT_EPOLL_SESSION_STATE_CLOSED,
+	MQTT_EPOLL_SESSION_STATE_CONNECTING, //!< TCP connection is being established.
+	MQTT_EPOLL_SESSION_STATE_WAITING_FOR_CONNACK, //!< CONNECT packet has been queued, waiting for the server answer.
+	MQTT_EPOLL_SESSION_STATE_CONNECTED //!< MQTT connection is established.
+} TMQTTEpollSessionState;
+
+/** A connection to a MQTT server. */
+typedef struct TMQTTEpollSession
+{
+	TMQTTContext Context; //!< Forge messages in this context, then send them with MQTTEpollSend().
+	void *Pointer_User_Data; //!< Free for user usage.
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTEpollSessionState State; //!< Use MQTT_EPOLL_GET_SESSION_STATE() to get this field.
+	int Socket; //!< The non-blocking connection socket.
+	TMQTTDecoder Decoder; //!< Extract packets from received data.
+	unsigned char *Pointer_Send_Queue; //!< Circular buffer holding the data the socket could not send yet.
+	int Send_Queue_Capacity; //!< The send queue size in bytes.
+	int Send_Queue_Read_Index; //!< The first byte to send.
+	int Send_Queue_Size; //!< How many bytes are waiting to be sent. Use MQTT_EPOLL_GET_SEND_QUEUE_FREE_SIZE() to get the free space.
+	int Is_Writable_Event_Enabled; //!< Tell whether the socket is polled for write readiness.
+	unsigned short Keep_Alive; //!< The keep alive value sent to the server in seconds, 0 if keep alive is disabled.
+	int Is_Ping_Response_Pending; //!< Set when a PINGREQ has been sent and the PINGRESP has not been received yet.
+	int Is_Session_Present; //!< The CONNACK session present flag of the last granted connection. Use MQTT_EPOLL_IS_SESSION_PRESENT() to get this field.
+	unsigned int Timer_Rounds; //!< How many full timer wheel turns are left before the keep alive timer expires.
+	int Timer_Slot_Index; //!< The timer wheel slot the session is linked to, or -1 if the timer is not armed.
+	struct TMQTTEpollSession *Pointer_Previous_Timer; //!< The previous session in the timer wheel slot.
+	struct TMQTTEpollSession *Pointer_Next_Timer; //!< The next session in the timer wheel slot.
+} TMQTTEpollSession;
+
+/** Called when a session MQTT connection is granted by the server.
+ * @param Pointer_Session The connected session. Use MQTT_EPOLL_IS_SESSION_PRESENT() to know whether the server kept the previous session subscriptions, so subscribing again can be skipped.
+ */
+typedef void (*TMQTTEpollConnectionHandler)(TMQTTEpollSession *Pointer_Session);
+
+/** Called for each packet received on a connected session, except PINGRESP packets that are handled by the transport.
+ * @param Pointer_Session The session the packet has been received on.
+ * @param Pointer_Packet The decoded packet. It is valid only during the handler call.
+ */
+typedef void (*TMQTTEpollPacketHandler)(TMQTTEpollSession *Pointer_Session, TMQTTPacket *Pointer_Packet);
+
+/** Called when the send queue of a session has been fully sent, so the user can send more data.
+ * @param Pointer_Session The session that can accept more data.
+ */
+typedef void (*TMQTTEpollWritableHandler)(TMQTTEpollSession *Pointer_Session);
+
+/** Called when a session has been closed because of a network error, a protocol error, a refused connection or a keep alive timeout. The session socket is closed yet.
+ * @param Pointer_Session The closed session.
+ */
+typedef void (*TMQTTEpollCloseHandler)(TMQTTEpollSession *Pointer_Session);
+
+/** Event loop shared by all sessions. */
+typedef struct
+{
+	TMQTTEpollConnectionHandler Connection_Handler; //!< Can be NULL.
+	TMQTTEpollPacketHandler Packet_Handler; //!< Can be NULL.
+	TMQTTEpollWritableHandler Writable_Handler; //!< Can be NULL.
+	TMQTTEpollCloseHandler Close_Handler; //!< Can be NULL.
+	// Following fields are for internal usage only, do not modify or use
+	int Epoll_Descriptor; //!< The epoll instance.
+	TMQTTEpollSession *Pointer_Timer_Wheel_Slots[MQTT_EPOLL_TIMER_WHEEL_SLOTS_COUNT]; //!< Sessions lists sorted by keep alive expiration second.
+	unsigned int Current_Tick; //!< The timer wheel slot being processed.
+	long long Next_Tick_Time; //!< When the next timer wheel tick must be processed, in milliseconds.
+	unsigned char Receive_Buffer[MQTT_EPOLL_RECEIVE_BUFFER_SIZE]; //!< Received data are stored here before being decoded.
+} TMQTTEpollLoop;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Retrieve a session state.
+ * @param Pointer_Session An initialized session.
+ * @return The session state as a TMQTTEpollSessionState value.
+ */
+#define MQTT_EPOLL_GET_SESSION_STATE(Pointer_Session) (Pointer_Session)->State
+
+/** Tell whether the server resumed the session state of a previous connection, which is possible only when the connection parameters disable the clean session.
+ * @param Pointer_Session A connected session.
+ * @return 1 if the server kept the previous subscriptions and messages, 0 if a new session has been created.
+ */
+#define MQTT_EPOLL_IS_SESSION_PRESENT(Pointer_Session) (Pointer_Session)->Is_Session_Present
+
+/** Retrieve how many bytes can be queued to a session before it stops accepting messages.
+ * @param Pointer_Session An initialized session.
+ * @return The send queue free size in bytes.
+ */
+#define MQTT_EPOLL_GET_SEND_QUEUE_FREE_SIZE(Pointer_Session) ((Pointer_Session)->Send_Queue_Capacity - (Pointer_Session)->Send_Queue_Size)
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Create the event loop. Set the handlers fields after calling this function.
+ * @param Pointer_Loop The loop to initialize.
+ * @return -1 if the epoll instance could not be created (see errno for details),
+ * @return 0 on success.
+ */
+int MQTTEpollInitialize(TMQTTEpollLoop *Pointer_Loop);
+
+/** Free the loop resources. Sessions must have been closed before.
+ * @param Pointer_Loop An initialized loop.
+ */
+void MQTTEpollUninitialize(TMQTTEpollLoop *Pointer_Loop);
+
+/** Prepare a session memory. Call it once before the first connection.
+ * @param Pointer_Session The session to initialize.
+ * @param Pointer_Send_Queue_Buffer Buffer holding the data that could not be immediately sent. Its size bounds how much data can be pending before MQTTEpollSend() reports back pressure.
+ * @param Send_Queue_Buffer_Size The send queue buffer size in bytes.
+ * @param Pointer_Decoder_Buffer Buffer used to reassemble received packets split across several reads.
+ * @param Decoder_Buffer_Size The decoder buffer size in bytes.
+ */
+void MQTTEpollInitializeSession(TMQTTEpollSession *Pointer_Session, void *Pointer_Send_Queue_Buffer, int Send_Queue_Buffer_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size);
+
+/** Start connecting a session to a server without blocking. The CONNECT packet is sent as soon as the TCP connection is established, the connection handler is called when the server grants the connection.
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session A closed session.
+ * @param Pointer_Address The server address.
+ * @param Address_Size The server address size in bytes.
+ * @param Pointer_Connection_Parameters The MQTT connection parameters. Buffer must be dedicated to this session.
+ * @return -1 if the connection could not be started (see errno for details),
+ * @return 0 on success.
+ */
+int MQTTEpollConnect(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters);
+
+/** Send the message currently forged in the session context. Data the socket can't immediately accept are queued and sent when possible.
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session A connected session.
+ * @return -1 if the message does not fit in the send queue (nothing has been sent, wait for the writable handler to be called before retrying),
+ * @return 0 on success.
+ */
+int MQTTEpollSend(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session);
+
+/** Close a session connection immediately. The close handler is not called.
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session The session to close. Nothing is done if the session is closed yet.
+ */
+void MQTTEpollClose(TMQTTEpollLoop *Pointer_Loop, TMQTTEpollSession *Pointer_Session);
+
+/** Wait for network events and process them, then process the elapsed keep alive timers.
+ * @param Pointer_Loop An initialized loop.
+ * @param Maximum_Waiting_Time How many milliseconds to wait for events at most. Set to -1 to wait until the next keep alive tick.
+ * @return -1 if an unrecoverable error occurred (see errno for details),
+ * @return 0 on success.
+ */
+int MQTTEpollProcessEvents(TMQTTEpollLoop *Pointer_Loop, int Maximum_Waiting_Time);
+
+#endif
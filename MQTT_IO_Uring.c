@@ -0,0 +1,725 @@
+/** @file MQTT_IO_Uring.c
+ * @see MQTT_IO_Uring.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <MQTT_IO_Uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+#if MQTT_IO_URING_SEND_SLOTS_COUNT > 256
+	#error "MQTT_IO_URING_SEND_SLOTS_COUNT must not exceed 256, because the slot index is stored on 8 bits in the requests user data."
+#endif
+
+/** The user data of a request sending a message. */
+#define MQTT_IO_URING_OPERATION_SEND 1
+/** The user data of a multishot receive request. */
+#define MQTT_IO_URING_OPERATION_RECEIVE 2
+
+/** The receive buffers ring identifier. */
+#define MQTT_IO_URING_RECEIVE_BUFFERS_GROUP 0
+
+/** How many sessions can be driven at most, because the session index is stored on 16 bits in the requests user data. */
+#define MQTT_IO_URING_MAXIMUM_SESSIONS_COUNT 65535
+
+/** Build a request user data, so its completion can be matched with the session connection and the send slot it belongs to.
+ * @param Session_Index The session index in the loop sessions array.
+ * @param Generation The session generation when the request is submitted.
+ * @param Slot_Index The send slot index, or 0 for a receive request.
+ * @param Operation The request operation.
+ * @return The user data.
+ */
+#define MQTT_IO_URING_MAKE_USER_DATA(Session_Index, Generation, Slot_Index, Operation) (((unsigned long long) (Generation) << 32) | ((unsigned long long) (Session_Index) << 16) | ((unsigned long long) (Slot_Index) << 8) | (Operation))
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Close a session after an error and tell the user.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTIOUringAbortSession(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	MQTTIOUringClose(Pointer_Loop, Pointer_Session);
+	if (Pointer_Loop->Close_Handler != NULL) Pointer_Loop->Close_Handler(Pointer_Session);
+}
+
+/** Decode received data and give the packets to the user.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session the data have been received on.
+ * @param Pointer_Data The received data.
+ * @param Size The data size in bytes.
+ */
+static void MQTTIOUringDecodeData(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session, unsigned char *Pointer_Data, int Size)
+{
+	int Decoded_Size;
+	TMQTTPacket Packet;
+	
+	while (Size > 0)
+	{
+		Decoded_Size = MQTTDecode(&Pointer_Session->Decoder, Pointer_Data, Size, &Packet);
+		if (Decoded_Size < 0)
+		{
+			MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+			return;
+		}
+		Pointer_Data += Decoded_Size;
+		Size -= Decoded_Size;
+		
+		// More data are needed
+		if (Packet.Type == 0) continue;
+		
+		if (Pointer_Loop->Packet_Handler != NULL) Pointer_Loop->Packet_Handler(Pointer_Session, &Packet);
+		
+		// User may have closed the session from the handler
+		if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) return;
+	}
+}
+
+/** Forget the oldest messages that have been fully sent, so their slots can be reused.
+ * @param Pointer_Session The session.
+ */
+static void MQTTIOUringReleaseSendSlots(TMQTTIOUringSession *Pointer_Session)
+{
+	TMQTTIOUringSendSlot *Pointer_Slot;
+	
+	while (Pointer_Session->Used_Send_Slots_Count > 0)
+	{
+		Pointer_Slot = &Pointer_Session->Send_Slots[Pointer_Session->Send_Slots_Head_Index];
+		if (Pointer_Slot->Sent_Size < Pointer_Slot->Message_Size) break;
+		
+		Pointer_Session->Send_Slots_Head_Index = (Pointer_Session->Send_Slots_Head_Index + 1) % MQTT_IO_URING_SEND_SLOTS_COUNT;
+		Pointer_Session->Used_Send_Slots_Count--;
+	}
+}
+
+/** Give a receive buffer back to the kernel.
+ * @param Pointer_Loop The loop.
+ * @param Buffer_Index The buffer index, it is also the buffer identifier.
+ */
+static void MQTTIOUringReleaseReceiveBuffer(TMQTTIOUringLoop *Pointer_Loop, int Buffer_Index)
+{
+	struct io_uring_buf *Pointer_Buffer;
+	
+	Pointer_Buffer = &Pointer_Loop->Pointer_Receive_Buffers_Ring->bufs[Pointer_Loop->Receive_Buffers_Ring_Tail & (MQTT_IO_URING_RECEIVE_BUFFERS_COUNT - 1)];
+	Pointer_Buffer->addr = (unsigned long) (Pointer_Loop->Pointer_Receive_Buffers + Buffer_Index * MQTT_IO_URING_RECEIVE_BUFFER_SIZE);
+	Pointer_Buffer->len = MQTT_IO_URING_RECEIVE_BUFFER_SIZE;
+	Pointer_Buffer->bid = (unsigned short) Buffer_Index;
+	
+	// The kernel can use the buffer as soon as the tail is updated
+	Pointer_Loop->Receive_Buffers_Ring_Tail++;
+	__atomic_store_n(&Pointer_Loop->Pointer_Receive_Buffers_Ring->tail, Pointer_Loop->Receive_Buffers_Ring_Tail, __ATOMIC_RELEASE);
+}
+
+/** Handle a completion posted by the kernel.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Completion The completion.
+ */
+static void MQTTIOUringProcessCompletion(TMQTTIOUringLoop *Pointer_Loop, struct io_uring_cqe *Pointer_Completion)
+{
+	TMQTTIOUringSession *Pointer_Session;
+	TMQTTIOUringSendSlot *Pointer_Slot;
+	unsigned long long User_Data = Pointer_Completion->user_data;
+	int Result = Pointer_Completion->res, Is_Stale, Buffer_Index;
+	
+	// Completions of a connection that has been closed meanwhile are ignored
+	Pointer_Session = &Pointer_Loop->Pointer_Sessions[(User_Data >> 16) & 0xFFFF];
+	Is_Stale = !MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session) || (Pointer_Session->Generation != (unsigned int) (User_Data >> 32));
+	
+	if ((User_Data & 0xFF) == MQTT_IO_URING_OPERATION_RECEIVE)
+	{
+		// The request will be posted again by the next MQTTIOUringProcessEvents() call when the kernel terminated it (this happens when all receive buffers are used)
+		if (!Is_Stale && !(Pointer_Completion->flags & IORING_CQE_F_MORE)) Pointer_Session->Is_Receive_Request_Posted = 0;
+		
+		// The buffer must be given back even if the connection is closed
+		if (Pointer_Completion->flags & IORING_CQE_F_BUFFER)
+		{
+			Buffer_Index = Pointer_Completion->flags >> IORING_CQE_BUFFER_SHIFT;
+			if (!Is_Stale && (Result > 0)) MQTTIOUringDecodeData(Pointer_Loop, Pointer_Session, Pointer_Loop->Pointer_Receive_Buffers + Buffer_Index * MQTT_IO_URING_RECEIVE_BUFFER_SIZE, Result);
+			MQTTIOUringReleaseReceiveBuffer(Pointer_Loop, Buffer_Index);
+		}
+		if (Is_Stale || !MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) return;
+		
+		// Server closed the connection or the connection is broken
+		if ((Result == 0) || ((Result < 0) && (Result != -ENOBUFS) && (Result != -EINTR) && (Result != -EAGAIN))) MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	
+	if (Is_Stale) return;
+	Pointer_Session->In_Flight_Send_Slots_Count--;
+	
+	// A cancelled write follows a short write and will be submitted again in the next chain
+	Pointer_Slot = &Pointer_Session->Send_Slots[(User_Data >> 8) & 0xFF];
+	if (Result > 0) Pointer_Slot->Sent_Size += Result;
+	else if ((Result < 0) && (Result != -ECANCELED) && (Result != -EINTR) && (Result != -EAGAIN))
+	{
+		MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	
+	if (Pointer_Session->In_Flight_Send_Slots_Count == 0) MQTTIOUringReleaseSendSlots(Pointer_Session);
+}
+
+/** Process all completions posted by the kernel, the kernel can post new ones meanwhile.
+ * @param Pointer_Loop The loop.
+ */
+static void MQTTIOUringProcessCompletions(TMQTTIOUringLoop *Pointer_Loop)
+{
+	unsigned int Head, Tail;
+	
+	Head = *Pointer_Loop->Pointer_Completion_Queue_Head;
+	Tail = __atomic_load_n(Pointer_Loop->Pointer_Completion_Queue_Tail, __ATOMIC_ACQUIRE);
+	while (Head != Tail)
+	{
+		MQTTIOUringProcessCompletion(Pointer_Loop, &Pointer_Loop->Pointer_Completion_Queue_Entries[Head & Pointer_Loop->Completion_Queue_Mask]);
+		Head++;
+		
+		// Give the completion queue entries back to the kernel
+		__atomic_store_n(Pointer_Loop->Pointer_Completion_Queue_Head, Head, __ATOMIC_RELEASE);
+	}
+}
+
+/** Publish the filled submission queue entries, then make the kernel process them and optionally wait for completions.
+ * @param Pointer_Loop The loop.
+ * @param Maximum_Waiting_Time How many milliseconds to wait for a completion at most, -1 to wait forever, 0 to return as soon as the entries are submitted.
+ * @return -1 if an error occurred,
+ * @return 0 on success.
+ */
+static int MQTTIOUringEnter(TMQTTIOUringLoop *Pointer_Loop, int Maximum_Waiting_Time)
+{
+	struct io_uring_getevents_arg Arguments;
+	struct __kernel_timespec Timeout;
+	unsigned int Flags = 0, Minimum_Completions_Count = 0;
+	void *Pointer_Arguments = NULL;
+	size_t Arguments_Size = 0;
+	long Result;
+	
+	// The kernel reads the entries up to the tail, they must be fully written before the tail is updated
+	__atomic_store_n(Pointer_Loop->Pointer_Submission_Queue_Tail, Pointer_Loop->Submission_Queue_Tail, __ATOMIC_RELEASE);
+	
+	if (Maximum_Waiting_Time != 0)
+	{
+		Flags = IORING_ENTER_GETEVENTS;
+		Minimum_Completions_Count = 1;
+		
+		// Give the timeout with the extended arguments, so no timeout request needs to be submitted
+		if (Maximum_Waiting_Time > 0)
+		{
+			Timeout.tv_sec = Maximum_Waiting_Time / 1000;
+			Timeout.tv_nsec = (Maximum_Waiting_Time % 1000) * 1000000LL;
+			memset(&Arguments, 0, sizeof(Arguments));
+			Arguments.ts = (unsigned long long) (unsigned long) &Timeout;
+			Pointer_Arguments = &Arguments;
+			Arguments_Size = sizeof(Arguments);
+			Flags |= IORING_ENTER_EXT_ARG;
+		}
+	}
+	
+	Result = syscall(__NR_io_uring_enter, Pointer_Loop->Ring_Descriptor, Pointer_Loop->Pending_Submissions_Count, Minimum_Completions_Count, Flags, Pointer_Arguments, Arguments_Size);
+	Pointer_Loop->System_Calls_Count++;
+	if (Result < 0)
+	{
+		// The waiting has been interrupted or has timed out, or the completion queue must be emptied before submitting more entries
+		if ((errno == EINTR) || (errno == ETIME) || (errno == EAGAIN) || (errno == EBUSY)) return 0;
+		return -1;
+	}
+	Pointer_Loop->Pending_Submissions_Count -= (unsigned int) Result;
+	return 0;
+}
+
+/** Make sure that some submission queue entries are free, submitting the filled entries if needed.
+ * @param Pointer_Loop The loop.
+ * @param Entries_Count How many entries are needed.
+ * @return -1 if the kernel could not consume the filled entries,
+ * @return 0 on success.
+ * @note Completions may be processed to let the kernel accept the entries, so any session can be closed by this function.
+ */
+static int MQTTIOUringReserveEntries(TMQTTIOUringLoop *Pointer_Loop, unsigned int Entries_Count)
+{
+	if (MQTT_IO_URING_QUEUE_ENTRIES_COUNT - Pointer_Loop->Pending_Submissions_Count >= Entries_Count) return 0;
+	
+	if (MQTTIOUringEnter(Pointer_Loop, 0) != 0) return -1;
+	if (MQTT_IO_URING_QUEUE_ENTRIES_COUNT - Pointer_Loop->Pending_Submissions_Count >= Entries_Count) return 0;
+	
+	// The kernel refuses new entries while the completion queue is overflowing (EBUSY), so make room in it and try again
+	MQTTIOUringProcessCompletions(Pointer_Loop);
+	if (MQTTIOUringEnter(Pointer_Loop, 0) != 0) return -1;
+	if (MQTT_IO_URING_QUEUE_ENTRIES_COUNT - Pointer_Loop->Pending_Submissions_Count >= Entries_Count) return 0;
+	return -1;
+}
+
+/** Fill the next submission queue entry. Call MQTTIOUringReserveEntries() before to make sure the entry is free.
+ * @param Pointer_Loop The loop.
+ * @return The entry, zeroed.
+ */
+static struct io_uring_sqe *MQTTIOUringGetSubmissionQueueEntry(TMQTTIOUringLoop *Pointer_Loop)
+{
+	struct io_uring_sqe *Pointer_Entry;
+	unsigned int Index;
+	
+	// Submission queue positions and entries are used in the same order, so the array is the identity
+	Index = Pointer_Loop->Submission_Queue_Tail & (MQTT_IO_URING_QUEUE_ENTRIES_COUNT - 1);
+	Pointer_Entry = &Pointer_Loop->Pointer_Submission_Queue_Entries[Index];
+	memset(Pointer_Entry, 0, sizeof(struct io_uring_sqe));
+	Pointer_Loop->Pointer_Submission_Queue_Array[Index] = Index;
+	
+	Pointer_Loop->Submission_Queue_Tail++;
+	Pointer_Loop->Pending_Submissions_Count++;
+	return Pointer_Entry;
+}
+
+/** Post a multishot receive request, it will complete each time data are received until an error occurs.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @return -1 if no submission queue entry is available,
+ * @return 0 on success.
+ */
+static int MQTTIOUringPostReceiveRequest(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	struct io_uring_sqe *Pointer_Entry;
+	
+	if (MQTTIOUringReserveEntries(Pointer_Loop, 1) != 0) return -1;
+	if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) return 0; // The session has been closed by a completion processed while reserving the entry
+	
+	// The kernel picks a buffer from the receive buffers ring when data are available
+	Pointer_Entry = MQTTIOUringGetSubmissionQueueEntry(Pointer_Loop);
+	Pointer_Entry->opcode = IORING_OP_RECV;
+	Pointer_Entry->fd = Pointer_Session->Socket;
+	Pointer_Entry->ioprio = IORING_RECV_MULTISHOT;
+	Pointer_Entry->flags = IOSQE_BUFFER_SELECT;
+	Pointer_Entry->buf_group = MQTT_IO_URING_RECEIVE_BUFFERS_GROUP;
+	Pointer_Entry->user_data = MQTT_IO_URING_MAKE_USER_DATA(Pointer_Session - Pointer_Loop->Pointer_Sessions, Pointer_Session->Generation, 0, MQTT_IO_URING_OPERATION_RECEIVE);
+	
+	Pointer_Session->Is_Receive_Request_Posted = 1;
+	return 0;
+}
+
+/** Submit all queued messages of a session as a chain of linked writes, so the kernel sends them in order. Nothing is done while a previous chain is being sent, because two chains could be sent concurrently.
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ * @return -1 if no submission queue entry is available,
+ * @return 0 on success.
+ */
+static int MQTTIOUringSubmitSendChain(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	struct io_uring_sqe *Pointer_Entry;
+	TMQTTIOUringSendSlot *Pointer_Slot;
+	int Slots_Count, Slot_Index, Session_Index, i;
+	
+	if ((Pointer_Session->In_Flight_Send_Slots_Count > 0) || (Pointer_Session->Used_Send_Slots_Count == 0)) return 0;
+	
+	// A chain must be submitted by a single system call, the kernel does not link entries submitted separately
+	if (MQTTIOUringReserveEntries(Pointer_Loop, 1) != 0) return -1;
+	if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session) || (Pointer_Session->In_Flight_Send_Slots_Count > 0) || (Pointer_Session->Used_Send_Slots_Count == 0)) return 0; // Completions may have been processed while reserving the entries
+	Slots_Count = (int) (MQTT_IO_URING_QUEUE_ENTRIES_COUNT - Pointer_Loop->Pending_Submissions_Count);
+	if (Slots_Count > Pointer_Session->Used_Send_Slots_Count) Slots_Count = Pointer_Session->Used_Send_Slots_Count;
+	
+	Session_Index = (int) (Pointer_Session - Pointer_Loop->Pointer_Sessions);
+	for (i = 0; i < Slots_Count; i++)
+	{
+		Slot_Index = (Pointer_Session->Send_Slots_Head_Index + i) % MQTT_IO_URING_SEND_SLOTS_COUNT;
+		Pointer_Slot = &Pointer_Session->Send_Slots[Slot_Index];
+		
+		// Send the message part that has not been sent yet from the registered buffer
+		Pointer_Entry = MQTTIOUringGetSubmissionQueueEntry(Pointer_Loop);
+		Pointer_Entry->opcode = IORING_OP_WRITE_FIXED;
+		Pointer_Entry->fd = Pointer_Session->Socket;
+		Pointer_Entry->addr = (unsigned long) (Pointer_Session->Pointer_Send_Buffer + Slot_Index * Pointer_Session->Send_Slot_Size + Pointer_Slot->Message_Offset + Pointer_Slot->Sent_Size);
+		Pointer_Entry->len = (unsigned int) (Pointer_Slot->Message_Size - Pointer_Slot->Sent_Size);
+		Pointer_Entry->buf_index = (unsigned short) Session_Index;
+		Pointer_Entry->user_data = MQTT_IO_URING_MAKE_USER_DATA(Session_Index, Pointer_Session->Generation, Slot_Index, MQTT_IO_URING_OPERATION_SEND);
+		
+		// A short write cancels the following writes of the chain, so data are never sent out of order
+		if (i < Slots_Count - 1) Pointer_Entry->flags = IOSQE_IO_LINK;
+	}
+	
+	Pointer_Session->In_Flight_Send_Slots_Count = Slots_Count;
+	return 0;
+}
+
+/** Map the submission and completion queues of a new io_uring instance, then register the send buffers and the receive buffers ring.
+ * @param Pointer_Loop The loop, its sessions and its receive memory must be set.
+ * @return -1 if io_uring can't be used (the partially created instance must be destroyed),
+ * @return 0 on success.
+ */
+static int MQTTIOUringCreateRing(TMQTTIOUringLoop *Pointer_Loop)
+{
+	struct io_uring_params Parameters;
+	struct io_uring_buf_reg Buffers_Ring_Registration;
+	struct iovec *Pointer_IO_Vectors;
+	size_t Submission_Queue_Size, Completion_Queue_Size;
+	int i;
+	
+	// Multishot receive needs Linux 6.0, which is also the first version supporting the single issuer optimization, so the instance creation fails on older kernels
+	memset(&Parameters, 0, sizeof(Parameters));
+	Parameters.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+	Pointer_Loop->Ring_Descriptor = (int) syscall(__NR_io_uring_setup, MQTT_IO_URING_QUEUE_ENTRIES_COUNT, &Parameters);
+	if (Pointer_Loop->Ring_Descriptor < 0) return -1;
+	if (((Parameters.features & IORING_FEAT_SINGLE_MMAP) == 0) || ((Parameters.features & IORING_FEAT_EXT_ARG) == 0) || (Parameters.sq_entries != MQTT_IO_URING_QUEUE_ENTRIES_COUNT)) return -1;
+	
+	// Both queues rings are in the same mapping
+	Submission_Queue_Size = Parameters.sq_off.array + Parameters.sq_entries * sizeof(unsigned int);
+	Completion_Queue_Size = Parameters.cq_off.cqes + Parameters.cq_entries * sizeof(struct io_uring_cqe);
+	Pointer_Loop->Rings_Memory_Size = Submission_Queue_Size > Completion_Queue_Size ? Submission_Queue_Size : Completion_Queue_Size;
+	Pointer_Loop->Pointer_Rings_Memory = mmap(NULL, Pointer_Loop->Rings_Memory_Size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Pointer_Loop->Ring_Descriptor, IORING_OFF_SQ_RING);
+	if (Pointer_Loop->Pointer_Rings_Memory == MAP_FAILED)
+	{
+		Pointer_Loop->Pointer_Rings_Memory = NULL;
+		return -1;
+	}
+	Pointer_Loop->Pointer_Submission_Queue_Entries = mmap(NULL, MQTT_IO_URING_QUEUE_ENTRIES_COUNT * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Pointer_Loop->Ring_Descriptor, IORING_OFF_SQES);
+	if (Pointer_Loop->Pointer_Submission_Queue_Entries == MAP_FAILED)
+	{
+		Pointer_Loop->Pointer_Submission_Queue_Entries = NULL;
+		return -1;
+	}
+	
+	Pointer_Loop->Pointer_Submission_Queue_Tail = (unsigned int *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.sq_off.tail);
+	Pointer_Loop->Pointer_Submission_Queue_Array = (unsigned int *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.sq_off.array);
+	Pointer_Loop->Submission_Queue_Tail = *Pointer_Loop->Pointer_Submission_Queue_Tail;
+	Pointer_Loop->Pointer_Completion_Queue_Head = (unsigned int *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.cq_off.head);
+	Pointer_Loop->Pointer_Completion_Queue_Tail = (unsigned int *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.cq_off.tail);
+	Pointer_Loop->Completion_Queue_Mask = *(unsigned int *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.cq_off.ring_mask);
+	Pointer_Loop->Pointer_Completion_Queue_Entries = (struct io_uring_cqe *) (Pointer_Loop->Pointer_Rings_Memory + Parameters.cq_off.cqes);
+	
+	// Register each session send slots as a fixed buffer, the kernel pins them once instead of mapping them for each write. The receive buffers are not used yet, so they temporarily hold the IO vectors
+	Pointer_IO_Vectors = (struct iovec *) Pointer_Loop->Pointer_Receive_Buffers;
+	for (i = 0; i < Pointer_Loop->Sessions_Count; i++)
+	{
+		Pointer_IO_Vectors[i].iov_base = Pointer_Loop->Pointer_Sessions[i].Pointer_Send_Buffer;
+		Pointer_IO_Vectors[i].iov_len = (size_t) MQTT_IO_URING_SEND_SLOTS_COUNT * Pointer_Loop->Pointer_Sessions[i].Send_Slot_Size;
+	}
+	Pointer_Loop->System_Calls_Count++;
+	if (syscall(__NR_io_uring_register, Pointer_Loop->Ring_Descriptor, IORING_REGISTER_BUFFERS, Pointer_IO_Vectors, Pointer_Loop->Sessions_Count) != 0) return -1;
+	
+	// Provide all receive buffers to the kernel
+	memset(&Buffers_Ring_Registration, 0, sizeof(Buffers_Ring_Registration));
+	Buffers_Ring_Registration.ring_addr = (unsigned long) Pointer_Loop->Pointer_Receive_Buffers_Ring;
+	Buffers_Ring_Registration.ring_entries = MQTT_IO_URING_RECEIVE_BUFFERS_COUNT;
+	Buffers_Ring_Registration.bgid = MQTT_IO_URING_RECEIVE_BUFFERS_GROUP;
+	Pointer_Loop->System_Calls_Count++;
+	if (syscall(__NR_io_uring_register, Pointer_Loop->Ring_Descriptor, IORING_REGISTER_PBUF_RING, &Buffers_Ring_Registration, 1) != 0) return -1;
+	for (i = 0; i < MQTT_IO_URING_RECEIVE_BUFFERS_COUNT; i++) MQTTIOUringReleaseReceiveBuffer(Pointer_Loop, i);
+	
+	return 0;
+}
+
+/** Release the io_uring instance resources, registrations are removed when the instance is closed.
+ * @param Pointer_Loop The loop.
+ */
+static void MQTTIOUringDestroyRing(TMQTTIOUringLoop *Pointer_Loop)
+{
+	if (Pointer_Loop->Pointer_Submission_Queue_Entries != NULL)
+	{
+		munmap(Pointer_Loop->Pointer_Submission_Queue_Entries, MQTT_IO_URING_QUEUE_ENTRIES_COUNT * sizeof(struct io_uring_sqe));
+		Pointer_Loop->Pointer_Submission_Queue_Entries = NULL;
+	}
+	if (Pointer_Loop->Pointer_Rings_Memory != NULL)
+	{
+		munmap(Pointer_Loop->Pointer_Rings_Memory, Pointer_Loop->Rings_Memory_Size);
+		Pointer_Loop->Pointer_Rings_Memory = NULL;
+	}
+	if (Pointer_Loop->Ring_Descriptor >= 0)
+	{
+		close(Pointer_Loop->Ring_Descriptor);
+		Pointer_Loop->Ring_Descriptor = -1;
+	}
+}
+
+/** Send as much queued messages as the socket can accept with a single system call per round (fallback mode only).
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTIOUringFallbackFlushSendSlots(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	struct iovec IO_Vectors[MQTT_IO_URING_SEND_SLOTS_COUNT];
+	TMQTTIOUringSendSlot *Pointer_Slot;
+	int Slot_Index, Remaining_Size, i;
+	ssize_t Sent_Size;
+	
+	while (Pointer_Session->Used_Send_Slots_Count > 0)
+	{
+		for (i = 0; i < Pointer_Session->Used_Send_Slots_Count; i++)
+		{
+			Slot_Index = (Pointer_Session->Send_Slots_Head_Index + i) % MQTT_IO_URING_SEND_SLOTS_COUNT;
+			Pointer_Slot = &Pointer_Session->Send_Slots[Slot_Index];
+			IO_Vectors[i].iov_base = Pointer_Session->Pointer_Send_Buffer + Slot_Index * Pointer_Session->Send_Slot_Size + Pointer_Slot->Message_Offset + Pointer_Slot->Sent_Size;
+			IO_Vectors[i].iov_len = Pointer_Slot->Message_Size - Pointer_Slot->Sent_Size;
+		}
+		
+		Sent_Size = writev(Pointer_Session->Socket, IO_Vectors, Pointer_Session->Used_Send_Slots_Count);
+		Pointer_Loop->System_Calls_Count++;
+		if (Sent_Size < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if (errno == EINTR) continue;
+			MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+			return;
+		}
+		
+		// Account the sent bytes to the oldest messages
+		for (i = 0; Sent_Size > 0; i++)
+		{
+			Pointer_Slot = &Pointer_Session->Send_Slots[(Pointer_Session->Send_Slots_Head_Index + i) % MQTT_IO_URING_SEND_SLOTS_COUNT];
+			Remaining_Size = Pointer_Slot->Message_Size - Pointer_Slot->Sent_Size;
+			if (Sent_Size < Remaining_Size) Remaining_Size = (int) Sent_Size;
+			Pointer_Slot->Sent_Size += Remaining_Size;
+			Sent_Size -= Remaining_Size;
+		}
+		MQTTIOUringReleaseSendSlots(Pointer_Session);
+	}
+}
+
+/** Read and decode the data received by a session (fallback mode only).
+ * @param Pointer_Loop The loop.
+ * @param Pointer_Session The session.
+ */
+static void MQTTIOUringFallbackReceiveData(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	ssize_t Read_Size;
+	
+	do
+	{
+		Read_Size = read(Pointer_Session->Socket, Pointer_Loop->Pointer_Receive_Buffers, MQTT_IO_URING_RECEIVE_BUFFER_SIZE);
+		Pointer_Loop->System_Calls_Count++;
+	} while ((Read_Size < 0) && (errno == EINTR));
+	if (Read_Size < 0)
+	{
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+		MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	// Server closed the connection
+	if (Read_Size == 0)
+	{
+		MQTTIOUringAbortSession(Pointer_Loop, Pointer_Session);
+		return;
+	}
+	
+	MQTTIOUringDecodeData(Pointer_Loop, Pointer_Session, Pointer_Loop->Pointer_Receive_Buffers, (int) Read_Size);
+}
+
+/** Send the queued messages and receive data with poll(), writev() and read() (fallback mode only).
+ * @param Pointer_Loop The loop.
+ * @param Maximum_Waiting_Time How many milliseconds to wait for events at most, -1 to wait forever.
+ * @return -1 if an unrecoverable error occurred,
+ * @return 0 on success.
+ */
+static int MQTTIOUringFallbackProcessEvents(TMQTTIOUringLoop *Pointer_Loop, int Maximum_Waiting_Time)
+{
+	TMQTTIOUringSession *Pointer_Session;
+	struct pollfd *Pointer_Poll_Descriptor;
+	int i, Result;
+	
+	// Send the queued messages right now, sockets are non-blocking so only the data that do not fit in the sockets buffers are left
+	for (i = 0; i < Pointer_Loop->Sessions_Count; i++)
+	{
+		Pointer_Session = &Pointer_Loop->Pointer_Sessions[i];
+		Pointer_Poll_Descriptor = &Pointer_Loop->Pointer_Poll_Descriptors[i];
+		if (MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session) && (Pointer_Session->Used_Send_Slots_Count > 0)) MQTTIOUringFallbackFlushSendSlots(Pointer_Loop, Pointer_Session);
+		
+		// Negative descriptors are ignored by poll()
+		Pointer_Poll_Descriptor->fd = Pointer_Session->Socket;
+		Pointer_Poll_Descriptor->events = POLLIN;
+		if (Pointer_Session->Used_Send_Slots_Count > 0) Pointer_Poll_Descriptor->events |= POLLOUT;
+		Pointer_Poll_Descriptor->revents = 0;
+	}
+	
+	Result = poll(Pointer_Loop->Pointer_Poll_Descriptors, Pointer_Loop->Sessions_Count, Maximum_Waiting_Time);
+	Pointer_Loop->System_Calls_Count++;
+	if (Result < 0)
+	{
+		if (errno == EINTR) return 0;
+		return -1;
+	}
+	
+	for (i = 0; (i < Pointer_Loop->Sessions_Count) && (Result > 0); i++)
+	{
+		Pointer_Session = &Pointer_Loop->Pointer_Sessions[i];
+		Pointer_Poll_Descriptor = &Pointer_Loop->Pointer_Poll_Descriptors[i];
+		if (Pointer_Poll_Descriptor->revents == 0) continue;
+		Result--;
+		
+		// Session may have been closed while processing a previous session
+		if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) continue;
+		
+		// Receive data first, the server may have sent data before closing the connection
+		if (Pointer_Poll_Descriptor->revents & (POLLIN | POLLHUP | POLLERR))
+		{
+			MQTTIOUringFallbackReceiveData(Pointer_Loop, Pointer_Session);
+			if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) continue;
+		}
+		if ((Pointer_Poll_Descriptor->revents & POLLOUT) && (Pointer_Session->Used_Send_Slots_Count > 0)) MQTTIOUringFallbackFlushSendSlots(Pointer_Loop, Pointer_Session);
+	}
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+void MQTTIOUringInitializeSession(TMQTTIOUringSession *Pointer_Session, void *Pointer_Send_Buffer, int Send_Slot_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Session != NULL);
+	assert(Pointer_Send_Buffer != NULL);
+	assert(Send_Slot_Size > 0);
+	
+	memset(Pointer_Session, 0, sizeof(TMQTTIOUringSession));
+	Pointer_Session->Socket = -1;
+	Pointer_Session->Pointer_Send_Buffer = Pointer_Send_Buffer;
+	Pointer_Session->Send_Slot_Size = Send_Slot_Size;
+	MQTTDecoderInitialize(&Pointer_Session->Decoder, Pointer_Decoder_Buffer, Decoder_Buffer_Size);
+}
+
+int MQTTIOUringInitialize(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Sessions, int Sessions_Count)
+{
+	size_t Buffers_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Sessions != NULL);
+	assert(Sessions_Count > 0);
+	assert(Sessions_Count <= MQTT_IO_URING_MAXIMUM_SESSIONS_COUNT);
+	
+	memset(Pointer_Loop, 0, sizeof(TMQTTIOUringLoop));
+	Pointer_Loop->Pointer_Sessions = Pointer_Sessions;
+	Pointer_Loop->Sessions_Count = Sessions_Count;
+	Pointer_Loop->Ring_Descriptor = -1;
+	
+	// The buffers ring must be page-aligned, so all receive memory is directly mapped. The buffers area must also be able to hold the IO vectors used to register the send buffers
+	Buffers_Size = (size_t) MQTT_IO_URING_RECEIVE_BUFFERS_COUNT * MQTT_IO_URING_RECEIVE_BUFFER_SIZE;
+	if (Buffers_Size < Sessions_Count * sizeof(struct iovec)) Buffers_Size = Sessions_Count * sizeof(struct iovec);
+	Pointer_Loop->Receive_Memory_Size = MQTT_IO_URING_RECEIVE_BUFFERS_COUNT * sizeof(struct io_uring_buf) + Sessions_Count * sizeof(struct pollfd) + Buffers_Size;
+	Pointer_Loop->Pointer_Receive_Memory = mmap(NULL, Pointer_Loop->Receive_Memory_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (Pointer_Loop->Pointer_Receive_Memory == MAP_FAILED) return -1;
+	Pointer_Loop->Pointer_Receive_Buffers_Ring = (struct io_uring_buf_ring *) Pointer_Loop->Pointer_Receive_Memory;
+	Pointer_Loop->Pointer_Poll_Descriptors = (struct pollfd *) (Pointer_Loop->Pointer_Receive_Memory + MQTT_IO_URING_RECEIVE_BUFFERS_COUNT * sizeof(struct io_uring_buf));
+	Pointer_Loop->Pointer_Receive_Buffers = (unsigned char *) (Pointer_Loop->Pointer_Poll_Descriptors + Sessions_Count);
+	
+	// Keep working with the classic system calls when io_uring is not available
+	if (MQTTIOUringCreateRing(Pointer_Loop) != 0)
+	{
+		MQTTIOUringDestroyRing(Pointer_Loop);
+		Pointer_Loop->Is_Fallback_Used = 1;
+	}
+	return 0;
+}
+
+void MQTTIOUringUninitialize(TMQTTIOUringLoop *Pointer_Loop)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	
+	MQTTIOUringDestroyRing(Pointer_Loop);
+	munmap(Pointer_Loop->Pointer_Receive_Memory, Pointer_Loop->Receive_Memory_Size);
+}
+
+int MQTTIOUringAttach(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session, int Socket, int Protocol_Version)
+{
+	int Flags;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	assert(!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session));
+	assert(Socket >= 0);
+	
+	// The fallback must not block while other sessions have data to process, io_uring waits for the socket readiness by itself
+	if (Pointer_Loop->Is_Fallback_Used)
+	{
+		Flags = fcntl(Socket, F_GETFL);
+		if ((Flags < 0) || (fcntl(Socket, F_SETFL, Flags | O_NONBLOCK) != 0)) return -1;
+	}
+	
+	// Reset session state, the new generation makes the completions of the previous connection ignored
+	Pointer_Session->Socket = Socket;
+	Pointer_Session->Generation++;
+	Pointer_Session->Send_Slots_Head_Index = 0;
+	Pointer_Session->Used_Send_Slots_Count = 0;
+	Pointer_Session->In_Flight_Send_Slots_Count = 0;
+	Pointer_Session->Is_Receive_Request_Posted = 0;
+	MQTTInitializeContext(&Pointer_Session->Context, Pointer_Session->Pointer_Send_Buffer, Pointer_Session->Send_Slot_Size);
+	if (Protocol_Version == MQTT_PROTOCOL_VERSION_5) Pointer_Session->Context.Protocol_Version = MQTT_PROTOCOL_VERSION_5;
+	MQTTDecoderInitialize(&Pointer_Session->Decoder, Pointer_Session->Decoder.Pointer_Buffer, Pointer_Session->Decoder.Buffer_Size);
+	MQTTDecoderSetProtocolVersion(&Pointer_Session->Decoder, Protocol_Version);
+	return 0;
+}
+
+int MQTTIOUringSend(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	TMQTTIOUringSendSlot *Pointer_Slot;
+	int Slot_Index;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	
+	if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) return -1;
+	
+	// A slot must stay free to forge the next message
+	if (Pointer_Session->Used_Send_Slots_Count >= MQTT_IO_URING_SEND_SLOTS_COUNT - 1) return -1;
+	
+	// The message has been forged in the slot following the used ones
+	Slot_Index = (Pointer_Session->Send_Slots_Head_Index + Pointer_Session->Used_Send_Slots_Count) % MQTT_IO_URING_SEND_SLOTS_COUNT;
+	Pointer_Slot = &Pointer_Session->Send_Slots[Slot_Index];
+	Pointer_Slot->Message_Offset = (int) (MQTT_GET_MESSAGE_BUFFER(&Pointer_Session->Context) - Pointer_Session->Context.Pointer_Buffer);
+	Pointer_Slot->Message_Size = MQTT_GET_MESSAGE_SIZE(&Pointer_Session->Context);
+	Pointer_Slot->Sent_Size = 0;
+	Pointer_Session->Used_Send_Slots_Count++;
+	
+	// Forge the next message in the next slot, the context state (packet identifiers, topic aliases...) is kept
+	Pointer_Session->Context.Pointer_Buffer = Pointer_Session->Pointer_Send_Buffer + ((Slot_Index + 1) % MQTT_IO_URING_SEND_SLOTS_COUNT) * Pointer_Session->Send_Slot_Size;
+	return 0;
+}
+
+void MQTTIOUringClose(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	assert(Pointer_Session != NULL);
+	
+	if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) return;
+	
+	// Submit the entries still referencing the socket descriptor now, so they can't be applied to another socket reusing the same descriptor number
+	if (!Pointer_Loop->Is_Fallback_Used && (Pointer_Loop->Pending_Submissions_Count > 0)) MQTTIOUringEnter(Pointer_Loop, 0);
+	
+	// Shutting the connection down terminates the requests pending on the socket, their completions will be ignored
+	shutdown(Pointer_Session->Socket, SHUT_RDWR);
+	close(Pointer_Session->Socket);
+	Pointer_Session->Socket = -1;
+}
+
+int MQTTIOUringProcessEvents(TMQTTIOUringLoop *Pointer_Loop, int Maximum_Waiting_Time)
+{
+	TMQTTIOUringSession *Pointer_Session;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Loop != NULL);
+	
+	if (Pointer_Loop->Is_Fallback_Used) return MQTTIOUringFallbackProcessEvents(Pointer_Loop, Maximum_Waiting_Time);
+	
+	// Make sure each session waits for data, then submit the messages queued since the previous call
+	for (i = 0; i < Pointer_Loop->Sessions_Count; i++)
+	{
+		Pointer_Session = &Pointer_Loop->Pointer_Sessions[i];
+		if (!MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session)) continue;
+		
+		if ((!Pointer_Session->Is_Receive_Request_Posted && (MQTTIOUringPostReceiveRequest(Pointer_Loop, Pointer_Session) != 0)) || (MQTTIOUringSubmitSendChain(Pointer_Loop, Pointer_Session) != 0)) return -1;
+	}
+	
+	// Submit all requests and wait for completions with the same system call
+	if (((Pointer_Loop->Pending_Submissions_Count > 0) || (Maximum_Waiting_Time != 0)) && (MQTTIOUringEnter(Pointer_Loop, Maximum_Waiting_Time) != 0)) return -1;
+	
+	MQTTIOUringProcessCompletions(Pointer_Loop);
+	return 0;
+}
@@ -0,0 +1,196 @@
+/** @file MQTT_IO_Uring.h
+ * Linux transport sending and receiving the packets of many established MQTT sessions through io_uring, so a single system call can send and receive data for many messages.
+ * Each session owns a ring of send slots registered to the kernel as a fixed buffer. A message is forged in place in a slot, then all queued messages of a session are submitted as a chain of linked writes so the kernel sends them in order.
+ * Received data are read by a multishot receive request kept posted for each session, the kernel picks buffers from a ring shared by all sessions.
+ * When io_uring is not available (old kernel, disabled by the administrator or filtered by a sandbox), the same API falls back to poll(), writev() and read().
+ * The loop and its sessions must be used by the thread that initialized the loop, this lets the kernel skip the synchronization between submitters.
+ * Connection establishment and keep alive are left to the user : establish the MQTT connection on a blocking socket, then attach the socket to a session. PINGREQ packets can be forged and sent like any other packet.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_IO_URING_H
+#define H_MQTT_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <MQTT.h>
+#include <poll.h>
+#include <stddef.h>
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** How many requests the submission queue can hold. It must be a power of two. Define it in the makefile to change the value. */
+#ifndef MQTT_IO_URING_QUEUE_ENTRIES_COUNT
+	#define MQTT_IO_URING_QUEUE_ENTRIES_COUNT 1024
+#endif
+
+/** How many messages a session can have waiting to be sent, plus one slot used to forge the next message. The maximum value is 256. Define it in the makefile to change the value. */
+#ifndef MQTT_IO_URING_SEND_SLOTS_COUNT
+	#define MQTT_IO_URING_SEND_SLOTS_COUNT 64
+#endif
+
+/** How many buffers the kernel can fill with received data before they are decoded. It must be a power of two. Define it in the makefile to change the value. */
+#ifndef MQTT_IO_URING_RECEIVE_BUFFERS_COUNT
+	#define MQTT_IO_URING_RECEIVE_BUFFERS_COUNT 256
+#endif
+
+/** How many bytes a receive buffer can hold. Define it in the makefile to change the value. */
+#ifndef MQTT_IO_URING_RECEIVE_BUFFER_SIZE
+	#define MQTT_IO_URING_RECEIVE_BUFFER_SIZE 16384
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** A message waiting to be sent. */
+typedef struct
+{
+	int Message_Offset; //!< Where the message begins in the slot, the fixed header is not always at the slot beginning.
+	int Message_Size; //!< The message size in bytes.
+	int Sent_Size; //!< How many bytes of the message the kernel has sent yet.
+} TMQTTIOUringSendSlot;
+
+/** An established connection to a MQTT server. */
+typedef struct
+{
+	TMQTTContext Context; //!< Forge messages in this context, then send them with MQTTIOUringSend(). The context buffer is the free send slot, so it changes each time a message is sent.
+	void *Pointer_User_Data; //!< Free for user usage.
+	// Following fields are for internal usage only, do not modify or use
+	int Socket; //!< The connection socket, or -1 if the session is not attached. Use MQTT_IO_URING_IS_SESSION_ATTACHED() to get this field state.
+	unsigned int Generation; //!< Incremented each time the session is attached, so completions of a previous connection can be recognized.
+	TMQTTDecoder Decoder; //!< Extract packets from received data.
+	unsigned char *Pointer_Send_Buffer; //!< All send slots, registered to the kernel as a single fixed buffer.
+	int Send_Slot_Size; //!< The size of a send slot in bytes.
+	TMQTTIOUringSendSlot Send_Slots[MQTT_IO_URING_SEND_SLOTS_COUNT]; //!< The send slots ring.
+	int Send_Slots_Head_Index; //!< The oldest message not fully sent.
+	int Used_Send_Slots_Count; //!< How many messages are not fully sent, the following slot is the context buffer.
+	int In_Flight_Send_Slots_Count; //!< How many messages are currently submitted to the kernel, they are the oldest used slots.
+	int Is_Receive_Request_Posted; //!< Tell whether a multishot receive request is waiting for data.
+} TMQTTIOUringSession;
+
+/** Called for each packet received on a session.
+ * @param Pointer_Session The session the packet has been received on.
+ * @param Pointer_Packet The decoded packet. It is valid only during the handler call.
+ */
+typedef void (*TMQTTIOUringPacketHandler)(TMQTTIOUringSession *Pointer_Session, TMQTTPacket *Pointer_Packet);
+
+/** Called when a session has been closed because of a network error or a protocol error. The session socket is closed yet.
+ * @param Pointer_Session The closed session.
+ */
+typedef void (*TMQTTIOUringCloseHandler)(TMQTTIOUringSession *Pointer_Session);
+
+/** Event loop shared by all sessions. */
+typedef struct
+{
+	TMQTTIOUringPacketHandler Packet_Handler; //!< Can be NULL.
+	TMQTTIOUringCloseHandler Close_Handler; //!< Can be NULL.
+	// Following fields are for internal usage only, do not modify or use
+	int Is_Fallback_Used; //!< Set when io_uring could not be used. Use MQTT_IO_URING_IS_FALLBACK_USED() to get this field.
+	unsigned long long System_Calls_Count; //!< How many system calls the loop made to send and receive data. Use MQTT_IO_URING_GET_SYSTEM_CALLS_COUNT() to get this field.
+	TMQTTIOUringSession *Pointer_Sessions; //!< All sessions, a session index is also its fixed buffer index.
+	int Sessions_Count; //!< How many sessions the array holds.
+	int Ring_Descriptor; //!< The io_uring instance.
+	unsigned char *Pointer_Rings_Memory; //!< The submission and completion queues rings, mapped from the kernel.
+	size_t Rings_Memory_Size; //!< The rings mapping size in bytes.
+	struct io_uring_sqe *Pointer_Submission_Queue_Entries; //!< The submission queue entries, mapped from the kernel.
+	unsigned int *Pointer_Submission_Queue_Tail; //!< Incremented when entries are published to the kernel.
+	unsigned int *Pointer_Submission_Queue_Array; //!< Tell which entry each submission queue position uses.
+	unsigned int Submission_Queue_Tail; //!< The next free position, entries up to this position are published when the kernel is entered.
+	unsigned int Pending_Submissions_Count; //!< How many entries have not been submitted to the kernel yet.
+	unsigned int *Pointer_Completion_Queue_Head; //!< Incremented when a completion has been processed.
+	unsigned int *Pointer_Completion_Queue_Tail; //!< Incremented by the kernel when it posts a completion.
+	unsigned int Completion_Queue_Mask; //!< The completion queue entries count minus one.
+	struct io_uring_cqe *Pointer_Completion_Queue_Entries; //!< The completion queue entries, mapped from the kernel.
+	unsigned char *Pointer_Receive_Memory; //!< The receive buffers ring, the poll descriptors and the receive buffers.
+	size_t Receive_Memory_Size; //!< The receive memory mapping size in bytes.
+	struct io_uring_buf_ring *Pointer_Receive_Buffers_Ring; //!< The buffers the kernel can pick received data buffers from.
+	unsigned char *Pointer_Receive_Buffers; //!< All receive buffers.
+	unsigned short Receive_Buffers_Ring_Tail; //!< Where the next released buffer is given back to the kernel.
+	struct pollfd *Pointer_Poll_Descriptors; //!< Only used in fallback mode, one descriptor per session.
+} TMQTTIOUringLoop;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Tell whether io_uring could not be used, so the loop uses poll(), writev() and read() instead.
+ * @param Pointer_Loop An initialized loop.
+ * @return 1 if the fallback is used, 0 if io_uring is used.
+ */
+#define MQTT_IO_URING_IS_FALLBACK_USED(Pointer_Loop) (Pointer_Loop)->Is_Fallback_Used
+
+/** Retrieve how many system calls the loop made to send and receive data, compare it with the amount of sent messages to tune the batching.
+ * @param Pointer_Loop An initialized loop.
+ * @return The system calls count.
+ */
+#define MQTT_IO_URING_GET_SYSTEM_CALLS_COUNT(Pointer_Loop) (Pointer_Loop)->System_Calls_Count
+
+/** Tell whether a session is attached to a connection.
+ * @param Pointer_Session An initialized session.
+ * @return 1 if the session can send and receive data, 0 if it is closed.
+ */
+#define MQTT_IO_URING_IS_SESSION_ATTACHED(Pointer_Session) ((Pointer_Session)->Socket >= 0)
+
+/** Retrieve how many messages can be sent before MQTTIOUringSend() reports back pressure.
+ * @param Pointer_Session An attached session.
+ * @return The free send slots count.
+ */
+#define MQTT_IO_URING_GET_FREE_SEND_SLOTS_COUNT(Pointer_Session) (MQTT_IO_URING_SEND_SLOTS_COUNT - 1 - (Pointer_Session)->Used_Send_Slots_Count)
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Prepare a session memory. Call it for all sessions before initializing the loop.
+ * @param Pointer_Session The session to initialize.
+ * @param Pointer_Send_Buffer The send slots memory, it must be MQTT_IO_URING_SEND_SLOTS_COUNT * Send_Slot_Size bytes long. The kernel pins this memory while the loop exists.
+ * @param Send_Slot_Size A send slot size in bytes, it bounds the size of a message.
+ * @param Pointer_Decoder_Buffer Buffer used to reassemble received packets split across several reads.
+ * @param Decoder_Buffer_Size The decoder buffer size in bytes.
+ */
+void MQTTIOUringInitializeSession(TMQTTIOUringSession *Pointer_Session, void *Pointer_Send_Buffer, int Send_Slot_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size);
+
+/** Create the event loop and register all sessions send buffers. Set the handlers fields after calling this function.
+ * @param Pointer_Loop The loop to initialize.
+ * @param Pointer_Sessions The sessions driven by the loop, they must all have been initialized.
+ * @param Sessions_Count How many sessions the array holds. The kernel can register 16384 fixed buffers at most, so the fallback is used with more sessions.
+ * @return -1 if the loop memory could not be allocated (see errno for details),
+ * @return 0 on success (use MQTT_IO_URING_IS_FALLBACK_USED() to know whether io_uring is used).
+ */
+int MQTTIOUringInitialize(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Sessions, int Sessions_Count);
+
+/** Free the loop resources. Sessions must have been closed before.
+ * @param Pointer_Loop An initialized loop.
+ */
+void MQTTIOUringUninitialize(TMQTTIOUringLoop *Pointer_Loop);
+
+/** Drive a connection with a session. The context is initialized to forge messages in the first send slot.
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session A session that is not attached.
+ * @param Socket A socket on which the MQTT connection has been established. The session owns it from now on.
+ * @param Protocol_Version The connection protocol version, as given in the connection parameters.
+ * @return -1 if the socket could not be configured (see errno for details, the socket is not closed),
+ * @return 0 on success.
+ */
+int MQTTIOUringAttach(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session, int Socket, int Protocol_Version);
+
+/** Queue the message currently forged in the session context, then make the context forge the next message in another send slot. Queued messages are submitted to the kernel by MQTTIOUringProcessEvents().
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session An attached session.
+ * @return -1 if all send slots are used (nothing has been queued, call MQTTIOUringProcessEvents() before retrying without forging the message again),
+ * @return 0 on success.
+ */
+int MQTTIOUringSend(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session);
+
+/** Close a session connection immediately. The close handler is not called.
+ * @param Pointer_Loop An initialized loop.
+ * @param Pointer_Session The session to close. Nothing is done if the session is not attached.
+ */
+void MQTTIOUringClose(TMQTTIOUringLoop *Pointer_Loop, TMQTTIOUringSession *Pointer_Session);
+
+/** Submit the queued messages of all sessions, wait for completions and process them. A single system call is made when io_uring is used.
+ * @param Pointer_Loop An initialized loop.
+ * @param Maximum_Waiting_Time How many milliseconds to wait for a completion at most. Set to -1 to wait forever, or to 0 to only process the completions that are available.
+ * @return -1 if an unrecoverable error occurred (see errno for details),
+ * @return 0 on success.
+ */
+int MQTTIOUringProcessEvents(TMQTTIOUringLoop *Pointer_Loop, int Maximum_Waiting_Time);
+
+#endif
@@ -0,0 +1,313 @@
+/** @file MQTT_Outbox.c
+ * @see MQTT_Outbox.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <MQTT_Outbox.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Tell that a file contains an outbox ("MQOB" in ASCII). */
+#define MQTT_OUTBOX_MAGIC_NUMBER 0x4D514F42
+
+/** PUBLISH control packet type, stored in the fixed header first byte upper nibble. */
+#define MQTT_OUTBOX_PACKET_TYPE_PUBLISH 0x30
+/** PUBLISH fixed header DUP flag. */
+#define MQTT_OUTBOX_PUBLISH_FLAG_DUP 0x08
+/** PUBLISH fixed header QoS bits. */
+#define MQTT_OUTBOX_PUBLISH_FLAGS_QOS_MASK 0x06
+
+/** Access a ring byte from its offset.
+ * @param Pointer_Outbox The outbox.
+ * @param Offset The byte offset.
+ */
+#define MQTT_OUTBOX_BYTE(Pointer_Outbox, Offset) (Pointer_Outbox)->Pointer_Data[(Offset) % (Pointer_Outbox)->Pointer_Header->Data_Size]
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Decode the fixed header of a packet stored in the ring.
+ * @param Pointer_Outbox The outbox.
+ * @param Offset The packet first byte offset.
+ * @param End_Offset The offset right after the last valid byte.
+ * @return -1 if the packet is malformed or if it is not fully stored before the end offset,
+ * @return The whole packet size in bytes.
+ */
+static int MQTTOutboxGetPacketSize(TMQTTOutbox *Pointer_Outbox, unsigned long long Offset, unsigned long long End_Offset)
+{
+	unsigned char Byte;
+	int i, Remaining_Length = 0, Multiplier = 1;
+	
+	// Reserved packet types are never forged, they are found in a partially written packet
+	Byte = MQTT_OUTBOX_BYTE(Pointer_Outbox, Offset);
+	if (((Byte >> 4) == 0) || ((Byte >> 4) == 15)) return -1;
+	
+	// Remaining length field is made of 1 to 4 bytes
+	for (i = 1; i <= 4; i++)
+	{
+		if (Offset + i >= End_Offset) return -1;
+		Byte = MQTT_OUTBOX_BYTE(Pointer_Outbox, Offset + i);
+		Remaining_Length += (Byte & 0x7F) * Multiplier;
+		
+		// Is it the last byte ?
+		if ((Byte & 0x80) == 0)
+		{
+			if (Offset + 1 + i + Remaining_Length > End_Offset) return -1;
+			return 1 + i + Remaining_Length;
+		}
+		Multiplier <<= 7;
+	}
+	
+	return -1;
+}
+
+/** Find the end of the last packet fully contained in a ring area.
+ * @param Pointer_Outbox The outbox.
+ * @param Start_Offset The first packet offset.
+ * @param End_Offset The area end, it can be located in the middle of a packet.
+ * @return The offset right after the last packet that fully fits before the end offset (the start offset if there is no such packet).
+ */
+static unsigned long long MQTTOutboxFindPacketsEnd(TMQTTOutbox *Pointer_Outbox, unsigned long long Start_Offset, unsigned long long End_Offset)
+{
+	unsigned long long Offset = Start_Offset;
+	int Packet_Size;
+	
+	while (Offset < End_Offset)
+	{
+		Packet_Size = MQTTOutboxGetPacketSize(Pointer_Outbox, Offset, End_Offset);
+		if (Packet_Size < 0) break;
+		Offset += Packet_Size;
+	}
+	
+	return Offset;
+}
+
+/** Set the DUP flag of all QoS 1 and 2 PUBLISH packets in a ring area.
+ * @param Pointer_Outbox The outbox.
+ * @param Start_Offset The first packet offset.
+ * @param End_Offset The offset right after the last packet.
+ * @return The offset right after the last valid packet, which is lower than the end offset if a malformed packet was found.
+ */
+static unsigned long long MQTTOutboxSetDuplicateFlags(TMQTTOutbox *Pointer_Outbox, unsigned long long Start_Offset, unsigned long long End_Offset)
+{
+	unsigned long long Offset = Start_Offset;
+	unsigned char *Pointer_Byte;
+	int Packet_Size;
+	
+	while (Offset < End_Offset)
+	{
+		Packet_Size = MQTTOutboxGetPacketSize(Pointer_Outbox, Offset, End_Offset);
+		if (Packet_Size < 0) break;
+		
+		// QoS 0 packets are never acknowledged by the server, so they are not flagged
+		Pointer_Byte = &MQTT_OUTBOX_BYTE(Pointer_Outbox, Offset);
+		if (((*Pointer_Byte & 0xF0) == MQTT_OUTBOX_PACKET_TYPE_PUBLISH) && ((*Pointer_Byte & MQTT_OUTBOX_PUBLISH_FLAGS_QOS_MASK) != 0)) *Pointer_Byte |= MQTT_OUTBOX_PUBLISH_FLAG_DUP;
+		Offset += Packet_Size;
+	}
+	
+	return Offset;
+}
+
+/** Map an opened outbox file and check its content.
+ * @param Pointer_Outbox The outbox, its file descriptor must be set.
+ * @param Data_Size The expected ring size in bytes.
+ * @return -1 if an error occurred (errno is set, the file is not mapped),
+ * @return 0 on success.
+ */
+static int MQTTOutboxMapFile(TMQTTOutbox *Pointer_Outbox, unsigned int Data_Size)
+{
+	struct stat File_Status;
+	TMQTTOutboxFileHeader *Pointer_Header;
+	
+	// Give a new file its final size (the created area is filled with zeroes)
+	Pointer_Outbox->Mapping_Size = sizeof(TMQTTOutboxFileHeader) + Data_Size;
+	if (fstat(Pointer_Outbox->File_Descriptor, &File_Status) != 0) return -1;
+	if (File_Status.st_size == 0)
+	{
+		if (ftruncate(Pointer_Outbox->File_Descriptor, Pointer_Outbox->Mapping_Size) != 0) return -1;
+	}
+	else if ((size_t) File_Status.st_size != Pointer_Outbox->Mapping_Size)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	
+	Pointer_Header = mmap(NULL, Pointer_Outbox->Mapping_Size, PROT_READ | PROT_WRITE, MAP_SHARED, Pointer_Outbox->File_Descriptor, 0);
+	if (Pointer_Header == MAP_FAILED) return -1;
+	Pointer_Outbox->Pointer_Header = Pointer_Header;
+	Pointer_Outbox->Pointer_Data = (unsigned char *) Pointer_Header + sizeof(TMQTTOutboxFileHeader);
+	
+	// Initialize a new file header (this is also the case when a crash occurred before a new file header was fully written)
+	if (Pointer_Header->Magic_Number == 0)
+	{
+		Pointer_Header->Data_Size = Data_Size;
+		Pointer_Header->Write_Offset = 0;
+		Pointer_Header->Acknowledge_Offset = 0;
+		Pointer_Header->Magic_Number = MQTT_OUTBOX_MAGIC_NUMBER;
+	}
+	// Make sure an existing file is a consistent outbox
+	else if ((Pointer_Header->Magic_Number != MQTT_OUTBOX_MAGIC_NUMBER) || (Pointer_Header->Data_Size != Data_Size) || (Pointer_Header->Acknowledge_Offset > Pointer_Header->Write_Offset) || (Pointer_Header->Write_Offset - Pointer_Header->Acknowledge_Offset > Data_Size))
+	{
+		munmap(Pointer_Header, Pointer_Outbox->Mapping_Size);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	// All pending packets may have been sent before the file was closed, discard the packets following a partially written one
+	Pointer_Header->Write_Offset = MQTTOutboxSetDuplicateFlags(Pointer_Outbox, Pointer_Header->Acknowledge_Offset, Pointer_Header->Write_Offset);
+	Pointer_Outbox->Send_Offset = Pointer_Header->Acknowledge_Offset;
+	Pointer_Outbox->Sent_Packets_End_Offset = Pointer_Header->Acknowledge_Offset;
+	
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+int MQTTOutboxOpen(TMQTTOutbox *Pointer_Outbox, char *Pointer_String_File_Name, unsigned int Data_Size)
+{
+	int Saved_Errno;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	assert(Pointer_String_File_Name != NULL);
+	assert(Data_Size > 0);
+	
+	Pointer_Outbox->File_Descriptor = open(Pointer_String_File_Name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (Pointer_Outbox->File_Descriptor == -1) return -1;
+	
+	if (MQTTOutboxMapFile(Pointer_Outbox, Data_Size) != 0)
+	{
+		Saved_Errno = errno;
+		close(Pointer_Outbox->File_Descriptor);
+		errno = Saved_Errno;
+		return -1;
+	}
+	
+	return 0;
+}
+
+void MQTTOutboxClose(TMQTTOutbox *Pointer_Outbox)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	
+	msync(Pointer_Outbox->Pointer_Header, Pointer_Outbox->Mapping_Size, MS_ASYNC);
+	munmap(Pointer_Outbox->Pointer_Header, Pointer_Outbox->Mapping_Size);
+	close(Pointer_Outbox->File_Descriptor);
+}
+
+int MQTTOutboxAppend(TMQTTOutbox *Pointer_Outbox, void *Pointer_Packet, int Packet_Size)
+{
+	TMQTTOutboxFileHeader *Pointer_Header;
+	unsigned int Position, First_Part_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	assert(Pointer_Packet != NULL);
+	assert(Packet_Size > 0);
+	
+	Pointer_Header = Pointer_Outbox->Pointer_Header;
+	if (Pointer_Header->Write_Offset - Pointer_Header->Acknowledge_Offset + Packet_Size > Pointer_Header->Data_Size) return -1;
+	
+	// Split the copy when the packet wraps around the ring end
+	Position = Pointer_Header->Write_Offset % Pointer_Header->Data_Size;
+	First_Part_Size = Pointer_Header->Data_Size - Position;
+	if (First_Part_Size >= (unsigned int) Packet_Size) memcpy(Pointer_Outbox->Pointer_Data + Position, Pointer_Packet, Packet_Size);
+	else
+	{
+		memcpy(Pointer_Outbox->Pointer_Data + Position, Pointer_Packet, First_Part_Size);
+		memcpy(Pointer_Outbox->Pointer_Data, (unsigned char *) Pointer_Packet + First_Part_Size, Packet_Size - First_Part_Size);
+	}
+	
+	// The packet must be in the mapping before the offset tells it is there, so a process crash never exposes a partial packet (the kernel does not preserve this order when writing pages to the disk)
+	atomic_signal_fence(memory_order_release);
+	Pointer_Header->Write_Offset += Packet_Size;
+	return 0;
+}
+
+int MQTTOutboxPeek(TMQTTOutbox *Pointer_Outbox, TMQTTBufferSegment *Pointer_Segments, int Maximum_Size)
+{
+	unsigned long long Pending_Size;
+	unsigned int Position, First_Part_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	assert(Pointer_Segments != NULL);
+	assert(Maximum_Size > 0);
+	
+	Pending_Size = Pointer_Outbox->Pointer_Header->Write_Offset - Pointer_Outbox->Send_Offset;
+	if (Pending_Size == 0) return 0;
+	if (Pending_Size > (unsigned long long) Maximum_Size) Pending_Size = Maximum_Size;
+	
+	Position = Pointer_Outbox->Send_Offset % Pointer_Outbox->Pointer_Header->Data_Size;
+	First_Part_Size = Pointer_Outbox->Pointer_Header->Data_Size - Position;
+	Pointer_Segments[0].Pointer_Buffer = Pointer_Outbox->Pointer_Data + Position;
+	if (Pending_Size <= First_Part_Size)
+	{
+		Pointer_Segments[0].Size = (int) Pending_Size;
+		return 1;
+	}
+	
+	// Data wraps around the ring end
+	Pointer_Segments[0].Size = (int) First_Part_Size;
+	Pointer_Segments[1].Pointer_Buffer = Pointer_Outbox->Pointer_Data;
+	Pointer_Segments[1].Size = (int) (Pending_Size - First_Part_Size);
+	return 2;
+}
+
+void MQTTOutboxConsume(TMQTTOutbox *Pointer_Outbox, int Sent_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	assert(Sent_Size >= 0);
+	assert(Pointer_Outbox->Send_Offset + Sent_Size <= Pointer_Outbox->Pointer_Header->Write_Offset);
+	
+	Pointer_Outbox->Send_Offset += Sent_Size;
+	
+	// Only whole packets can be acknowledged, so find the last one that has been fully sent
+	Pointer_Outbox->Sent_Packets_End_Offset = MQTTOutboxFindPacketsEnd(Pointer_Outbox, Pointer_Outbox->Sent_Packets_End_Offset, Pointer_Outbox->Send_Offset);
+}
+
+void MQTTOutboxAcknowledge(TMQTTOutbox *Pointer_Outbox, unsigned long long Offset)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	assert(Offset <= Pointer_Outbox->Pointer_Header->Write_Offset);
+	
+	if (Offset <= Pointer_Outbox->Pointer_Header->Acknowledge_Offset) return;
+	
+	// The acknowledge offset must stay on a packet boundary, because packets are parsed from it when the outbox is opened or rewound
+	Offset = MQTTOutboxFindPacketsEnd(Pointer_Outbox, Pointer_Outbox->Pointer_Header->Acknowledge_Offset, Offset);
+	Pointer_Outbox->Pointer_Header->Acknowledge_Offset = Offset;
+	
+	// There is no need to send acknowledged data again
+	if (Pointer_Outbox->Send_Offset < Offset) Pointer_Outbox->Send_Offset = Offset;
+	if (Pointer_Outbox->Sent_Packets_End_Offset < Offset) Pointer_Outbox->Sent_Packets_End_Offset = Offset;
+}
+
+void MQTTOutboxRewind(TMQTTOutbox *Pointer_Outbox)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	
+	MQTTOutboxSetDuplicateFlags(Pointer_Outbox, Pointer_Outbox->Pointer_Header->Acknowledge_Offset, Pointer_Outbox->Sent_Packets_End_Offset);
+	Pointer_Outbox->Send_Offset = Pointer_Outbox->Pointer_Header->Acknowledge_Offset;
+	Pointer_Outbox->Sent_Packets_End_Offset = Pointer_Outbox->Pointer_Header->Acknowledge_Offset;
+}
+
+int MQTTOutboxSynchronize(TMQTTOutbox *Pointer_Outbox, int Is_Waiting_For_Completion)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Outbox != NULL);
+	
+	return msync(Pointer_Outbox->Pointer_Header, Pointer_Outbox->Mapping_Size, Is_Waiting_For_Completion ? MS_SYNC : MS_ASYNC);
+}
@@ -0,0 +1,120 @@
+/** @file MQTT_Outbox.h
+ * Store-and-forward outbox keeping encoded packets in a memory-mapped ring file, so messages published while the server is unreachable are not lost, even if the program crashes.
+ * Packets are appended as forged by MQTTPublish() (or any other packet forging function). The unacknowledged part of the ring is replayed after a reconnection as big contiguous chunks.
+ * Writing to the file is done by the kernel page cache, the outbox never calls fsync() on its own. Call MQTTOutboxSynchronize() periodically, the packets appended after the last completed synchronization are not reliable after a power failure.
+ * This module is POSIX only. No dynamic allocation is done.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_OUTBOX_H
+#define H_MQTT_OUTBOX_H
+
+#include <MQTT.h>
+#include <stddef.h>
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** The outbox state, stored at the file beginning. Offsets always increase, the ring position is the offset modulo the data size. */
+typedef struct
+{
+	unsigned int Magic_Number; //!< Tell that the file has been initialized.
+	unsigned int Data_Size; //!< The ring size in bytes.
+	unsigned long long Write_Offset; //!< Where the next packet will be appended.
+	unsigned long long Acknowledge_Offset; //!< All data before this offset can be overwritten.
+} TMQTTOutboxFileHeader;
+
+/** A packets ring stored in a file. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTOutboxFileHeader *Pointer_Header; //!< The mapped file beginning.
+	unsigned char *Pointer_Data; //!< The ring first byte.
+	unsigned long long Send_Offset; //!< The first byte that has not been sent yet. It is not stored in the file, so everything not acknowledged is sent again after a restart.
+	unsigned long long Sent_Packets_End_Offset; //!< The offset right after the last fully sent packet, Send_Offset can be in the middle of the following packet. Use MQTT_OUTBOX_GET_SEND_OFFSET() to get this field.
+	size_t Mapping_Size; //!< The whole file size in bytes.
+	int File_Descriptor; //!< The opened file.
+} TMQTTOutbox;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Retrieve the offset right after the last appended packet. Store it after an append, then give it to MQTTOutboxAcknowledge() when the server acknowledged the packet.
+ * @param Pointer_Outbox An opened outbox.
+ * @return The write offset.
+ */
+#define MQTT_OUTBOX_GET_WRITE_OFFSET(Pointer_Outbox) (Pointer_Outbox)->Pointer_Header->Write_Offset
+
+/** Retrieve the offset right after the last fully sent packet (a packet partially sent by MQTTOutboxConsume() is not included). Give it to MQTTOutboxAcknowledge() to release QoS 0 packets as soon as they have been sent.
+ * @param Pointer_Outbox An opened outbox.
+ * @return The send offset, always located on a packet boundary.
+ */
+#define MQTT_OUTBOX_GET_SEND_OFFSET(Pointer_Outbox) (Pointer_Outbox)->Sent_Packets_End_Offset
+
+/** Retrieve how many bytes have been appended but not acknowledged yet.
+ * @param Pointer_Outbox An opened outbox.
+ * @return The pending data size in bytes.
+ */
+#define MQTT_OUTBOX_GET_PENDING_SIZE(Pointer_Outbox) ((Pointer_Outbox)->Pointer_Header->Write_Offset - (Pointer_Outbox)->Pointer_Header->Acknowledge_Offset)
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Open an outbox file, creating it if it does not exist. The packets that were not acknowledged when the file was closed are ready to be sent again, with the DUP flag set for QoS 1 and 2 PUBLISH packets.
+ * @param Pointer_Outbox On output, the opened outbox.
+ * @param Pointer_String_File_Name The file path.
+ * @param Data_Size The ring size in bytes. It must match the size the file was created with.
+ * @return -1 if an error occurred (errno is set, EINVAL tells that the file has been created with another size or is corrupted),
+ * @return 0 on success.
+ * @note After a process crash, all appended packets are recovered. After a power loss, only the packets appended before the last completed MQTTOutboxSynchronize(..., 1) call are guaranteed to be recovered: the page cache may write the header before the packets data, and stale packets from the previous ring lap can't be told apart from the lost ones.
+ */
+int MQTTOutboxOpen(TMQTTOutbox *Pointer_Outbox, char *Pointer_String_File_Name, unsigned int Data_Size);
+
+/** Schedule the writing of all pending data to the disk, then close the file.
+ * @param Pointer_Outbox An opened outbox.
+ */
+void MQTTOutboxClose(TMQTTOutbox *Pointer_Outbox);
+
+/** Copy a forged packet at the ring end.
+ * @param Pointer_Outbox An opened outbox.
+ * @param Pointer_Packet The whole packet, as returned by MQTT_GET_MESSAGE_BUFFER().
+ * @param Packet_Size The packet size in bytes, as returned by MQTT_GET_MESSAGE_SIZE(). The packet must not use a topic alias, because it may be sent on another connection.
+ * @return -1 if there is not enough free space (the oldest packets must be acknowledged first),
+ * @return 0 on success.
+ */
+int MQTTOutboxAppend(TMQTTOutbox *Pointer_Outbox, void *Pointer_Packet, int Packet_Size);
+
+/** Retrieve the data that has not been sent yet, as at most two contiguous chunks (the second one is used when the data wraps around the ring end).
+ * @param Pointer_Outbox An opened outbox.
+ * @param Pointer_Segments On output, contain the chunks to send. The array must have room for two segments.
+ * @param Maximum_Size How many bytes can be retrieved at most. The last chunk may end in the middle of a packet.
+ * @return How many segments have been filled (0 if all data has been sent).
+ */
+int MQTTOutboxPeek(TMQTTOutbox *Pointer_Outbox, TMQTTBufferSegment *Pointer_Segments, int Maximum_Size);
+
+/** Tell how many bytes returned by MQTTOutboxPeek() have been sent, partial sends are allowed.
+ * @param Pointer_Outbox An opened outbox.
+ * @param Sent_Size How many bytes have been sent.
+ */
+void MQTTOutboxConsume(TMQTTOutbox *Pointer_Outbox, int Sent_Size);
+
+/** Release all packets before an offset, their space can be reused by following appends. The acknowledge is cumulative: all packets before the offset are released, even if the server did not acknowledge some of them yet.
+ * @param Pointer_Outbox An opened outbox.
+ * @param Offset A value returned by MQTT_OUTBOX_GET_WRITE_OFFSET() or MQTT_OUTBOX_GET_SEND_OFFSET(). Offsets lower than the current acknowledge offset are ignored. An offset located in the middle of a packet is rounded down to this packet beginning.
+ * @note Acknowledges must be given in the packets order. When the server acknowledges packets out of order (for instance a PUBACK for a QoS 1 packet received before the PUBCOMP of a previous QoS 2 packet), keep the later offset until all previous packets have been acknowledged, otherwise an unacknowledged packet is lost.
+ */
+void MQTTOutboxAcknowledge(TMQTTOutbox *Pointer_Outbox, unsigned long long Offset);
+
+/** Send again all sent but not acknowledged packets. Call this function after a reconnection. The DUP flag is set for QoS 1 and 2 PUBLISH packets.
+ * @param Pointer_Outbox An opened outbox.
+ */
+void MQTTOutboxRewind(TMQTTOutbox *Pointer_Outbox);
+
+/** Start writing the outbox content to the disk.
+ * @param Pointer_Outbox An opened outbox.
+ * @param Is_Waiting_For_Completion Set to 1 to wait for the data to be written to the disk, set to 0 to return immediately.
+ * @return -1 if an error occurred (errno is set),
+ * @return 0 on success.
+ */
+int MQTTOutboxSynchronize(TMQTTOutbox *Pointer_Outbox, int Is_Waiting_For_Completion);
+
+#endif
@@ -0,0 +1,146 @@
+/** @file MQTT_Pool.c
+ * @see MQTT_Pool.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <MQTT_Pool.h>
+#include <stddef.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Round a size to the next multiple of a pointer size, so all blocks are correctly aligned and can store the free list link.
+ * @param Size The size to round.
+ */
+#define MQTT_POOL_ALIGN_SIZE(Size) (((Size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+int MQTTPoolInitialize(TMQTTPool *Pointer_Pool, void *Pointer_Buffer, int Buffer_Size, const int *Pointer_Blocks_Sizes, const int *Pointer_Blocks_Counts, int Size_Classes_Count)
+{
+	TMQTTPoolSizeClass *Pointer_Size_Class;
+	unsigned char *Pointer_Memory, *Pointer_Memory_End, *Pointer_Block;
+	int i, j, Block_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Pool != NULL);
+	assert(Pointer_Buffer != NULL);
+	assert(Pointer_Blocks_Sizes != NULL);
+	assert(Pointer_Blocks_Counts != NULL);
+	assert((Size_Classes_Count > 0) && (Size_Classes_Count <= MQTT_POOL_SIZE_CLASSES_MAXIMUM_COUNT));
+	
+	// Start from an aligned address
+	Pointer_Memory = (unsigned char *) MQTT_POOL_ALIGN_SIZE((size_t) Pointer_Buffer);
+	Pointer_Memory_End = (unsigned char *) Pointer_Buffer + Buffer_Size;
+	if (Pointer_Memory > Pointer_Memory_End) return -1; // The buffer is smaller than the alignment padding
+	
+	for (i = 0; i < Size_Classes_Count; i++)
+	{
+		assert(Pointer_Blocks_Sizes[i] > 0);
+		assert((i == 0) || (Pointer_Blocks_Sizes[i] > Pointer_Blocks_Sizes[i - 1]));
+		assert(Pointer_Blocks_Counts[i] >= 0);
+		
+		// Make sure all blocks of this class fit in the remaining memory
+		Block_Size = (int) MQTT_POOL_ALIGN_SIZE(Pointer_Blocks_Sizes[i]);
+		if ((size_t) (Pointer_Memory_End - Pointer_Memory) < (size_t) Block_Size * Pointer_Blocks_Counts[i]) return -1;
+		
+		Pointer_Size_Class = &Pointer_Pool->Size_Classes[i];
+		Pointer_Size_Class->Pointer_Memory_Start = Pointer_Memory;
+		Pointer_Size_Class->Block_Size = Block_Size;
+		Pointer_Size_Class->Free_Blocks_Count = Pointer_Blocks_Counts[i];
+		
+		// Chain all blocks in the free list, in address order
+		Pointer_Size_Class->Pointer_Free_Blocks = NULL;
+		for (j = Pointer_Blocks_Counts[i] - 1; j >= 0; j--)
+		{
+			Pointer_Block = Pointer_Memory + j * Block_Size;
+			*((void **) Pointer_Block) = Pointer_Size_Class->Pointer_Free_Blocks;
+			Pointer_Size_Class->Pointer_Free_Blocks = Pointer_Block;
+		}
+		Pointer_Memory += Block_Size * Pointer_Blocks_Counts[i];
+		Pointer_Size_Class->Pointer_Memory_End = Pointer_Memory;
+	}
+	Pointer_Pool->Size_Classes_Count = Size_Classes_Count;
+	
+	return 0;
+}
+
+void *MQTTPoolAllocate(TMQTTPool *Pointer_Pool, int Size, int *Pointer_Block_Size)
+{
+	TMQTTPoolSizeClass *Pointer_Size_Class;
+	void *Pointer_Block;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Pool != NULL);
+	
+	// Use a bigger class when the best fitting one is exhausted
+	for (i = 0; i < Pointer_Pool->Size_Classes_Count; i++)
+	{
+		Pointer_Size_Class = &Pointer_Pool->Size_Classes[i];
+		if ((Pointer_Size_Class->Block_Size < Size) || (Pointer_Size_Class->Pointer_Free_Blocks == NULL)) continue;
+		
+		// Unlink the first free block
+		Pointer_Block = Pointer_Size_Class->Pointer_Free_Blocks;
+		Pointer_Size_Class->Pointer_Free_Blocks = *((void **) Pointer_Block);
+		Pointer_Size_Class->Free_Blocks_Count--;
+		
+		if (Pointer_Block_Size != NULL) *Pointer_Block_Size = Pointer_Size_Class->Block_Size;
+		return Pointer_Block;
+	}
+	
+	return NULL;
+}
+
+void MQTTPoolFree(TMQTTPool *Pointer_Pool, void *Pointer_Block)
+{
+	TMQTTPoolSizeClass *Pointer_Size_Class;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Pool != NULL);
+	assert(Pointer_Block != NULL);
+	
+	// Find the class the block belongs to from its address
+	for (i = 0; i < Pointer_Pool->Size_Classes_Count; i++)
+	{
+		Pointer_Size_Class = &Pointer_Pool->Size_Classes[i];
+		if (((unsigned char *) Pointer_Block < Pointer_Size_Class->Pointer_Memory_Start) || ((unsigned char *) Pointer_Block >= Pointer_Size_Class->Pointer_Memory_End)) continue;
+		
+		// Put the block back at the free list head, so the most recently used memory (which is likely in cache) is allocated first
+		*((void **) Pointer_Block) = Pointer_Size_Class->Pointer_Free_Blocks;
+		Pointer_Size_Class->Pointer_Free_Blocks = Pointer_Block;
+		Pointer_Size_Class->Free_Blocks_Count++;
+		return;
+	}
+	
+	// The block does not belong to this pool
+	assert(0);
+}
+
+int MQTTPoolBorrowBuffer(TMQTTPool *Pointer_Pool, TMQTTContext *Pointer_Context, int Size)
+{
+	void *Pointer_Block;
+	int Block_Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	
+	Pointer_Block = MQTTPoolAllocate(Pointer_Pool, Size, &Block_Size);
+	if (Pointer_Block == NULL) return -1;
+	
+	// The whole block can be used, even if it is bigger than requested
+	MQTTSetBuffer(Pointer_Context, Pointer_Block, Block_Size);
+	return 0;
+}
+
+void MQTTPoolReleaseBuffer(TMQTTPool *Pointer_Pool, TMQTTContext *Pointer_Context)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Context != NULL);
+	
+	MQTTPoolFree(Pointer_Pool, Pointer_Context->Pointer_Buffer);
+	Pointer_Context->Pointer_Buffer = NULL;
+	Pointer_Context->Buffer_Size = 0;
+}
@@ -0,0 +1,85 @@
+/** @file MQTT_Pool.h
+ * Fixed-size blocks allocator with several size classes, so many sessions can share a small amount of memory by borrowing a buffer only while a packet is forged and sent.
+ * Blocks are taken from a user-provided buffer, no dynamic allocation is done. Allocating and freeing a block have a constant cost. The pool is not thread-safe.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_POOL_H
+#define H_MQTT_POOL_H
+
+#include <MQTT.h>
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** How many size classes a pool can have at most. Define it in the makefile to change the value. */
+#ifndef MQTT_POOL_SIZE_CLASSES_MAXIMUM_COUNT
+	#define MQTT_POOL_SIZE_CLASSES_MAXIMUM_COUNT 8
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** All blocks having the same size. */
+typedef struct
+{
+	unsigned char *Pointer_Memory_Start; //!< The first block.
+	unsigned char *Pointer_Memory_End; //!< The first byte after the last block.
+	void *Pointer_Free_Blocks; //!< The free blocks list head, each free block stores the address of the next one.
+	int Block_Size; //!< Each block size in bytes.
+	int Free_Blocks_Count; //!< How many blocks can still be allocated.
+} TMQTTPoolSizeClass;
+
+/** A blocks allocator. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTPoolSizeClass Size_Classes[MQTT_POOL_SIZE_CLASSES_MAXIMUM_COUNT]; //!< All size classes, sorted by increasing block size.
+	int Size_Classes_Count; //!< How many size classes are used.
+} TMQTTPool;
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Split a buffer into blocks.
+ * @param Pointer_Pool The pool to initialize.
+ * @param Pointer_Buffer The memory in which all blocks are stored. It must stay valid as long as the pool is used.
+ * @param Buffer_Size The buffer size in bytes. It must be at least the sum of each size class block size (rounded up to a pointer size multiple) multiplied by its blocks count.
+ * @param Pointer_Blocks_Sizes Each size class block size in bytes, sorted by increasing size.
+ * @param Pointer_Blocks_Counts How many blocks each size class has.
+ * @param Size_Classes_Count How many size classes are provided, up to MQTT_POOL_SIZE_CLASSES_MAXIMUM_COUNT.
+ * @return -1 if the buffer is too small,
+ * @return 0 on success.
+ */
+int MQTTPoolInitialize(TMQTTPool *Pointer_Pool, void *Pointer_Buffer, int Buffer_Size, const int *Pointer_Blocks_Sizes, const int *Pointer_Blocks_Counts, int Size_Classes_Count);
+
+/** Allocate a block from the smallest size class that can hold the requested size and still has free blocks.
+ * @param Pointer_Pool An initialized pool.
+ * @param Size The needed size in bytes.
+ * @param Pointer_Block_Size On output, contain the allocated block size, which can be bigger than the requested size. Set to NULL if this value is not needed.
+ * @return NULL if no block is big enough or if all big enough blocks are used,
+ * @return The allocated block on success.
+ */
+void *MQTTPoolAllocate(TMQTTPool *Pointer_Pool, int Size, int *Pointer_Block_Size);
+
+/** Give a block back to the pool.
+ * @param Pointer_Pool An initialized pool.
+ * @param Pointer_Block A block returned by MQTTPoolAllocate().
+ */
+void MQTTPoolFree(TMQTTPool *Pointer_Pool, void *Pointer_Block);
+
+/** Allocate a block and make it the buffer in which a context forges messages.
+ * @param Pointer_Pool An initialized pool.
+ * @param Pointer_Context A context previously initialized with a call to MQTTConnect().
+ * @param Size The needed size in bytes, as returned by a MQTTComputeXxxBufferSize() function.
+ * @return -1 if no block could be allocated (the context buffer is not modified),
+ * @return 0 on success. Release the buffer with MQTTPoolReleaseBuffer() as soon as the forged message has been sent or copied.
+ */
+int MQTTPoolBorrowBuffer(TMQTTPool *Pointer_Pool, TMQTTContext *Pointer_Context, int Size);
+
+/** Give a context buffer borrowed with MQTTPoolBorrowBuffer() back to the pool. The context must not be used to forge messages until another buffer is borrowed or set.
+ * @param Pointer_Pool An initialized pool.
+ * @param Pointer_Context A context having a borrowed buffer.
+ */
+void MQTTPoolReleaseBuffer(TMQTTPool *Pointer_Pool, TMQTTContext *Pointer_Context);
+
+#endif
@@ -0,0 +1,143 @@
+/** @file MQTT_Publish_Queue.c
+ * @see MQTT_Publish_Queue.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <MQTT_Publish_Queue.h>
+#include <stddef.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+void MQTTPublishQueueInitialize(TMQTTPublishQueue *Pointer_Queue, TMQTTPublishQueueSlot *Pointer_Slots, int Slots_Count, void *Pointer_Buffer, int Slot_Buffer_Size, int Protocol_Version)
+{
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Queue != NULL);
+	assert(Pointer_Slots != NULL);
+	assert(Slots_Count >= 2); // With a single slot, a committed packet sequence would match the next producer turn
+	assert((Slots_Count & (Slots_Count - 1)) == 0);
+	assert(Pointer_Buffer != NULL);
+	assert(Slot_Buffer_Size > 5); // Room for the biggest fixed header is always reserved
+	
+	Pointer_Queue->Pointer_Slots = Pointer_Slots;
+	Pointer_Queue->Slots_Mask = (unsigned int) Slots_Count - 1;
+	Pointer_Queue->Slot_Buffer_Size = Slot_Buffer_Size;
+	atomic_init(&Pointer_Queue->Enqueue_Position, 0);
+	Pointer_Queue->Dequeue_Position = 0;
+	
+	// Each slot sequence starts with the position of the first producer turn it can be used at
+	for (i = 0; i < Slots_Count; i++)
+	{
+		// Slot contexts are used by all producers, so they can't share a topic aliases table
+		MQTTInitializeContext(&Pointer_Slots[i].Context, (unsigned char *) Pointer_Buffer + i * Slot_Buffer_Size, Slot_Buffer_Size);
+		if (Protocol_Version == MQTT_PROTOCOL_VERSION_5) Pointer_Slots[i].Context.Protocol_Version = MQTT_PROTOCOL_VERSION_5;
+		atomic_init(&Pointer_Slots[i].Sequence, (unsigned int) i);
+	}
+}
+
+TMQTTPublishQueueSlot *MQTTPublishQueueReserve(TMQTTPublishQueue *Pointer_Queue)
+{
+	TMQTTPublishQueueSlot *Pointer_Slot;
+	unsigned int Position, Sequence;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Queue != NULL);
+	
+	Position = atomic_load_explicit(&Pointer_Queue->Enqueue_Position, memory_order_relaxed);
+	while (1)
+	{
+		Pointer_Slot = &Pointer_Queue->Pointer_Slots[Position & Pointer_Queue->Slots_Mask];
+		Sequence = atomic_load_explicit(&Pointer_Slot->Sequence, memory_order_acquire);
+		
+		// The slot is free for this turn, try to claim it (the comparison reloads the current position on failure)
+		if (Sequence == Position)
+		{
+			if (atomic_compare_exchange_weak_explicit(&Pointer_Queue->Enqueue_Position, &Position, Position + 1, memory_order_relaxed, memory_order_relaxed)) break;
+		}
+		// The slot still holds the packet of the previous turn, so the queue is full
+		else if ((int) (Sequence - Position) < 0) return NULL;
+		// Another producer claimed the slot in the meantime
+		else Position = atomic_load_explicit(&Pointer_Queue->Enqueue_Position, memory_order_relaxed);
+	}
+	
+	Pointer_Slot->Position = Position;
+	return Pointer_Slot;
+}
+
+void MQTTPublishQueueCommit(TMQTTPublishQueueSlot *Pointer_Slot)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Slot != NULL);
+	
+	// Release ordering makes the packet content visible to the consumer before the slot is seen as ready
+	atomic_store_explicit(&Pointer_Slot->Sequence, Pointer_Slot->Position + 1, memory_order_release);
+}
+
+int MQTTPublishQueuePublish(TMQTTPublishQueue *Pointer_Queue, char *Pointer_String_Topic_Name, int Flags, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size)
+{
+	TMQTTPublishQueueSlot *Pointer_Slot;
+	int Size;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Queue != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	
+	// Make sure the packet can be forged before claiming a slot, because a claimed slot must always be committed
+	if (MQTTCheckTopicName(Pointer_String_Topic_Name, strlen(Pointer_String_Topic_Name)) != 0) return -1;
+	Size = MQTTComputePublishBufferSize(Pointer_String_Topic_Name, Flags, Application_Message_Size);
+	if (MQTT_GET_PROTOCOL_VERSION(&Pointer_Queue->Pointer_Slots[0].Context) == MQTT_PROTOCOL_VERSION_5) Size += MQTT_PUBLISH_PROPERTIES_MAXIMUM_SIZE;
+	if (Size > Pointer_Queue->Slot_Buffer_Size) return -1;
+	
+	Pointer_Slot = MQTTPublishQueueReserve(Pointer_Queue);
+	if (Pointer_Slot == NULL) return -1;
+	
+	MQTTPublishExtended(&Pointer_Slot->Context, Pointer_String_Topic_Name, Flags, Packet_Identifier, Pointer_Application_Message, Application_Message_Size);
+	MQTTPublishQueueCommit(Pointer_Slot);
+	return 0;
+}
+
+int MQTTPublishQueuePeek(TMQTTPublishQueue *Pointer_Queue, TMQTTBufferSegment *Pointer_Segments, int Maximum_Segments_Count)
+{
+	TMQTTPublishQueueSlot *Pointer_Slot;
+	unsigned int Position;
+	int Count;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Queue != NULL);
+	assert(Pointer_Segments != NULL);
+	
+	// Gather consecutive committed slots, stop at the first one that is free or still being forged so packets order is kept
+	Position = Pointer_Queue->Dequeue_Position;
+	for (Count = 0; Count < Maximum_Segments_Count; Count++)
+	{
+		Pointer_Slot = &Pointer_Queue->Pointer_Slots[Position & Pointer_Queue->Slots_Mask];
+		if (atomic_load_explicit(&Pointer_Slot->Sequence, memory_order_acquire) != Position + 1) break;
+		
+		Pointer_Segments[Count].Pointer_Buffer = MQTT_GET_MESSAGE_BUFFER(&Pointer_Slot->Context);
+		Pointer_Segments[Count].Size = MQTT_GET_MESSAGE_SIZE(&Pointer_Slot->Context);
+		Position++;
+	}
+	
+	return Count;
+}
+
+void MQTTPublishQueueRelease(TMQTTPublishQueue *Pointer_Queue, int Packets_Count)
+{
+	TMQTTPublishQueueSlot *Pointer_Slot;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Queue != NULL);
+	assert(Packets_Count >= 0);
+	
+	// Make each slot free for the producers next turn
+	for (i = 0; i < Packets_Count; i++)
+	{
+		Pointer_Slot = &Pointer_Queue->Pointer_Slots[Pointer_Queue->Dequeue_Position & Pointer_Queue->Slots_Mask];
+		atomic_store_explicit(&Pointer_Slot->Sequence, Pointer_Queue->Dequeue_Position + Pointer_Queue->Slots_Mask + 1, memory_order_release);
+		Pointer_Queue->Dequeue_Position++;
+	}
+}
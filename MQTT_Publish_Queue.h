@@ -0,0 +1,96 @@
+/** @file MQTT_Publish_Queue.h
+ * Let several threads publish on the same connection without locking.
+ * The queue is a bounded ring of slots, each slot holding a whole encoded packet. Producers claim a slot with an atomic compare-and-swap, forge their packet in it and mark it ready.
+ * A single consumer thread retrieves all consecutive ready packets at once as buffer segments, so they can be sent with a single writev() call, then gives the slots back to the producers.
+ * The queue needs C11 atomics. All memory is provided by the user, no dynamic allocation is done.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_PUBLISH_QUEUE_H
+#define H_MQTT_PUBLISH_QUEUE_H
+
+#include <MQTT.h>
+#include <stdatomic.h>
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** The producers and consumer shared fields are aligned on this value, so a thread updating a field does not invalidate the cache line of the other threads fields. It must be a power of two, set it to a small value on microcontrollers without cache. Define it in the makefile to change the value. */
+#ifndef MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE
+	#define MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE 64
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** A queue entry holding a single packet. */
+typedef struct
+{
+	TMQTTContext Context; //!< Forge the packet in this context between MQTTPublishQueueReserve() and MQTTPublishQueueCommit() calls.
+	// Following fields are for internal usage only, do not modify or use
+	atomic_uint Sequence; //!< Tell whether the slot is free for a given producer turn or ready for a given consumer turn.
+	unsigned int Position; //!< The queue position the slot has been reserved for.
+} __attribute__((aligned(MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE))) TMQTTPublishQueueSlot;
+
+/** A multiple producers, single consumer packets queue. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTPublishQueueSlot *Pointer_Slots; //!< All slots.
+	unsigned int Slots_Mask; //!< Slots count minus one (slots count is a power of two).
+	int Slot_Buffer_Size; //!< Each slot buffer size in bytes.
+	_Alignas(MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE) atomic_uint Enqueue_Position; //!< The next slot producers will claim. It is written by all producers.
+	_Alignas(MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE) unsigned int Dequeue_Position; //!< The oldest slot not released yet. It is written by the consumer only.
+} TMQTTPublishQueue;
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Create an empty queue. This function is not thread-safe.
+ * @param Pointer_Queue The queue to initialize.
+ * @param Pointer_Slots The slots array.
+ * @param Slots_Count How many slots the array holds. It must be a power of two, at least 2.
+ * @param Pointer_Buffer The memory used to store the packets, it must be Slots_Count * Slot_Buffer_Size bytes long.
+ * @param Slot_Buffer_Size How many bytes each slot can use. The biggest packet to send must fit in, including the 5 bytes reserved for the fixed header.
+ * @param Protocol_Version The protocol version of the connection the packets will be sent on, as returned by MQTT_GET_PROTOCOL_VERSION(). Topic aliases are never used by the queue.
+ */
+void MQTTPublishQueueInitialize(TMQTTPublishQueue *Pointer_Queue, TMQTTPublishQueueSlot *Pointer_Slots, int Slots_Count, void *Pointer_Buffer, int Slot_Buffer_Size, int Protocol_Version);
+
+/** Claim a free slot to forge any packet in. This function can be called by any thread and never blocks.
+ * @param Pointer_Queue An initialized queue.
+ * @return NULL if the queue is full,
+ * @return The claimed slot on success. Forge a single packet in its context, then call MQTTPublishQueueCommit() as soon as possible, because the consumer can't retrieve the following slots until this one is committed.
+ */
+TMQTTPublishQueueSlot *MQTTPublishQueueReserve(TMQTTPublishQueue *Pointer_Queue);
+
+/** Make a reserved slot packet available to the consumer. This function can be called by any thread.
+ * @param Pointer_Slot The slot returned by MQTTPublishQueueReserve(), its context must contain a forged packet.
+ */
+void MQTTPublishQueueCommit(TMQTTPublishQueueSlot *Pointer_Slot);
+
+/** Forge a PUBLISH packet and enqueue it. This function can be called by any thread and never blocks.
+ * @param Pointer_Queue An initialized queue.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values.
+ * @param Packet_Identifier The packet identifier, it is ignored if QoS is 0.
+ * @param Pointer_Application_Message The application message.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return -1 if the topic name is not valid, if the queue is full or if the packet does not fit in a slot,
+ * @return 0 on success.
+ */
+int MQTTPublishQueuePublish(TMQTTPublishQueue *Pointer_Queue, char *Pointer_String_Topic_Name, int Flags, unsigned short Packet_Identifier, void *Pointer_Application_Message, int Application_Message_Size);
+
+/** Retrieve the oldest committed packets, in the order they were reserved. This function must be called by the consumer thread only.
+ * @param Pointer_Queue An initialized queue.
+ * @param Pointer_Segments On output, contain one segment per packet. Segments stay valid until the packets are released.
+ * @param Maximum_Segments_Count How many segments the array can hold.
+ * @return How many packets are ready to be sent (0 if the queue is empty or if the oldest slot is not committed yet).
+ */
+int MQTTPublishQueuePeek(TMQTTPublishQueue *Pointer_Queue, TMQTTBufferSegment *Pointer_Segments, int Maximum_Segments_Count);
+
+/** Give the oldest slots back to the producers once their packets have been fully sent. This function must be called by the consumer thread only.
+ * @param Pointer_Queue An initialized queue.
+ * @param Packets_Count How many packets to release, it must not be greater than the value returned by the last MQTTPublishQueuePeek() call.
+ */
+void MQTTPublishQueueRelease(TMQTTPublishQueue *Pointer_Queue, int Packets_Count);
+
+#endif
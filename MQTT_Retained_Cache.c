@@ -0,0 +1,199 @@
+/** @file MQTT_Retained_Cache.c
+ * @see MQTT_Retained_Cache.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <MQTT_Retained_Cache.h>
+#include <stddef.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Find the entry of a topic.
+ * @param Pointer_Cache The cache.
+ * @param Pointer_Topic_Name The topic name, it does not need to be terminated.
+ * @param Length The topic name length in bytes.
+ * @param Hash The topic name FNV-1a hash.
+ * @param Pointer_Free_Entry_Index On output, contain the free entry the topic can be stored in if it is not found, or -1 if the table is full. It can be NULL.
+ * @return NULL if the topic is not cached,
+ * @return The topic entry on success.
+ */
+static TMQTTRetainedCacheEntry *MQTTRetainedCacheFindEntry(TMQTTRetainedCache *Pointer_Cache, unsigned char *Pointer_Topic_Name, int Length, unsigned int Hash, int *Pointer_Free_Entry_Index)
+{
+	TMQTTRetainedCacheEntry *Pointer_Entry;
+	int Index, Probes_Count, Entry_Topic_Name_Length;
+	
+	// Use linear probing, entries are never removed so the first free entry tells that the topic is not known
+	Index = Hash & Pointer_Cache->Entries_Mask;
+	for (Probes_Count = 0; Probes_Count <= Pointer_Cache->Entries_Mask; Probes_Count++)
+	{
+		Pointer_Entry = &Pointer_Cache->Pointer_Entries[Index];
+		
+		// Acquire ordering makes the topic name and the first message visible to readers once the entry is seen as used
+		Entry_Topic_Name_Length = atomic_load_explicit(&Pointer_Entry->Topic_Name_Length, memory_order_acquire);
+		if (Entry_Topic_Name_Length == 0)
+		{
+			if (Pointer_Free_Entry_Index != NULL) *Pointer_Free_Entry_Index = Index;
+			return NULL;
+		}
+		
+		// The topic name of a used entry never changes, so it can be compared without synchronization
+		if ((Pointer_Entry->Topic_Name_Hash == Hash) && (Entry_Topic_Name_Length == Length) && (memcmp(Pointer_Cache->Pointer_Buffer + Index * Pointer_Cache->Entry_Buffer_Size, Pointer_Topic_Name, Length) == 0)) return Pointer_Entry;
+		Index = (Index + 1) & Pointer_Cache->Entries_Mask;
+	}
+	
+	if (Pointer_Free_Entry_Index != NULL) *Pointer_Free_Entry_Index = -1;
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+void MQTTRetainedCacheInitialize(TMQTTRetainedCache *Pointer_Cache, void *Pointer_Arena, int Entries_Count, int Maximum_Topic_Name_Length, int Maximum_Application_Message_Size)
+{
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Cache != NULL);
+	assert(Pointer_Arena != NULL);
+	assert(((size_t) Pointer_Arena % _Alignof(TMQTTRetainedCacheEntry)) == 0);
+	assert(Entries_Count > 0);
+	assert((Entries_Count & (Entries_Count - 1)) == 0);
+	assert(Maximum_Topic_Name_Length > 0);
+	assert(Maximum_Application_Message_Size >= 0);
+	
+	Pointer_Cache->Pointer_Entries = Pointer_Arena;
+	Pointer_Cache->Pointer_Buffer = (unsigned char *) Pointer_Arena + Entries_Count * sizeof(TMQTTRetainedCacheEntry);
+	Pointer_Cache->Entries_Mask = Entries_Count - 1;
+	Pointer_Cache->Maximum_Topic_Name_Length = Maximum_Topic_Name_Length;
+	Pointer_Cache->Maximum_Application_Message_Size = Maximum_Application_Message_Size;
+	Pointer_Cache->Entry_Buffer_Size = Maximum_Topic_Name_Length + 1 + Maximum_Application_Message_Size; // The topic name is stored with its terminating zero, so readers can use it as a string
+	
+	// All entries are free
+	for (i = 0; i < Entries_Count; i++)
+	{
+		atomic_init(&Pointer_Cache->Pointer_Entries[i].Sequence, 0);
+		atomic_init(&Pointer_Cache->Pointer_Entries[i].Topic_Name_Length, 0);
+	}
+}
+
+int MQTTRetainedCacheStore(TMQTTRetainedCache *Pointer_Cache, TMQTTPacket *Pointer_Packet, unsigned int Current_Time)
+{
+	TMQTTRetainedCacheEntry *Pointer_Entry;
+	unsigned char *Pointer_Entry_Buffer;
+	unsigned int Hash = 2166136261U, Sequence;
+	int Length, Index, Is_New_Entry = 0, i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Cache != NULL);
+	assert(Pointer_Packet != NULL);
+	assert(Pointer_Packet->Type == MQTT_PACKET_TYPE_PUBLISH);
+	
+	// The topic name has been checked by the decoder, an empty topic name means that only a MQTT 5 topic alias has been received
+	Length = Pointer_Packet->Topic_Name_Size;
+	if ((Length == 0) || (Length > Pointer_Cache->Maximum_Topic_Name_Length)) return -1;
+	if (Pointer_Packet->Payload_Size > Pointer_Cache->Maximum_Application_Message_Size) return -1;
+	
+	// Compute topic name FNV-1a hash
+	for (i = 0; i < Length; i++)
+	{
+		Hash ^= Pointer_Packet->Pointer_Topic_Name[i];
+		Hash *= 16777619U;
+	}
+	
+	Pointer_Entry = MQTTRetainedCacheFindEntry(Pointer_Cache, Pointer_Packet->Pointer_Topic_Name, Length, Hash, &Index);
+	if (Pointer_Entry == NULL)
+	{
+		if (Index < 0) return -1;
+		
+		// Readers can't find the new entry yet, so its topic name can be stored without synchronization
+		Pointer_Entry = &Pointer_Cache->Pointer_Entries[Index];
+		Pointer_Entry_Buffer = Pointer_Cache->Pointer_Buffer + Index * Pointer_Cache->Entry_Buffer_Size;
+		memcpy(Pointer_Entry_Buffer, Pointer_Packet->Pointer_Topic_Name, Length);
+		Pointer_Entry_Buffer[Length] = 0;
+		Pointer_Entry->Topic_Name_Hash = Hash;
+		Is_New_Entry = 1;
+	}
+	else Pointer_Entry_Buffer = Pointer_Cache->Pointer_Buffer + (Pointer_Entry - Pointer_Cache->Pointer_Entries) * Pointer_Cache->Entry_Buffer_Size;
+	
+	// Make the sequence odd while the message is modified, the release fence keeps the following writes after the sequence update
+	Sequence = atomic_load_explicit(&Pointer_Entry->Sequence, memory_order_relaxed);
+	atomic_store_explicit(&Pointer_Entry->Sequence, Sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	
+	memcpy(Pointer_Entry_Buffer + Pointer_Cache->Maximum_Topic_Name_Length + 1, Pointer_Packet->Pointer_Payload, Pointer_Packet->Payload_Size);
+	Pointer_Entry->Application_Message_Size = Pointer_Packet->Payload_Size;
+	Pointer_Entry->Reception_Time = Current_Time;
+	Pointer_Entry->Flags = Pointer_Packet->Flags;
+	
+	// Release ordering makes the new message visible to readers seeing the even sequence
+	atomic_store_explicit(&Pointer_Entry->Sequence, Sequence + 2, memory_order_release);
+	
+	// Publish a new entry only once it holds its first message, so readers never see an entry without message
+	if (Is_New_Entry) atomic_store_explicit(&Pointer_Entry->Topic_Name_Length, Length, memory_order_release);
+	return 0;
+}
+
+int MQTTRetainedCacheRead(TMQTTRetainedCache *Pointer_Cache, char *Pointer_String_Topic_Name, void *Pointer_Buffer, int Buffer_Size, TMQTTRetainedCacheMessageInformation *Pointer_Information)
+{
+	TMQTTRetainedCacheEntry *Pointer_Entry;
+	unsigned char *Pointer_Application_Message;
+	unsigned int Hash = 2166136261U, Sequence, Reception_Time;
+	int Length, Application_Message_Size, Copied_Size;
+	unsigned char Flags;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Cache != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	assert((Pointer_Buffer != NULL) || (Buffer_Size == 0));
+	
+	// Compute topic name FNV-1a hash and length at the same time
+	for (Length = 0; Pointer_String_Topic_Name[Length] != 0; Length++)
+	{
+		Hash ^= (unsigned char) Pointer_String_Topic_Name[Length];
+		Hash *= 16777619U;
+	}
+	
+	Pointer_Entry = MQTTRetainedCacheFindEntry(Pointer_Cache, (unsigned char *) Pointer_String_Topic_Name, Length, Hash, NULL);
+	if (Pointer_Entry == NULL) return -1;
+	Pointer_Application_Message = Pointer_Cache->Pointer_Buffer + (Pointer_Entry - Pointer_Cache->Pointer_Entries) * Pointer_Cache->Entry_Buffer_Size + Pointer_Cache->Maximum_Topic_Name_Length + 1;
+	
+	// Copy the message, then try again if the writer modified it in the meantime (the copy may be torn, but it is discarded in this case)
+	while (1)
+	{
+		Sequence = atomic_load_explicit(&Pointer_Entry->Sequence, memory_order_acquire);
+		if (Sequence & 1) continue;
+		
+		// The size stored by the writer is always in range, so even a torn copy stays in the entry buffer
+		Application_Message_Size = Pointer_Entry->Application_Message_Size;
+		Reception_Time = Pointer_Entry->Reception_Time;
+		Flags = Pointer_Entry->Flags;
+		Copied_Size = Application_Message_Size;
+		if (Copied_Size > Buffer_Size) Copied_Size = Buffer_Size;
+		if (Copied_Size > 0) memcpy(Pointer_Buffer, Pointer_Application_Message, Copied_Size);
+		
+		// The acquire fence keeps the copy before the sequence check
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&Pointer_Entry->Sequence, memory_order_relaxed) == Sequence) break;
+	}
+	
+	if (Pointer_Information != NULL)
+	{
+		Pointer_Information->Is_Retained = Flags & MQTT_PUBLISH_FLAG_RETAIN;
+		Pointer_Information->QoS = (Flags >> 1) & 0x03;
+		Pointer_Information->Reception_Time = Reception_Time;
+		Pointer_Information->Updates_Count = Sequence / 2;
+	}
+	return Application_Message_Size;
+}
+
+char *MQTTRetainedCacheGetTopicName(TMQTTRetainedCache *Pointer_Cache, int Entry_Index)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Cache != NULL);
+	assert((Entry_Index >= 0) && (Entry_Index <= Pointer_Cache->Entries_Mask));
+	
+	if (atomic_load_explicit(&Pointer_Cache->Pointer_Entries[Entry_Index].Topic_Name_Length, memory_order_acquire) == 0) return NULL;
+	return (char *) Pointer_Cache->Pointer_Buffer + Entry_Index * Pointer_Cache->Entry_Buffer_Size;
+}
@@ -0,0 +1,107 @@
+/** @file MQTT_Retained_Cache.h
+ * Keep the latest application message received for each topic, so local consumers can display the current state as soon as they start instead of waiting for the server retained messages, and do not need their own copy of it.
+ * Messages are stored in a fixed-size table indexed by the topic name hash, inside a single memory area provided by the user. A topic entry is never removed, so the last received value of each topic stays available.
+ * A single thread stores the received messages, any number of threads can read them without locking : each entry is protected by a sequence lock, a reader copies the message and tries again if the writer modified it in the meantime.
+ * The cache needs C11 atomics. No dynamic allocation is done.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_RETAINED_CACHE_H
+#define H_MQTT_RETAINED_CACHE_H
+
+#include <MQTT.h>
+#include <stdatomic.h>
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** The latest message of a topic. */
+typedef struct
+{
+	atomic_uint Sequence; //!< Odd while the writer is updating the message, incremented twice by each update.
+	atomic_int Topic_Name_Length; //!< The topic name length in bytes, 0 tells that the entry is free. It is set once the topic name is stored and never changes afterwards.
+	unsigned int Topic_Name_Hash; //!< Speed up topic names comparison.
+	int Application_Message_Size; //!< The latest application message size in bytes.
+	unsigned int Reception_Time; //!< When the latest message has been stored.
+	unsigned char Flags; //!< The latest message PUBLISH flags.
+} TMQTTRetainedCacheEntry;
+
+/** A last-value table shared by a writer and many readers. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTRetainedCacheEntry *Pointer_Entries; //!< All entries, at the arena beginning.
+	unsigned char *Pointer_Buffer; //!< Each entry topic name and latest application message, following the entries in the arena.
+	int Entries_Mask; //!< Entries count minus one, the count is a power of two.
+	int Maximum_Topic_Name_Length; //!< The longest topic name an entry can store.
+	int Maximum_Application_Message_Size; //!< The biggest application message an entry can store.
+	int Entry_Buffer_Size; //!< How many bytes of the buffer each entry uses.
+} TMQTTRetainedCache;
+
+/** What is known about a cached message. */
+typedef struct
+{
+	int Is_Retained; //!< Set when the message has been received with the RETAIN flag, so it comes from the server retained messages and not from a live publication.
+	int QoS; //!< The message quality of service.
+	unsigned int Reception_Time; //!< The time given to MQTTRetainedCacheStore() when the message was received.
+	unsigned int Updates_Count; //!< How many messages have been stored for this topic.
+} TMQTTRetainedCacheMessageInformation;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Compute the arena size needed by a cache.
+ * @param Entries_Count How many entries the cache has.
+ * @param Maximum_Topic_Name_Length The longest topic name that can be cached.
+ * @param Maximum_Application_Message_Size The biggest application message that can be cached.
+ * @return The arena size in bytes.
+ */
+#define MQTT_RETAINED_CACHE_COMPUTE_ARENA_SIZE(Entries_Count, Maximum_Topic_Name_Length, Maximum_Application_Message_Size) ((Entries_Count) * (sizeof(TMQTTRetainedCacheEntry) + (Maximum_Topic_Name_Length) + 1 + (Maximum_Application_Message_Size)))
+
+/** Retrieve how many entries a cache has, use it to enumerate the cached topics with MQTTRetainedCacheGetTopicName().
+ * @param Pointer_Cache An initialized cache.
+ * @return The entries count.
+ */
+#define MQTT_RETAINED_CACHE_GET_ENTRIES_COUNT(Pointer_Cache) ((Pointer_Cache)->Entries_Mask + 1)
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Create an empty cache. This function is not thread-safe.
+ * @param Pointer_Cache The cache to initialize.
+ * @param Pointer_Arena The memory holding the entries, the topic names and the application messages. It must be aligned like an int and its size must be computed with MQTT_RETAINED_CACHE_COMPUTE_ARENA_SIZE().
+ * @param Entries_Count How many entries the cache has. There must be one entry per cached topic plus some free entries to keep the table fast. It must be a power of two.
+ * @param Maximum_Topic_Name_Length The longest topic name that can be cached.
+ * @param Maximum_Application_Message_Size The biggest application message that can be cached.
+ */
+void MQTTRetainedCacheInitialize(TMQTTRetainedCache *Pointer_Cache, void *Pointer_Arena, int Entries_Count, int Maximum_Topic_Name_Length, int Maximum_Application_Message_Size);
+
+/** Store a received message, replacing the previous message of the same topic. Only a single thread is allowed to call this function.
+ * @param Pointer_Cache An initialized cache.
+ * @param Pointer_Packet A PUBLISH packet returned by MQTTDecode(). A zero-length application message is stored like any other one, it tells that the topic retained message has been deleted.
+ * @param Current_Time The current time, the time unit is chosen by the user.
+ * @return -1 if the packet uses a MQTT 5 topic alias without topic name, if the topic name or the application message is too long, or if the table is full,
+ * @return 0 on success.
+ * @note Readers spin while an entry is being updated, so on a single core the writer must not be preempted by a reader in the middle of an update (give the writer the highest priority).
+ */
+int MQTTRetainedCacheStore(TMQTTRetainedCache *Pointer_Cache, TMQTTPacket *Pointer_Packet, unsigned int Current_Time);
+
+/** Copy the latest message of a topic. This function can be called by any thread and never blocks the writer.
+ * @param Pointer_Cache An initialized cache.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Pointer_Buffer On output, contain the application message.
+ * @param Buffer_Size The buffer size in bytes. If the message is bigger, only the beginning of the message is copied.
+ * @param Pointer_Information On output, contain the message metadata. It can be NULL.
+ * @return -1 if no message has been received for this topic,
+ * @return The whole application message size in bytes.
+ */
+int MQTTRetainedCacheRead(TMQTTRetainedCache *Pointer_Cache, char *Pointer_String_Topic_Name, void *Pointer_Buffer, int Buffer_Size, TMQTTRetainedCacheMessageInformation *Pointer_Information);
+
+/** Retrieve the topic name stored in an entry, so readers can enumerate all cached topics. This function can be called by any thread.
+ * @param Pointer_Cache An initialized cache.
+ * @param Entry_Index The entry index, in range [0; MQTT_RETAINED_CACHE_GET_ENTRIES_COUNT() - 1].
+ * @return NULL if the entry is free,
+ * @return The topic name on success. The string is terminated and it is valid as long as the cache exists.
+ */
+char *MQTTRetainedCacheGetTopicName(TMQTTRetainedCache *Pointer_Cache, int Entry_Index);
+
+#endif
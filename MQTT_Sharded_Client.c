@@ -0,0 +1,567 @@
+/** @file MQTT_Sharded_Client.c
+ * @see MQTT_Sharded_Client.h for description.
+ * @author Adrien RICCIARDI
+ */
+#define _GNU_SOURCE // Needed by pthread_setaffinity_np() and CPU_SET()
+#include <assert.h>
+#include <errno.h>
+#include <MQTT_Sharded_Client.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private variables
+//-------------------------------------------------------------------------------------------------
+/** Sent by the worker threads when their shard has been idle for the keep alive duration. */
+static const unsigned char MQTT_Sharded_Client_Ping_Request_Packet[2] = MQTT_PINGREQ_PACKET_INITIALIZER;
+/** Sent by the worker threads before leaving. */
+static const unsigned char MQTT_Sharded_Client_Disconnect_Packet[2] = MQTT_DISCONNECT_PACKET_INITIALIZER;
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Get a monotonic time.
+ * @return The time in milliseconds.
+ */
+static long long MQTTShardedClientGetTime(void)
+{
+	struct timespec Time;
+	
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return (long long) Time.tv_sec * 1000 + Time.tv_nsec / 1000000;
+}
+
+/** Send buffers until all of them are fully sent.
+ * @param Pointer_Shard The shard to send data on.
+ * @param Pointer_IO_Vectors The buffers to send, they are modified when a buffer is partially sent.
+ * @param IO_Vectors_Count How many buffers to send.
+ * @return -1 if an error occurred (see errno for details),
+ * @return 0 on success.
+ */
+static int MQTTShardedClientSend(TMQTTShardedClientShard *Pointer_Shard, struct iovec *Pointer_IO_Vectors, int IO_Vectors_Count)
+{
+	ssize_t Sent_Size;
+	
+	while (IO_Vectors_Count > 0)
+	{
+		Sent_Size = writev(Pointer_Shard->Socket, Pointer_IO_Vectors, IO_Vectors_Count);
+		atomic_fetch_add_explicit(&Pointer_Shard->System_Calls_Count, 1, memory_order_relaxed);
+		if (Sent_Size < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		atomic_fetch_add_explicit(&Pointer_Shard->Sent_Bytes_Count, (unsigned long long) Sent_Size, memory_order_relaxed);
+		
+		// Skip the fully sent buffers and resume the partially sent one
+		while ((IO_Vectors_Count > 0) && (Sent_Size >= (ssize_t) Pointer_IO_Vectors->iov_len))
+		{
+			Sent_Size -= Pointer_IO_Vectors->iov_len;
+			Pointer_IO_Vectors++;
+			IO_Vectors_Count--;
+		}
+		if (IO_Vectors_Count > 0)
+		{
+			Pointer_IO_Vectors->iov_base = (unsigned char *) Pointer_IO_Vectors->iov_base + Sent_Size;
+			Pointer_IO_Vectors->iov_len -= Sent_Size;
+		}
+	}
+	
+	return 0;
+}
+
+/** Send a constant packet.
+ * @param Pointer_Shard The shard to send the packet on.
+ * @param Pointer_Packet The packet.
+ * @param Size The packet size in bytes.
+ * @return -1 if an error occurred (see errno for details),
+ * @return 0 on success.
+ */
+static int MQTTShardedClientSendPacket(TMQTTShardedClientShard *Pointer_Shard, const unsigned char *Pointer_Packet, int Size)
+{
+	struct iovec IO_Vector;
+	
+	IO_Vector.iov_base = (void *) Pointer_Packet;
+	IO_Vector.iov_len = Size;
+	if (MQTTShardedClientSend(Pointer_Shard, &IO_Vector, 1) != 0) return -1;
+	
+	atomic_fetch_add_explicit(&Pointer_Shard->Sent_Packets_Count, 1, memory_order_relaxed);
+	return 0;
+}
+
+/** Read the data the server sent without waiting, then give the decoded packets to the packet handler.
+ * @param Pointer_Shard The shard to receive data from.
+ * @return -1 if the connection has been closed by the server or if an error occurred,
+ * @return 0 on success (including when no data was available).
+ */
+static int MQTTShardedClientReceive(TMQTTShardedClientShard *Pointer_Shard)
+{
+	unsigned char Buffer[MQTT_SHARDED_CLIENT_RECEIVE_BUFFER_SIZE], *Pointer_Data = Buffer;
+	TMQTTShardedClient *Pointer_Client = Pointer_Shard->Pointer_Client;
+	TMQTTPacket Packet;
+	ssize_t Size;
+	int Decoded_Size;
+	
+	Size = recv(Pointer_Shard->Socket, Buffer, sizeof(Buffer), MSG_DONTWAIT);
+	atomic_fetch_add_explicit(&Pointer_Shard->System_Calls_Count, 1, memory_order_relaxed);
+	if (Size < 0)
+	{
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) return 0;
+		return -1;
+	}
+	if (Size == 0) return -1; // The server closed the connection
+	
+	while (Size > 0)
+	{
+		Decoded_Size = MQTTDecode(&Pointer_Shard->Decoder, Pointer_Data, (int) Size, &Packet);
+		if (Decoded_Size < 0) return -1;
+		Pointer_Data += Decoded_Size;
+		Size -= Decoded_Size;
+		
+		// More data are needed
+		if (Packet.Type == 0) continue;
+		
+		atomic_fetch_add_explicit(&Pointer_Shard->Received_Packets_Count, 1, memory_order_relaxed);
+		if (Packet.Type == MQTT_PACKET_TYPE_PINGRESP) Pointer_Shard->Is_Ping_Response_Pending = 0;
+		else
+		{
+			if (Packet.Type == MQTT_PACKET_TYPE_PUBACK) atomic_fetch_add_explicit(&Pointer_Shard->Acknowledged_Messages_Count, 1, memory_order_relaxed);
+			if (Pointer_Client->Packet_Handler != NULL) Pointer_Client->Packet_Handler(Pointer_Shard, &Packet);
+		}
+	}
+	
+	return 0;
+}
+
+/** Send the queued packets of a shard and receive the server packets until the connection is lost or the client disconnects.
+ * @param Pointer_Parameter The shard.
+ * @return Always NULL.
+ */
+static void *MQTTShardedClientWorkerThread(void *Pointer_Parameter)
+{
+	TMQTTShardedClientShard *Pointer_Shard = Pointer_Parameter;
+	TMQTTShardedClient *Pointer_Client = Pointer_Shard->Pointer_Client;
+	TMQTTBufferSegment Segments[MQTT_SHARDED_CLIENT_MAXIMUM_BATCH_SIZE];
+	struct iovec IO_Vectors[MQTT_SHARDED_CLIENT_MAXIMUM_BATCH_SIZE];
+	struct pollfd Poll_Descriptors[2];
+	cpu_set_t Processors_Set;
+	long long Current_Time, Last_Sending_Time, Keep_Alive_Duration = (long long) Pointer_Shard->Keep_Alive * 1000, Waiting_Time;
+	int Segments_Count, Is_Stop_Requested, Result, i;
+	eventfd_t Wakeups_Count;
+	
+	// Pinning is only an optimization, so keep running on any processor if the requested one is not allowed
+	if (Pointer_Shard->Processor_Index >= 0)
+	{
+		CPU_ZERO(&Processors_Set);
+		CPU_SET(Pointer_Shard->Processor_Index, &Processors_Set);
+		pthread_setaffinity_np(pthread_self(), sizeof(Processors_Set), &Processors_Set);
+	}
+	
+	Poll_Descriptors[0].fd = Pointer_Shard->Socket;
+	Poll_Descriptors[0].events = POLLIN;
+	Poll_Descriptors[1].fd = Pointer_Shard->Wakeup_Descriptor;
+	Poll_Descriptors[1].events = POLLIN;
+	Last_Sending_Time = MQTTShardedClientGetTime();
+	while (1)
+	{
+		// The stop request must be read before checking the queue, so the packets committed before the request are sent
+		Is_Stop_Requested = atomic_load(&Pointer_Client->Is_Stop_Requested);
+		
+		Segments_Count = MQTTPublishQueuePeek(&Pointer_Shard->Queue, Segments, MQTT_SHARDED_CLIENT_MAXIMUM_BATCH_SIZE);
+		if (Segments_Count > 0)
+		{
+			// Send all ready packets with as few system calls as possible
+			for (i = 0; i < Segments_Count; i++)
+			{
+				IO_Vectors[i].iov_base = Segments[i].Pointer_Buffer;
+				IO_Vectors[i].iov_len = Segments[i].Size;
+			}
+			if (MQTTShardedClientSend(Pointer_Shard, IO_Vectors, Segments_Count) != 0) break;
+			MQTTPublishQueueRelease(&Pointer_Shard->Queue, Segments_Count);
+			atomic_fetch_add_explicit(&Pointer_Shard->Sent_Packets_Count, (unsigned long long) Segments_Count, memory_order_relaxed);
+			Last_Sending_Time = MQTTShardedClientGetTime();
+			
+			// Retrieve the acknowledges without waiting, so the server is never stalled by a full socket receive buffer
+			if (MQTTShardedClientReceive(Pointer_Shard) != 0) break;
+			continue;
+		}
+		
+		if (Is_Stop_Requested)
+		{
+			// The server may have closed the connection first, there is nothing more to do in this case
+			MQTTShardedClientSendPacket(Pointer_Shard, MQTT_Sharded_Client_Disconnect_Packet, sizeof(MQTT_Sharded_Client_Disconnect_Packet));
+			return NULL;
+		}
+		
+		// Nothing to send, ask the producers for a wakeup, then look at the queue again in case a packet was committed meanwhile (the fence pairs with the MQTTShardedClientPublish() one, so either the packet or the request is seen)
+		atomic_store_explicit(&Pointer_Shard->Is_Worker_Waiting, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (MQTTPublishQueuePeek(&Pointer_Shard->Queue, Segments, 1) > 0)
+		{
+			atomic_store_explicit(&Pointer_Shard->Is_Worker_Waiting, 0, memory_order_relaxed);
+			continue;
+		}
+		
+		// Wait for the server data, a producer wakeup or the keep alive deadline
+		Current_Time = MQTTShardedClientGetTime();
+		if (Keep_Alive_Duration == 0) Waiting_Time = -1;
+		else
+		{
+			Waiting_Time = Keep_Alive_Duration - (Current_Time - Last_Sending_Time);
+			if (Waiting_Time < 0) Waiting_Time = 0;
+		}
+		Result = poll(Poll_Descriptors, 2, (int) Waiting_Time);
+		atomic_fetch_add_explicit(&Pointer_Shard->System_Calls_Count, 1, memory_order_relaxed);
+		atomic_store_explicit(&Pointer_Shard->Is_Worker_Waiting, 0, memory_order_relaxed);
+		if ((Result < 0) && (errno != EINTR)) break;
+		if (Result > 0)
+		{
+			if ((Poll_Descriptors[0].revents != 0) && (MQTTShardedClientReceive(Pointer_Shard) != 0)) break;
+			
+			// Reset the wakeups counter, the queue is checked on next loop
+			if (Poll_Descriptors[1].revents != 0)
+			{
+				eventfd_read(Pointer_Shard->Wakeup_Descriptor, &Wakeups_Count);
+				atomic_fetch_add_explicit(&Pointer_Shard->System_Calls_Count, 1, memory_order_relaxed);
+			}
+		}
+		
+		// Tell the server that the client is still alive when nothing has been sent for a while
+		if (Keep_Alive_Duration > 0)
+		{
+			Current_Time = MQTTShardedClientGetTime();
+			if (Current_Time - Last_Sending_Time >= Keep_Alive_Duration)
+			{
+				// The server did not answer to the previous PINGREQ
+				if (Pointer_Shard->Is_Ping_Response_Pending) break;
+				
+				if (MQTTShardedClientSendPacket(Pointer_Shard, MQTT_Sharded_Client_Ping_Request_Packet, sizeof(MQTT_Sharded_Client_Ping_Request_Packet)) != 0) break;
+				Pointer_Shard->Is_Ping_Response_Pending = 1;
+				Last_Sending_Time = Current_Time;
+			}
+		}
+	}
+	
+	// The connection is lost, the socket is closed by MQTTShardedClientDisconnect() after the thread has been joined so its descriptor can't be reused meanwhile
+	atomic_store(&Pointer_Shard->Is_Connected, 0);
+	if (Pointer_Client->Close_Handler != NULL) Pointer_Client->Close_Handler(Pointer_Shard);
+	return NULL;
+}
+
+/** Establish a shard connection and wait for the server to grant it.
+ * @param Pointer_Shard The shard to connect.
+ * @param Pointer_Address The server address.
+ * @param Address_Size The server address size in bytes.
+ * @param Pointer_Connection_Parameters The shard connection parameters.
+ * @return -1 if the connection failed (see errno for details),
+ * @return 0 on success.
+ */
+static int MQTTShardedClientConnectShard(TMQTTShardedClientShard *Pointer_Shard, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters)
+{
+	TMQTTContext Context;
+	TMQTTPacket Packet;
+	struct iovec IO_Vector;
+	unsigned char Byte;
+	ssize_t Size;
+	
+	Pointer_Shard->Socket = socket(Pointer_Address->sa_family, SOCK_STREAM, 0);
+	if (Pointer_Shard->Socket == -1) return -1;
+	if (connect(Pointer_Shard->Socket, Pointer_Address, Address_Size) == -1) return -1;
+	
+	if (MQTTConnect(&Context, Pointer_Connection_Parameters) != 0)
+	{
+		errno = ENOBUFS;
+		return -1;
+	}
+	IO_Vector.iov_base = MQTT_GET_MESSAGE_BUFFER(&Context);
+	IO_Vector.iov_len = MQTT_GET_MESSAGE_SIZE(&Context);
+	if (MQTTShardedClientSend(Pointer_Shard, &IO_Vector, 1) != 0) return -1;
+	atomic_fetch_add_explicit(&Pointer_Shard->Sent_Packets_Count, 1, memory_order_relaxed);
+	
+	// Read the CONNACK packet one byte at a time, so the packets the server may send right after it are left to the worker thread
+	MQTTDecoderInitialize(&Pointer_Shard->Decoder, Pointer_Shard->Decoder.Pointer_Buffer, Pointer_Shard->Decoder.Buffer_Size);
+	MQTTDecoderSetProtocolVersion(&Pointer_Shard->Decoder, MQTT_GET_PROTOCOL_VERSION(&Context));
+	do
+	{
+		Size = read(Pointer_Shard->Socket, &Byte, 1);
+		atomic_fetch_add_explicit(&Pointer_Shard->System_Calls_Count, 1, memory_order_relaxed);
+		if (Size < 0)
+		{
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if ((Size == 0) || (MQTTDecode(&Pointer_Shard->Decoder, &Byte, 1, &Packet) < 0))
+		{
+			errno = ECONNRESET;
+			return -1;
+		}
+	} while (Packet.Type == 0);
+	
+	if ((Packet.Type != MQTT_PACKET_TYPE_CONNACK) || (Packet.Return_Code != 0))
+	{
+		errno = ECONNREFUSED;
+		return -1;
+	}
+	
+	Pointer_Shard->Keep_Alive = Pointer_Connection_Parameters->Keep_Alive;
+	Pointer_Shard->Is_Ping_Response_Pending = 0;
+	return 0;
+}
+
+/** Connect a shard with its own client identifier, then start its worker thread.
+ * @param Pointer_Shard The shard to start.
+ * @param Pointer_Address The server address.
+ * @param Address_Size The server address size in bytes.
+ * @param Pointer_Connection_Parameters The client connection parameters.
+ * @return -1 if the shard could not be started (see errno for details),
+ * @return 0 on success.
+ */
+static int MQTTShardedClientStartShard(TMQTTShardedClientShard *Pointer_Shard, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters)
+{
+	TMQTTConnectionParameters Shard_Connection_Parameters;
+	char String_Client_Identifier[MQTT_SHARDED_CLIENT_MAXIMUM_CLIENT_IDENTIFIER_LENGTH + 1];
+	int Result;
+	
+	// Derive the shard client identifier, an empty identifier asks the server to assign one
+	if (Pointer_Connection_Parameters->Pointer_String_Client_Identifier[0] == 0) String_Client_Identifier[0] = 0;
+	else
+	{
+		Result = snprintf(String_Client_Identifier, sizeof(String_Client_Identifier), "%s-%d", Pointer_Connection_Parameters->Pointer_String_Client_Identifier, Pointer_Shard->Index);
+		if ((Result < 0) || (Result >= (int) sizeof(String_Client_Identifier)))
+		{
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+	}
+	Shard_Connection_Parameters = *Pointer_Connection_Parameters;
+	Shard_Connection_Parameters.Pointer_String_Client_Identifier = String_Client_Identifier;
+	
+	if (MQTTShardedClientConnectShard(Pointer_Shard, Pointer_Address, Address_Size, &Shard_Connection_Parameters) != 0) return -1;
+	
+	// The worker thread sleeps until a producer signals this descriptor when the queue is empty
+	Pointer_Shard->Wakeup_Descriptor = eventfd(0, EFD_NONBLOCK);
+	if (Pointer_Shard->Wakeup_Descriptor == -1) return -1;
+	atomic_store(&Pointer_Shard->Is_Worker_Waiting, 0);
+	
+	// Discard the packets a previous connection could not send, and forge the new ones for the granted protocol version
+	MQTTPublishQueueInitialize(&Pointer_Shard->Queue, Pointer_Shard->Pointer_Queue_Slots, Pointer_Shard->Queue_Slots_Count, Pointer_Shard->Pointer_Queue_Buffer, Pointer_Shard->Queue_Slot_Buffer_Size, Pointer_Shard->Decoder.Protocol_Version);
+	
+	atomic_store(&Pointer_Shard->Is_Connected, 1);
+	Result = pthread_create(&Pointer_Shard->Worker_Thread, NULL, MQTTShardedClientWorkerThread, Pointer_Shard);
+	if (Result != 0)
+	{
+		errno = Result;
+		return -1;
+	}
+	Pointer_Shard->Is_Worker_Thread_Started = 1;
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+void MQTTShardedClientInitializeShard(TMQTTShardedClientShard *Pointer_Shard, TMQTTPublishQueueSlot *Pointer_Queue_Slots, int Queue_Slots_Count, void *Pointer_Queue_Buffer, int Queue_Slot_Buffer_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size)
+{
+	// Do some safety checks on parameters
+	assert(Pointer_Shard != NULL);
+	assert(Pointer_Queue_Slots != NULL);
+	assert(Queue_Slots_Count >= 2);
+	assert((Queue_Slots_Count & (Queue_Slots_Count - 1)) == 0);
+	assert(Pointer_Queue_Buffer != NULL);
+	assert(Pointer_Decoder_Buffer != NULL);
+	
+	Pointer_Shard->Pointer_User_Data = NULL;
+	Pointer_Shard->Processor_Index = -1;
+	Pointer_Shard->Pointer_Client = NULL;
+	Pointer_Shard->Index = 0;
+	Pointer_Shard->Socket = -1;
+	Pointer_Shard->Wakeup_Descriptor = -1;
+	Pointer_Shard->Is_Worker_Thread_Started = 0;
+	atomic_init(&Pointer_Shard->Is_Connected, 0);
+	Pointer_Shard->Keep_Alive = 0;
+	Pointer_Shard->Is_Ping_Response_Pending = 0;
+	MQTTDecoderInitialize(&Pointer_Shard->Decoder, Pointer_Decoder_Buffer, Decoder_Buffer_Size);
+	Pointer_Shard->Pointer_Queue_Slots = Pointer_Queue_Slots;
+	Pointer_Shard->Queue_Slots_Count = Queue_Slots_Count;
+	Pointer_Shard->Pointer_Queue_Buffer = Pointer_Queue_Buffer;
+	Pointer_Shard->Queue_Slot_Buffer_Size = Queue_Slot_Buffer_Size;
+	MQTTPublishQueueInitialize(&Pointer_Shard->Queue, Pointer_Queue_Slots, Queue_Slots_Count, Pointer_Queue_Buffer, Queue_Slot_Buffer_Size, MQTT_PROTOCOL_VERSION_3_1_1);
+	atomic_init(&Pointer_Shard->Packet_Identifier, 0);
+	atomic_init(&Pointer_Shard->Is_Worker_Waiting, 0);
+	atomic_init(&Pointer_Shard->Rejected_Messages_Count, 0);
+	atomic_init(&Pointer_Shard->Sent_Packets_Count, 0);
+	atomic_init(&Pointer_Shard->Sent_Bytes_Count, 0);
+	atomic_init(&Pointer_Shard->Received_Packets_Count, 0);
+	atomic_init(&Pointer_Shard->Acknowledged_Messages_Count, 0);
+	atomic_init(&Pointer_Shard->System_Calls_Count, 0);
+}
+
+void MQTTShardedClientInitialize(TMQTTShardedClient *Pointer_Client, TMQTTShardedClientShard *Pointer_Shards, int Shards_Count)
+{
+	long Processors_Count;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	assert(Pointer_Shards != NULL);
+	assert(Shards_Count > 0);
+	
+	Pointer_Client->Packet_Handler = NULL;
+	Pointer_Client->Close_Handler = NULL;
+	Pointer_Client->Pointer_Shards = Pointer_Shards;
+	Pointer_Client->Shards_Count = Shards_Count;
+	atomic_init(&Pointer_Client->Is_Stop_Requested, 0);
+	
+	// Give each worker thread its own processor as long as there are enough processors
+	Processors_Count = sysconf(_SC_NPROCESSORS_ONLN);
+	for (i = 0; i < Shards_Count; i++)
+	{
+		Pointer_Shards[i].Pointer_Client = Pointer_Client;
+		Pointer_Shards[i].Index = i;
+		if (Processors_Count > 0) Pointer_Shards[i].Processor_Index = (int) (i % Processors_Count);
+		else Pointer_Shards[i].Processor_Index = -1;
+	}
+}
+
+int MQTTShardedClientConnect(TMQTTShardedClient *Pointer_Client, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters)
+{
+	int Saved_Error, i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	assert(Pointer_Address != NULL);
+	assert(Pointer_Connection_Parameters != NULL);
+	assert(Pointer_Connection_Parameters->Pointer_String_Client_Identifier != NULL);
+	
+	atomic_store(&Pointer_Client->Is_Stop_Requested, 0);
+	
+	for (i = 0; i < Pointer_Client->Shards_Count; i++)
+	{
+		if (MQTTShardedClientStartShard(&Pointer_Client->Pointer_Shards[i], Pointer_Address, Address_Size, Pointer_Connection_Parameters) != 0)
+		{
+			// Stop the shards that are connected yet, without losing the failure reason
+			Saved_Error = errno;
+			MQTTShardedClientDisconnect(Pointer_Client);
+			errno = Saved_Error;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int MQTTShardedClientGetShardIndex(TMQTTShardedClient *Pointer_Client, char *Pointer_String_Topic_Name)
+{
+	unsigned int Hash = 2166136261U;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	
+	// FNV-1a hash spreads topics differing by a single character, like numbered sensors, over all shards
+	while (*Pointer_String_Topic_Name != 0)
+	{
+		Hash ^= (unsigned char) *Pointer_String_Topic_Name;
+		Hash *= 16777619U;
+		Pointer_String_Topic_Name++;
+	}
+	return (int) (Hash % (unsigned int) Pointer_Client->Shards_Count);
+}
+
+int MQTTShardedClientPublish(TMQTTShardedClient *Pointer_Client, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size)
+{
+	TMQTTShardedClientShard *Pointer_Shard;
+	unsigned short Packet_Identifier = 0;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	assert(Pointer_String_Topic_Name != NULL);
+	assert((Flags & MQTT_PUBLISH_FLAG_QOS_2) == 0);
+	
+	Pointer_Shard = &Pointer_Client->Pointer_Shards[MQTTShardedClientGetShardIndex(Pointer_Client, Pointer_String_Topic_Name)];
+	if (atomic_load_explicit(&Pointer_Shard->Is_Connected, memory_order_relaxed))
+	{
+		// Producers share the shard packet identifiers, 0 is not a valid identifier
+		if (Flags & MQTT_PUBLISH_FLAG_QOS_1)
+		{
+			do
+			{
+				Packet_Identifier = (unsigned short) (atomic_fetch_add_explicit(&Pointer_Shard->Packet_Identifier, 1, memory_order_relaxed) + 1);
+			} while (Packet_Identifier == 0);
+		}
+		
+		if (MQTTPublishQueuePublish(&Pointer_Shard->Queue, Pointer_String_Topic_Name, Flags, Packet_Identifier, Pointer_Application_Message, Application_Message_Size) == 0)
+		{
+			// Wake the worker thread up if it found the queue empty, the fence pairs with the worker thread one. Only one producer clears the request, so a single system call is made per wakeup
+			atomic_thread_fence(memory_order_seq_cst);
+			if (atomic_load_explicit(&Pointer_Shard->Is_Worker_Waiting, memory_order_relaxed) && atomic_exchange_explicit(&Pointer_Shard->Is_Worker_Waiting, 0, memory_order_relaxed)) eventfd_write(Pointer_Shard->Wakeup_Descriptor, 1);
+			return 0;
+		}
+	}
+	
+	atomic_fetch_add_explicit(&Pointer_Shard->Rejected_Messages_Count, 1, memory_order_relaxed);
+	return -1;
+}
+
+void MQTTShardedClientGetStatistics(TMQTTShardedClient *Pointer_Client, int Shard_Index, TMQTTShardedClientStatistics *Pointer_Statistics)
+{
+	TMQTTShardedClientShard *Pointer_Shard;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	assert((Shard_Index >= 0) && (Shard_Index < Pointer_Client->Shards_Count));
+	assert(Pointer_Statistics != NULL);
+	
+	// Each counter is consistent, but they are not read at the same instant
+	Pointer_Shard = &Pointer_Client->Pointer_Shards[Shard_Index];
+	Pointer_Statistics->Sent_Packets_Count = atomic_load_explicit(&Pointer_Shard->Sent_Packets_Count, memory_order_relaxed);
+	Pointer_Statistics->Sent_Bytes_Count = atomic_load_explicit(&Pointer_Shard->Sent_Bytes_Count, memory_order_relaxed);
+	Pointer_Statistics->Rejected_Messages_Count = atomic_load_explicit(&Pointer_Shard->Rejected_Messages_Count, memory_order_relaxed);
+	Pointer_Statistics->Received_Packets_Count = atomic_load_explicit(&Pointer_Shard->Received_Packets_Count, memory_order_relaxed);
+	Pointer_Statistics->Acknowledged_Messages_Count = atomic_load_explicit(&Pointer_Shard->Acknowledged_Messages_Count, memory_order_relaxed);
+	Pointer_Statistics->System_Calls_Count = atomic_load_explicit(&Pointer_Shard->System_Calls_Count, memory_order_relaxed);
+}
+
+void MQTTShardedClientDisconnect(TMQTTShardedClient *Pointer_Client)
+{
+	TMQTTShardedClientShard *Pointer_Shard;
+	int i;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Client != NULL);
+	
+	// Let all worker threads flush their queue at the same time, waking up the ones waiting for data (the wakeup is kept by the eventfd counter if a thread is not waiting yet)
+	atomic_store(&Pointer_Client->Is_Stop_Requested, 1);
+	for (i = 0; i < Pointer_Client->Shards_Count; i++)
+	{
+		if (Pointer_Client->Pointer_Shards[i].Wakeup_Descriptor != -1) eventfd_write(Pointer_Client->Pointer_Shards[i].Wakeup_Descriptor, 1);
+	}
+	
+	for (i = 0; i < Pointer_Client->Shards_Count; i++)
+	{
+		Pointer_Shard = &Pointer_Client->Pointer_Shards[i];
+		
+		if (Pointer_Shard->Is_Worker_Thread_Started)
+		{
+			pthread_join(Pointer_Shard->Worker_Thread, NULL);
+			Pointer_Shard->Is_Worker_Thread_Started = 0;
+		}
+		atomic_store(&Pointer_Shard->Is_Connected, 0);
+		
+		if (Pointer_Shard->Socket != -1)
+		{
+			close(Pointer_Shard->Socket);
+			Pointer_Shard->Socket = -1;
+		}
+		if (Pointer_Shard->Wakeup_Descriptor != -1)
+		{
+			close(Pointer_Shard->Wakeup_Descriptor);
+			Pointer_Shard->Wakeup_Descriptor = -1;
+		}
+	}
+}
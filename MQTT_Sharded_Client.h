@@ -0,0 +1,186 @@
+/** @file MQTT_Sharded_Client.h
+ * Spread the messages published by many threads across several connections to the same server, so sending scales with processor cores and a slow connection does not delay the other topics.
+ * Each shard owns a connection, a lock-free publish queue and a worker thread pinned to a processor. A message is always routed to the shard chosen by its topic name hash, so messages published by a thread to a topic are received in order by the server.
+ * Shards use the client identifier followed by a dash and the shard index (for example "sensor-0", "sensor-1"...), so the server sees them as separate clients.
+ * This module is Linux only. All memory is provided by the user, no dynamic allocation is done.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_SHARDED_CLIENT_H
+#define H_MQTT_SHARDED_CLIENT_H
+
+#include <MQTT.h>
+#include <MQTT_Publish_Queue.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+
+//-------------------------------------------------------------------------------------------------
+// Configuration
+//-------------------------------------------------------------------------------------------------
+/** The longest client identifier a shard can use, including the shard index suffix. Define it in the makefile to change the value. */
+#ifndef MQTT_SHARDED_CLIENT_MAXIMUM_CLIENT_IDENTIFIER_LENGTH
+	#define MQTT_SHARDED_CLIENT_MAXIMUM_CLIENT_IDENTIFIER_LENGTH 64
+#endif
+
+/** How many queued packets a worker thread sends with a single system call at most. Define it in the makefile to change the value. */
+#ifndef MQTT_SHARDED_CLIENT_MAXIMUM_BATCH_SIZE
+	#define MQTT_SHARDED_CLIENT_MAXIMUM_BATCH_SIZE 64
+#endif
+
+/** How many bytes a worker thread can read from its socket at once. The buffer is allocated on the worker thread stack. Define it in the makefile to change the value. */
+#ifndef MQTT_SHARDED_CLIENT_RECEIVE_BUFFER_SIZE
+	#define MQTT_SHARDED_CLIENT_RECEIVE_BUFFER_SIZE 4096
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** A snapshot of a shard counters. */
+typedef struct
+{
+	unsigned long long Sent_Packets_Count; //!< How many packets the worker thread sent, including PINGREQ packets.
+	unsigned long long Sent_Bytes_Count; //!< How many bytes the worker thread sent.
+	unsigned long long Rejected_Messages_Count; //!< How many messages could not be published because the shard queue was full or the shard was not connected.
+	unsigned long long Received_Packets_Count; //!< How many packets the server sent after the CONNACK packet.
+	unsigned long long Acknowledged_Messages_Count; //!< How many PUBACK packets have been received.
+	unsigned long long System_Calls_Count; //!< How many send, receive and poll system calls the worker thread made.
+} TMQTTShardedClientStatistics;
+
+/** A connection used by the sharded client. */
+typedef struct TMQTTShardedClientShard
+{
+	void *Pointer_User_Data; //!< Free for user usage.
+	int Processor_Index; //!< The processor the worker thread is pinned to. MQTTShardedClientInitialize() spreads shards over all online processors, change the value before connecting or set it to -1 to let the system schedule the thread.
+	// Following fields are for internal usage only, do not modify or use
+	struct TMQTTShardedClient *Pointer_Client; //!< The client owning the shard.
+	int Index; //!< The shard position in the client shards array. Use MQTT_SHARDED_CLIENT_GET_SHARD_INDEX() to get this field.
+	int Socket; //!< The blocking connection socket, or -1 if the shard is not connected.
+	int Wakeup_Descriptor; //!< An eventfd signaled by the producers to wake the worker thread up when its queue is no more empty, or -1 if the shard is not connected.
+	pthread_t Worker_Thread; //!< Send the queued packets and receive the server packets.
+	int Is_Worker_Thread_Started; //!< Tell whether the worker thread must be joined when disconnecting.
+	atomic_int Is_Connected; //!< Cleared when the connection is lost. Use MQTT_SHARDED_CLIENT_IS_SHARD_CONNECTED() to get this field.
+	unsigned short Keep_Alive; //!< The keep alive value sent to the server in seconds, 0 if keep alive is disabled.
+	int Is_Ping_Response_Pending; //!< Set when a PINGREQ has been sent and the PINGRESP has not been received yet.
+	TMQTTDecoder Decoder; //!< Extract packets from received data.
+	TMQTTPublishQueue Queue; //!< Messages waiting to be sent by the worker thread.
+	TMQTTPublishQueueSlot *Pointer_Queue_Slots; //!< The queue slots, kept to reset the queue on each connection.
+	int Queue_Slots_Count; //!< How many slots the queue has.
+	void *Pointer_Queue_Buffer; //!< The queued packets memory.
+	int Queue_Slot_Buffer_Size; //!< Each queue slot buffer size in bytes.
+	_Alignas(MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE) atomic_uint Packet_Identifier; //!< The last packet identifier allocated by a producer.
+	atomic_int Is_Worker_Waiting; //!< Set by the worker thread before it blocks because its queue is empty, cleared by the producer that wakes it up.
+	atomic_ullong Rejected_Messages_Count; //!< Written by the producers.
+	_Alignas(MQTT_PUBLISH_QUEUE_CACHE_LINE_SIZE) atomic_ullong Sent_Packets_Count; //!< Written by the worker thread, producers counters are kept on another cache line.
+	atomic_ullong Sent_Bytes_Count; //!< Written by the worker thread.
+	atomic_ullong Received_Packets_Count; //!< Written by the worker thread.
+	atomic_ullong Acknowledged_Messages_Count; //!< Written by the worker thread.
+	atomic_ullong System_Calls_Count; //!< Written by the worker thread.
+} TMQTTShardedClientShard;
+
+/** Called by a worker thread for each packet received on its shard, except PINGRESP packets that are handled by the worker thread.
+ * @param Pointer_Shard The shard the packet has been received on.
+ * @param Pointer_Packet The decoded packet. It is valid only during the handler call.
+ * @note The handler is called concurrently by all worker threads.
+ */
+typedef void (*TMQTTShardedClientPacketHandler)(TMQTTShardedClientShard *Pointer_Shard, TMQTTPacket *Pointer_Packet);
+
+/** Called by a worker thread when its shard connection has been lost because of a network error, a protocol error or a keep alive timeout. The following messages routed to this shard are rejected.
+ * @param Pointer_Shard The disconnected shard.
+ * @note The handler is called concurrently by all worker threads.
+ */
+typedef void (*TMQTTShardedClientCloseHandler)(TMQTTShardedClientShard *Pointer_Shard);
+
+/** Several connections sharing the published messages. */
+typedef struct TMQTTShardedClient
+{
+	TMQTTShardedClientPacketHandler Packet_Handler; //!< Can be NULL.
+	TMQTTShardedClientCloseHandler Close_Handler; //!< Can be NULL.
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTShardedClientShard *Pointer_Shards; //!< All shards.
+	int Shards_Count; //!< How many shards are used. Use MQTT_SHARDED_CLIENT_GET_SHARDS_COUNT() to get this field.
+	atomic_int Is_Stop_Requested; //!< Tell the worker threads to send their remaining packets, then to disconnect.
+} TMQTTShardedClient;
+
+//-------------------------------------------------------------------------------------------------
+// Constants and macros
+//-------------------------------------------------------------------------------------------------
+/** Retrieve how many shards a client uses.
+ * @param Pointer_Client An initialized client.
+ * @return The shards count.
+ */
+#define MQTT_SHARDED_CLIENT_GET_SHARDS_COUNT(Pointer_Client) (Pointer_Client)->Shards_Count
+
+/** Retrieve a shard position, it is also the suffix of the shard client identifier.
+ * @param Pointer_Shard An initialized shard.
+ * @return The shard index.
+ */
+#define MQTT_SHARDED_CLIENT_GET_SHARD_INDEX(Pointer_Shard) (Pointer_Shard)->Index
+
+/** Tell whether a shard connection is established.
+ * @param Pointer_Shard An initialized shard.
+ * @return 1 if the shard accepts messages, 0 if it is disconnected.
+ */
+#define MQTT_SHARDED_CLIENT_IS_SHARD_CONNECTED(Pointer_Shard) atomic_load(&(Pointer_Shard)->Is_Connected)
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Prepare a shard memory. Call it once for each shard before initializing the client.
+ * @param Pointer_Shard The shard to initialize.
+ * @param Pointer_Queue_Slots The shard publish queue slots.
+ * @param Queue_Slots_Count How many slots the array holds. It must be a power of two, at least 2.
+ * @param Pointer_Queue_Buffer The memory used to store the queued packets, it must be Queue_Slots_Count * Queue_Slot_Buffer_Size bytes long.
+ * @param Queue_Slot_Buffer_Size How many bytes each queue slot can use. The biggest packet to publish must fit in, including the 5 bytes reserved for the fixed header.
+ * @param Pointer_Decoder_Buffer Buffer used to reassemble received packets split across several reads.
+ * @param Decoder_Buffer_Size The decoder buffer size in bytes.
+ */
+void MQTTShardedClientInitializeShard(TMQTTShardedClientShard *Pointer_Shard, TMQTTPublishQueueSlot *Pointer_Queue_Slots, int Queue_Slots_Count, void *Pointer_Queue_Buffer, int Queue_Slot_Buffer_Size, void *Pointer_Decoder_Buffer, int Decoder_Buffer_Size);
+
+/** Create a disconnected client. Set the handlers fields after calling this function.
+ * @param Pointer_Client The client to initialize.
+ * @param Pointer_Shards The shards, they must have been initialized with MQTTShardedClientInitializeShard().
+ * @param Shards_Count How many shards the array holds.
+ */
+void MQTTShardedClientInitialize(TMQTTShardedClient *Pointer_Client, TMQTTShardedClientShard *Pointer_Shards, int Shards_Count);
+
+/** Establish all shards connections one after the other, then start the worker threads. This function blocks until all connections are granted by the server.
+ * @param Pointer_Client A disconnected client.
+ * @param Pointer_Address The server address.
+ * @param Address_Size The server address size in bytes.
+ * @param Pointer_Connection_Parameters The MQTT connection parameters, the shard index is appended to the client identifier. Buffer is used to forge each CONNECT packet in turn. An empty client identifier is kept as is, so the server assigns an identifier to each shard.
+ * @return -1 if a shard could not be connected (see errno for details, all shards are disconnected),
+ * @return 0 on success.
+ */
+int MQTTShardedClientConnect(TMQTTShardedClient *Pointer_Client, struct sockaddr *Pointer_Address, socklen_t Address_Size, TMQTTConnectionParameters *Pointer_Connection_Parameters);
+
+/** Tell which shard messages published to a topic are sent by.
+ * @param Pointer_Client An initialized client.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @return The shard index.
+ */
+int MQTTShardedClientGetShardIndex(TMQTTShardedClient *Pointer_Client, char *Pointer_String_Topic_Name);
+
+/** Queue a PUBLISH packet on the shard the topic is routed to. This function can be called by any thread and never blocks. It makes a system call only to wake the shard worker thread up when its queue was empty.
+ * @param Pointer_Client A connected client.
+ * @param Pointer_String_Topic_Name The topic name.
+ * @param Flags A combination of MQTT_PUBLISH_FLAG_xxx values. QoS 2 is not supported, because the worker threads do not answer PUBREC packets. QoS 1 messages packet identifier is allocated by the shard, the PUBACK packets are given to the packet handler.
+ * @param Pointer_Application_Message The application message.
+ * @param Application_Message_Size The application message size in bytes.
+ * @return -1 if the topic name is not valid, if the shard queue is full, if the shard is not connected or if the packet does not fit in a queue slot,
+ * @return 0 on success.
+ */
+int MQTTShardedClientPublish(TMQTTShardedClient *Pointer_Client, char *Pointer_String_Topic_Name, int Flags, void *Pointer_Application_Message, int Application_Message_Size);
+
+/** Read a shard counters. This function can be called by any thread while the client is running.
+ * @param Pointer_Client An initialized client.
+ * @param Shard_Index The shard index.
+ * @param Pointer_Statistics On output, contain the shard counters.
+ */
+void MQTTShardedClientGetStatistics(TMQTTShardedClient *Pointer_Client, int Shard_Index, TMQTTShardedClientStatistics *Pointer_Statistics);
+
+/** Send all queued messages followed by a DISCONNECT packet on each shard, then close the connections. Producers must have stopped publishing before calling this function.
+ * @param Pointer_Client A connected client. Nothing is done for shards that are not connected.
+ */
+void MQTTShardedClientDisconnect(TMQTTShardedClient *Pointer_Client);
+
+#endif
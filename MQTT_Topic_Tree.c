@@ -0,0 +1,298 @@
+/** @file MQTT_Topic_Tree.c
+ * @see MQTT_Topic_Tree.h for description.
+ * @author Adrien RICCIARDI
+ */
+#include <assert.h>
+#include <MQTT_Topic_Tree.h>
+#include <stddef.h>
+#include <string.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants and macros
+//-------------------------------------------------------------------------------------------------
+/** The hash table uses at most 1/N of the buffer, the remaining memory is left to the nodes. */
+#define MQTT_TOPIC_TREE_BUCKETS_MEMORY_RATIO 8
+
+/** Round a size to the next multiple of a pointer size, so all nodes are correctly aligned.
+ * @param Size The size to round.
+ */
+#define MQTT_TOPIC_TREE_ALIGN_SIZE(Size) (((Size) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Compute a level hash (FNV-1a algorithm), the parent address is mixed in so the same level name gets a different hash under different parents.
+ * @param Pointer_Parent The parent level.
+ * @param Pointer_Name The level name.
+ * @param Name_Length The level name length in bytes.
+ * @return The hash.
+ */
+static unsigned int MQTTTopicTreeComputeHash(TMQTTTopicTreeNode *Pointer_Parent, char *Pointer_Name, int Name_Length)
+{
+	unsigned int Hash;
+	int i;
+	
+	Hash = 2166136261U ^ (unsigned int) (size_t) Pointer_Parent;
+	for (i = 0; i < Name_Length; i++)
+	{
+		Hash ^= (unsigned char) Pointer_Name[i];
+		Hash *= 16777619U;
+	}
+	return Hash;
+}
+
+/** Take a node from the tree memory.
+ * @param Pointer_Tree The tree.
+ * @param Pointer_Parent The node parent.
+ * @param Pointer_Name The level name.
+ * @param Name_Length The level name length in bytes.
+ * @return NULL if there is not enough memory left,
+ * @return The initialized node.
+ */
+static TMQTTTopicTreeNode *MQTTTopicTreeAllocateNode(TMQTTTopicTree *Pointer_Tree, TMQTTTopicTreeNode *Pointer_Parent, char *Pointer_Name, int Name_Length)
+{
+	TMQTTTopicTreeNode *Pointer_Node;
+	size_t Size;
+	
+	// Make sure the node fits in the remaining memory
+	Size = MQTT_TOPIC_TREE_ALIGN_SIZE(sizeof(TMQTTTopicTreeNode) + Name_Length);
+	if (Size > (size_t) (Pointer_Tree->Pointer_Memory_End - Pointer_Tree->Pointer_Free_Memory)) return NULL;
+	Pointer_Node = (TMQTTTopicTreeNode *) Pointer_Tree->Pointer_Free_Memory;
+	Pointer_Tree->Pointer_Free_Memory += Size;
+	
+	memset(Pointer_Node, 0, sizeof(TMQTTTopicTreeNode));
+	Pointer_Node->Pointer_Parent = Pointer_Parent;
+	Pointer_Node->Name_Length = Name_Length;
+	memcpy(Pointer_Node->Name, Pointer_Name, Name_Length);
+	return Pointer_Node;
+}
+
+/** Find the level following a parent level.
+ * @param Pointer_Tree The tree.
+ * @param Pointer_Parent The parent level.
+ * @param Pointer_Name The level name.
+ * @param Name_Length The level name length in bytes.
+ * @param Hash The level hash computed with MQTTTopicTreeComputeHash().
+ * @return NULL if the level does not exist,
+ * @return The level node.
+ */
+static TMQTTTopicTreeNode *MQTTTopicTreeFindChild(TMQTTTopicTree *Pointer_Tree, TMQTTTopicTreeNode *Pointer_Parent, char *Pointer_Name, int Name_Length, unsigned int Hash)
+{
+	TMQTTTopicTreeNode *Pointer_Node;
+	
+	for (Pointer_Node = Pointer_Tree->Pointer_Buckets[Hash & Pointer_Tree->Buckets_Mask]; Pointer_Node != NULL; Pointer_Node = Pointer_Node->Pointer_Next_In_Bucket)
+	{
+		if ((Pointer_Node->Hash == Hash) && (Pointer_Node->Pointer_Parent == Pointer_Parent) && (Pointer_Node->Name_Length == Name_Length) && (memcmp(Pointer_Node->Name, Pointer_Name, Name_Length) == 0)) return Pointer_Node;
+	}
+	return NULL;
+}
+
+/** Retrieve the node matching a topic filter.
+ * @param Pointer_Tree The tree.
+ * @param Pointer_String_Topic_Filter The filter.
+ * @param Is_Creation_Allowed Set to 1 to create the missing levels, set to 0 to only search for the filter.
+ * @return NULL if the filter is malformed, not found or there is not enough memory to create it,
+ * @return The last filter level node.
+ */
+static TMQTTTopicTreeNode *MQTTTopicTreeGetFilterNode(TMQTTTopicTree *Pointer_Tree, char *Pointer_String_Topic_Filter, int Is_Creation_Allowed)
+{
+	TMQTTTopicTreeNode *Pointer_Node, *Pointer_Child, **Pointer_Pointer_Wildcard_Child;
+	char *Pointer_Level_End;
+	int Level_Length;
+	unsigned int Hash, Bucket_Index;
+	
+	Pointer_Node = Pointer_Tree->Pointer_Root;
+	while (1)
+	{
+		// Find the current level end
+		Pointer_Level_End = strchr(Pointer_String_Topic_Filter, '/');
+		if (Pointer_Level_End == NULL) Level_Length = (int) strlen(Pointer_String_Topic_Filter);
+		else Level_Length = (int) (Pointer_Level_End - Pointer_String_Topic_Filter);
+		
+		// Wildcards must occupy a whole level (see specification section 4.7.1)
+		if ((Level_Length == 1) && ((Pointer_String_Topic_Filter[0] == '+') || (Pointer_String_Topic_Filter[0] == '#')))
+		{
+			// Multi-level wildcard must be the last filter character
+			if (Pointer_String_Topic_Filter[0] == '#')
+			{
+				if (Pointer_Level_End != NULL) return NULL;
+				Pointer_Pointer_Wildcard_Child = &Pointer_Node->Pointer_Multi_Level_Wildcard_Child;
+			}
+			else Pointer_Pointer_Wildcard_Child = &Pointer_Node->Pointer_Single_Level_Wildcard_Child;
+			
+			Pointer_Child = *Pointer_Pointer_Wildcard_Child;
+			if ((Pointer_Child == NULL) && Is_Creation_Allowed)
+			{
+				Pointer_Child = MQTTTopicTreeAllocateNode(Pointer_Tree, Pointer_Node, Pointer_String_Topic_Filter, 1);
+				*Pointer_Pointer_Wildcard_Child = Pointer_Child;
+			}
+		}
+		else
+		{
+			if ((memchr(Pointer_String_Topic_Filter, '+', Level_Length) != NULL) || (memchr(Pointer_String_Topic_Filter, '#', Level_Length) != NULL)) return NULL;
+			
+			// Regular levels are stored in the hash table
+			Hash = MQTTTopicTreeComputeHash(Pointer_Node, Pointer_String_Topic_Filter, Level_Length);
+			Pointer_Child = MQTTTopicTreeFindChild(Pointer_Tree, Pointer_Node, Pointer_String_Topic_Filter, Level_Length, Hash);
+			if ((Pointer_Child == NULL) && Is_Creation_Allowed)
+			{
+				Pointer_Child = MQTTTopicTreeAllocateNode(Pointer_Tree, Pointer_Node, Pointer_String_Topic_Filter, Level_Length);
+				if (Pointer_Child != NULL)
+				{
+					Pointer_Child->Hash = Hash;
+					Bucket_Index = Hash & Pointer_Tree->Buckets_Mask;
+					Pointer_Child->Pointer_Next_In_Bucket = Pointer_Tree->Pointer_Buckets[Bucket_Index];
+					Pointer_Tree->Pointer_Buckets[Bucket_Index] = Pointer_Child;
+				}
+			}
+		}
+		if (Pointer_Child == NULL) return NULL;
+		Pointer_Node = Pointer_Child;
+		
+		// Go to next level
+		if (Pointer_Level_End == NULL) return Pointer_Node;
+		Pointer_String_Topic_Filter = Pointer_Level_End + 1;
+	}
+}
+
+/** Call the handlers of all filters matching the remaining topic levels.
+ * @param Pointer_Tree The tree.
+ * @param Pointer_Node The level matching the previous topic levels.
+ * @param Pointer_Topic_Name The remaining topic levels.
+ * @param Topic_Name_Length The remaining topic levels length in bytes, or -1 if there is no more level.
+ * @param Pointer_Packet The received packet.
+ * @param Are_Wildcards_Allowed Set to 0 to prevent wildcards from matching the next level.
+ * @return How many handlers have been called.
+ */
+static int MQTTTopicTreeMatch(TMQTTTopicTree *Pointer_Tree, TMQTTTopicTreeNode *Pointer_Node, char *Pointer_Topic_Name, int Topic_Name_Length, TMQTTPacket *Pointer_Packet, int Are_Wildcards_Allowed)
+{
+	TMQTTTopicTreeNode *Pointer_Child;
+	char *Pointer_Level_End;
+	int Level_Length, Remaining_Length, Handlers_Count = 0;
+	
+	// Multi-level wildcard matches the parent level and all following ones
+	Pointer_Child = Pointer_Node->Pointer_Multi_Level_Wildcard_Child;
+	if (Are_Wildcards_Allowed && (Pointer_Child != NULL) && (Pointer_Child->Handler != NULL))
+	{
+		Pointer_Child->Handler(Pointer_Packet, Pointer_Child->Pointer_User_Data);
+		Handlers_Count++;
+	}
+	
+	// Is the whole topic matched ?
+	if (Topic_Name_Length < 0)
+	{
+		if (Pointer_Node->Handler != NULL)
+		{
+			Pointer_Node->Handler(Pointer_Packet, Pointer_Node->Pointer_User_Data);
+			Handlers_Count++;
+		}
+		return Handlers_Count;
+	}
+	
+	// Extract the current level
+	Pointer_Level_End = memchr(Pointer_Topic_Name, '/', Topic_Name_Length);
+	if (Pointer_Level_End == NULL)
+	{
+		Level_Length = Topic_Name_Length;
+		Remaining_Length = -1;
+	}
+	else
+	{
+		Level_Length = (int) (Pointer_Level_End - Pointer_Topic_Name);
+		Remaining_Length = Topic_Name_Length - Level_Length - 1;
+	}
+	
+	// Single-level wildcard matches any level name
+	Pointer_Child = Pointer_Node->Pointer_Single_Level_Wildcard_Child;
+	if (Are_Wildcards_Allowed && (Pointer_Child != NULL)) Handlers_Count += MQTTTopicTreeMatch(Pointer_Tree, Pointer_Child, Pointer_Topic_Name + Level_Length + 1, Remaining_Length, Pointer_Packet, 1);
+	
+	// Exact level name match
+	Pointer_Child = MQTTTopicTreeFindChild(Pointer_Tree, Pointer_Node, Pointer_Topic_Name, Level_Length, MQTTTopicTreeComputeHash(Pointer_Node, Pointer_Topic_Name, Level_Length));
+	if (Pointer_Child != NULL) Handlers_Count += MQTTTopicTreeMatch(Pointer_Tree, Pointer_Child, Pointer_Topic_Name + Level_Length + 1, Remaining_Length, Pointer_Packet, 1);
+	
+	return Handlers_Count;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Public functions
+//-------------------------------------------------------------------------------------------------
+int MQTTTopicTreeInitialize(TMQTTTopicTree *Pointer_Tree, void *Pointer_Buffer, int Buffer_Size)
+{
+	unsigned char *Pointer_Memory;
+	size_t Padding_Size;
+	unsigned int Buckets_Count;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Tree != NULL);
+	assert(Pointer_Buffer != NULL);
+	
+	// Align buffer beginning
+	Pointer_Memory = Pointer_Buffer;
+	Padding_Size = MQTT_TOPIC_TREE_ALIGN_SIZE((size_t) Pointer_Memory) - (size_t) Pointer_Memory;
+	if (Buffer_Size < (int) Padding_Size) return -1;
+	Pointer_Memory += Padding_Size;
+	Buffer_Size -= (int) Padding_Size;
+	
+	// Use the biggest power of two buckets count fitting in the buffer part dedicated to the hash table
+	Buckets_Count = 1;
+	while (Buckets_Count * 2 * sizeof(TMQTTTopicTreeNode *) <= (size_t) Buffer_Size / MQTT_TOPIC_TREE_BUCKETS_MEMORY_RATIO) Buckets_Count *= 2;
+	Pointer_Tree->Pointer_Buckets = (TMQTTTopicTreeNode **) Pointer_Memory;
+	Pointer_Tree->Buckets_Mask = Buckets_Count - 1;
+	if ((size_t) Buffer_Size < Buckets_Count * sizeof(TMQTTTopicTreeNode *)) return -1;
+	memset(Pointer_Tree->Pointer_Buckets, 0, Buckets_Count * sizeof(TMQTTTopicTreeNode *));
+	
+	// Nodes use the remaining memory
+	Pointer_Tree->Pointer_Free_Memory = Pointer_Memory + Buckets_Count * sizeof(TMQTTTopicTreeNode *);
+	Pointer_Tree->Pointer_Memory_End = Pointer_Memory + Buffer_Size;
+	Pointer_Tree->Pointer_Root = MQTTTopicTreeAllocateNode(Pointer_Tree, NULL, "", 0);
+	if (Pointer_Tree->Pointer_Root == NULL) return -1;
+	return 0;
+}
+
+int MQTTTopicTreeAddFilter(TMQTTTopicTree *Pointer_Tree, char *Pointer_String_Topic_Filter, TMQTTTopicTreeHandler Handler, void *Pointer_User_Data)
+{
+	TMQTTTopicTreeNode *Pointer_Node;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Tree != NULL);
+	assert(Pointer_String_Topic_Filter != NULL);
+	assert(Handler != NULL);
+	
+	// A filter must be at least one character long
+	if (Pointer_String_Topic_Filter[0] == 0) return -1;
+	
+	Pointer_Node = MQTTTopicTreeGetFilterNode(Pointer_Tree, Pointer_String_Topic_Filter, 1);
+	if (Pointer_Node == NULL) return -1;
+	Pointer_Node->Handler = Handler;
+	Pointer_Node->Pointer_User_Data = Pointer_User_Data;
+	return 0;
+}
+
+int MQTTTopicTreeRemoveFilter(TMQTTTopicTree *Pointer_Tree, char *Pointer_String_Topic_Filter)
+{
+	TMQTTTopicTreeNode *Pointer_Node;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Tree != NULL);
+	assert(Pointer_String_Topic_Filter != NULL);
+	
+	Pointer_Node = MQTTTopicTreeGetFilterNode(Pointer_Tree, Pointer_String_Topic_Filter, 0);
+	if ((Pointer_Node == NULL) || (Pointer_Node->Handler == NULL)) return -1;
+	Pointer_Node->Handler = NULL;
+	return 0;
+}
+
+int MQTTTopicTreeDispatch(TMQTTTopicTree *Pointer_Tree, TMQTTPacket *Pointer_Packet)
+{
+	char *Pointer_Topic_Name;
+	
+	// Do some safety checks on parameters
+	assert(Pointer_Tree != NULL);
+	assert(Pointer_Packet != NULL);
+	
+	if ((Pointer_Packet->Type != MQTT_PACKET_TYPE_PUBLISH) || (Pointer_Packet->Topic_Name_Size == 0)) return 0;
+	
+	// Wildcards can't match the first level of topics starting with '$'
+	Pointer_Topic_Name = (char *) Pointer_Packet->Pointer_Topic_Name;
+	return MQTTTopicTreeMatch(Pointer_Tree, Pointer_Tree->Pointer_Root, Pointer_Topic_Name, Pointer_Packet->Topic_Name_Size, Pointer_Packet, Pointer_Topic_Name[0] != '$');
+}
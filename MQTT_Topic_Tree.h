@@ -0,0 +1,84 @@
+/** @file MQTT_Topic_Tree.h
+ * Route received PUBLISH messages to the handlers of all matching topic filters, including the ones using "+" and "#" wildcards.
+ * Filters are stored in a tree with one level per topic level, so matching cost depends on the topic depth, not on the number of registered filters.
+ * All memory is taken from a user-provided buffer, no dynamic allocation is done.
+ * @author Adrien RICCIARDI
+ */
+#ifndef H_MQTT_TOPIC_TREE_H
+#define H_MQTT_TOPIC_TREE_H
+
+#include <MQTT.h>
+
+//-------------------------------------------------------------------------------------------------
+// Types
+//-------------------------------------------------------------------------------------------------
+/** Function called for each filter matching a received message topic.
+ * @param Pointer_Packet The received PUBLISH packet.
+ * @param Pointer_User_Data The value given when the filter was added.
+ */
+typedef void (*TMQTTTopicTreeHandler)(TMQTTPacket *Pointer_Packet, void *Pointer_User_Data);
+
+/** A topic level. */
+typedef struct TMQTTTopicTreeNode
+{
+	struct TMQTTTopicTreeNode *Pointer_Parent; //!< The previous level, or NULL for the tree root.
+	struct TMQTTTopicTreeNode *Pointer_Next_In_Bucket; //!< The next node having the same hash table bucket.
+	struct TMQTTTopicTreeNode *Pointer_Single_Level_Wildcard_Child; //!< The "+" level following this one.
+	struct TMQTTTopicTreeNode *Pointer_Multi_Level_Wildcard_Child; //!< The "#" level following this one.
+	TMQTTTopicTreeHandler Handler; //!< The function to call when a topic ends at this level, or NULL if no filter ends here.
+	void *Pointer_User_Data; //!< Given to the handler.
+	unsigned int Hash; //!< The level name hash, mixed with the parent address.
+	int Name_Length; //!< The level name length in bytes.
+	char Name[]; //!< The level name (it is not terminated).
+} TMQTTTopicTreeNode;
+
+/** All registered topic filters. */
+typedef struct
+{
+	// Following fields are for internal usage only, do not modify or use
+	TMQTTTopicTreeNode **Pointer_Buckets; //!< Hash table used to find a level from its parent and its name.
+	unsigned int Buckets_Mask; //!< Buckets count minus one (buckets count is a power of two).
+	unsigned char *Pointer_Free_Memory; //!< Where the next node will be allocated.
+	unsigned char *Pointer_Memory_End; //!< The first byte after the user buffer.
+	TMQTTTopicTreeNode *Pointer_Root; //!< The node before the first topic level.
+} TMQTTTopicTree;
+
+//-------------------------------------------------------------------------------------------------
+// Functions
+//-------------------------------------------------------------------------------------------------
+/** Create an empty tree.
+ * @param Pointer_Tree The tree to initialize.
+ * @param Pointer_Buffer The memory in which all tree data are stored. It must stay valid as long as the tree is used.
+ * @param Buffer_Size The buffer size in bytes. Plan about 64 bytes per distinct topic level.
+ * @return -1 if the buffer is too small,
+ * @return 0 on success.
+ */
+int MQTTTopicTreeInitialize(TMQTTTopicTree *Pointer_Tree, void *Pointer_Buffer, int Buffer_Size);
+
+/** Register a handler for a topic filter. Adding a filter that is present yet replaces its handler.
+ * @param Pointer_Tree An initialized tree.
+ * @param Pointer_String_Topic_Filter The filter, wildcards are allowed.
+ * @param Handler The function to call for each received message matching the filter.
+ * @param Pointer_User_Data A value given to the handler.
+ * @return -1 if the filter is malformed or if there is not enough memory left,
+ * @return 0 on success.
+ */
+int MQTTTopicTreeAddFilter(TMQTTTopicTree *Pointer_Tree, char *Pointer_String_Topic_Filter, TMQTTTopicTreeHandler Handler, void *Pointer_User_Data);
+
+/** Unregister a topic filter handler. The filter memory is not given back, but it will be reused if the same filter is added again.
+ * @param Pointer_Tree An initialized tree.
+ * @param Pointer_String_Topic_Filter The filter to remove.
+ * @return -1 if the filter was not found,
+ * @return 0 on success.
+ */
+int MQTTTopicTreeRemoveFilter(TMQTTTopicTree *Pointer_Tree, char *Pointer_String_Topic_Filter);
+
+/** Call the handlers of all filters matching a received PUBLISH packet topic name.
+ * @param Pointer_Tree An initialized tree.
+ * @param Pointer_Packet A PUBLISH packet returned by MQTTDecode().
+ * @return How many handlers have been called.
+ * @note Topic names starting with '$' are not matched by filters starting with a wildcard (see specification section 4.7.2).
+ */
+int MQTTTopicTreeDispatch(TMQTTTopicTree *Pointer_Tree, TMQTTPacket *Pointer_Packet);
+
+#endif
@@ -0,0 +1,220 @@
+/** @file Packet_Generator.c
+ * Generate a C header containing the CONNECT and SUBSCRIBE packets of a device which connection parameters and subscriptions are known at build time.
+ * The packets are stored as const arrays, so they can live in flash and be sent with a single write, without encoding work nor RAM buffer.
+ * @author Adrien RICCIARDI
+ */
+#include <MQTT.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+//-------------------------------------------------------------------------------------------------
+// Private constants
+//-------------------------------------------------------------------------------------------------
+/** How many topic filters can be subscribed to at most. */
+#define PACKET_GENERATOR_MAXIMUM_SUBSCRIPTIONS_COUNT 64
+/** The default SUBSCRIBE packet identifier. MQTTAllocatePacketIdentifier() returns this value last, so it does not collide with other packets sent right after the connection. */
+#define PACKET_GENERATOR_DEFAULT_SUBSCRIBE_PACKET_IDENTIFIER 0xFFFF
+
+//-------------------------------------------------------------------------------------------------
+// Private functions
+//-------------------------------------------------------------------------------------------------
+/** Display the program usage.
+ * @param Pointer_String_Program_Name The program name.
+ */
+static void PacketGeneratorDisplayUsage(char *Pointer_String_Program_Name)
+{
+	printf("Usage : %s -c Client_Identifier [-u User_Name] [-w Password] [-k Keep_Alive] [-n] [-t Will_Topic -m Will_Message [-q Will_QoS] [-r]] [-s Topic_Filter:QoS]... [-i Subscribe_Packet_Identifier] [-p Prefix]\n", Pointer_String_Program_Name);
+	printf("  -c : the client identifier.\n");
+	printf("  -u : the user name.\n");
+	printf("  -w : the password.\n");
+	printf("  -k : the keep alive value in seconds (default is 60).\n");
+	printf("  -n : do not request a clean session.\n");
+	printf("  -t : the will topic.\n");
+	printf("  -m : the will message.\n");
+	printf("  -q : the will message QoS (default is 0).\n");
+	printf("  -r : retain the will message.\n");
+	printf("  -s : subscribe to a topic filter with the specified maximum QoS, can be repeated. The SUBSCRIBE packet is generated only if at least one topic filter is provided.\n");
+	printf("  -i : the SUBSCRIBE packet identifier (default is %d).\n", PACKET_GENERATOR_DEFAULT_SUBSCRIBE_PACKET_IDENTIFIER);
+	printf("  -p : the prefix of the generated arrays and macros names (default is \"MQTT_Constant\").\n");
+	printf("The generated header is written to the standard output.\n");
+}
+
+/** Output a packet as a const array definition.
+ * @param Pointer_String_Prefix The array name prefix.
+ * @param Pointer_String_Name The packet name, appended to the prefix.
+ * @param Pointer_Context The context containing the forged packet.
+ */
+static void PacketGeneratorOutputPacket(char *Pointer_String_Prefix, char *Pointer_String_Name, TMQTTContext *Pointer_Context)
+{
+	unsigned char *Pointer_Buffer;
+	int i, Size;
+	
+	Pointer_Buffer = MQTT_GET_MESSAGE_BUFFER(Pointer_Context);
+	Size = MQTT_GET_MESSAGE_SIZE(Pointer_Context);
+	
+	printf("static const unsigned char %s_%s_Packet[%d] =\n{", Pointer_String_Prefix, Pointer_String_Name, Size);
+	for (i = 0; i < Size; i++)
+	{
+		// Display 16 bytes per line
+		if ((i % 16) == 0) printf("\n\t");
+		else printf(" ");
+		printf("0x%02X%s", Pointer_Buffer[i], i < Size - 1 ? "," : "");
+	}
+	printf("\n};\n");
+}
+
+//-------------------------------------------------------------------------------------------------
+// Entry point
+//-------------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	static unsigned char Buffer[65536]; // Avoid storing big buffers on the stack
+	TMQTTContext MQTT_Context;
+	TMQTTConnectionParameters MQTT_Connection_Parameters;
+	TMQTTSubscription Subscriptions[PACKET_GENERATOR_MAXIMUM_SUBSCRIPTIONS_COUNT];
+	char *Pointer_String_Prefix = "MQTT_Constant", String_Macros_Prefix[256], *Pointer_String_Separator;
+	int Option, Subscriptions_Count = 0, Keep_Alive, Packet_Identifier = PACKET_GENERATOR_DEFAULT_SUBSCRIBE_PACKET_IDENTIFIER, i;
+	
+	memset(&MQTT_Connection_Parameters, 0, sizeof(MQTT_Connection_Parameters));
+	MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 1;
+	MQTT_Connection_Parameters.Keep_Alive = 60;
+	MQTT_Connection_Parameters.Pointer_Buffer = Buffer;
+	MQTT_Connection_Parameters.Buffer_Size = sizeof(Buffer);
+	
+	// Check parameters
+	while ((Option = getopt(argc, argv, "c:u:w:k:nt:m:q:rs:i:p:")) != -1)
+	{
+		switch (Option)
+		{
+			case 'c':
+				MQTT_Connection_Parameters.Pointer_String_Client_Identifier = optarg;
+				break;
+			
+			case 'u':
+				MQTT_Connection_Parameters.Pointer_String_User_Name = optarg;
+				break;
+			
+			case 'w':
+				MQTT_Connection_Parameters.Pointer_String_Password = optarg;
+				break;
+			
+			case 'k':
+				Keep_Alive = atoi(optarg);
+				if ((Keep_Alive < 0) || (Keep_Alive > 65535))
+				{
+					fprintf(stderr, "Error : keep alive must be in range [0; 65535].\n");
+					return EXIT_FAILURE;
+				}
+				MQTT_Connection_Parameters.Keep_Alive = (unsigned short) Keep_Alive;
+				break;
+			
+			case 'n':
+				MQTT_Connection_Parameters.Is_Clean_Session_Enabled = 0;
+				break;
+			
+			case 't':
+				MQTT_Connection_Parameters.Pointer_String_Will_Topic = optarg;
+				break;
+			
+			case 'm':
+				MQTT_Connection_Parameters.Pointer_Will_Message = optarg;
+				MQTT_Connection_Parameters.Will_Message_Size = (int) strlen(optarg);
+				break;
+			
+			case 'q':
+				if (strcmp(optarg, "1") == 0) MQTT_Connection_Parameters.Will_Flags |= MQTT_PUBLISH_FLAG_QOS_1;
+				else if (strcmp(optarg, "2") == 0) MQTT_Connection_Parameters.Will_Flags |= MQTT_PUBLISH_FLAG_QOS_2;
+				else if (strcmp(optarg, "0") != 0)
+				{
+					fprintf(stderr, "Error : will QoS must be 0, 1 or 2.\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			
+			case 'r':
+				MQTT_Connection_Parameters.Will_Flags |= MQTT_PUBLISH_FLAG_RETAIN;
+				break;
+			
+			case 's':
+				if (Subscriptions_Count >= PACKET_GENERATOR_MAXIMUM_SUBSCRIPTIONS_COUNT)
+				{
+					fprintf(stderr, "Error : too many topic filters, the maximum is %d.\n", PACKET_GENERATOR_MAXIMUM_SUBSCRIPTIONS_COUNT);
+					return EXIT_FAILURE;
+				}
+				
+				// The QoS follows the last colon, so topic filters can contain colons
+				Pointer_String_Separator = strrchr(optarg, ':');
+				if ((Pointer_String_Separator == NULL) || (Pointer_String_Separator == optarg) || (strlen(Pointer_String_Separator) != 2) || (Pointer_String_Separator[1] < '0') || (Pointer_String_Separator[1] > '2'))
+				{
+					fprintf(stderr, "Error : bad subscription '%s', the expected format is Topic_Filter:QoS with QoS being 0, 1 or 2.\n", optarg);
+					return EXIT_FAILURE;
+				}
+				*Pointer_String_Separator = 0;
+				Subscriptions[Subscriptions_Count].Pointer_String_Topic_Filter = optarg;
+				Subscriptions[Subscriptions_Count].QoS = Pointer_String_Separator[1] - '0';
+				Subscriptions_Count++;
+				break;
+			
+			case 'i':
+				Packet_Identifier = atoi(optarg);
+				if ((Packet_Identifier <= 0) || (Packet_Identifier > 65535))
+				{
+					fprintf(stderr, "Error : packet identifier must be in range [1; 65535].\n");
+					return EXIT_FAILURE;
+				}
+				break;
+			
+			case 'p':
+				Pointer_String_Prefix = optarg;
+				break;
+			
+			default:
+				PacketGeneratorDisplayUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if ((MQTT_Connection_Parameters.Pointer_String_Client_Identifier == NULL) || ((MQTT_Connection_Parameters.Pointer_String_Will_Topic == NULL) != (MQTT_Connection_Parameters.Pointer_Will_Message == NULL)) || (optind != argc))
+	{
+		PacketGeneratorDisplayUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	// Macros use the upper case prefix
+	snprintf(String_Macros_Prefix, sizeof(String_Macros_Prefix), "%s", Pointer_String_Prefix);
+	for (i = 0; String_Macros_Prefix[i] != 0; i++)
+	{
+		if ((String_Macros_Prefix[i] >= 'a') && (String_Macros_Prefix[i] <= 'z')) String_Macros_Prefix[i] -= 'a' - 'A';
+	}
+	
+	printf("/** @file\n * MQTT packets generated by Packet_Generator for client identifier \"%s\", do not modify.\n */\n", MQTT_Connection_Parameters.Pointer_String_Client_Identifier);
+	printf("#ifndef H_%s_PACKETS_H\n#define H_%s_PACKETS_H\n\n", String_Macros_Prefix, String_Macros_Prefix);
+	
+	// Generate the CONNECT packet
+	if (MQTTConnect(&MQTT_Context, &MQTT_Connection_Parameters) != 0)
+	{
+		fprintf(stderr, "Error : the CONNECT packet is too big.\n");
+		return EXIT_FAILURE;
+	}
+	printf("/** The CONNECT packet, send it as is then call MQTTInitializeContext() to be able to forge the following messages. */\n");
+	PacketGeneratorOutputPacket(Pointer_String_Prefix, "Connect", &MQTT_Context);
+	
+	// Generate the SUBSCRIBE packet
+	if (Subscriptions_Count > 0)
+	{
+		// All topic filters must fit in a single packet
+		if (MQTTSubscribe(&MQTT_Context, (unsigned short) Packet_Identifier, Subscriptions, Subscriptions_Count) != Subscriptions_Count)
+		{
+			fprintf(stderr, "Error : the SUBSCRIBE packet is too big.\n");
+			return EXIT_FAILURE;
+		}
+		printf("\n/** The SUBSCRIBE packet identifier, the SUBACK packet will contain it. */\n#define %s_SUBSCRIBE_PACKET_IDENTIFIER 0x%04X\n", String_Macros_Prefix, Packet_Identifier);
+		printf("/** How many topic filters the SUBSCRIBE packet contains, the SUBACK packet will contain one return code per topic filter. */\n#define %s_SUBSCRIPTIONS_COUNT %d\n\n", String_Macros_Prefix, Subscriptions_Count);
+		printf("/** The SUBSCRIBE packet, send it right after the CONNACK packet has been received. */\n");
+		PacketGeneratorOutputPacket(Pointer_String_Prefix, "Subscribe", &MQTT_Context);
+	}
+	
+	printf("\n#endif\n");
+	return EXIT_SUCCESS;
+}